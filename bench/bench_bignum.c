@@ -0,0 +1,114 @@
+// Big-number arithmetic of calc_big.c against operand size: each multiplication algorithm
+// forced on its own through the crossover variables, division by Knuth's algorithm D and
+// through the Newton reciprocal, and the cost of handing one job to a worker thread and
+// getting it back on the reactor, which decides what prog23b_s computes on its I/O thread
+
+#include "../calc_big.h"
+#include "../workpool.h"
+#include "../posixnet_err.h"
+
+#include "microbench.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define MAX_LIMBS 8192
+
+struct big_ctx {
+	size_t n;
+	uint32_t a[2 * MAX_LIMBS], b[MAX_LIMBS], r[3 * MAX_LIMBS], q[MAX_LIMBS + 1], rem[MAX_LIMBS];
+	struct reactor *reactor;
+	struct workpool *pool;
+	int done;
+};
+
+void bench_mul(void *arg, uint64_t iterations)
+{
+	struct big_ctx *ctx = arg;
+	for (uint64_t i = 0; i < iterations; i++) {
+		calc_big_mul(ctx->r, ctx->a, ctx->n, ctx->b, ctx->n);
+		MB_CLOBBER(ctx->r);
+	}
+}
+
+// 2n limbs by n
+void bench_div(void *arg, uint64_t iterations)
+{
+	struct big_ctx *ctx = arg;
+	for (uint64_t i = 0; i < iterations; i++) {
+		calc_big_divmod(ctx->q, ctx->rem, ctx->a, 2 * ctx->n, ctx->b, ctx->n);
+		MB_CLOBBER(ctx->q);
+	}
+}
+
+void nothing(void *arg)
+{
+}
+
+void job_done(struct reactor *r, void *arg)
+{
+	struct big_ctx *ctx = arg;
+	ctx->done = 1;
+}
+
+void bench_offload(void *arg, uint64_t iterations)
+{
+	struct big_ctx *ctx = arg;
+	struct workpool_job job;
+	for (uint64_t i = 0; i < iterations; i++) {
+		ctx->done = 0;
+		workpool_job_init(&job, nothing, job_done, ctx);
+		workpool_submit(ctx->pool, &job);
+		while (!ctx->done)
+			if (reactor_run_once(ctx->reactor, -1) < 0)
+				ERR("reactor_run_once");
+	}
+}
+
+int main(void)
+{
+	static struct big_ctx ctx;
+	static const size_t mul_sizes[] = { 16, 64, 256, 1024, 4096 }, div_sizes[] = { 256, 1024, 4096, 8192 };
+	int karatsuba = calc_big_karatsuba, toom3 = calc_big_toom3, newton = calc_big_newton;
+	char name[64];
+
+	srand(1);
+	for (size_t i = 0; i < 2 * MAX_LIMBS; i++)
+		ctx.a[i] = (uint32_t)rand() * 2654435761u;
+	for (size_t i = 0; i < MAX_LIMBS; i++)
+		ctx.b[i] = (uint32_t)rand() * 40503u | 1u << 31;
+
+	for (size_t s = 0; s < sizeof(mul_sizes) / sizeof(mul_sizes[0]); s++) {
+		ctx.n = mul_sizes[s];
+		calc_big_karatsuba = INT_MAX;
+		snprintf(name, sizeof(name), "bignum/mul_schoolbook/%zu", ctx.n);
+		mb_run(name, bench_mul, &ctx, 1);
+		calc_big_karatsuba = karatsuba;
+		calc_big_toom3 = INT_MAX;
+		snprintf(name, sizeof(name), "bignum/mul_karatsuba/%zu", ctx.n);
+		mb_run(name, bench_mul, &ctx, 1);
+		calc_big_toom3 = 0; // Toom-3 down to where Karatsuba would take over from schoolbook
+		snprintf(name, sizeof(name), "bignum/mul_toom3/%zu", ctx.n);
+		mb_run(name, bench_mul, &ctx, 1);
+		calc_big_toom3 = toom3;
+	}
+	for (size_t s = 0; s < sizeof(div_sizes) / sizeof(div_sizes[0]); s++) {
+		ctx.n = div_sizes[s];
+		calc_big_newton = INT_MAX;
+		snprintf(name, sizeof(name), "bignum/div_knuth/%zu", ctx.n);
+		mb_run(name, bench_div, &ctx, 1);
+		calc_big_newton = 0; // Newton steps all the way down to the smallest reciprocal
+		snprintf(name, sizeof(name), "bignum/div_newton/%zu", ctx.n);
+		mb_run(name, bench_div, &ctx, 1);
+		calc_big_newton = newton;
+	}
+
+	if ((ctx.reactor = reactor_create(NULL)) == NULL)
+		ERR("reactor_create");
+	if ((ctx.pool = workpool_create(ctx.reactor, 1)) == NULL)
+		ERR("workpool_create");
+	mb_run("bignum/workpool_round_trip", bench_offload, &ctx, 1);
+	workpool_destroy(ctx.pool);
+	reactor_destroy(ctx.reactor);
+	return EXIT_SUCCESS;
+}
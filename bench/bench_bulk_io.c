@@ -0,0 +1,63 @@
+// bulk_read/bulk_write of libposixnet over a socketpair, and the buffered reader and
+// gathering writer doing the same work for a batch of small messages
+
+#include "../posixnet.h"
+#include "../posixnet_err.h"
+#include "microbench.h"
+
+#include <string.h>
+
+#define MESSAGE 20 // size of a calculator request
+#define BATCH 64
+
+struct io_ctx {
+	int fd[2];
+	char batch[BATCH * MESSAGE];
+	char rbuf[NET_READER_SIZE];
+};
+
+// One request written and read back with a syscall each
+void bench_bulk(void *arg, uint64_t iterations)
+{
+	struct io_ctx *ctx = arg;
+	char msg[MESSAGE] = { 0 };
+	for (uint64_t i = 0; i < iterations; i++) {
+		if (bulk_write(ctx->fd[0], msg, MESSAGE) != MESSAGE)
+			ERR("bulk_write");
+		if (bulk_read(ctx->fd[1], msg, MESSAGE) != MESSAGE)
+			ERR("bulk_read");
+	}
+}
+
+// BATCH requests gathered into one writev and read back through the ring buffer
+void bench_buffered(void *arg, uint64_t iterations)
+{
+	struct io_ctx *ctx = arg;
+	struct net_writer writer;
+	struct net_reader reader;
+	char msg[MESSAGE];
+	writer_init(&writer, ctx->fd[0]);
+	reader_init(&reader, ctx->fd[1], ctx->rbuf, sizeof(ctx->rbuf));
+	for (uint64_t i = 0; i < iterations; i++) {
+		for (int j = 0; j < BATCH; j++)
+			if (writer_add(&writer, ctx->batch + (BATCH - 1 - j) * MESSAGE, MESSAGE) < 0)
+				ERR("writer_add");
+		if (writer_flush(&writer) != BATCH * MESSAGE)
+			ERR("writer_flush");
+		for (int j = 0; j < BATCH; j++)
+			if (reader_read(&reader, msg, MESSAGE) != MESSAGE)
+				ERR("reader_read");
+	}
+}
+
+int main(void)
+{
+	struct io_ctx ctx;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, ctx.fd) < 0)
+		ERR("socketpair");
+	memset(ctx.batch, 'x', sizeof(ctx.batch));
+	mb_run("bulk_io/bulk_write+bulk_read", bench_bulk, &ctx, 1);
+	// Pieces are added in reverse memory order so that they are not merged into one
+	mb_run("bulk_io/writer+reader", bench_buffered, &ctx, BATCH);
+	return EXIT_SUCCESS;
+}
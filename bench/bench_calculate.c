@@ -0,0 +1,102 @@
+// calculate() of the calculator servers (prog23b_s.c; prog23a_s.c has the same code) and
+// the expression programs of calc_vm.c against the same computation done one operator at a time
+
+#define main prog23b_s_main
+#include "../prog23b_s.c"
+#undef main
+
+#include "microbench.h"
+
+#include <string.h>
+
+#define ROWS 1024
+#define EXPRESSION "(a+b)*c/d"
+
+struct calc_ctx {
+	int32_t requests[4][5];
+	int32_t operands[ROWS * 4];
+	int32_t results[ROWS];
+	uint32_t failed[CALC_MASK_WORDS(ROWS)];
+	struct calc_program program;
+	struct calc_cache *cache;
+};
+
+void bench_calculate(void *arg, uint64_t iterations)
+{
+	struct calc_ctx *ctx = arg;
+	int32_t data[5];
+	for (uint64_t i = 0; i < iterations; i++) {
+		memcpy(data, ctx->requests[i & 3], sizeof(data));
+		calculate(data);
+		MB_CLOBBER(data);
+	}
+}
+
+// (a+b)*c/d as three v1 requests per row, the way a client without programs must do it
+void bench_chain(void *arg, uint64_t iterations)
+{
+	struct calc_ctx *ctx = arg;
+	int32_t data[5];
+	for (uint64_t i = 0; i < iterations; i++) {
+		const int32_t *row = &ctx->operands[(i & (ROWS - 1)) * 4];
+		int32_t value = row[0];
+		for (int step = 0; step < 3; step++) {
+			data[0] = htonl(value);
+			data[1] = htonl(row[step + 1]);
+			data[3] = htonl("+*/"[step]);
+			calculate(data);
+			value = ntohl(data[2]);
+		}
+		MB_CLOBBER(&value);
+	}
+}
+
+void bench_program(void *arg, uint64_t iterations)
+{
+	struct calc_ctx *ctx = arg;
+	for (uint64_t i = 0; i < iterations; i++) {
+		calc_run(&ctx->program, ctx->operands, ROWS, ctx->results, ctx->failed);
+		MB_CLOBBER(ctx->results);
+	}
+}
+
+void bench_cache_hit(void *arg, uint64_t iterations)
+{
+	struct calc_ctx *ctx = arg;
+	const struct calc_program *p;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int32_t handle = calc_cache_compile(ctx->cache, EXPRESSION, sizeof(EXPRESSION) - 1, &p);
+		MB_CLOBBER(&handle);
+	}
+}
+
+void prepare(int32_t data[5], int32_t op1, int32_t op2, char op)
+{
+	data[0] = htonl(op1);
+	data[1] = htonl(op2);
+	data[2] = htonl(0);
+	data[3] = htonl(op);
+	data[4] = htonl(1);
+}
+
+int main(void)
+{
+	struct calc_ctx ctx;
+	prepare(ctx.requests[0], 1234, 5678, '+');
+	prepare(ctx.requests[1], 1234, 5678, '*');
+	prepare(ctx.requests[2], 99999, 17, '/');
+	prepare(ctx.requests[3], 1, 0, '/');
+	mb_run("calculate/mixed", bench_calculate, &ctx, 1);
+
+	for (int i = 0; i < ROWS * 4; i++)
+		ctx.operands[i] = 1 + i % 97;
+	if (calc_compile_expression(&ctx.program, EXPRESSION, sizeof(EXPRESSION) - 1) < 0)
+		ERR("calc_compile_expression");
+	if ((ctx.cache = calc_cache_create()) == NULL)
+		ERR("calc_cache_create");
+	mb_run("expression/calculate_chain_row", bench_chain, &ctx, 1);
+	mb_run("expression/program_row", bench_program, &ctx, ROWS);
+	mb_run("expression/cache_hit", bench_cache_hit, &ctx, 1);
+	calc_cache_destroy(ctx.cache);
+	return EXIT_SUCCESS;
+}
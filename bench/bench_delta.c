@@ -0,0 +1,88 @@
+// Delta scan of delta.c, which prog24c -u runs over the whole new copy of a file: the weak
+// checksum of one block (recomputed after every match), and the scan per byte of a 4 MB
+// file against the signatures of its old copy, one changed byte apart and all different,
+// where the weak checksum rolls over every byte
+
+#include "../delta.h"
+#include "../posixnet_err.h"
+
+#include "microbench.h"
+
+#include <string.h>
+
+#define SIZE (4 << 20)
+
+struct delta_ctx {
+	uint8_t *old, *new;
+	size_t len;
+	struct delta_index index;
+	int32_t pieces;
+};
+
+void bench_weak(void *arg, uint64_t iterations)
+{
+	struct delta_ctx *ctx = arg;
+	for (uint64_t i = 0; i < iterations; i++) {
+		uint32_t weak = delta_weak(ctx->new, ctx->len);
+		MB_CLOBBER(weak);
+	}
+}
+
+void count_piece(int32_t block, const uint8_t *data, size_t len, void *arg)
+{
+	struct delta_ctx *ctx = arg;
+	ctx->pieces++;
+}
+
+void bench_scan(void *arg, uint64_t iterations)
+{
+	struct delta_ctx *ctx = arg;
+	for (uint64_t i = 0; i < iterations; i++)
+		delta_scan(&ctx->index, ctx->new, SIZE, count_piece, ctx);
+}
+
+void make_index(struct delta_ctx *ctx, struct delta_sig *sigs)
+{
+	size_t block = delta_block_size(SIZE);
+	int32_t blocks = SIZE / block;
+	for (int32_t i = 0; i < blocks; i++) {
+		sigs[i].weak = delta_weak(ctx->old + i * block, block);
+		sigs[i].strong = delta_strong(DELTA_STRONG_INIT, ctx->old + i * block, block);
+	}
+	delta_index_free(&ctx->index);
+	if (delta_index_init(&ctx->index, sigs, blocks, block, block) < 0)
+		ERR("delta_index_init");
+}
+
+int main(void)
+{
+	static struct delta_ctx ctx;
+	static struct delta_sig sigs[SIZE / 1024];
+	static const size_t blocks[] = { 1024, 16384 };
+	char name[64];
+
+	if ((ctx.old = malloc(SIZE)) == NULL || (ctx.new = malloc(SIZE)) == NULL)
+		ERR("malloc");
+	srand(1);
+	for (size_t i = 0; i < SIZE; i++)
+		ctx.old[i] = rand();
+	memcpy(ctx.new, ctx.old, SIZE);
+
+	for (size_t s = 0; s < sizeof(blocks) / sizeof(blocks[0]); s++) {
+		ctx.len = blocks[s];
+		snprintf(name, sizeof(name), "delta/weak_checksum/%zu", ctx.len);
+		mb_run(name, bench_weak, &ctx, 1);
+	}
+
+	ctx.new[SIZE / 2] ^= 1;
+	make_index(&ctx, sigs);
+	mb_run("delta/scan_one_change_per_byte", bench_scan, &ctx, SIZE);
+	for (size_t i = 0; i < SIZE; i++)
+		ctx.old[i] = rand();
+	make_index(&ctx, sigs);
+	mb_run("delta/scan_all_changed_per_byte", bench_scan, &ctx, SIZE);
+	delta_index_free(&ctx.index);
+	free(ctx.old);
+	free(ctx.new);
+	return EXIT_SUCCESS;
+}
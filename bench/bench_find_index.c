@@ -0,0 +1,51 @@
+// findIndex() of the UDP file server (prog24s.c)
+
+#define main prog24s_main
+#include "../prog24s.c"
+#undef main
+
+#include "microbench.h"
+
+struct find_ctx {
+	struct connections con[MAXADDR];
+	struct sockaddr_in known;
+	struct sockaddr_in fresh;
+};
+
+// Every transfer in progress: the sender is in the last used slot
+void bench_hit(void *arg, uint64_t iterations)
+{
+	struct find_ctx *ctx = arg;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int pos = findIndex(ctx->known, ctx->con);
+		MB_CLOBBER(pos);
+	}
+}
+
+// A new sender takes the free slot, which is released again for the next round
+void bench_new(void *arg, uint64_t iterations)
+{
+	struct find_ctx *ctx = arg;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int pos = findIndex(ctx->fresh, ctx->con);
+		ctx->con[pos].free = 1;
+	}
+}
+
+int main(void)
+{
+	struct find_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	for (int i = 0; i < MAXADDR; i++) {
+		ctx.con[i].addr.sin_family = AF_INET;
+		ctx.con[i].addr.sin_port = htons(10000 + i);
+		ctx.con[i].addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+	ctx.known = ctx.con[MAXADDR - 2].addr;
+	ctx.fresh = ctx.con[0].addr;
+	ctx.fresh.sin_port = htons(20000);
+	ctx.con[MAXADDR - 1].free = 1;
+	mb_run("findIndex/existing", bench_hit, &ctx, 1);
+	mb_run("findIndex/new_sender", bench_new, &ctx, 1);
+	return EXIT_SUCCESS;
+}
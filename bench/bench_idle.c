@@ -0,0 +1,190 @@
+// Memory per idle connection: starts prog23b_s and labs, opens as many loopback connections
+// to each as the descriptor limit allows (a million when it allows that many), makes one
+// request on every connection and leaves it idle, then reports how much the server's
+// resident set grew per connection. Socket memory of the kernel is not part of the RSS.
+// Run from the repository root, where make bench runs it, after the servers are built.
+
+#include "../posixnet.h"
+#include "../posixnet_err.h"
+#include "../calc.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define CONNECTIONS 1000000
+#define SPARE_FDS 64 // descriptors left for everything else in both processes
+#define PER_SOURCE 25000 // connections from one source address, under the ephemeral port range
+#define BATCH 100 // connections made before their answers are read, under the servers' backlog of 128
+#define SETTLE_MS 30000
+
+int connections[CONNECTIONS];
+
+void sleep_ms(int ms)
+{
+	struct timespec ts = { ms / 1000, ms % 1000 * 1000000L };
+	while (nanosleep(&ts, &ts) < 0 && EINTR == errno)
+		;
+}
+
+long rss_kb(pid_t pid)
+{
+	char path[64], line[256];
+	long kb = -1;
+	FILE *f;
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	if ((f = fopen(path, "r")) == NULL)
+		ERR("fopen");
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb;
+}
+
+int open_fds(pid_t pid)
+{
+	char path[64];
+	struct dirent *e;
+	DIR *d;
+	int n = 0;
+	snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+	if ((d = opendir(path)) == NULL)
+		ERR("opendir");
+	while ((e = readdir(d)) != NULL)
+		n += '.' != e->d_name[0];
+	closedir(d);
+	return n;
+}
+
+pid_t start_server(char *const argv[])
+{
+	pid_t pid;
+	int null;
+	if ((pid = fork()) < 0)
+		ERR("fork");
+	if (0 == pid) {
+		if ((null = open("/dev/null", O_WRONLY)) < 0 || dup2(null, STDOUT_FILENO) < 0 || dup2(null, STDERR_FILENO) < 0)
+			ERR("open");
+		execv(argv[0], argv);
+		ERR("execv");
+	}
+	return pid;
+}
+
+// Connection i comes from 127.0.0.(1 + i / PER_SOURCE), so a million fit in the port range
+int connect_from(int i, uint16_t port)
+{
+	struct sockaddr_in source = { .sin_family = AF_INET }, server = { .sin_family = AF_INET };
+	int fd = make_socket(PF_INET, SOCK_STREAM), one = 1;
+	source.sin_addr.s_addr = htonl(INADDR_LOOPBACK + i / PER_SOURCE);
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server.sin_port = htons(port);
+	if (setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)) < 0 ||
+	    bind(fd, (struct sockaddr *)&source, sizeof(source)) < 0)
+		ERR("bind");
+	if (connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+		if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+			ERR("close");
+		return -1;
+	}
+	return fd;
+}
+
+// One request on the connection, answered before it goes idle; v2 keeps a calculator connection open
+void request(int fd, int labs)
+{
+	struct calc_frame f = { 0 };
+	int32_t number = htonl(1);
+	if (labs) {
+		if (bulk_write(fd, &number, sizeof(number)) < 0)
+			ERR("write");
+		return;
+	}
+	f.data[0] = htonl(3);
+	f.data[1] = htonl(4);
+	f.data[3] = htonl('+');
+	f.data[4] = htonl(CALC_V2);
+	if (bulk_write(fd, &f, CALC_FRAME_V2) < 0)
+		ERR("write");
+}
+
+void answer(int fd, int labs)
+{
+	struct calc_frame f;
+	size_t size = labs ? sizeof(int32_t) : CALC_FRAME_V2;
+	if (bulk_read(fd, &f, size) != (ssize_t)size)
+		ERR("read");
+}
+
+void measure(const char *name, char *const argv[], uint16_t port, int n, int labs)
+{
+	pid_t pid = start_server(argv);
+	long before, after;
+	int fd, base, i, waited;
+
+	for (waited = 0; (fd = connect_from(0, port)) < 0; waited += 10) {
+		if (waited > SETTLE_MS)
+			ERR("connect");
+		sleep_ms(10);
+	}
+	request(fd, labs);
+	answer(fd, labs);
+	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+		ERR("close");
+	sleep_ms(100);
+	before = rss_kb(pid);
+	base = open_fds(pid);
+
+	// Connect in batches, answering each before the next, so that the accept queue never overflows
+	for (i = 0; i < n;) {
+		int batch = i + BATCH < n ? i + BATCH : n, j;
+		for (j = i; j < batch; j++) {
+			if ((connections[j] = connect_from(j, port)) < 0)
+				ERR("connect");
+			request(connections[j], labs);
+		}
+		for (j = i; j < batch; j++)
+			answer(connections[j], labs);
+		i = batch;
+	}
+	for (waited = 0; open_fds(pid) < base + n && waited < SETTLE_MS; waited += 10)
+		sleep_ms(10);
+	sleep_ms(100);
+	after = rss_kb(pid);
+	printf("{\"benchmark\": \"%s\", \"connections\": %d, \"rss_before_kb\": %ld, \"rss_after_kb\": %ld, "
+	       "\"rss_bytes_per_connection\": %.1f}\n",
+	       name, n, before, after, (after - before) * 1024.0 / n);
+	fflush(stdout);
+
+	if (kill(pid, SIGINT) < 0 || waitpid(pid, NULL, 0) < 0)
+		ERR("kill");
+	for (i = 0; i < n; i++)
+		if (TEMP_FAILURE_RETRY(close(connections[i])) < 0)
+			ERR("close");
+}
+
+int main(int argc, char **argv)
+{
+	char *calculator[] = { "./prog23b_s", "/tmp/bench_idle.sock", "9190", NULL };
+	char *labs[] = { "./labs", "-q", "-s", "", NULL };
+	struct rlimit rl;
+	int n = argc > 1 ? atoi(argv[1]) : CONNECTIONS;
+
+	raise_fd_limit(); // Inherited by the servers
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+		ERR("getrlimit");
+	if (n > CONNECTIONS)
+		n = CONNECTIONS;
+	if ((rlim_t)n > rl.rlim_cur - SPARE_FDS)
+		n = rl.rlim_cur - SPARE_FDS; // Both ends of every connection need a descriptor
+	if (sethandler(SIG_IGN, SIGPIPE))
+		ERR("Seting SIGPIPE:");
+	measure("idle_connections/prog23b_s", calculator, 9190, n, 0);
+	measure("idle_connections/labs", labs, 12345, n, 1);
+	return EXIT_SUCCESS;
+}
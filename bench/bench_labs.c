@@ -0,0 +1,64 @@
+// handle_client() of labs.c: one number (or query) per round trip over a socketpair
+
+#define main labs_main
+#include "../labs.c"
+#undef main
+
+#include "microbench.h"
+
+struct labs_ctx {
+	struct worker worker;
+	struct client *client;
+	int peer; // client side of the socketpair
+	int32_t word;
+};
+
+void bench_client(void *arg, uint64_t iterations)
+{
+	struct labs_ctx *ctx = arg;
+	int32_t reply, word;
+	for (uint64_t i = 0; i < iterations; i++) {
+		word = htonl(ctx->word ? ctx->word : (int32_t)(1 + i % 1000));
+		if (bulk_write(ctx->peer, &word, sizeof(word)) < 0)
+			ERR("write");
+		handle_client(&ctx->worker, ctx->client);
+		if (bulk_read(ctx->peer, &reply, sizeof(reply)) != sizeof(reply))
+			ERR("read");
+		ctx->client->numbers = 0; // Keep the session open past MAX_NUMBERS
+	}
+}
+
+int main(void)
+{
+	struct labs_ctx ctx;
+	int pair[2];
+	memset(&ctx, 0, sizeof(ctx));
+	verbose = 0;
+	pthread_mutex_init(&engine_locks[0], NULL);
+	ctx.worker.stats = &stats[0];
+	ctx.worker.engine = &engines[0];
+	ctx.worker.engine_lock = &engine_locks[0];
+	ctx.worker.seed = 1;
+	if ((ctx.worker.reactor = reactor_create("epoll")) == NULL)
+		ERR("reactor_create");
+	wheel_init(&ctx.worker.wheel, ctx.worker.reactor, TICK_MS);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+		ERR("socketpair");
+	ctx.peer = pair[1];
+	// Same state add_client() builds, kept here so the benchmark can reach it
+	if ((ctx.client = slab_alloc(sizeof(struct client))) == NULL)
+		ERR("slab_alloc");
+	memset(ctx.client, 0, sizeof(struct client));
+	ctx.client->worker = &ctx.worker;
+	ctx.client->fd = pair[0];
+	ctx.client->ip = htonl(INADDR_LOOPBACK);
+	wheel_timer_init(&ctx.client->timer, client_timeout, ctx.client);
+	if (set_nonblock(pair[0]) < 0)
+		ERR("fcntl");
+	if (reactor_add(ctx.worker.reactor, pair[0], REACTOR_READ, client_ready, ctx.client) < 0)
+		ERR("reactor_add");
+	mb_run("handle_client/number", bench_client, &ctx, 1);
+	ctx.word = OP_WINDOW_MAX;
+	mb_run("handle_client/window_max_query", bench_client, &ctx, 1);
+	return EXIT_SUCCESS;
+}
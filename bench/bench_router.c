@@ -0,0 +1,115 @@
+// handle_host_message() of router.c: unicast and broadcast frames from host 1, routed,
+// queued and flushed to the recipient sockets; also reports the slab figures of the
+// router (allocations per message, memory held per connection)
+
+#define main router_main
+#include "../router.c"
+#undef main
+
+#include "../posixnet_err.h"
+#include "microbench.h"
+
+#define BATCH 8
+#define PAYLOAD 32
+#define HOSTS 3
+#define SLAB_ROUNDS 1000
+
+struct route_ctx {
+	int client[HOSTS]; // far ends of the host sockets
+	int recipient;
+	char batch[BATCH * (FRAME_HEADER + PAYLOAD)];
+};
+
+void register_slot(struct route_ctx *ctx, int slot, int address)
+{
+	int pair[2];
+	char frame[FRAME_HEADER] = { 0, address, 0 };
+	char answer[FRAME_HEADER + sizeof(int32_t)];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+		ERR("socketpair");
+	set_nonblock(pair[0]);
+	hosts[slot].socket = pair[0];
+	ctx->client[slot] = pair[1];
+	if (bulk_write(pair[1], frame, sizeof(frame)) < 0 || handle_host_message(slot) < 0 || flush_host(slot) < 0)
+		ERR("register");
+	if (bulk_read(pair[1], answer, sizeof(answer)) != sizeof(answer))
+		ERR("register");
+}
+
+void set_recipient(struct route_ctx *ctx, int address)
+{
+	ctx->recipient = address;
+	for (int i = 0; i < BATCH; i++)
+		ctx->batch[i * (FRAME_HEADER + PAYLOAD)] = address;
+}
+
+void bench_route(void *arg, uint64_t iterations)
+{
+	struct route_ctx *ctx = arg;
+	char out[sizeof(ctx->batch)];
+	for (uint64_t i = 0; i < iterations; i++) {
+		if (bulk_write(ctx->client[0], ctx->batch, sizeof(ctx->batch)) < 0)
+			ERR("write");
+		if (handle_host_message(0) < 0)
+			ERR("route");
+		for (int slot = 0; slot < HOSTS; slot++) {
+			if (ctx->recipient != BROADCAST_ADDRESS && ctx->recipient != slot + 1)
+				continue;
+			if (flush_host(slot) < 0)
+				ERR("flush");
+			if (bulk_read(ctx->client[slot], out, sizeof(out)) != sizeof(out))
+				ERR("read");
+		}
+	}
+}
+
+// Slab allocations per routed message, counted by the allocator of this thread
+double slab_allocs_per_message(struct route_ctx *ctx, int address)
+{
+	struct slab_stats before, after;
+	set_recipient(ctx, address);
+	slab_stats(&before);
+	bench_route(ctx, SLAB_ROUNDS);
+	slab_stats(&after);
+	return (double)(after.allocs - before.allocs) / (SLAB_ROUNDS * BATCH);
+}
+
+int main(void)
+{
+	struct route_ctx ctx;
+	struct slab_stats slab;
+	size_t idle_bytes = 0;
+	double unicast, broadcast;
+	for (int i = 0; i < MAX_HOSTS; i++) {
+		hosts[i].socket = -1;
+		wheel_timer_init(&hosts[i].timer, host_timeout, &hosts[i]);
+	}
+	router_id = 1;
+	if ((reactor = reactor_create(NULL)) == NULL)
+		ERR("reactor_create");
+	wheel_init(&wheel, reactor, TICK_MS);
+	for (int i = 0; i < HOSTS; i++)
+		register_slot(&ctx, i, i + 1);
+	for (int i = 0; i < BATCH; i++) {
+		char *frame = ctx.batch + i * (FRAME_HEADER + PAYLOAD);
+		frame[1] = 1;
+		frame[2] = PAYLOAD;
+		memset(frame + FRAME_HEADER, 'x', PAYLOAD);
+	}
+	set_recipient(&ctx, 2);
+	mb_run("handle_host_message/unicast", bench_route, &ctx, BATCH);
+	set_recipient(&ctx, BROADCAST_ADDRESS);
+	mb_run("handle_host_message/broadcast", bench_route, &ctx, BATCH);
+
+	unicast = slab_allocs_per_message(&ctx, 2);
+	broadcast = slab_allocs_per_message(&ctx, BROADCAST_ADDRESS);
+	// Buffers an idle connection keeps besides its Host entry (nothing once its queues drained)
+	for (int i = 0; i < HOSTS; i++)
+		idle_bytes += (hosts[i].in != NULL ? HOST_BUF_SIZE : 0) + (hosts[i].queue.out != NULL ? OUT_BATCH : 0);
+	slab_stats(&slab);
+	printf("{\"benchmark\": \"router/slab\", \"slab_allocs_per_unicast\": %.3f, \"slab_allocs_per_broadcast\": %.3f, "
+	       "\"broadcast_recipients\": %d, \"host_bytes\": %zu, \"idle_buffer_bytes_per_host\": %.1f, "
+	       "\"slab_mapped_bytes\": %zu, \"huge_page_chunks\": %zu}\n",
+	       unicast, broadcast, HOSTS, sizeof(Host), (double)idle_bytes / HOSTS, slab.mapped, slab.huge_chunks);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+// trace_event() of libposixnet with tracing disabled and enabled
+
+#include "../trace.h"
+#include "../posixnet_err.h"
+
+#include "microbench.h"
+
+#include <string.h>
+
+void bench_event(void *arg, uint64_t iterations)
+{
+	for (uint64_t i = 0; i < iterations; i++)
+		trace_event(TRACE_FRAME, (uint32_t)i);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/bench_traceXXXXXX";
+	int fd;
+	mb_run("trace_event/disabled", bench_event, NULL, 1);
+	if ((fd = mkstemp(path)) < 0)
+		ERR("mkstemp");
+	close(fd);
+	setenv("POSIXNET_TRACE", path, 1);
+	if (trace_init() < 0)
+		ERR("trace_init");
+	mb_run("trace_event/enabled", bench_event, NULL, 1);
+	unlink(path);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include "microbench.h"
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MB_MIN_NS 300000000ULL // a measurement must take at least this long
+
+uint64_t mb_allocs;
+uint64_t mb_syscalls;
+
+// Allocations and system calls of project code go through these (ld --wrap=symbol)
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	mb_allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	mb_allocs++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+	mb_allocs++;
+	return __real_realloc(p, size);
+}
+
+#define MB_WRAP(ret, name, params, args) \
+	ret __real_##name params;        \
+	ret __wrap_##name params         \
+	{                                \
+		mb_syscalls++;           \
+		return __real_##name args; \
+	}
+
+MB_WRAP(ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n))
+MB_WRAP(ssize_t, write, (int fd, const void *buf, size_t n), (fd, buf, n))
+MB_WRAP(ssize_t, readv, (int fd, const struct iovec *iov, int cnt), (fd, iov, cnt))
+MB_WRAP(ssize_t, writev, (int fd, const struct iovec *iov, int cnt), (fd, iov, cnt))
+MB_WRAP(ssize_t, recvfrom, (int fd, void *buf, size_t n, int flags, struct sockaddr *addr, socklen_t *len),
+	(fd, buf, n, flags, addr, len))
+MB_WRAP(ssize_t, sendto, (int fd, const void *buf, size_t n, int flags, const struct sockaddr *addr, socklen_t len),
+	(fd, buf, n, flags, addr, len))
+MB_WRAP(int, accept, (int fd, struct sockaddr *addr, socklen_t *len), (fd, addr, len))
+MB_WRAP(int, epoll_ctl, (int epfd, int op, int fd, struct epoll_event *ev), (epfd, op, fd, ev))
+MB_WRAP(int, epoll_wait, (int epfd, struct epoll_event *ev, int n, int timeout), (epfd, ev, n, timeout))
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Counter of raw_syscalls:sys_enter for this thread, -1 when tracepoints are not accessible
+static int open_syscall_counter(void)
+{
+	const char *paths[] = { "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+				"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" };
+	struct perf_event_attr attr;
+	FILE *f = NULL;
+	unsigned long long id;
+	int ok = 0;
+	for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]) && NULL == f; i++)
+		f = fopen(paths[i], "r");
+	if (NULL == f)
+		return -1;
+	ok = fscanf(f, "%llu", &id) == 1;
+	fclose(f);
+	if (!ok)
+		return -1;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	attr.disabled = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int measure(mb_fn fn, void *ctx, uint64_t iterations, int counter, uint64_t *ns, uint64_t *syscalls,
+		   uint64_t *allocs)
+{
+	uint64_t start, wrapped = mb_syscalls, allocated = mb_allocs, kernel = 0;
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = now_ns();
+	fn(ctx, iterations);
+	*ns = now_ns() - start;
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter, &kernel, sizeof(kernel)) != sizeof(kernel))
+			kernel = 0;
+	}
+	*syscalls = counter >= 0 ? kernel : mb_syscalls - wrapped;
+	*allocs = mb_allocs - allocated;
+	return 0;
+}
+
+void mb_run(const char *name, mb_fn fn, void *ctx, uint64_t ops_per_iteration)
+{
+	uint64_t iterations = 1, ns, syscalls, allocs, ops;
+	int counter = open_syscall_counter();
+	// Double the loop until a single run is long enough for a stable figure
+	for (;;) {
+		measure(fn, ctx, iterations, counter, &ns, &syscalls, &allocs);
+		if (ns >= MB_MIN_NS)
+			break;
+		iterations = ns > 0 && ns < MB_MIN_NS / 64 ? iterations * 8 : iterations * 2;
+	}
+	ops = iterations * ops_per_iteration;
+	printf("{\"benchmark\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"syscalls_per_op\": %.3f, "
+	       "\"syscall_counter\": \"%s\", \"allocs_per_op\": %.3f}\n",
+	       name, (unsigned long long)ops, (double)ns / ops, (double)syscalls / ops, counter >= 0 ? "perf" : "libc-wrap",
+	       (double)allocs / ops);
+	fflush(stdout);
+	if (counter >= 0)
+		close(counter);
+}
@@ -0,0 +1,19 @@
+// Microbenchmark harness: runs a loop until it takes long enough to time, counts
+// system calls (perf tracepoint when the kernel allows it, otherwise the libc calls
+// made by project code, intercepted with ld --wrap) and heap allocations, and prints
+// one JSON object per benchmark on stdout.
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdint.h>
+
+// Runs iterations of the measured operation; each iteration performs ops_per_iteration ops
+typedef void (*mb_fn)(void *ctx, uint64_t iterations);
+
+void mb_run(const char *name, mb_fn fn, void *ctx, uint64_t ops_per_iteration);
+
+// Keeps the compiler from dropping computations whose results are never used
+#define MB_CLOBBER(p) __asm__ volatile("" : : "r"(p) : "memory")
+
+#endif
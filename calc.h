@@ -0,0 +1,109 @@
+// Wire format of the calculator servers (prog23a_s, prog23b_s) and their clients.
+//
+// v1: a request is five int32_t in network order - operand1, operand2, result (unused),
+// operation, type CALC_V1. The answer is the same frame with the result filled in and
+// the status in place of the type; the server closes the connection after it.
+//
+// v2: the type is CALC_V2 and the frame goes on with a 64-bit request ID chosen by the
+// client. The answer carries the same ID and the connection stays open for more
+// requests. Answers come back in the order requests complete, not the order they were
+// sent, so a client matches them by ID.
+//
+// v2 programs (calc_vm.h): operation CALC_COMPILE sends an expression as a payload of
+// operand1 bytes after the frame; the answer's result is the program handle and its
+// operand2 the number of variables, status CALC_FAILED when the text does not parse.
+// CALC_EVAL has the handle as operand1, the number of rows as operand2 and the
+// variables per row in place of the result, followed by rows * variables int32_t
+// operands. Its answer has the number of result rows as operand2 (0 when there are
+// none, e.g. for CALC_BUSY or CALC_UNKNOWN) and the number of rows that failed as the
+// result. The payload is the results, then a bitmap of the failed rows in 32-bit words
+// (bit i % 32 of word i / 32); status CALC_FAILED means some rows did.
+//
+// v2 big numbers (calc_big.h): operation CALC_BIG has the limb counts of operand1 and
+// operand2 in their places and the operator ('+', '-', '*', '/' or '%') in place of
+// the result, followed by the limbs of both operands: 32-bit, least significant first,
+// each in network order; a negative count is a negative number. The answer has the
+// limb count of the result in place of the result (0 with CALC_FAILED or CALC_BUSY),
+// followed by its limbs. Division truncates toward zero.
+
+#ifndef CALC_H
+#define CALC_H
+
+#include "posixnet.h"
+
+#include <arpa/inet.h>
+
+#define CALC_V1 1
+#define CALC_V2 2
+
+#define CALC_FAILED 0 // unknown operation or division by zero
+#define CALC_OK 1
+#define CALC_BUSY 2 // shed by admission control, try again later
+#define CALC_UNKNOWN 3 // the program handle is not cached (any more), compile it again
+
+#define CALC_COMPILE 'c'
+#define CALC_EVAL 'e'
+#define CALC_BIG 'b'
+#define CALC_MAX_PAYLOAD 4096 // bytes after one request frame, except CALC_BIG
+#define CALC_MAX_LIMBS 16384 // of one CALC_BIG operand
+#define CALC_MAX_ROWS 1024
+#define CALC_MASK_WORDS(rows) (((rows) + 31) / 32)
+#define CALC_VARIABLES 26 // a..z
+
+#define CALC_FRAME_V1 (5 * sizeof(int32_t))
+#define CALC_FRAME_V2 sizeof(struct calc_frame)
+
+struct calc_frame {
+	int32_t data[5];
+	uint32_t id[2]; // high word first, network order; v2 only
+};
+
+static inline void calc_set_id(struct calc_frame *f, uint64_t id)
+{
+	f->id[0] = htonl(id >> 32);
+	f->id[1] = htonl((uint32_t)id);
+}
+
+static inline uint64_t calc_get_id(const struct calc_frame *f)
+{
+	return (uint64_t)ntohl(f->id[0]) << 32 | ntohl(f->id[1]);
+}
+
+// Bytes following a v2 request frame, -1 when they would exceed the limits
+static inline ssize_t calc_request_payload(const struct calc_frame *f)
+{
+	int32_t a = ntohl(f->data[0]), b = ntohl(f->data[1]), c = ntohl(f->data[2]);
+	switch (ntohl(f->data[3])) {
+	case CALC_COMPILE:
+		return a >= 0 && a <= CALC_MAX_PAYLOAD ? a : -1;
+	case CALC_EVAL:
+		if (b < 0 || b > (int32_t)CALC_MAX_ROWS || c < 0 || c > CALC_VARIABLES || (size_t)b * c * sizeof(int32_t) > CALC_MAX_PAYLOAD)
+			return -1;
+		return (ssize_t)b * c * sizeof(int32_t);
+	case CALC_BIG:
+		if (a < -CALC_MAX_LIMBS || a > CALC_MAX_LIMBS || b < -CALC_MAX_LIMBS || b > CALC_MAX_LIMBS)
+			return -1;
+		return (ssize_t)(abs(a) + abs(b)) * sizeof(uint32_t);
+	}
+	return 0;
+}
+
+// Bytes following a v2 answer frame
+static inline size_t calc_answer_payload(const struct calc_frame *f)
+{
+	uint32_t rows = ntohl(f->data[1]);
+	switch (ntohl(f->data[3])) {
+	case CALC_EVAL:
+		return (rows + CALC_MASK_WORDS(rows)) * sizeof(int32_t);
+	case CALC_BIG:
+		return (size_t)labs((int32_t)ntohl(f->data[2])) * sizeof(uint32_t);
+	}
+	return 0;
+}
+
+static inline int calc_row_failed(const uint32_t *failed, int row)
+{
+	return failed[row / 32] >> (row % 32) & 1;
+}
+
+#endif
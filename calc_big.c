@@ -0,0 +1,647 @@
+#include "calc_big.h"
+#include "posixnet_err.h"
+
+#include <string.h>
+
+// Crossovers measured with bench/bench_bignum
+int calc_big_karatsuba = 24;
+int calc_big_toom3 = 192;
+int calc_big_newton = 6144;
+
+#define MIN_SPLIT 17 // smallest product Karatsuba and Toom-3 split, below it SCRATCH would not hold
+#define MIN_NEWTON 4
+#define GUARD_BITS 16 // extra precision of each Newton step, keeps the final correction to a step or two
+
+// Scratch of a product whose shorter operand has n limbs: a balanced product takes under 8n
+// limbs over all levels of splitting, an unbalanced one 3n more
+#define SCRATCH(n) (11 * (size_t)(n) + 2048)
+// Limbs of floor(2^(2n) / b) for a divisor of n bits, with room for the steps before the correction
+#define RECIPROCAL(n) ((n) / 32 + 6)
+
+static void *allocate(size_t limbs)
+{
+	void *p;
+	if ((p = malloc(limbs ? limbs * sizeof(uint32_t) : 1)) == NULL)
+		ERR("malloc");
+	return p;
+}
+
+static size_t normalize(const uint32_t *a, size_t n)
+{
+	while (n > 0 && 0 == a[n - 1])
+		n--;
+	return n;
+}
+
+static int compare_n(const uint32_t *a, const uint32_t *b, size_t n)
+{
+	while (n-- > 0)
+		if (a[n] != b[n])
+			return a[n] < b[n] ? -1 : 1;
+	return 0;
+}
+
+// Both normalized
+static int compare(const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	if (na != nb)
+		return na < nb ? -1 : 1;
+	return compare_n(a, b, na);
+}
+
+// r = a + b for na >= nb, returns the carry; r may be a or b
+static uint32_t add(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	uint64_t t = 0;
+	size_t i;
+	for (i = 0; i < nb; i++) {
+		t += (uint64_t)a[i] + b[i];
+		r[i] = (uint32_t)t;
+		t >>= 32;
+	}
+	for (; i < na; i++) {
+		t += a[i];
+		r[i] = (uint32_t)t;
+		t >>= 32;
+	}
+	return (uint32_t)t;
+}
+
+// r = a - b for na >= nb, returns the borrow; r may be a or b
+static uint32_t sub(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	uint64_t t, borrow = 0;
+	size_t i;
+	for (i = 0; i < nb; i++) {
+		t = (uint64_t)a[i] - b[i] - borrow;
+		r[i] = (uint32_t)t;
+		borrow = t >> 63;
+	}
+	for (; i < na; i++) {
+		t = (uint64_t)a[i] - borrow;
+		r[i] = (uint32_t)t;
+		borrow = t >> 63;
+	}
+	return (uint32_t)borrow;
+}
+
+// Two's complement of n limbs
+static void negate(uint32_t *a, size_t n)
+{
+	uint64_t t = 1;
+	for (size_t i = 0; i < n; i++) {
+		t += (uint32_t)~a[i];
+		a[i] = (uint32_t)t;
+		t >>= 32;
+	}
+}
+
+// a += 1 with room for a carry into one more limb; returns the limbs of a
+static size_t increment(uint32_t *a, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n && 0 == ++a[i]; i++)
+		;
+	if (i == n)
+		a[n++] = 1;
+	return n;
+}
+
+static size_t bit_length(const uint32_t *a, size_t n)
+{
+	return n > 0 ? 32 * n - __builtin_clz(a[n - 1]) : 0;
+}
+
+// r = a << bits, r has room for na + bits / 32 + 1 limbs; returns that many
+static size_t shift_left(uint32_t *r, const uint32_t *a, size_t na, size_t bits)
+{
+	size_t w = bits / 32;
+	int s = bits % 32;
+	uint32_t carry = 0;
+	memset(r, 0, w * sizeof(uint32_t));
+	for (size_t i = 0; i < na; i++) {
+		r[i + w] = a[i] << s | carry;
+		carry = s ? a[i] >> (32 - s) : 0;
+	}
+	r[na + w] = carry;
+	return na + w + 1;
+}
+
+// r = a >> bits, returns the limbs of r
+static size_t shift_right(uint32_t *r, const uint32_t *a, size_t na, size_t bits)
+{
+	size_t w = bits / 32;
+	int s = bits % 32;
+	if (w >= na)
+		return 0;
+	for (size_t i = 0; i < na - w; i++)
+		r[i] = a[i + w] >> s | (s && i + w + 1 < na ? a[i + w + 1] << (32 - s) : 0);
+	return na - w;
+}
+
+static void mul_basecase(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	memset(r, 0, (na + nb) * sizeof(uint32_t));
+	for (size_t j = 0; j < nb; j++) {
+		uint64_t t = 0;
+		for (size_t i = 0; i < na; i++) {
+			t += (uint64_t)a[i] * b[j] + r[i + j];
+			r[i + j] = (uint32_t)t;
+			t >>= 32;
+		}
+		r[na + j] = (uint32_t)t;
+	}
+}
+
+static void mul_n(uint32_t *r, const uint32_t *a, const uint32_t *b, size_t n, uint32_t *scratch);
+
+// a0 b0 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) x + a1 b1 x^2 with a0 and b0 the l low limbs
+static void mul_karatsuba(uint32_t *r, const uint32_t *a, const uint32_t *b, size_t n, uint32_t *scratch)
+{
+	size_t l = (n + 1) / 2, h = n - l, top = 2 * n - l;
+	uint32_t *sa = scratch, *sb = sa + l + 1, *z1 = sb + l + 1, *next = z1 + 2 * (l + 1);
+
+	mul_n(r, a, b, l, next);
+	mul_n(r + 2 * l, a + l, b + l, h, next);
+	sa[l] = add(sa, a, l, a + l, h);
+	sb[l] = add(sb, b, l, b + l, h);
+	mul_n(z1, sa, sb, l + 1, next);
+	sub(z1, z1, 2 * l + 2, r, 2 * l);
+	sub(z1, z1, 2 * l + 2, r + 2 * l, 2 * h);
+	// The middle term has at most l + h + 1 significant limbs, the rest of z1 is zero
+	add(r + l, r + l, top, z1, 2 * l + 2 < top ? 2 * l + 2 : top);
+}
+
+// e = a0 + a1 + a2 in k + 1 limbs
+static void evaluate_one(uint32_t *e, const uint32_t *a, size_t k, size_t h)
+{
+	e[k] = add(e, a, k, a + 2 * k, h);
+	e[k] += add(e, e, k, a + k, k);
+}
+
+// e = |a0 - a1 + a2| in k + 1 limbs, returns 1 when the value is negative
+static int evaluate_minus_one(uint32_t *e, const uint32_t *a, size_t k, size_t h)
+{
+	e[k] = add(e, a, k, a + 2 * k, h);
+	if (0 == e[k] && compare_n(e, a + k, k) < 0) {
+		sub(e, a + k, k, e, k);
+		return 1;
+	}
+	e[k] -= sub(e, e, k, a + k, k);
+	return 0;
+}
+
+// e = a0 + 2 a1 + 4 a2 in k + 1 limbs, by Horner's rule
+static void evaluate_two(uint32_t *e, const uint32_t *a, size_t k, size_t h)
+{
+	memcpy(e, a + 2 * k, h * sizeof(uint32_t));
+	memset(e + h, 0, (k + 1 - h) * sizeof(uint32_t));
+	for (int step = 1; step >= 0; step--) {
+		const uint32_t *x = a + step * k;
+		uint64_t t = 0;
+		for (size_t i = 0; i <= k; i++) {
+			t += ((uint64_t)e[i] << 1) + (i < k ? x[i] : 0);
+			e[i] = (uint32_t)t;
+			t >>= 32;
+		}
+	}
+}
+
+// Exact division of a two's complement number by 3, limb by limb from the bottom
+static void divexact3(uint32_t *a, size_t n)
+{
+	uint32_t c = 0, s, l;
+	for (size_t i = 0; i < n; i++) {
+		s = a[i];
+		l = s - c;
+		c = l > s;
+		l *= 0xaaaaaaabu; // the inverse of 3 modulo 2^32
+		a[i] = l;
+		c += (l >= 0x55555556u) + (l >= 0xaaaaaaabu); // the high limb of 3 l
+	}
+}
+
+// Arithmetic shift right by one of a two's complement number
+static void halve(uint32_t *a, size_t n)
+{
+	for (size_t i = 0; i + 1 < n; i++)
+		a[i] = a[i] >> 1 | a[i + 1] << 31;
+	a[n - 1] = (uint32_t)((int32_t)a[n - 1] >> 1);
+}
+
+// Both operands as polynomials of three pieces of k limbs in x = 2^(32k), the product through
+// their values at 0, 1, -1, 2 and infinity and interpolation with exact divisions (Bodrato)
+static void mul_toom3(uint32_t *r, const uint32_t *a, const uint32_t *b, size_t n, uint32_t *scratch)
+{
+	size_t k = (n + 2) / 3, h = n - 2 * k, m = 2 * k + 4;
+	uint32_t *ea = scratch, *eb = ea + k + 2, *r1 = eb + k + 2, *rm1 = r1 + m, *r2 = rm1 + m, *next = r2 + m;
+	uint32_t *r0 = r, *rinf = r + 4 * k;
+	int negative;
+
+	// The values at 1, -1 and 2 in two's complement numbers of m limbs
+	evaluate_one(ea, a, k, h);
+	evaluate_one(eb, b, k, h);
+	mul_n(r1, ea, eb, k + 1, next);
+	memset(r1 + 2 * k + 2, 0, 2 * sizeof(uint32_t));
+	negative = evaluate_minus_one(ea, a, k, h) != evaluate_minus_one(eb, b, k, h);
+	mul_n(rm1, ea, eb, k + 1, next);
+	memset(rm1 + 2 * k + 2, 0, 2 * sizeof(uint32_t));
+	if (negative)
+		negate(rm1, m);
+	evaluate_two(ea, a, k, h);
+	evaluate_two(eb, b, k, h);
+	mul_n(r2, ea, eb, k + 1, next);
+	memset(r2 + 2 * k + 2, 0, 2 * sizeof(uint32_t));
+	// The values at 0 and infinity are the lowest and highest coefficient, in place
+	mul_n(r0, a, b, k, next);
+	mul_n(rinf, a + 2 * k, b + 2 * k, h, next);
+	memset(r + 2 * k, 0, 2 * k * sizeof(uint32_t));
+
+	sub(r2, r2, m, rm1, m);
+	divexact3(r2, m); // (r(2) - r(-1)) / 3 = c1 + c2 + 3 c3 + 5 c4
+	sub(r1, r1, m, rm1, m);
+	halve(r1, m); // (r(1) - r(-1)) / 2 = c1 + c3
+	sub(rm1, rm1, m, r0, 2 * k); // r(-1) - r(0) = -c1 + c2 - c3 + c4
+	sub(r2, r2, m, rm1, m);
+	halve(r2, m); // c1 + 2 c3 + 2 c4
+	add(rm1, rm1, m, r1, m);
+	sub(rm1, rm1, m, rinf, 2 * h); // c2
+	sub(r2, r2, m, r1, m);
+	sub(r2, r2, m, rinf, 2 * h);
+	sub(r2, r2, m, rinf, 2 * h); // c3
+	sub(r1, r1, m, r2, m); // c1
+
+	// Coefficients are never negative and none reaches past the product, so the limbs of m that
+	// do not fit are zero
+	for (int i = 1; i <= 3; i++) {
+		uint32_t *c = 1 == i ? r1 : 2 == i ? rm1 : r2;
+		size_t room = 2 * n - i * k;
+		add(r + i * k, r + i * k, room, c, m < room ? m : room);
+	}
+}
+
+static void mul_n(uint32_t *r, const uint32_t *a, const uint32_t *b, size_t n, uint32_t *scratch)
+{
+	if (n < MIN_SPLIT || n < (size_t)calc_big_karatsuba)
+		mul_basecase(r, a, n, b, n);
+	else if (n < (size_t)calc_big_toom3)
+		mul_karatsuba(r, a, b, n, scratch);
+	else
+		mul_toom3(r, a, b, n, scratch);
+}
+
+// r = a b in na + nb limbs; the longer operand goes in pieces as long as the shorter one
+static void mul(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *scratch)
+{
+	uint32_t *t, *pad, *next;
+	const uint32_t *piece;
+	size_t len;
+
+	if (na < nb) {
+		const uint32_t *swap = a;
+		a = b;
+		b = swap;
+		len = na;
+		na = nb;
+		nb = len;
+	}
+	if (nb < MIN_SPLIT || nb < (size_t)calc_big_karatsuba) {
+		mul_basecase(r, a, na, b, nb);
+		return;
+	}
+	t = scratch;
+	pad = t + 2 * nb;
+	next = pad + nb;
+	mul_n(r, a, b, nb, next);
+	for (size_t done = nb; done < na; done += len) {
+		len = na - done < nb ? na - done : nb;
+		piece = a + done;
+		if (len < nb) {
+			memcpy(pad, piece, len * sizeof(uint32_t));
+			memset(pad + len, 0, (nb - len) * sizeof(uint32_t));
+			piece = pad;
+		}
+		mul_n(t, piece, b, nb, next);
+		add(r + done, t, len + nb, r + done, nb);
+	}
+}
+
+void calc_big_mul(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	size_t n = na < nb ? na : nb;
+	uint32_t *scratch = n >= MIN_SPLIT && n >= (size_t)calc_big_karatsuba ? allocate(SCRATCH(n)) : NULL;
+	mul(r, a, na, b, nb, scratch);
+	free(scratch);
+}
+
+// Knuth's algorithm D: one quotient limb at a time from a two-limb estimate
+static void div_basecase(uint32_t *q, uint32_t *rem, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	uint32_t *u, *v;
+	uint64_t qhat, rhat, p, t, carry, borrow;
+	int s;
+
+	if (1 == nb) {
+		t = 0;
+		for (size_t i = na; i-- > 0;) {
+			t = t << 32 | a[i];
+			q[i] = (uint32_t)(t / b[0]);
+			t %= b[0];
+		}
+		rem[0] = (uint32_t)t;
+		return;
+	}
+	u = allocate(na + 1 + nb);
+	v = u + na + 1;
+	// Normalized so that the divisor's top bit is set, which makes the estimate at most 2 too large
+	s = __builtin_clz(b[nb - 1]);
+	shift_left(u, a, na, s);
+	shift_left(v, b, nb - 1, s);
+	v[nb - 1] = b[nb - 1] << s | (s ? b[nb - 2] >> (32 - s) : 0);
+	for (size_t j = na - nb + 1; j-- > 0;) {
+		t = (uint64_t)u[j + nb] << 32 | u[j + nb - 1];
+		qhat = t / v[nb - 1];
+		rhat = t % v[nb - 1];
+		while (qhat > UINT32_MAX || qhat * v[nb - 2] > (rhat << 32 | u[j + nb - 2])) {
+			qhat--;
+			if ((rhat += v[nb - 1]) > UINT32_MAX)
+				break;
+		}
+		carry = borrow = 0;
+		for (size_t i = 0; i < nb; i++) {
+			p = qhat * v[i] + carry;
+			carry = p >> 32;
+			t = (uint64_t)u[i + j] - (uint32_t)p - borrow;
+			u[i + j] = (uint32_t)t;
+			borrow = t >> 63;
+		}
+		t = (uint64_t)u[j + nb] - carry - borrow;
+		u[j + nb] = (uint32_t)t;
+		q[j] = (uint32_t)qhat;
+		if (t >> 63) {
+			// Rarely one too large still: add the divisor back
+			q[j]--;
+			u[j + nb] += add(u + j, u + j, nb, v, nb);
+		}
+	}
+	shift_right(rem, u, nb, s);
+	free(u);
+}
+
+// x = floor(2^(2n) / b) for b of n bits, in RECIPROCAL(n) limbs; returns its length. The top
+// half of b gives half the bits by recursion, one Newton step x + x (2^(2n) - b x) / 2^(2n)
+// doubles them and, when exact, a last multiplication corrects the few units left; the
+// levels below skip it, their guard bits absorb those units.
+static size_t reciprocal(uint32_t *x, const uint32_t *b, size_t nb, size_t n, int exact)
+{
+	size_t newton = calc_big_newton < MIN_NEWTON ? MIN_NEWTON : calc_big_newton;
+	size_t w = 2 * n / 32 + 3, h, nh, nx, ny, np, ne, nc;
+	uint32_t *bh, *xh, *y, *p, *e, *c, one = 1;
+	int negative;
+
+	if (nb < newton) {
+		size_t na = 2 * n / 32 + 1;
+		uint32_t *a = allocate(na + nb);
+		memset(a, 0, na * sizeof(uint32_t));
+		a[na - 1] = 1u << (2 * n % 32);
+		div_basecase(x, a + na, a, na, b, nb);
+		free(a);
+		return normalize(x, na - nb + 1);
+	}
+	h = n / 2 + GUARD_BITS;
+	bh = allocate(nb + RECIPROCAL(h) + RECIPROCAL(n) + (nb + RECIPROCAL(n)) + w + (RECIPROCAL(n) + w));
+	xh = bh + nb;
+	y = xh + RECIPROCAL(h);
+	p = y + RECIPROCAL(n);
+	e = p + nb + RECIPROCAL(n);
+	c = e + w;
+
+	nh = normalize(bh, shift_right(bh, b, nb, n - h));
+	nx = reciprocal(xh, bh, nh, h, 0);
+	ny = normalize(y, shift_left(y, xh, nx, n - h));
+
+	// e = 2^(2n) - b y, which may be negative when the top half of b rounded x up
+	calc_big_mul(p, b, nb, y, ny);
+	np = normalize(p, nb + ny);
+	memset(e, 0, w * sizeof(uint32_t));
+	e[2 * n / 32] = 1u << (2 * n % 32);
+	sub(e, e, w, p, np);
+	if ((negative = e[w - 1] >> 31))
+		negate(e, w);
+	ne = normalize(e, w);
+	calc_big_mul(c, y, ny, e, ne);
+	nc = normalize(c, shift_right(c, c, ny + ne, 2 * n));
+	if (negative) {
+		sub(y, y, ny, c, nc);
+	} else {
+		y[ny] = add(y, y, ny, c, nc); // the step is below y, as |e| is far below 2^(2n)
+		ny++;
+	}
+	ny = normalize(y, ny);
+
+	// Within a few units now: step until 0 <= 2^(2n) - b y < b
+	if (exact) {
+		calc_big_mul(p, b, nb, y, ny);
+		np = normalize(p, nb + ny);
+		memset(e, 0, w * sizeof(uint32_t));
+		e[2 * n / 32] = 1u << (2 * n % 32);
+		sub(e, e, w, p, np);
+		while (e[w - 1] >> 31) {
+			sub(y, y, ny, &one, 1);
+			add(e, e, w, b, nb);
+		}
+		while (compare(e, normalize(e, w), b, nb) >= 0) {
+			ny = increment(y, ny);
+			sub(e, e, w, b, nb);
+		}
+		ny = normalize(y, ny);
+	}
+	memcpy(x, y, ny * sizeof(uint32_t));
+	free(bh);
+	return ny;
+}
+
+// q = floor(a 2^s x / 2^(2N)) with x the reciprocal of b 2^s, b 2^s of N bits and a 2^s of at
+// most 2N; at most one short of the quotient, which the remainder tells
+static void div_newton(uint32_t *q, uint32_t *rem, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	size_t n = bit_length(b, nb), m = bit_length(a, na), N = m > 2 * n ? m - n : n, s = N - n;
+	size_t nb2, na2, nx, nq, nr;
+	uint32_t *b2, *a2, *x, *t, *r;
+
+	b2 = allocate((nb + s / 32 + 1) + (na + s / 32 + 1) + RECIPROCAL(N) + (na + s / 32 + 1 + RECIPROCAL(N)) + na + 1);
+	a2 = b2 + nb + s / 32 + 1;
+	x = a2 + na + s / 32 + 1;
+	t = x + RECIPROCAL(N);
+	r = t + na + s / 32 + 1 + RECIPROCAL(N);
+
+	nb2 = normalize(b2, shift_left(b2, b, nb, s));
+	na2 = normalize(a2, shift_left(a2, a, na, s));
+	nx = reciprocal(x, b2, nb2, N, 1);
+	calc_big_mul(t, a2, na2, x, nx);
+	nq = normalize(t, shift_right(t, t, na2 + nx, 2 * N));
+
+	// r = a - q b, never negative since q is not above the quotient
+	if (nq > 0) {
+		calc_big_mul(a2, t, nq, b, nb);
+		sub(r, a, na, a2, normalize(a2, nq + nb));
+	} else {
+		memcpy(r, a, na * sizeof(uint32_t));
+	}
+	while (compare(r, nr = normalize(r, na), b, nb) >= 0) {
+		sub(r, r, nr, b, nb);
+		nq = increment(t, nq);
+	}
+	memset(q, 0, (na - nb + 1) * sizeof(uint32_t));
+	memcpy(q, t, nq * sizeof(uint32_t));
+	memset(rem, 0, nb * sizeof(uint32_t));
+	memcpy(rem, r, normalize(r, nb) * sizeof(uint32_t));
+	free(b2);
+}
+
+void calc_big_divmod(uint32_t *q, uint32_t *rem, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+	size_t newton = calc_big_newton < MIN_NEWTON ? MIN_NEWTON : calc_big_newton;
+	if (nb >= newton && na - nb + 1 >= newton)
+		div_newton(q, rem, a, na, b, nb);
+	else
+		div_basecase(q, rem, a, na, b, nb);
+}
+
+int calc_big_limbs(char operation, int na, int nb)
+{
+	na = abs(na);
+	nb = abs(nb);
+	switch (operation) {
+	case '+':
+	case '-':
+	case '/':
+	case '%':
+		return (na > nb ? na : nb) + 1;
+	case '*':
+		return na + nb;
+	}
+	return 0;
+}
+
+int calc_big_calculate(char operation, const uint32_t *a, int na, const uint32_t *b, int nb, uint32_t *r, int *nr)
+{
+	size_t la = normalize(a, abs(na)), lb = normalize(b, abs(nb)), n;
+	int sa = na < 0, sb = nb < 0, negative;
+	uint32_t *t;
+
+	switch (operation) {
+	case '-':
+		sb = !sb;
+		// fall through
+	case '+':
+		if (sa == sb) {
+			n = (la > lb ? la : lb) + 1;
+			r[n - 1] = la >= lb ? add(r, a, la, b, lb) : add(r, b, lb, a, la);
+			negative = sa;
+		} else if (compare(a, la, b, lb) >= 0) {
+			sub(r, a, la, b, lb);
+			n = la;
+			negative = sa;
+		} else {
+			sub(r, b, lb, a, la);
+			n = lb;
+			negative = sb;
+		}
+		break;
+	case '*':
+		calc_big_mul(r, a, la, b, lb);
+		n = la + lb;
+		negative = sa != sb;
+		break;
+	case '/':
+	case '%':
+		if (0 == lb)
+			return CALC_FAILED;
+		if (compare(a, la, b, lb) < 0) {
+			n = '/' == operation ? 0 : la;
+			memcpy(r, a, n * sizeof(uint32_t));
+		} else {
+			t = allocate(la + 1);
+			if ('/' == operation)
+				calc_big_divmod(r, t, a, la, b, lb);
+			else
+				calc_big_divmod(t, r, a, la, b, lb);
+			free(t);
+			n = '/' == operation ? la - lb + 1 : lb;
+		}
+		negative = '/' == operation ? sa != sb : sa; // the remainder has the sign of the dividend
+		break;
+	default:
+		return CALC_FAILED;
+	}
+	n = normalize(r, n);
+	*nr = negative && n > 0 ? -(int)n : (int)n;
+	return CALC_OK;
+}
+
+int calc_big_parse(const char *text, uint32_t *r, int capacity, int *n)
+{
+	int negative = '-' == *text, len = 0;
+	const char *s = text + negative;
+	uint32_t chunk, scale;
+	uint64_t t;
+
+	if ('\0' == *s)
+		return errno = EINVAL, -1;
+	// Nine digits at a time: r = r 10^9 + chunk
+	while (*s != '\0') {
+		for (chunk = 0, scale = 1; scale < 1000000000 && *s != '\0'; s++, scale *= 10) {
+			if (*s < '0' || *s > '9')
+				return errno = EINVAL, -1;
+			chunk = 10 * chunk + (*s - '0');
+		}
+		t = chunk;
+		for (int i = 0; i < len; i++) {
+			t += (uint64_t)r[i] * scale;
+			r[i] = (uint32_t)t;
+			t >>= 32;
+		}
+		if (t > 0) {
+			if (len == capacity)
+				return errno = EINVAL, -1;
+			r[len++] = (uint32_t)t;
+		}
+	}
+	*n = negative ? -len : len;
+	return 0;
+}
+
+char *calc_big_format(const uint32_t *a, int n)
+{
+	size_t len = abs(n);
+	uint32_t *t = allocate(len);
+	char *text, *p;
+	uint64_t rem;
+
+	if ((text = malloc(10 * len + 12)) == NULL)
+		ERR("malloc");
+	p = text + 10 * len + 11;
+	*p = '\0';
+	memcpy(t, a, len * sizeof(uint32_t));
+	len = normalize(t, len);
+	// Nine digits at a time from the bottom: t = t / 10^9
+	do {
+		rem = 0;
+		for (size_t i = len; i-- > 0;) {
+			rem = rem << 32 | t[i];
+			t[i] = (uint32_t)(rem / 1000000000);
+			rem %= 1000000000;
+		}
+		len = normalize(t, len);
+		for (int i = 0; i < 9; i++, rem /= 10)
+			*--p = '0' + rem % 10;
+	} while (len > 0);
+	while ('0' == *p && p[1] != '\0')
+		p++;
+	if (n < 0 && strcmp(p, "0") != 0)
+		*--p = '-';
+	memmove(text, p, strlen(p) + 1);
+	free(t);
+	return text;
+}
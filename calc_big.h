@@ -0,0 +1,35 @@
+// Arbitrary-precision integers of the calculator servers. A number is an array of
+// 32-bit limbs, least significant first, and a signed limb count whose sign is the
+// sign of the number (0 is zero), the way CALC_BIG requests carry it (calc.h).
+//
+// Multiplication picks schoolbook, Karatsuba or Toom-3 by operand size; division
+// is schoolbook (Knuth's algorithm D) for short quotients or divisors and goes
+// through a Newton reciprocal above that. The crossover points are variables so
+// that bench/bench_bignum can time each algorithm on its own; they are read
+// without locking and are meant to be set before any thread computes.
+
+#ifndef CALC_BIG_H
+#define CALC_BIG_H
+
+#include "calc.h"
+
+extern int calc_big_karatsuba; // limbs of the shorter operand from which products split in two
+extern int calc_big_toom3; // ... and from which they split in three
+extern int calc_big_newton; // limbs of divisor and quotient from which division uses a reciprocal
+
+// Limbs the result of operation may need, 0 for an unknown operation
+int calc_big_limbs(char operation, int na, int nb);
+// r gets calc_big_limbs(operation, na, nb) limbs at most; CALC_OK, or CALC_FAILED for an
+// unknown operation or division by zero. Division truncates toward zero like C's.
+int calc_big_calculate(char operation, const uint32_t *a, int na, const uint32_t *b, int nb, uint32_t *r, int *nr);
+
+// Magnitudes: r gets na + nb limbs, q na - nb + 1 and rem nb (na >= nb, b[nb - 1] != 0)
+void calc_big_mul(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb);
+void calc_big_divmod(uint32_t *q, uint32_t *rem, const uint32_t *a, size_t na, const uint32_t *b, size_t nb);
+
+// Decimal text, an optional '-' and digits; -1 with EINVAL when it is not a number or needs more than capacity limbs
+int calc_big_parse(const char *text, uint32_t *r, int capacity, int *n);
+// Decimal text of the number, to be freed by the caller
+char *calc_big_format(const uint32_t *a, int n);
+
+#endif
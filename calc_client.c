@@ -0,0 +1,392 @@
+#include "calc_client.h"
+#include "slab.h"
+#include "posixnet_err.h"
+
+#include <string.h>
+
+#define CALC_IN_FRAMES 64 // answers taken with one read
+#define CALC_IN_SIZE (CALC_IN_FRAMES * CALC_FRAME_V2 + (CALC_MAX_ROWS + CALC_MASK_WORDS(CALC_MAX_ROWS)) * sizeof(int32_t))
+#define CALC_MAX_ANSWER (2 * CALC_MAX_LIMBS * sizeof(uint32_t)) // payload of the longest product
+
+struct calc_call {
+	struct calc_call *next;
+	uint64_t id;
+	int conn;
+	calc_cb cb;
+	calc_rows_cb rows_cb; // instead of cb for CALC_EVAL
+	calc_big_cb big_cb; // ... and for CALC_BIG
+	void *arg;
+};
+
+struct calc_conn {
+	struct calc_client *cc;
+	int fd; // -1 once the connection broke
+	int index;
+	int writing; // REACTOR_WRITE is requested
+	int deferred; // a flush is due at the end of the round
+	size_t pending; // requests sent and not answered
+	char *in; // grown for one long answer at a time
+	size_t in_len, in_cap;
+	char *out;
+	size_t out_len, out_done, out_cap;
+};
+
+struct calc_client {
+	struct reactor *reactor;
+	struct calc_conn *conns;
+	int nconns;
+	uint64_t next_id;
+	struct calc_call **table; // pending calls by id, chained
+	size_t buckets; // power of two
+	size_t pending;
+};
+
+static struct calc_call **bucket(struct calc_client *cc, uint64_t id)
+{
+	return &cc->table[id & (cc->buckets - 1)];
+}
+
+static void grow_table(struct calc_client *cc)
+{
+	struct calc_call **old = cc->table, *call;
+	size_t n = cc->buckets;
+	cc->buckets = n ? 2 * n : 64;
+	if ((cc->table = calloc(cc->buckets, sizeof(struct calc_call *))) == NULL)
+		ERR("calloc");
+	for (size_t i = 0; i < n; i++)
+		while ((call = old[i]) != NULL) {
+			old[i] = call->next;
+			call->next = *bucket(cc, call->id);
+			*bucket(cc, call->id) = call;
+		}
+	free(old);
+}
+
+static struct calc_call *take_call(struct calc_client *cc, uint64_t id)
+{
+	struct calc_call **p = bucket(cc, id), *call;
+	for (; (call = *p) != NULL; p = &call->next)
+		if (call->id == id) {
+			*p = call->next;
+			cc->pending--;
+			cc->conns[call->conn].pending--;
+			return call;
+		}
+	return NULL;
+}
+
+// rows results and the failed-row bitmap follow for CALC_EVAL, result is then the number of failed
+// rows; for CALC_BIG result is the signed limb count of the number in results
+static void complete(struct calc_client *cc, struct calc_call *call, int status, int32_t result, int rows,
+		     const int32_t *results)
+{
+	calc_cb cb = call->cb;
+	calc_rows_cb rows_cb = call->rows_cb;
+	calc_big_cb big_cb = call->big_cb;
+	void *arg = call->arg;
+	uint64_t id = call->id;
+	slab_free(call, sizeof(struct calc_call));
+	if (rows_cb != NULL)
+		rows_cb(cc, id, status, rows, results, (const uint32_t *)results + rows, arg);
+	else if (big_cb != NULL)
+		big_cb(cc, id, status, (const uint32_t *)results, NULL == results ? 0 : result, arg);
+	else
+		cb(cc, id, status, result, arg);
+}
+
+// Closes a broken connection and fails the requests still waiting on it
+static void conn_fail(struct calc_conn *c)
+{
+	struct calc_client *cc = c->cc;
+	struct calc_call *failed = NULL, *call;
+	if (c->fd < 0)
+		return;
+	if (reactor_remove(cc->reactor, c->fd) < 0)
+		ERR("reactor_remove");
+	if (TEMP_FAILURE_RETRY(close(c->fd)) < 0)
+		ERR("close");
+	c->fd = -1;
+	c->in_len = c->out_len = c->out_done = 0;
+	// Unlinked first: the callbacks may submit again and grow the table
+	for (size_t i = 0; i < cc->buckets && c->pending > 0; i++) {
+		struct calc_call **p = &cc->table[i];
+		while ((call = *p) != NULL) {
+			if (call->conn != c->index) {
+				p = &call->next;
+				continue;
+			}
+			*p = call->next;
+			cc->pending--;
+			c->pending--;
+			call->next = failed;
+			failed = call;
+		}
+	}
+	while ((call = failed) != NULL) {
+		failed = call->next;
+		complete(cc, call, -1, -1, 0, NULL);
+	}
+}
+
+static void conn_flush(struct calc_conn *c)
+{
+	ssize_t size;
+	while (c->out_done < c->out_len) {
+		size = TEMP_FAILURE_RETRY(write(c->fd, c->out + c->out_done, c->out_len - c->out_done));
+		if (size < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+			break;
+		if (size < 0) {
+			conn_fail(c);
+			return;
+		}
+		c->out_done += size;
+	}
+	if (c->out_done == c->out_len)
+		c->out_done = c->out_len = 0;
+	if (c->writing != (c->out_len > 0)) {
+		c->writing = c->out_len > 0;
+		if (reactor_modify(c->cc->reactor, c->fd, REACTOR_READ | (c->writing ? REACTOR_WRITE : 0)) < 0)
+			ERR("reactor_modify");
+	}
+}
+
+static void deferred_flush(struct reactor *r, void *arg)
+{
+	struct calc_conn *c = arg;
+	c->deferred = 0;
+	if (c->fd >= 0)
+		conn_flush(c);
+}
+
+static void conn_read(struct calc_conn *c)
+{
+	struct calc_client *cc = c->cc;
+	int32_t *results;
+	struct calc_frame f;
+	struct calc_call *call;
+	size_t off = 0, len, need = 0;
+	ssize_t size;
+	size = TEMP_FAILURE_RETRY(read(c->fd, c->in + c->in_len, c->in_cap - c->in_len));
+	if (size < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+		return;
+	if (size <= 0) {
+		conn_fail(c);
+		return;
+	}
+	c->in_len += size;
+	for (; c->in_len - off >= CALC_FRAME_V2; off += CALC_FRAME_V2 + len) {
+		memcpy(&f, c->in + off, CALC_FRAME_V2);
+		if ((len = calc_answer_payload(&f)) > CALC_MAX_ANSWER) {
+			conn_fail(c);
+			return;
+		}
+		if (c->in_len - off < CALC_FRAME_V2 + len) {
+			need = CALC_FRAME_V2 + len;
+			break;
+		}
+		// Frames and payloads are whole words, so the payload is aligned in the buffer
+		results = (int32_t *)(c->in + off + CALC_FRAME_V2);
+		for (size_t i = 0; i < len / sizeof(int32_t); i++)
+			results[i] = ntohl(results[i]);
+		// An unknown ID would be a server bug; the answer has nobody to go to
+		if ((call = take_call(cc, calc_get_id(&f))) != NULL)
+			complete(cc, call, ntohl(f.data[4]), ntohl(f.data[2]), ntohl(f.data[1]), results);
+		if (c->fd < 0)
+			return; // a callback ended up failing this connection
+	}
+	memmove(c->in, c->in + off, c->in_len - off);
+	c->in_len -= off;
+	if (need > c->in_cap || (c->in_cap > CALC_IN_SIZE && c->in_len <= CALC_IN_SIZE && need <= CALC_IN_SIZE)) {
+		c->in_cap = need > CALC_IN_SIZE ? need : CALC_IN_SIZE;
+		if ((c->in = realloc(c->in, c->in_cap)) == NULL)
+			ERR("realloc");
+	}
+}
+
+static void conn_event(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	struct calc_conn *c = arg;
+	if (events & REACTOR_READ)
+		conn_read(c);
+	if ((events & REACTOR_WRITE) && c->fd >= 0)
+		conn_flush(c);
+}
+
+struct calc_client *calc_client_create(struct reactor *r, char *host, char *port, int connections)
+{
+	struct calc_client *cc;
+	if (connections < 1)
+		return errno = EINVAL, NULL;
+	if ((cc = calloc(1, sizeof(struct calc_client))) == NULL)
+		return NULL;
+	if ((cc->conns = calloc(connections, sizeof(struct calc_conn))) == NULL) {
+		free(cc);
+		return NULL;
+	}
+	cc->reactor = r;
+	cc->nconns = connections;
+	cc->next_id = 1;
+	grow_table(cc);
+	for (int i = 0; i < connections; i++) {
+		struct calc_conn *c = &cc->conns[i];
+		c->cc = cc;
+		c->index = i;
+		c->in_cap = CALC_IN_SIZE;
+		if ((c->in = malloc(c->in_cap)) == NULL)
+			ERR("malloc");
+		c->fd = NULL == port ? connect_local_socket(host) : connect_socket(host, port);
+		if (set_nonblock(c->fd) < 0)
+			ERR("fcntl");
+		if (reactor_add(r, c->fd, REACTOR_READ, conn_event, c) < 0)
+			ERR("reactor_add");
+	}
+	return cc;
+}
+
+// Requests still pending are dropped without calling back
+void calc_client_destroy(struct calc_client *cc)
+{
+	struct calc_call *call;
+	for (int i = 0; i < cc->nconns; i++) {
+		struct calc_conn *c = &cc->conns[i];
+		if (c->fd >= 0) {
+			reactor_remove(cc->reactor, c->fd);
+			if (TEMP_FAILURE_RETRY(close(c->fd)) < 0)
+				ERR("close");
+		}
+		free(c->in);
+		free(c->out);
+	}
+	for (size_t i = 0; i < cc->buckets; i++)
+		while ((call = cc->table[i]) != NULL) {
+			cc->table[i] = call->next;
+			slab_free(call, sizeof(struct calc_call));
+		}
+	free(cc->table);
+	free(cc->conns);
+	free(cc);
+}
+
+// Queues a request frame and its payload; returns the ID the callback will get, 0 when no connection is left
+static uint64_t submit(struct calc_client *cc, struct calc_frame *f, const void *payload, size_t len, calc_cb cb,
+		       calc_rows_cb rows_cb, calc_big_cb big_cb, void *arg)
+{
+	struct calc_conn *c = NULL;
+	struct calc_call *call;
+	// The connection with the fewest requests in flight
+	for (int i = 0; i < cc->nconns; i++)
+		if (cc->conns[i].fd >= 0 && (NULL == c || cc->conns[i].pending < c->pending))
+			c = &cc->conns[i];
+	if (NULL == c)
+		return errno = ENOTCONN, 0;
+	if ((call = slab_alloc(sizeof(struct calc_call))) == NULL)
+		ERR("slab_alloc");
+	if (cc->pending >= cc->buckets)
+		grow_table(cc);
+	call->id = cc->next_id++;
+	call->conn = c->index;
+	call->cb = cb;
+	call->rows_cb = rows_cb;
+	call->big_cb = big_cb;
+	call->arg = arg;
+	call->next = *bucket(cc, call->id);
+	*bucket(cc, call->id) = call;
+	cc->pending++;
+	c->pending++;
+
+	f->data[4] = htonl(CALC_V2);
+	calc_set_id(f, call->id);
+	if (c->out_len + CALC_FRAME_V2 + len > c->out_cap) {
+		if (c->out_done > 0) {
+			memmove(c->out, c->out + c->out_done, c->out_len - c->out_done);
+			c->out_len -= c->out_done;
+			c->out_done = 0;
+		}
+		while (c->out_len + CALC_FRAME_V2 + len > c->out_cap) {
+			c->out_cap = c->out_cap ? 2 * c->out_cap : CALC_IN_FRAMES * CALC_FRAME_V2;
+			if ((c->out = realloc(c->out, c->out_cap)) == NULL)
+				ERR("realloc");
+		}
+	}
+	memcpy(c->out + c->out_len, f, CALC_FRAME_V2);
+	memcpy(c->out + c->out_len + CALC_FRAME_V2, payload, len);
+	c->out_len += CALC_FRAME_V2 + len;
+	if (!c->deferred && !c->writing) {
+		c->deferred = 1;
+		reactor_defer(cc->reactor, deferred_flush, c);
+	}
+	return call->id;
+}
+
+uint64_t calc_submit(struct calc_client *cc, int32_t op1, char operation, int32_t op2, calc_cb cb, void *arg)
+{
+	struct calc_frame f;
+	f.data[0] = htonl(op1);
+	f.data[1] = htonl(op2);
+	f.data[2] = htonl(0);
+	f.data[3] = htonl((int32_t)operation);
+	return submit(cc, &f, NULL, 0, cb, NULL, NULL, arg);
+}
+
+// The callback's result is the handle of the program
+uint64_t calc_compile(struct calc_client *cc, const char *expression, calc_cb cb, void *arg)
+{
+	struct calc_frame f;
+	size_t len = strlen(expression);
+	if (len > CALC_MAX_PAYLOAD)
+		return errno = EINVAL, 0;
+	f.data[0] = htonl(len);
+	f.data[1] = htonl(0);
+	f.data[2] = htonl(0);
+	f.data[3] = htonl(CALC_COMPILE);
+	return submit(cc, &f, expression, len, cb, NULL, NULL, arg);
+}
+
+// Runs a compiled program over rows of variables operands each
+uint64_t calc_eval(struct calc_client *cc, int32_t handle, int variables, int rows, const int32_t *operands,
+		   calc_rows_cb cb, void *arg)
+{
+	int32_t payload[CALC_MAX_PAYLOAD / sizeof(int32_t)];
+	struct calc_frame f;
+	size_t n = (size_t)rows * variables;
+	if (rows < 0 || rows > (int)CALC_MAX_ROWS || variables < 0 || variables > CALC_VARIABLES ||
+	    n * sizeof(int32_t) > CALC_MAX_PAYLOAD)
+		return errno = EINVAL, 0;
+	for (size_t i = 0; i < n; i++)
+		payload[i] = htonl(operands[i]);
+	f.data[0] = htonl(handle);
+	f.data[1] = htonl(rows);
+	f.data[2] = htonl(variables);
+	f.data[3] = htonl(CALC_EVAL);
+	return submit(cc, &f, payload, n * sizeof(int32_t), NULL, cb, NULL, arg);
+}
+
+// a operation b on numbers of na and nb limbs, negative counts for negative numbers (calc_big.h)
+uint64_t calc_big(struct calc_client *cc, const uint32_t *a, int na, char operation, const uint32_t *b, int nb,
+		  calc_big_cb cb, void *arg)
+{
+	struct calc_frame f;
+	uint32_t *payload;
+	size_t la = labs(na), lb = labs(nb);
+	uint64_t id;
+	if (la > CALC_MAX_LIMBS || lb > CALC_MAX_LIMBS)
+		return errno = EINVAL, 0;
+	if ((payload = malloc((la + lb + 1) * sizeof(uint32_t))) == NULL)
+		ERR("malloc");
+	for (size_t i = 0; i < la; i++)
+		payload[i] = htonl(a[i]);
+	for (size_t i = 0; i < lb; i++)
+		payload[la + i] = htonl(b[i]);
+	f.data[0] = htonl(na);
+	f.data[1] = htonl(nb);
+	f.data[2] = htonl((int32_t)operation);
+	f.data[3] = htonl(CALC_BIG);
+	id = submit(cc, &f, payload, (la + lb) * sizeof(uint32_t), NULL, NULL, cb, arg);
+	free(payload);
+	return id;
+}
+
+size_t calc_pending(const struct calc_client *cc)
+{
+	return cc->pending;
+}
@@ -0,0 +1,38 @@
+// Asynchronous client of the calculator servers for the libposixnet reactor. Requests
+// go out as v2 frames (calc.h) over a few long-lived connections, many of them in
+// flight at once; requests submitted in the same reactor round share one write per
+// connection. Answers are matched to requests by ID, so they may arrive in any order.
+// The callback gets CALC_OK, CALC_FAILED, CALC_BUSY or CALC_UNKNOWN, or -1 when the
+// connection broke before the answer came. Expressions are compiled once with
+// calc_compile and then evaluated by handle over many rows of operands with calc_eval.
+// calc_big computes on arbitrary-precision numbers (calc_big.h).
+
+#ifndef CALC_CLIENT_H
+#define CALC_CLIENT_H
+
+#include "calc.h"
+#include "reactor.h"
+
+struct calc_client;
+
+typedef void (*calc_cb)(struct calc_client *cc, uint64_t id, int status, int32_t result, void *arg);
+// Answer of calc_eval: rows results, failed rows (division by zero) are marked in failed, see calc_row_failed
+typedef void (*calc_rows_cb)(struct calc_client *cc, uint64_t id, int status, int rows, const int32_t *results,
+			     const uint32_t *failed, void *arg);
+// Answer of calc_big: the result in limbs, least significant first, n negative for a negative number
+typedef void (*calc_big_cb)(struct calc_client *cc, uint64_t id, int status, const uint32_t *limbs, int n, void *arg);
+
+// port NULL means host is the path of a local socket; connections are made before returning
+struct calc_client *calc_client_create(struct reactor *r, char *host, char *port, int connections);
+// Not from a reactor callback: writes deferred to the end of the round would outlive the client
+void calc_client_destroy(struct calc_client *cc);
+
+uint64_t calc_submit(struct calc_client *cc, int32_t op1, char operation, int32_t op2, calc_cb cb, void *arg);
+uint64_t calc_compile(struct calc_client *cc, const char *expression, calc_cb cb, void *arg);
+uint64_t calc_eval(struct calc_client *cc, int32_t handle, int variables, int rows, const int32_t *operands,
+		   calc_rows_cb cb, void *arg);
+uint64_t calc_big(struct calc_client *cc, const uint32_t *a, int na, char operation, const uint32_t *b, int nb,
+		  calc_big_cb cb, void *arg);
+size_t calc_pending(const struct calc_client *cc);
+
+#endif
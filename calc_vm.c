@@ -0,0 +1,301 @@
+#include "calc_vm.h"
+
+#include <string.h>
+
+enum { OP_CONST, OP_VAR, OP_NEG, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD };
+
+// A binary operation whose right operand is a variable or a constant takes it from arg instead
+// of the stack, which saves the push of most leaves
+#define OP_MASK 0x0f
+#define OPERAND_VAR 0x10
+#define OPERAND_CONST 0x20
+
+// Recursive descent over the text; emits code for a stack machine
+struct parser {
+	const char *s, *end;
+	struct calc_program *p;
+	int depth;
+	int error;
+};
+
+static void skip_space(struct parser *ps)
+{
+	while (ps->s < ps->end && (' ' == *ps->s || '\t' == *ps->s))
+		ps->s++;
+}
+
+static void emit(struct parser *ps, int op, int32_t arg, int push)
+{
+	if (ps->p->len >= CALC_MAX_CODE || (ps->depth += push) > CALC_STACK) {
+		ps->error = 1;
+		return;
+	}
+	ps->p->op[ps->p->len] = op;
+	ps->p->arg[ps->p->len] = arg;
+	ps->p->len++;
+}
+
+// Folds a variable or constant pushed just before into the binary operation
+static void emit_binary(struct parser *ps, int op)
+{
+	struct calc_program *p = ps->p;
+	if (!ps->error && p->len > 0 && (OP_VAR == p->op[p->len - 1] || OP_CONST == p->op[p->len - 1])) {
+		p->op[p->len - 1] = op | (OP_VAR == p->op[p->len - 1] ? OPERAND_VAR : OPERAND_CONST);
+		ps->depth--;
+		return;
+	}
+	emit(ps, op, 0, -1);
+}
+
+static void parse_sum(struct parser *ps);
+
+static void parse_primary(struct parser *ps)
+{
+	skip_space(ps);
+	if (ps->s >= ps->end) {
+		ps->error = 1;
+	} else if ('(' == *ps->s) {
+		ps->s++;
+		parse_sum(ps);
+		skip_space(ps);
+		if (ps->s >= ps->end || *ps->s != ')')
+			ps->error = 1;
+		else
+			ps->s++;
+	} else if (*ps->s >= 'a' && *ps->s <= 'z') {
+		int v = *ps->s++ - 'a';
+		if (v >= ps->p->variables)
+			ps->p->variables = v + 1;
+		emit(ps, OP_VAR, v, 1);
+	} else if (*ps->s >= '0' && *ps->s <= '9') {
+		int64_t n = 0;
+		while (ps->s < ps->end && *ps->s >= '0' && *ps->s <= '9' && n <= INT32_MAX)
+			n = 10 * n + (*ps->s++ - '0');
+		if (n > (int64_t)INT32_MAX + 1) // 2147483648 only makes sense negated, and wraps anyway
+			ps->error = 1;
+		emit(ps, OP_CONST, (int32_t)(uint32_t)n, 1);
+	} else {
+		ps->error = 1;
+	}
+}
+
+static void parse_unary(struct parser *ps)
+{
+	skip_space(ps);
+	if (ps->s < ps->end && '-' == *ps->s) {
+		ps->s++;
+		parse_unary(ps);
+		emit(ps, OP_NEG, 0, 0);
+	} else {
+		parse_primary(ps);
+	}
+}
+
+static void parse_product(struct parser *ps)
+{
+	parse_unary(ps);
+	for (skip_space(ps); !ps->error && ps->s < ps->end; skip_space(ps)) {
+		int op = '*' == *ps->s ? OP_MUL : '/' == *ps->s ? OP_DIV : '%' == *ps->s ? OP_MOD : -1;
+		if (op < 0)
+			break;
+		ps->s++;
+		parse_unary(ps);
+		emit_binary(ps, op);
+	}
+}
+
+static void parse_sum(struct parser *ps)
+{
+	parse_product(ps);
+	for (skip_space(ps); !ps->error && ps->s < ps->end; skip_space(ps)) {
+		int op = '+' == *ps->s ? OP_ADD : '-' == *ps->s ? OP_SUB : -1;
+		if (op < 0)
+			break;
+		ps->s++;
+		parse_product(ps);
+		emit_binary(ps, op);
+	}
+}
+
+int calc_compile_expression(struct calc_program *p, const char *text, size_t len)
+{
+	struct parser ps = { .s = text, .end = text + len, .p = p };
+	p->len = 0;
+	p->variables = 0;
+	if (len > CALC_MAX_EXPRESSION)
+		return errno = EINVAL, -1;
+	parse_sum(&ps);
+	skip_space(&ps);
+	if (ps.error || ps.s != ps.end)
+		return errno = EINVAL, -1;
+	return 0;
+}
+
+// One instruction over all lanes; a is the top of the stack, b the right operand
+static void binary(int op, int32_t *restrict a, const int32_t *restrict b, uint8_t *restrict failed)
+{
+	const int n = CALC_LANES; // a fixed count lets the compiler vectorize without a tail loop
+	int l;
+	switch (op) {
+	case OP_ADD:
+		for (l = 0; l < n; l++)
+			a[l] = (int32_t)((uint32_t)a[l] + (uint32_t)b[l]);
+		break;
+	case OP_SUB:
+		for (l = 0; l < n; l++)
+			a[l] = (int32_t)((uint32_t)a[l] - (uint32_t)b[l]);
+		break;
+	case OP_MUL:
+		for (l = 0; l < n; l++)
+			a[l] = (int32_t)((uint32_t)a[l] * (uint32_t)b[l]);
+		break;
+	// INT32_MIN / -1 traps; x / -1 is -x and x % -1 is 0
+	case OP_DIV:
+		for (l = 0; l < n; l++) {
+			failed[l] |= 0 == b[l];
+			a[l] = 0 == b[l] ? 0 : -1 == b[l] ? (int32_t)(0 - (uint32_t)a[l]) : a[l] / b[l];
+		}
+		break;
+	case OP_MOD:
+		for (l = 0; l < n; l++) {
+			failed[l] |= 0 == b[l];
+			a[l] = 0 == b[l] || -1 == b[l] ? 0 : a[l] % b[l];
+		}
+		break;
+	}
+}
+
+// Evaluates rows of p->variables operands each, marks the failed ones in mask; returns how many failed
+int calc_run(const struct calc_program *p, const int32_t *operands, int rows, int32_t *results, uint32_t *mask)
+{
+	int32_t stack[CALC_STACK][CALC_LANES], columns[CALC_VARIABLES][CALC_LANES], constant[CALC_LANES];
+	uint8_t failed[CALC_LANES], any;
+	int nfailed = 0;
+	memset(mask, 0, CALC_MASK_WORDS(rows) * sizeof(uint32_t));
+	for (int row = 0; row < rows; row += CALC_LANES) {
+		int n = rows - row < CALC_LANES ? rows - row : CALC_LANES, sp = -1, l;
+		const int32_t *in = operands + (size_t)row * p->variables;
+		// Variables by column, so that every instruction below walks contiguous lanes; the
+		// instructions always run over all lanes, those past the last row compute on zeros
+		for (int v = 0; v < p->variables; v++) {
+			for (l = 0; l < n; l++)
+				columns[v][l] = in[l * p->variables + v];
+			memset(columns[v] + n, 0, (CALC_LANES - n) * sizeof(int32_t));
+		}
+		memset(failed, 0, sizeof(failed));
+		for (int i = 0; i < p->len; i++) {
+			int op = p->op[i];
+			int32_t arg = p->arg[i];
+			const int32_t *b;
+			switch (op) {
+			case OP_CONST:
+				sp++;
+				for (l = 0; l < CALC_LANES; l++)
+					stack[sp][l] = arg;
+				break;
+			case OP_VAR:
+				memcpy(stack[++sp], columns[arg], sizeof(columns[arg]));
+				break;
+			case OP_NEG:
+				for (l = 0; l < CALC_LANES; l++)
+					stack[sp][l] = (int32_t)(0 - (uint32_t)stack[sp][l]);
+				break;
+			default:
+				if (op & OPERAND_VAR) {
+					b = columns[arg];
+				} else if (op & OPERAND_CONST) {
+					for (l = 0; l < CALC_LANES; l++)
+						constant[l] = arg;
+					b = constant;
+				} else {
+					b = stack[sp--];
+				}
+				binary(op & OP_MASK, stack[sp], b, failed);
+			}
+		}
+		any = 0;
+		for (l = 0; l < n; l++) {
+			results[row + l] = failed[l] ? 0 : stack[0][l];
+			any |= failed[l];
+		}
+		for (l = 0; any && l < n; l++) {
+			mask[(row + l) / 32] |= (uint32_t)failed[l] << (row + l) % 32;
+			nfailed += failed[l];
+		}
+	}
+	return nfailed;
+}
+
+struct calc_slot {
+	uint32_t hash;
+	uint32_t generation; // changes whenever the slot gets another program
+	size_t len;
+	char *text;
+	struct calc_program program;
+};
+
+struct calc_cache {
+	struct calc_slot slots[CALC_CACHE_SLOTS];
+};
+
+static uint32_t hash_text(const char *text, size_t len)
+{
+	uint32_t h = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (uint8_t)text[i]) * 16777619u;
+	return h;
+}
+
+struct calc_cache *calc_cache_create(void)
+{
+	return calloc(1, sizeof(struct calc_cache));
+}
+
+void calc_cache_destroy(struct calc_cache *c)
+{
+	for (int i = 0; i < CALC_CACHE_SLOTS; i++)
+		free(c->slots[i].text);
+	free(c);
+}
+
+// A handle is the slot in the low bits and its generation above them, so the handle of an
+// evicted program stops working instead of running whatever replaced it
+static int32_t make_handle(const struct calc_cache *c, int slot)
+{
+	return (int32_t)((c->slots[slot].generation << CALC_CACHE_BITS | slot) & INT32_MAX);
+}
+
+// Returns the handle of the program for text, compiling it only when it is not cached; -1 when it does not parse
+int32_t calc_cache_compile(struct calc_cache *c, const char *text, size_t len, const struct calc_program **p)
+{
+	uint32_t hash = hash_text(text, len);
+	struct calc_slot *s = &c->slots[hash & (CALC_CACHE_SLOTS - 1)];
+	struct calc_program program;
+	char *copy;
+	if (s->text != NULL && s->hash == hash && s->len == len && 0 == memcmp(s->text, text, len)) {
+		*p = &s->program;
+		return make_handle(c, s - c->slots);
+	}
+	if (calc_compile_expression(&program, text, len) < 0)
+		return -1;
+	if ((copy = malloc(len ? len : 1)) == NULL)
+		return -1;
+	memcpy(copy, text, len);
+	free(s->text);
+	s->text = copy;
+	s->hash = hash;
+	s->len = len;
+	s->generation++;
+	s->program = program;
+	*p = &s->program;
+	return make_handle(c, s - c->slots);
+}
+
+// NULL when the handle was never given out or its program was evicted since
+const struct calc_program *calc_cache_get(struct calc_cache *c, int32_t handle)
+{
+	struct calc_slot *s = &c->slots[handle & (CALC_CACHE_SLOTS - 1)];
+	if (handle < 0 || NULL == s->text || make_handle(c, s - c->slots) != handle)
+		return NULL;
+	return &s->program;
+}
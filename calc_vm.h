@@ -0,0 +1,40 @@
+// Expression programs of the calculator servers. An expression over integer constants
+// and the variables a..z with + - * / % and parentheses is compiled once to stack
+// bytecode; a program cache keyed by the hash of the text hands out 32-bit handles, so
+// clients send a hot expression's text only once. The interpreter runs one instruction
+// over CALC_LANES rows of operands at a time, which keeps the dispatch cost per row
+// low and lets the compiler vectorize + - and *.
+//
+// Arithmetic wraps around like the rest of the calculator's 32-bit operations; a
+// division or remainder by zero fails its row only.
+
+#ifndef CALC_VM_H
+#define CALC_VM_H
+
+#include "calc.h"
+
+#define CALC_MAX_EXPRESSION 1024 // bytes of expression text
+#define CALC_MAX_CODE 256 // instructions of one program
+#define CALC_STACK 16
+#define CALC_LANES 64
+#define CALC_CACHE_BITS 10
+#define CALC_CACHE_SLOTS (1 << CALC_CACHE_BITS)
+
+struct calc_program {
+	int len;
+	int variables; // operands per row, the highest variable used plus one
+	uint8_t op[CALC_MAX_CODE];
+	int32_t arg[CALC_MAX_CODE];
+};
+
+struct calc_cache;
+
+int calc_compile_expression(struct calc_program *p, const char *text, size_t len);
+int calc_run(const struct calc_program *p, const int32_t *operands, int rows, int32_t *results, uint32_t *mask);
+
+struct calc_cache *calc_cache_create(void);
+void calc_cache_destroy(struct calc_cache *c);
+int32_t calc_cache_compile(struct calc_cache *c, const char *text, size_t len, const struct calc_program **p);
+const struct calc_program *calc_cache_get(struct calc_cache *c, int32_t handle);
+
+#endif
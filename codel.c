@@ -0,0 +1,78 @@
+#include "codel.h"
+
+#include <string.h>
+#include <time.h>
+
+static uint64_t clock_ns(clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void codel_init(struct codel *q, int target_ms, int interval_ms)
+{
+	q->target = target_ms * 1000000ULL;
+	q->interval = interval_ms * 1000000ULL;
+	q->interval_end = clock_ns(CLOCK_MONOTONIC) + q->interval;
+	q->min_sojourn = UINT64_MAX;
+	q->overloaded = 0;
+	q->admitted = q->shed = 0;
+}
+
+// Returns 1 when a request that waited sojourn ns should be served, 0 when it should be shed
+int codel_admit(struct codel *q, uint64_t sojourn)
+{
+	uint64_t now = clock_ns(CLOCK_MONOTONIC);
+	if (now >= q->interval_end) {
+		// An interval without requests says nothing about the queue: it is not standing
+		q->overloaded = q->min_sojourn != UINT64_MAX && q->min_sojourn > q->target;
+		q->min_sojourn = UINT64_MAX;
+		q->interval_end = now + q->interval;
+	}
+	if (sojourn < q->min_sojourn)
+		q->min_sojourn = sojourn;
+	if (sojourn > (q->overloaded ? q->target : q->interval)) {
+		q->shed++;
+		return 0;
+	}
+	q->admitted++;
+	return 1;
+}
+
+// Asks for receive timestamps; accepted sockets inherit the option from a listening one
+int codel_stamp(int fd)
+{
+	int on = 1;
+	return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+}
+
+// Clock of arrival times; a step of the wall clock does not move it
+uint64_t codel_clock(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
+
+// read() that also stores the arrival time of the data in *arrived when the kernel reports it
+ssize_t codel_recv(int fd, void *buf, size_t count, uint64_t *arrived)
+{
+	char control[CMSG_SPACE(sizeof(struct timespec))];
+	struct iovec iov = { .iov_base = buf, .iov_len = count };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+	struct cmsghdr *cmsg;
+	ssize_t n;
+	if ((n = TEMP_FAILURE_RETRY(recvmsg(fd, &msg, 0))) <= 0)
+		return n;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (SOL_SOCKET == cmsg->cmsg_level && SCM_TIMESTAMPNS == cmsg->cmsg_type) {
+			// The kernel stamps with the wall clock; only the age of the stamp is carried
+			// over to codel_clock, and a stamp from the future counts as just arrived
+			struct timespec ts;
+			uint64_t stamp, wall = clock_ns(CLOCK_REALTIME), now = codel_clock();
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			stamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+			*arrived = wall > stamp && wall - stamp < now ? now - (wall - stamp) : now;
+		}
+	}
+	return n;
+}
@@ -0,0 +1,34 @@
+// Admission control of libposixnet in the spirit of CoDel: a request is judged by how
+// long it waited (its sojourn time) before the server got to it. If during a whole
+// interval no request waited less than the target, the queue is standing rather than
+// absorbing a burst, and only requests younger than the target are admitted until it
+// drains; otherwise anything younger than the interval is admitted. Shed requests are
+// answered at once with a "busy" status instead of making every waiting client slower.
+//
+// The sojourn starts when the request arrived: the kernel receive timestamp of its
+// last byte where the socket has one (TCP with codel_stamp() on the listening socket),
+// otherwise the moment it was accepted.
+
+#ifndef CODEL_H
+#define CODEL_H
+
+#include "posixnet.h"
+
+struct codel {
+	uint64_t target; // ns
+	uint64_t interval; // ns
+	uint64_t interval_end; // CLOCK_MONOTONIC
+	uint64_t min_sojourn; // smallest sojourn seen in the current interval
+	int overloaded;
+	uint64_t admitted;
+	uint64_t shed;
+};
+
+void codel_init(struct codel *q, int target_ms, int interval_ms);
+int codel_admit(struct codel *q, uint64_t sojourn);
+
+int codel_stamp(int fd);
+uint64_t codel_clock(void);
+ssize_t codel_recv(int fd, void *buf, size_t count, uint64_t *arrived);
+
+#endif
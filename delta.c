@@ -0,0 +1,157 @@
+#include "delta.h"
+
+#include <string.h>
+
+#define MIN_BLOCK 1024
+
+typedef uint16_t v16u16 __attribute__((vector_size(32)));
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+
+size_t delta_block_size(int64_t size)
+{
+	size_t block = MIN_BLOCK;
+	while (block < DELTA_MAX_BLOCK && (int64_t)block * (int64_t)block < size)
+		block <<= 1;
+	return block;
+}
+
+// Runs for every signature and after every match. Both halves are kept modulo 2^16, so 16
+// lanes of 16 bits (GCC vector extensions, SSE2 multiplies and adds) each take every 16th
+// byte, summing it plain and weighted by its position.
+uint32_t delta_weak(const uint8_t *p, size_t len)
+{
+	v16u16 a = { 0 }, w = { 0 }, x, position = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	uint16_t sum = 0, weighted = 0;
+	v16u8 bytes;
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		memcpy(&bytes, p + i, sizeof(bytes));
+		x = __builtin_convertvector(bytes, v16u16);
+		a += x;
+		w += position * x;
+		position += 16;
+	}
+	for (int lane = 0; lane < 16; lane++) {
+		sum += a[lane];
+		weighted += w[lane];
+	}
+	for (; i < len; i++) {
+		sum += p[i];
+		weighted += (uint16_t)i * p[i];
+	}
+	// Weighted by the distance from the end: len - i for the byte at i
+	return sum | (uint32_t)(uint16_t)((uint16_t)len * sum - weighted) << 16;
+}
+
+uint32_t delta_roll(uint32_t weak, uint8_t out, uint8_t in, size_t len)
+{
+	uint32_t a = (weak - out + in) & 0xffff;
+	uint32_t b = ((weak >> 16) - (uint32_t)len * out + a) & 0xffff;
+	return a | b << 16;
+}
+
+uint64_t delta_strong(uint64_t h, const void *p, size_t len)
+{
+	const uint8_t *b = p;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ b[i]) * 1099511628211ULL;
+	return h;
+}
+
+static uint32_t fold(uint32_t weak)
+{
+	return (weak ^ weak >> 16) & 0xffff;
+}
+
+static uint32_t slot_of(uint32_t weak)
+{
+	return weak * 2654435761u; // Both halves of the checksum spread over the table
+}
+
+int delta_index_init(struct delta_index *x, const struct delta_sig *sigs, int32_t blocks, size_t block_size,
+		     size_t last_len)
+{
+	uint32_t size = 16;
+	x->block_size = block_size;
+	x->blocks = blocks;
+	x->last_len = last_len;
+	x->sigs = sigs;
+	while (size < 4 * (uint32_t)blocks)
+		size <<= 1;
+	if ((x->table = malloc(size * sizeof(struct delta_slot))) == NULL)
+		return -1;
+	for (uint32_t s = 0; s < size; s++)
+		x->table[s].block = -1;
+	x->mask = size - 1;
+	memset(x->filter, 0, sizeof(x->filter));
+	for (int32_t i = 0; i < blocks; i++) {
+		uint32_t s = slot_of(sigs[i].weak) & x->mask;
+		x->filter[fold(sigs[i].weak) / 64] |= 1ULL << fold(sigs[i].weak) % 64;
+		while (x->table[s].block >= 0)
+			s = (s + 1) & x->mask;
+		x->table[s].weak = sigs[i].weak;
+		x->table[s].block = i;
+	}
+	return 0;
+}
+
+void delta_index_free(struct delta_index *x)
+{
+	free(x->table);
+	x->table = NULL;
+}
+
+int32_t delta_match(const struct delta_index *x, uint32_t weak, const uint8_t *p, size_t len)
+{
+	uint64_t strong = 0;
+	int hashed = 0;
+	if (!(x->filter[fold(weak) / 64] & 1ULL << fold(weak) % 64))
+		return -1; // Most windows that match nothing end here
+	for (uint32_t s = slot_of(weak) & x->mask; x->table[s].block >= 0; s = (s + 1) & x->mask) {
+		int32_t i = x->table[s].block;
+		if (x->table[s].weak != weak || len != (i == x->blocks - 1 ? x->last_len : x->block_size))
+			continue;
+		if (!hashed) {
+			strong = delta_strong(DELTA_STRONG_INIT, p, len);
+			hashed = 1;
+		}
+		if (x->sigs[i].strong == strong)
+			return i;
+	}
+	return -1;
+}
+
+void delta_scan(const struct delta_index *x, const uint8_t *data, size_t len, delta_cb cb, void *arg)
+{
+	size_t block = x->block_size, pos = 0, literal = 0, tail = x->last_len;
+	uint32_t weak = 0;
+	int32_t i;
+
+	if (x->blocks > 0 && len >= block)
+		weak = delta_weak(data, block);
+	while (x->blocks > 0 && pos + block <= len) {
+		if ((i = delta_match(x, weak, data + pos, block)) >= 0) {
+			if (pos > literal)
+				cb(-1, data + literal, pos - literal, arg);
+			cb(i, NULL, block, arg);
+			literal = pos += block;
+			if (pos + block <= len)
+				weak = delta_weak(data + pos, block);
+			continue;
+		}
+		if (pos + block < len)
+			weak = delta_roll(weak, data[pos], data[pos + block], block);
+		pos++;
+	}
+	// A short last block of the old copy can only match the end of the new one
+	if (x->blocks > 0 && tail < block && len - literal >= tail && tail > 0 &&
+	    (i = delta_match(x, delta_weak(data + len - tail, tail), data + len - tail, tail)) >= 0) {
+		if (len - tail > literal)
+			cb(-1, data + literal, len - tail - literal, arg);
+		cb(i, NULL, tail, arg);
+		return;
+	}
+	if (len > literal)
+		cb(-1, data + literal, len - literal, arg);
+}
@@ -0,0 +1,54 @@
+// Block signatures and deltas of libposixnet in the manner of rsync. The receiver cuts its
+// old copy of a file into blocks and describes each by a weak checksum and a strong hash;
+// the sender slides a window over the new copy, rolling the weak checksum one byte at a
+// time, and where both match a block it refers to that block, sending everything in between
+// as literal data. Only a weak match costs a strong hash, and the receiver checks the
+// strong hash of the whole file it rebuilt.
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "posixnet.h"
+
+#define DELTA_STRONG_INIT 14695981039346656037ULL
+#define DELTA_MAX_BLOCK (128 << 10) // the largest block delta_block_size chooses
+
+struct delta_sig {
+	uint32_t weak; // the window's byte sum in the low half, the sum weighted by distance from its end in the high half
+	uint64_t strong; // FNV-1a
+};
+
+// Blocks of the old copy, looked up by their weak checksum
+struct delta_index {
+	size_t block_size;
+	int32_t blocks;
+	size_t last_len; // of the last block, which may be short
+	const struct delta_sig *sigs;
+	struct delta_slot {
+		uint32_t weak;
+		int32_t block; // -1 for an empty slot
+	} *table; // open addressing on the weak checksum, at most a quarter full
+	uint32_t mask;
+	uint64_t filter[1 << 10]; // a bit per 16-bit fold of the weak checksums present, stays in L1
+};
+
+// Called for each piece of the new copy in order: block >= 0 refers to that block of the old
+// copy, block -1 is len literal bytes at data
+typedef void (*delta_cb)(int32_t block, const uint8_t *data, size_t len, void *arg);
+
+// Grows with the square root of the size (in powers of two), so signatures and literals stay balanced
+size_t delta_block_size(int64_t size);
+uint32_t delta_weak(const uint8_t *p, size_t len);
+// The weak checksum of the window moved one byte: out left it, in entered it
+uint32_t delta_roll(uint32_t weak, uint8_t out, uint8_t in, size_t len);
+// Continues the hash h over another len bytes, DELTA_STRONG_INIT starts one
+uint64_t delta_strong(uint64_t h, const void *p, size_t len);
+
+int delta_index_init(struct delta_index *x, const struct delta_sig *sigs, int32_t blocks, size_t block_size,
+		     size_t last_len);
+void delta_index_free(struct delta_index *x);
+// The block whose content equals len bytes at p with the weak checksum weak, -1 if none
+int32_t delta_match(const struct delta_index *x, uint32_t weak, const uint8_t *p, size_t len);
+void delta_scan(const struct delta_index *x, const uint8_t *data, size_t len, delta_cb cb, void *arg);
+
+#endif
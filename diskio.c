@@ -0,0 +1,269 @@
+#include "diskio.h"
+#include "slab.h"
+#include "uring.h"
+#include "posixnet_err.h"
+
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+struct diskio_op {
+	diskio_cb done;
+	void *arg;
+	int buffer; // released on completion, -1 for none
+	// The request itself, so that a short write can be resubmitted for the rest
+	uint8_t opcode;
+	int slot;
+	int buf_index;
+	uint64_t addr;
+	uint32_t len;
+	uint64_t off;
+	uint32_t done_len; // written by earlier parts of this write
+};
+
+struct diskio {
+	struct reactor *reactor;
+	struct uring ring;
+	int fd; // eventfd, readable while completions wait for the reactor
+	char *memory; // the registered buffers, one after another
+	size_t buffer_size, memory_size;
+	int buffers;
+	int *free; // indices of the free buffers
+	int free_len;
+	int *files; // registered descriptors, -1 for a free slot
+	int files_len;
+	int in_flight;
+	int flushing; // a submit is deferred to the end of the round
+};
+
+static void submit(struct reactor *r, void *arg)
+{
+	struct diskio *d = arg;
+	d->flushing = 0;
+	while (d->ring.to_submit > 0)
+		if (uring_enter(&d->ring, 0, 0, NULL, 0) < 0 && EINTR != errno)
+			ERR("io_uring_enter");
+}
+
+// Puts op on the ring, to be submitted after the current reactor round
+static void prep(struct diskio *d, struct diskio_op *op)
+{
+	struct io_uring_sqe *sqe = uring_sqe(&d->ring);
+	sqe->opcode = op->opcode;
+	sqe->fd = op->slot;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->addr = op->addr;
+	sqe->len = op->len;
+	sqe->off = op->off;
+	sqe->buf_index = op->buf_index;
+	sqe->user_data = (uint64_t)(uintptr_t)op;
+	d->in_flight++;
+	if (!d->flushing) {
+		d->flushing = 1;
+		reactor_defer(d->reactor, submit, d);
+	}
+}
+
+static void queue(struct diskio *d, uint8_t opcode, int slot, int buf_index, uint64_t addr, uint32_t len,
+		  uint64_t off, diskio_cb done, void *arg, int buffer)
+{
+	struct diskio_op *op;
+	if ((op = slab_alloc(sizeof(struct diskio_op))) == NULL)
+		ERR("slab_alloc");
+	op->done = done;
+	op->arg = arg;
+	op->buffer = buffer;
+	op->opcode = opcode;
+	op->slot = slot;
+	op->buf_index = buf_index;
+	op->addr = addr;
+	op->len = len;
+	op->off = off;
+	op->done_len = 0;
+	prep(d, op);
+}
+
+// Takes the completions off the ring, calling back with each one already consumed
+static void complete(struct diskio *d, int call)
+{
+	unsigned head = *d->ring.cq_head;
+	while (head != __atomic_load_n(d->ring.cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &d->ring.cqes[head & *d->ring.cq_mask];
+		struct diskio_op *op = (struct diskio_op *)(uintptr_t)cqe->user_data;
+		int res = cqe->res;
+		__atomic_store_n(d->ring.cq_head, ++head, __ATOMIC_RELEASE);
+		d->in_flight--;
+		if (IORING_OP_WRITE_FIXED == op->opcode && res >= 0 && (uint32_t)res < op->len) {
+			// A short write (disk full, a signal): the rest goes out again, nothing written is an error
+			if (0 == res) {
+				res = -EIO;
+			} else {
+				op->addr += res;
+				op->len -= res;
+				op->off += res;
+				op->done_len += res;
+				prep(d, op);
+				continue;
+			}
+		} else if (IORING_OP_WRITE_FIXED == op->opcode && res >= 0)
+			res += op->done_len;
+		if (op->buffer >= 0)
+			diskio_release(d, op->buffer);
+		if (call)
+			op->done(d, res, op->arg);
+		slab_free(op, sizeof(struct diskio_op));
+	}
+}
+
+// Called by the reactor when operations have completed
+static void reap(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	uint64_t count;
+	if (TEMP_FAILURE_RETRY(read(fd, &count, sizeof(count))) < 0 && errno != EAGAIN)
+		ERR("read");
+	complete(arg, 1);
+}
+
+static int update_file(struct diskio *d, int slot, int fd)
+{
+	struct io_uring_files_update update = { .offset = slot, .fds = (uint64_t)(uintptr_t)&fd };
+	if (uring_register(&d->ring, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+		return -1;
+	d->files[slot] = fd;
+	return 0;
+}
+
+struct diskio *diskio_create(struct reactor *r, int buffers, size_t buffer_size, int files)
+{
+	struct io_uring_params p;
+	struct iovec *iov = NULL;
+	struct diskio *d;
+	unsigned entries = 8;
+	int i;
+
+	if (buffers < 1 || files < 1 || 0 == buffer_size)
+		return errno = EINVAL, NULL;
+	if ((d = calloc(1, sizeof(struct diskio))) == NULL)
+		return NULL;
+	d->reactor = r;
+	d->fd = -1;
+	d->ring.ring_fd = -1;
+	d->buffer_size = buffer_size;
+	d->buffers = buffers;
+	d->files_len = files;
+	// Every buffer can be in flight together with an fsync per file
+	while (entries < (unsigned)(buffers + files))
+		entries <<= 1;
+	memset(&p, 0, sizeof(p));
+	d->memory_size = buffers * buffer_size;
+	if ((d->free = malloc(buffers * sizeof(int))) == NULL || (d->files = malloc(files * sizeof(int))) == NULL ||
+	    (iov = malloc(buffers * sizeof(struct iovec))) == NULL)
+		goto fail;
+	if ((d->memory = mmap(NULL, d->memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) ==
+	    MAP_FAILED) {
+		d->memory = NULL;
+		goto fail;
+	}
+	for (i = 0; i < buffers; i++) {
+		iov[i].iov_base = d->memory + i * buffer_size;
+		iov[i].iov_len = buffer_size;
+		d->free[i] = buffers - 1 - i;
+	}
+	d->free_len = buffers;
+	for (i = 0; i < files; i++)
+		d->files[i] = -1; // A sparse table, descriptors come with diskio_open
+	if (uring_setup(&d->ring, entries, &p) < 0 ||
+	    uring_register(&d->ring, IORING_REGISTER_BUFFERS, iov, buffers) < 0 ||
+	    uring_register(&d->ring, IORING_REGISTER_FILES, d->files, files) < 0 ||
+	    (d->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+	    uring_register(&d->ring, IORING_REGISTER_EVENTFD, &d->fd, 1) < 0 ||
+	    reactor_add(r, d->fd, REACTOR_READ, reap, d) < 0)
+		goto fail;
+	free(iov);
+	return d;
+fail:
+	i = errno;
+	if (d->fd >= 0)
+		close(d->fd);
+	uring_teardown(&d->ring);
+	if (d->memory)
+		munmap(d->memory, d->memory_size);
+	free(iov);
+	free(d->files);
+	free(d->free);
+	free(d);
+	errno = i;
+	return NULL;
+}
+
+void diskio_destroy(struct diskio *d)
+{
+	submit(d->reactor, d);
+	d->flushing = 1; // The rest of a short write is submitted below, not after a reactor round
+	while (d->in_flight > 0) {
+		if (uring_enter(&d->ring, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && EINTR != errno)
+			ERR("io_uring_enter");
+		complete(d, 0);
+		submit(d->reactor, d);
+		d->flushing = 1;
+	}
+	reactor_remove(d->reactor, d->fd);
+	if (TEMP_FAILURE_RETRY(close(d->fd)) < 0)
+		ERR("close");
+	uring_teardown(&d->ring); // Closing the ring unregisters the buffers and files
+	munmap(d->memory, d->memory_size);
+	free(d->files);
+	free(d->free);
+	free(d);
+}
+
+char *diskio_buffer(struct diskio *d, int *index)
+{
+	if (0 == d->free_len)
+		return NULL;
+	*index = d->free[--d->free_len];
+	return d->memory + *index * d->buffer_size;
+}
+
+void diskio_release(struct diskio *d, int index)
+{
+	d->free[d->free_len++] = index;
+}
+
+int diskio_buffers_free(const struct diskio *d)
+{
+	return d->free_len;
+}
+
+int diskio_open(struct diskio *d, int fd)
+{
+	for (int slot = 0; slot < d->files_len; slot++)
+		if (d->files[slot] < 0)
+			return update_file(d, slot, fd) < 0 ? -1 : slot;
+	errno = EMFILE;
+	return -1;
+}
+
+void diskio_close(struct diskio *d, int slot)
+{
+	if (update_file(d, slot, -1) < 0)
+		ERR("io_uring_register");
+}
+
+void diskio_write(struct diskio *d, int slot, int index, const char *data, size_t len, off_t offset,
+		  diskio_cb done, void *arg)
+{
+	queue(d, IORING_OP_WRITE_FIXED, slot, index, (uint64_t)(uintptr_t)data, len, offset, done, arg, index);
+}
+
+void diskio_read(struct diskio *d, int slot, int index, char *data, size_t len, off_t offset, diskio_cb done,
+		 void *arg)
+{
+	queue(d, IORING_OP_READ_FIXED, slot, index, (uint64_t)(uintptr_t)data, len, offset, done, arg, -1);
+}
+
+void diskio_fsync(struct diskio *d, int slot, diskio_cb done, void *arg)
+{
+	queue(d, IORING_OP_FSYNC, slot, 0, 0, 0, 0, done, arg, -1);
+}
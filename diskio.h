@@ -0,0 +1,49 @@
+// Asynchronous file I/O of libposixnet through an io_uring of their own, next to
+// whichever backend the reactor runs on. Data moves between registered buffers and
+// registered files (IORING_OP_WRITE_FIXED, READ_FIXED), so the kernel neither pins the pages
+// nor looks the descriptor up on every operation. Operations queued during a reactor round
+// reach the kernel in one io_uring_enter after the round, and completions come back
+// through an eventfd the reactor watches.
+//
+// A caller receives straight into a buffer taken with diskio_buffer() and hands it to
+// diskio_write(), which gives it back once the write is done; while every buffer is in
+// flight diskio_buffer() returns NULL, which is the caller's cue to stop reading.
+
+#ifndef DISKIO_H
+#define DISKIO_H
+
+#include "posixnet.h"
+#include "reactor.h"
+
+struct diskio;
+
+// res is what the system call would return, -errno on failure
+typedef void (*diskio_cb)(struct diskio *d, int res, void *arg);
+
+struct diskio *diskio_create(struct reactor *r, int buffers, size_t buffer_size, int files);
+// Waits for the operations in flight without calling back
+void diskio_destroy(struct diskio *d);
+
+// A free registered buffer of buffer_size bytes, NULL when all are in flight
+char *diskio_buffer(struct diskio *d, int *index);
+void diskio_release(struct diskio *d, int index);
+int diskio_buffers_free(const struct diskio *d);
+
+// Registers fd in a free slot of the fixed file table and returns the slot; the caller still owns fd
+int diskio_open(struct diskio *d, int fd);
+// The slot must have no operation in flight
+void diskio_close(struct diskio *d, int slot);
+
+// Writes len bytes at data, which lies inside buffer index, to offset of the file in slot;
+// the buffer is released before done is called. A short write is resubmitted for the rest, so
+// done sees len or -errno (-EIO when the file took nothing, e.g. a full disk)
+void diskio_write(struct diskio *d, int slot, int index, const char *data, size_t len, off_t offset,
+		  diskio_cb done, void *arg);
+// Reads up to len bytes at offset of the file in slot into data, which lies inside buffer index;
+// the buffer stays the caller's, and a count short of len means the file ended
+void diskio_read(struct diskio *d, int slot, int index, char *data, size_t len, off_t offset, diskio_cb done,
+		 void *arg);
+// Submit it once the writes it should cover have completed, io_uring does not order them
+void diskio_fsync(struct diskio *d, int slot, diskio_cb done, void *arg);
+
+#endif
@@ -0,0 +1,36 @@
+#include "hist.h"
+
+static int hist_index(uint64_t v)
+{
+	if (v < HIST_SUB)
+		return v;
+	int e = 63 - __builtin_clzll(v);
+	return (e - 3) * HIST_SUB + ((v >> (e - 4)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_value(int idx)
+{
+	if (idx < HIST_SUB)
+		return idx;
+	int e = idx / HIST_SUB + 3;
+	return ((uint64_t)(HIST_SUB + idx % HIST_SUB)) << (e - 4);
+}
+
+void hist_add(struct histogram *h, uint64_t v)
+{
+	h->count[hist_index(v)]++;
+	h->total++;
+	if (v > h->max)
+		h->max = v;
+}
+
+uint64_t hist_percentile(struct histogram *h, double p)
+{
+	uint64_t rank = (uint64_t)(p * h->total), seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen > rank)
+			return hist_value(i);
+	}
+	return h->max;
+}
@@ -0,0 +1,23 @@
+// Latency histogram of libposixnet shared by the load generators: log-linear buckets,
+// HIST_SUB per power of two (about 6% resolution), so adding a sample is O(1) and a
+// percentile is read back without keeping the samples.
+
+#ifndef HIST_H
+#define HIST_H
+
+#include "posixnet.h"
+
+#define HIST_SUB 16
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct histogram {
+	uint64_t count[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+};
+
+void hist_add(struct histogram *h, uint64_t v);
+// Lower bound of the bucket holding the p-th fraction of the samples
+uint64_t hist_percentile(struct histogram *h, double p);
+
+#endif
@@ -0,0 +1,291 @@
+// Load generator for labs.c: simulates many labc-style clients from one process.
+// Every virtual client connects, sends MAX_NUMBERS random numbers from [1,1000] one
+// per interval, checks each reply against a reference model of the server's global
+// maximum, counts HITs and then reconnects as a fresh client until the run ends.
+
+#include "hist.h"
+#include "reactor.h"
+#include "wheel.h"
+#include "posixnet_err.h"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_NUMBERS 3
+#define MAX_VALUE 1000
+#define TICK_MS 1 // granularity of the send interval timers
+
+#define STATE_CONNECTING 0
+#define STATE_RUNNING 1
+
+struct vclient {
+	struct wheel_timer timer; // reconnect or send the next number
+	int fd;
+	int state;
+	int sent;
+	int replies;
+	int32_t numbers[MAX_NUMBERS];
+	int32_t floor[MAX_NUMBERS]; // lowest valid reply for every number (reference model)
+	uint64_t sent_at[MAX_NUMBERS];
+	char in[sizeof(int32_t)];
+	size_t in_len;
+};
+
+struct load_stats {
+	uint64_t connections;
+	uint64_t sent;
+	uint64_t replies;
+	uint64_t hits;
+	uint64_t violations;
+	uint64_t errors;
+	struct histogram latency;
+};
+
+struct sockaddr_in server;
+struct load_stats stats;
+struct reactor *reactor;
+struct timer_wheel wheel;
+int interval_ms = 750;
+int running = 1;
+
+// Reference model of the server: its maximum can only grow
+int32_t acked_max = 0; // max over numbers the server has already answered for
+int32_t sent_max = 0; // max over all numbers sent so far
+int32_t first_reply = 0; // bounds the maximum the server had before we started
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int32_t random_number(void)
+{
+	return 1 + rand() % MAX_VALUE;
+}
+
+void start_client(struct vclient *c);
+void handle_event(struct reactor *r, int fd, uint32_t events, void *arg);
+
+void stop_client(struct vclient *c, int restart)
+{
+	wheel_timer_stop(&wheel, &c->timer);
+	if (c->fd >= 0) {
+		if (reactor_remove(reactor, c->fd) < 0)
+			ERR("reactor_remove");
+		if (TEMP_FAILURE_RETRY(close(c->fd)) < 0)
+			ERR("close");
+		c->fd = -1;
+	}
+	if (restart && running)
+		start_client(c);
+}
+
+void start_client(struct vclient *c)
+{
+	memset(c->numbers, 0, sizeof(c->numbers));
+	c->sent = c->replies = 0;
+	c->in_len = 0;
+	c->state = STATE_CONNECTING;
+	if ((c->fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+		ERR("socket");
+	if (connect(c->fd, (struct sockaddr *)&server, sizeof(server)) < 0 && EINPROGRESS != errno) {
+		stats.errors++;
+		if (TEMP_FAILURE_RETRY(close(c->fd)) < 0)
+			ERR("close");
+		c->fd = -1;
+		wheel_timer_start(&wheel, &c->timer, interval_ms);
+		return;
+	}
+	if (reactor_add(reactor, c->fd, REACTOR_READ | REACTOR_WRITE, handle_event, c) < 0)
+		ERR("reactor_add");
+	stats.connections++;
+}
+
+void send_number(struct vclient *c)
+{
+	int32_t number = random_number(), data = htonl(number);
+	if (TEMP_FAILURE_RETRY(write(c->fd, &data, sizeof(data))) != sizeof(data)) {
+		stats.errors++;
+		stop_client(c, 1);
+		return;
+	}
+	c->numbers[c->sent] = number;
+	c->floor[c->sent] = number > acked_max ? number : acked_max;
+	c->sent_at[c->sent] = now_ns();
+	c->sent++;
+	stats.sent++;
+	if (number > sent_max)
+		sent_max = number;
+	if (c->sent < MAX_NUMBERS)
+		wheel_timer_start(&wheel, &c->timer, interval_ms);
+}
+
+void check_reply(struct vclient *c, int32_t reply)
+{
+	int i = c->replies++;
+	hist_add(&stats.latency, now_ns() - c->sent_at[i]);
+	stats.replies++;
+	if (0 == first_reply)
+		first_reply = reply;
+	// The reply is the server maximum after it took our number: at least our number and
+	// everything answered before we sent, at most the largest number it could have seen
+	if (reply < c->floor[i] || reply > (sent_max > first_reply ? sent_max : first_reply) || reply > MAX_VALUE)
+		stats.violations++;
+	if (reply > acked_max)
+		acked_max = reply;
+	if (reply == c->numbers[i])
+		stats.hits++;
+}
+
+void handle_readable(struct vclient *c)
+{
+	char buf[MAX_NUMBERS * sizeof(int32_t)];
+	ssize_t n;
+	size_t len;
+	memcpy(buf, c->in, c->in_len);
+	n = read(c->fd, buf + c->in_len, sizeof(buf) - c->in_len);
+	if (n < 0 && (EAGAIN == errno || EINTR == errno))
+		return;
+	if (n <= 0) {
+		// The server closes after MAX_NUMBERS replies, anything earlier is an error
+		if (c->replies < MAX_NUMBERS)
+			stats.errors++;
+		stop_client(c, 1);
+		return;
+	}
+	len = c->in_len + n;
+	for (size_t off = 0; off + sizeof(int32_t) <= len; off += sizeof(int32_t)) {
+		int32_t reply;
+		memcpy(&reply, buf + off, sizeof(reply));
+		if (c->replies < c->sent)
+			check_reply(c, ntohl(reply));
+		else
+			stats.violations++;
+	}
+	c->in_len = len % sizeof(int32_t);
+	memcpy(c->in, buf + len - c->in_len, c->in_len);
+	if (c->replies == MAX_NUMBERS)
+		stop_client(c, 1);
+}
+
+void handle_event(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	struct vclient *c = arg;
+	if (STATE_CONNECTING == c->state) {
+		int status;
+		socklen_t size = sizeof(status);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &status, &size) < 0)
+			ERR("getsockopt");
+		if (status != 0) {
+			stats.errors++;
+			stop_client(c, 0);
+			wheel_timer_start(&wheel, &c->timer, interval_ms);
+			return;
+		}
+		if (reactor_modify(r, c->fd, REACTOR_READ) < 0)
+			ERR("reactor_modify");
+		c->state = STATE_RUNNING;
+		send_number(c);
+		return;
+	}
+	if (events & REACTOR_READ)
+		handle_readable(c);
+}
+
+void client_timer(struct reactor *r, void *arg)
+{
+	struct vclient *c = arg;
+	if (c->fd < 0)
+		start_client(c);
+	else if (STATE_RUNNING == c->state && c->sent < MAX_NUMBERS)
+		send_number(c);
+}
+
+void end_of_run(struct reactor *r, void *arg)
+{
+	reactor_stop(r);
+}
+
+void print_report(int clients, double seconds)
+{
+	printf("clients=%d interval=%dms duration=%.1fs\n", clients, interval_ms, seconds);
+	printf("connections=%" PRIu64 " sent=%" PRIu64 " replies=%" PRIu64 " hits=%" PRIu64 " model_violations=%" PRIu64
+	       " errors=%" PRIu64 "\n",
+	       stats.connections, stats.sent, stats.replies, stats.hits, stats.violations, stats.errors);
+	printf("replies/s=%.0f latency[us] p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", stats.replies / seconds,
+	       hist_percentile(&stats.latency, 0.5) / 1000.0, hist_percentile(&stats.latency, 0.9) / 1000.0,
+	       hist_percentile(&stats.latency, 0.99) / 1000.0, hist_percentile(&stats.latency, 0.999) / 1000.0,
+	       stats.latency.max / 1000.0);
+}
+
+void doLoad(int clients, int duration)
+{
+	struct vclient *vc = calloc(clients, sizeof(struct vclient));
+	struct reactor_timer end;
+	uint64_t start = now_ns();
+	int i;
+	if (NULL == vc)
+		ERR("calloc");
+	if ((reactor = reactor_create(NULL)) == NULL)
+		ERR("reactor_create");
+	wheel_init(&wheel, reactor, TICK_MS);
+	// Spread the first connections over one interval so the load is smooth from the start
+	for (i = 0; i < clients; i++) {
+		vc[i].fd = -1;
+		wheel_timer_init(&vc[i].timer, client_timer, &vc[i]);
+		wheel_timer_start(&wheel, &vc[i].timer, rand() % interval_ms);
+	}
+	reactor_timer_init(&end, end_of_run, NULL);
+	reactor_timer_start(reactor, &end, duration * 1000);
+	if (reactor_run(reactor) < 0)
+		ERR("reactor_run");
+	running = 0;
+	for (i = 0; i < clients; i++)
+		stop_client(&vc[i], 0);
+	print_report(clients, (now_ns() - start) / 1e9);
+	free(vc);
+	wheel_destroy(&wheel);
+	reactor_destroy(reactor);
+}
+
+void usage(char *name)
+{
+	fprintf(stderr, "USAGE: %s domain port [-c clients] [-d seconds] [-i interval_ms]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int clients = 1000, duration = 10, c;
+	if (argc < 3)
+		usage(argv[0]);
+	optind = 3;
+	while ((c = getopt(argc, argv, "c:d:i:")) != -1) {
+		switch (c) {
+		case 'c':
+			clients = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (clients < 1 || duration < 1 || interval_ms < 1)
+		usage(argv[0]);
+	server = make_address(argv[1], argv[2]);
+	if (sethandler(SIG_IGN, SIGPIPE))
+		ERR("Seting SIGPIPE:");
+	raise_fd_limit();
+	srand(time(NULL));
+	doLoad(clients, duration);
+	return EXIT_SUCCESS;
+}
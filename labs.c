@@ -7,182 +7,845 @@
 //     (4p) Serwer nadal pracuje szeregowo, wyznacza aktualną maksymalną wartość otrzymaną i ją odsyła klientom. Klient rozpoznaje kiedy dostaje tą samą liczbę jak wysłał i wypisuje „HIT”.
 //     (6p) Serwer przyjmuje klientów równolegle, oblicza ile było liczb przesłanych do niego i w reakcji na SIGINT kończy się wypisując tę liczbę
 
-#define _GNU_SOURCE
-#include <errno.h>
-#include <netdb.h>
-#include <netinet/in.h>
+#include "posixnet.h"
+#include "posixnet_err.h"
+#include "reactor.h"
+#include "slab.h"
+#include "trace.h"
+#include "wheel.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include <stdatomic.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <unistd.h>
-
-#define ERR(source) (perror(source), fprintf(stderr, "%s:%d\n", __FILE__, __LINE__), exit(EXIT_FAILURE))
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
-#define BACKLOG 3
+#define BACKLOG 128
 #define MAX_NUMBERS 3
+#define MAX_WORKERS 64
+#define CACHE_LINE 64
+
+// Zapytania o statystyki: ujemne słowa, których nie traktujemy jako liczb
+#define OP_WINDOW_MAX -1   // -> [maksimum z ostatnich WINDOW_SECONDS sekund]
+#define OP_QUANTILE -2     // q w promilach -> [przybliżony kwantyl]
+#define OP_TOP_K -3        // -> [k, wartość, licznik, ...] najczęstszych liczb
+#define OP_CLIENT_STATS -4 // -> [liczby od adresu IP klienta, ich maksimum]
+
+#define WINDOW_SECONDS 60
+#define WINDOW_CAP 4096        // Limit kolejki monotonicznej (ciąg ściśle malejących liczb)
+#define KLL_K 128              // Pojemność jednego kompaktora szkicu kwantyli
+#define KLL_LEVELS 32
+#define TOPK_SIZE 16
+#define MAX_TRACKED_CLIENTS 1024  // Potęga dwójki
+#define READ_WORDS 4
+#define MAX_REPLY_WORDS (1 + 2 * TOPK_SIZE)
+#define OUT_WORDS (READ_WORDS * MAX_REPLY_WORDS + MAX_NUMBERS)
 
-volatile sig_atomic_t do_work = 1;
-int totalNumbers = 0; // Liczba wszystkiFch odebranych liczb
+#define CHECKPOINT_MAGIC "LABSSTAT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_INTERVAL 5  // Sekundy między zapisami stanu
 
-void sigint_handler(int sig)
+// Limity czasu połączeń (ms), odmierzane kołem czasowym wątku
+#define TICK_MS 100
+#define IDLE_TIMEOUT 30000     // Klient nic nie przysyła
+#define HEADER_TIMEOUT 5000    // Liczba przyszła tylko częściowo
+#define WRITE_TIMEOUT 5000     // Odpowiedź nie wychodzi, bo klient nie czyta
+
+// Liczniki wątku: zapisuje je tylko właściciel, każdy w osobnej linii cache
+struct worker_stats
 {
-    do_work = 0;
-    printf("Total numbers received: %d\n", totalNumbers);
-    exit(EXIT_SUCCESS);
-}
+    _Alignas(CACHE_LINE) _Atomic uint64_t numbers;
+    int32_t max; // Lokalne maksimum, nigdy większe od globalnego
+};
 
-int sethandler(void (*f)(int), int sigNo)
+// Kolejka monotoniczna: wartości malejące od początku, z czasem przyjęcia
+struct window_entry
 {
-    struct sigaction act;
-    memset(&act, 0, sizeof(struct sigaction));
-    act.sa_handler = f;
-    if (-1 == sigaction(sigNo, &act, NULL))
-        return -1;
-    return 0;
+    int32_t value;
+    int64_t time;
+};
+
+struct tracked_client
+{
+    uint32_t ip;             // 0 oznacza wolny wpis
+    uint32_t numbers;
+    int32_t max;
+};
+
+// Statystyki strumieniowe jednego wątku, pamięć stała niezależnie od liczby próbek.
+// Zapytania scalają silniki wszystkich wątków.
+struct stats_engine
+{
+    struct window_entry window[WINDOW_CAP];
+    size_t window_head;
+    size_t window_len;
+    // Szkic kwantyli w stylu KLL: poziom h trzyma próbki o wadze 2^h
+    int32_t kll[KLL_LEVELS][KLL_K];
+    int kll_len[KLL_LEVELS];
+    // Space-Saving dla najczęstszych liczb
+    int32_t topk_value[TOPK_SIZE];
+    uint64_t topk_count[TOPK_SIZE];
+    int topk_used;
+    struct tracked_client clients[MAX_TRACKED_CLIENTS];
+};
+
+// Kopia stanu w pliku; suma kontrolna obejmuje wszystko za polem checksum
+struct checkpoint_slot
+{
+    uint64_t generation;
+    uint64_t checksum;
+    uint64_t total;
+    int32_t max;
+    struct stats_engine engine; // Silniki wszystkich wątków scalone w jeden
+};
+
+// Plik mapowany do pamięci: dwa sloty zapisywane na zmianę, ważny jest ten z wyższą
+// generacją i poprawną sumą, więc przerwany zapis nigdy nie psuje ostatniego stanu
+struct checkpoint_file
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;
+    struct checkpoint_slot slots[2];
+};
+
+struct worker
+{
+    int fd;                 // Gniazdo nasłuchujące (SO_REUSEPORT, osobne dla każdego wątku)
+    struct reactor *reactor;
+    int stop_fd;            // eventfd budzący wątek przy zamykaniu serwera; -1: wątek sam odbiera SIGINT
+    int checkpoint_ms;      // Co ile wątek zapisuje stan, 0 - nie zapisuje
+    struct reactor_timer checkpoint_timer;
+    struct timer_wheel wheel;   // Limity czasu klientów tego wątku
+    pthread_t tid;
+    struct worker_stats *stats;
+    struct stats_engine *engine;
+    pthread_mutex_t *engine_lock;
+    unsigned int seed;      // Dla rand_r przy kompakcji szkicu
+};
+
+int verbose = 1;
+int worker_count = 1;
+struct worker_stats stats[MAX_WORKERS];
+struct stats_engine engines[MAX_WORKERS];
+pthread_mutex_t engine_locks[MAX_WORKERS];
+struct checkpoint_file *checkpoint = NULL;
+struct stats_engine checkpoint_engine; // Bufor scalania, używany tylko przez wątek zapisujący
+_Atomic int32_t maxNumber = 0; // Maksymalna liczba otrzymana dotychczas od wszystkich klientów
+
+// Suma liczników wszystkich wątków
+uint64_t total_numbers(void)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < worker_count; i++)
+        total += atomic_load_explicit(&stats[i].numbers, memory_order_relaxed);
+    return total;
 }
 
-int make_socket(int domain, int type)
+// Czas rzeczywisty, bo okno przeżywa restart serwera razem z zapisanym stanem
+int64_t now_seconds(void)
 {
-    int sock;
-    sock = socket(domain, type, 0);
-    if (sock < 0)
-        ERR("socket");
-    return sock;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
 }
 
-int add_new_client(int sfd)
+void window_expire(struct stats_engine *e, int64_t now)
 {
-    int nfd;
-    if ((nfd = TEMP_FAILURE_RETRY(accept(sfd, NULL, NULL))) < 0)
+    while (e->window_len > 0 && e->window[e->window_head].time <= now - WINDOW_SECONDS)
     {
-        if (EAGAIN == errno || EWOULDBLOCK == errno)
-            return -1;
-        ERR("accept");
+        e->window_head = (e->window_head + 1) % WINDOW_CAP;
+        e->window_len--;
     }
-    return nfd;
 }
 
-ssize_t bulk_read(int fd, void *buf, size_t count)
+// Zamortyzowane O(1): każda wartość raz wchodzi i raz wychodzi z kolejki.
+// Przy pełnej kolejce próbka wpada do ostatniego (najmniejszego) wpisu, który przejmuje jej czas:
+// maksimum okna może być wtedy chwilowo zawyżone, ale nigdy nie gubimy największej liczby
+void window_add(struct stats_engine *e, int32_t value, int64_t now)
 {
-    int c;
-    size_t len = 0;
-    do
+    window_expire(e, now);
+    while (e->window_len > 0 && e->window[(e->window_head + e->window_len - 1) % WINDOW_CAP].value <= value)
+        e->window_len--;
+    if (e->window_len == WINDOW_CAP)
     {
-        c = TEMP_FAILURE_RETRY(read(fd, buf, count));
-        if (c < 0)
-            return c;
-        if (c == 0)
-            return len;
-        buf += c;
-        len += c;
-        count -= c;
-    } while (count > 0);
-    return len;
+        e->window[(e->window_head + e->window_len - 1) % WINDOW_CAP].time = now;
+        return;
+    }
+    e->window[(e->window_head + e->window_len) % WINDOW_CAP] = (struct window_entry){value, now};
+    e->window_len++;
 }
 
-ssize_t bulk_write(int fd, const void *buf, size_t count)
+int compare_int32(const void *a, const void *b)
 {
-    int c;
-    size_t len = 0;
-    do
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Pełny poziom sortujemy i losowo zostawiamy co drugą próbkę, która przechodzi poziom wyżej z dwukrotną wagą
+void kll_compact(struct stats_engine *e, int level, unsigned int *seed)
+{
+    int offset = rand_r(seed) & 1;
+    if (level + 1 == KLL_LEVELS)
+    {
+        e->kll_len[level] = 0;
+        return;
+    }
+    qsort(e->kll[level], e->kll_len[level], sizeof(int32_t), compare_int32);
+    for (int i = offset; i < e->kll_len[level]; i += 2)
     {
-        c = TEMP_FAILURE_RETRY(write(fd, buf, count));
-        if (c < 0)
-            return c;
-        buf += c;
-        len += c;
-        count -= c;
-    } while (count > 0);
-    return len;
+        if (e->kll_len[level + 1] == KLL_K)
+            kll_compact(e, level + 1, seed);
+        e->kll[level + 1][e->kll_len[level + 1]++] = e->kll[level][i];
+    }
+    e->kll_len[level] = 0;
+}
+
+void kll_insert(struct stats_engine *e, int level, int32_t value, unsigned int *seed)
+{
+    if (e->kll_len[level] == KLL_K)
+        kll_compact(e, level, seed);
+    e->kll[level][e->kll_len[level]++] = value;
+}
+
+void kll_add(struct stats_engine *e, int32_t value, unsigned int *seed)
+{
+    kll_insert(e, 0, value, seed);
 }
 
-void handle_client(int cfd)
+// Space-Saving: przy braku miejsca liczba zastępuje najrzadszy licznik i przejmuje jego wartość
+void topk_add(struct stats_engine *e, int32_t value, uint64_t count)
 {
-    int32_t numbers[MAX_NUMBERS]; // Przechowuje odebrane liczby
-    int32_t maxNumber = 0;  // Maksymalna liczba otrzymana dotychczas
-    int attempts = 0;             // Licznik prób
-    while (attempts < MAX_NUMBERS)
+    int min = 0;
+    for (int i = 0; i < e->topk_used; i++)
     {
-        ssize_t bytesRead = bulk_read(cfd, numbers, sizeof(numbers));
-        if (bytesRead < 0)
+        if (e->topk_value[i] == value)
         {
-            ERR("read");
+            e->topk_count[i] += count;
+            return;
         }
-        else if (bytesRead == 0)
+        if (e->topk_count[i] < e->topk_count[min])
+            min = i;
+    }
+    if (e->topk_used < TOPK_SIZE)
+    {
+        min = e->topk_used++;
+        e->topk_count[min] = 0;
+    }
+    e->topk_value[min] = value;
+    e->topk_count[min] += count;
+}
+
+struct tracked_client *find_tracked(struct stats_engine *e, uint32_t ip, int create)
+{
+    uint32_t i = (ip * 2654435761u) & (MAX_TRACKED_CLIENTS - 1);
+    for (int probe = 0; probe < MAX_TRACKED_CLIENTS; probe++, i = (i + 1) & (MAX_TRACKED_CLIENTS - 1))
+    {
+        if (e->clients[i].ip == ip)
+            return &e->clients[i];
+        if (e->clients[i].ip == 0)
         {
-            break; // Zakończ połączenie, jeśli nie otrzymano żadnych danych
+            if (!create)
+                return NULL;
+            e->clients[i].ip = ip;
+            return &e->clients[i];
         }
-        else if (bytesRead == sizeof(numbers))
+    }
+    return NULL; // Tablica pełna, nowych adresów już nie śledzimy
+}
+
+int compare_window_time(const void *a, const void *b)
+{
+    int64_t x = ((const struct window_entry *)a)->time, y = ((const struct window_entry *)b)->time;
+    return (x > y) - (x < y);
+}
+
+// Dokłada stan src do dst tak, jakby dst widział obie sekwencje liczb
+void engine_merge(struct stats_engine *dst, struct stats_engine *src, unsigned int *seed)
+{
+    size_t count = 0;
+    struct window_entry *entries = malloc(sizeof(struct window_entry) * 2 * WINDOW_CAP);
+    if (entries == NULL)
+        ERR("malloc");
+    for (size_t i = 0; i < dst->window_len; i++)
+        entries[count++] = dst->window[(dst->window_head + i) % WINDOW_CAP];
+    for (size_t i = 0; i < src->window_len; i++)
+        entries[count++] = src->window[(src->window_head + i) % WINDOW_CAP];
+    qsort(entries, count, sizeof(struct window_entry), compare_window_time);
+    dst->window_head = dst->window_len = 0;
+    for (size_t i = 0; i < count; i++)
+        window_add(dst, entries[i].value, entries[i].time);
+    free(entries);
+
+    for (int h = 0; h < KLL_LEVELS; h++)
+        for (int j = 0; j < src->kll_len[h]; j++)
+            kll_insert(dst, h, src->kll[h][j], seed);
+    for (int i = 0; i < src->topk_used; i++)
+        topk_add(dst, src->topk_value[i], src->topk_count[i]);
+    for (int i = 0; i < MAX_TRACKED_CLIENTS; i++)
+    {
+        struct tracked_client *tc;
+        if (src->clients[i].ip == 0 || (tc = find_tracked(dst, src->clients[i].ip, 1)) == NULL)
+            continue;
+        if (tc->numbers == 0 || src->clients[i].max > tc->max)
+            tc->max = src->clients[i].max;
+        tc->numbers += src->clients[i].numbers;
+    }
+}
+
+uint64_t checkpoint_checksum(struct checkpoint_slot *slot)
+{
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    const unsigned char *p = (const unsigned char *)&slot->total;
+    const unsigned char *end = (const unsigned char *)(slot + 1);
+    for (hash ^= slot->generation; p < end; p++)
+        hash = (hash ^ *p) * 1099511628211ULL;
+    return hash;
+}
+
+int checkpoint_valid(struct checkpoint_slot *slot)
+{
+    return slot->generation != 0 && slot->checksum == checkpoint_checksum(slot);
+}
+
+// Mapuje plik stanu; jeśli zawiera poprawny slot, przywraca z niego liczniki i statystyki
+void checkpoint_open(char *path)
+{
+    int fd, restored = -1;
+    struct stat st;
+    if ((fd = TEMP_FAILURE_RETRY(open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644))) < 0)
+        ERR("open");
+    if (fstat(fd, &st) < 0)
+        ERR("fstat");
+    if (st.st_size != sizeof(struct checkpoint_file) && ftruncate(fd, sizeof(struct checkpoint_file)) < 0)
+        ERR("ftruncate");
+    checkpoint = mmap(NULL, sizeof(struct checkpoint_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (checkpoint == MAP_FAILED)
+        ERR("mmap");
+    if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+        ERR("close");
+    if (memcmp(checkpoint->magic, CHECKPOINT_MAGIC, sizeof(checkpoint->magic)) != 0 ||
+        checkpoint->version != CHECKPOINT_VERSION || checkpoint->slot_size != sizeof(struct checkpoint_slot))
+    {
+        // Nowy plik albo inny układ danych: zaczynamy od zera
+        if (st.st_size > 0)
+            fprintf(stderr, "Ignoring incompatible statistics file %s\n", path);
+        memset(checkpoint, 0, sizeof(struct checkpoint_file));
+        memcpy(checkpoint->magic, CHECKPOINT_MAGIC, sizeof(checkpoint->magic));
+        checkpoint->version = CHECKPOINT_VERSION;
+        checkpoint->slot_size = sizeof(struct checkpoint_slot);
+        return;
+    }
+    for (int i = 0; i < 2; i++)
+        if (checkpoint_valid(&checkpoint->slots[i]) &&
+            (restored < 0 || checkpoint->slots[i].generation > checkpoint->slots[restored].generation))
+            restored = i;
+    if (restored < 0)
+        return;
+    atomic_store(&maxNumber, checkpoint->slots[restored].max);
+    atomic_store(&stats[0].numbers, checkpoint->slots[restored].total);
+    memcpy(&engines[0], &checkpoint->slots[restored].engine, sizeof(struct stats_engine));
+    fprintf(stderr, "Restored %" PRIu64 " numbers from %s\n", checkpoint->slots[restored].total, path);
+}
+
+// Zapis do starszego slotu; do chwili zapisania sumy kontrolnej ważny pozostaje drugi slot.
+// Okresowy zapis zleca msync(MS_ASYNC) i nie blokuje pętli zdarzeń na dysku, MS_SYNC tylko przy zamknięciu
+void checkpoint_save(int flags)
+{
+    struct checkpoint_slot *slot;
+    unsigned int seed = 1;
+    uint64_t generation;
+    if (checkpoint == NULL)
+        return;
+    slot = &checkpoint->slots[0];
+    if (checkpoint->slots[1].generation < slot->generation)
+        slot = &checkpoint->slots[1];
+    generation = (checkpoint->slots[0].generation > checkpoint->slots[1].generation ? checkpoint->slots[0].generation
+                                                                                    : checkpoint->slots[1].generation) + 1;
+    memset(&checkpoint_engine, 0, sizeof(checkpoint_engine));
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_mutex_lock(&engine_locks[i]);
+        engine_merge(&checkpoint_engine, &engines[i], &seed);
+        pthread_mutex_unlock(&engine_locks[i]);
+    }
+    slot->generation = 0;
+    slot->total = total_numbers();
+    slot->max = atomic_load(&maxNumber);
+    memcpy(&slot->engine, &checkpoint_engine, sizeof(struct stats_engine));
+    slot->generation = generation;
+    slot->checksum = checkpoint_checksum(slot);
+    if (msync(checkpoint, sizeof(struct checkpoint_file), flags) < 0)
+        ERR("msync");
+}
+
+void engine_add(struct worker *w, int32_t value, uint32_t ip)
+{
+    struct stats_engine *e = w->engine;
+    struct tracked_client *tc;
+    pthread_mutex_lock(w->engine_lock);
+    window_add(e, value, now_seconds());
+    kll_add(e, value, &w->seed);
+    topk_add(e, value, 1);
+    if ((tc = find_tracked(e, ip, 1)) != NULL)
+    {
+        if (tc->numbers == 0 || value > tc->max)
+            tc->max = value;
+        tc->numbers++;
+    }
+    pthread_mutex_unlock(w->engine_lock);
+}
+
+int32_t query_window_max(void)
+{
+    int32_t max = 0;
+    int64_t now = now_seconds();
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_mutex_lock(&engine_locks[i]);
+        window_expire(&engines[i], now);
+        if (engines[i].window_len > 0 && engines[i].window[engines[i].window_head].value > max)
+            max = engines[i].window[engines[i].window_head].value;
+        pthread_mutex_unlock(&engine_locks[i]);
+    }
+    return max;
+}
+
+struct weighted
+{
+    int32_t value;
+    uint64_t weight;
+};
+
+int compare_weighted(const void *a, const void *b)
+{
+    return compare_int32(&((const struct weighted *)a)->value, &((const struct weighted *)b)->value);
+}
+
+// Kwantyl ze scalonych szkiców wszystkich wątków: próbka z poziomu h reprezentuje 2^h liczb
+int32_t query_quantile(int32_t permille)
+{
+    size_t count = 0;
+    uint64_t total = 0, rank, seen = 0;
+    int32_t result = 0;
+    struct weighted *items = malloc(sizeof(struct weighted) * worker_count * KLL_LEVELS * KLL_K);
+    if (items == NULL)
+        ERR("malloc");
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_mutex_lock(&engine_locks[i]);
+        for (int h = 0; h < KLL_LEVELS; h++)
         {
-            for (int i = 0; i < MAX_NUMBERS; i++)
+            for (int j = 0; j < engines[i].kll_len[h]; j++)
             {
-                int32_t receivedNumber = ntohl(numbers[i]);
-                totalNumbers++; // Zwiększ liczbę wszystkich odebranych liczb
-                printf("Received number: %d\n", receivedNumber);
-                if (receivedNumber == maxNumber)
-                {
-                    printf("HIT\n");
-                }
-                else if (receivedNumber > maxNumber)
-                {
-                    maxNumber = receivedNumber;
-                }
-                attempts++;
-                bulk_write(cfd, &maxNumber, sizeof(maxNumber));
+                items[count++] = (struct weighted){engines[i].kll[h][j], 1ULL << h};
+                total += 1ULL << h;
             }
         }
-        else
+        pthread_mutex_unlock(&engine_locks[i]);
+    }
+    qsort(items, count, sizeof(struct weighted), compare_weighted);
+    permille = permille < 0 ? 0 : (permille > 1000 ? 1000 : permille);
+    rank = total * permille / 1000;
+    for (size_t i = 0; i < count; i++)
+    {
+        result = items[i].value;
+        seen += items[i].weight;
+        if (seen > rank)
+            break;
+    }
+    free(items);
+    return result;
+}
+
+int compare_weighted_desc(const void *a, const void *b)
+{
+    uint64_t x = ((const struct weighted *)a)->weight, y = ((const struct weighted *)b)->weight;
+    return (x < y) - (x > y);
+}
+
+// Scala liczniki Space-Saving wszystkich wątków; zwraca liczbę słów odpowiedzi
+int query_top_k(int32_t *reply)
+{
+    struct weighted merged[MAX_WORKERS * TOPK_SIZE];
+    int count = 0, k;
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_mutex_lock(&engine_locks[i]);
+        for (int j = 0; j < engines[i].topk_used; j++)
+        {
+            int m;
+            for (m = 0; m < count && merged[m].value != engines[i].topk_value[j]; m++)
+                ;
+            if (m == count)
+                merged[count++] = (struct weighted){engines[i].topk_value[j], 0};
+            merged[m].weight += engines[i].topk_count[j];
+        }
+        pthread_mutex_unlock(&engine_locks[i]);
+    }
+    qsort(merged, count, sizeof(struct weighted), compare_weighted_desc);
+    k = count < TOPK_SIZE ? count : TOPK_SIZE;
+    reply[0] = htonl(k);
+    for (int i = 0; i < k; i++)
+    {
+        reply[1 + 2 * i] = htonl(merged[i].value);
+        reply[2 + 2 * i] = htonl(merged[i].weight > INT32_MAX ? INT32_MAX : (int32_t)merged[i].weight);
+    }
+    return 1 + 2 * k;
+}
+
+void query_client(uint32_t ip, int32_t *reply)
+{
+    uint64_t numbers = 0;
+    int32_t max = 0;
+    for (int i = 0; i < worker_count; i++)
+    {
+        struct tracked_client *tc;
+        pthread_mutex_lock(&engine_locks[i]);
+        if ((tc = find_tracked(&engines[i], ip, 0)) != NULL)
+        {
+            if (numbers == 0 || tc->max > max)
+                max = tc->max;
+            numbers += tc->numbers;
+        }
+        pthread_mutex_unlock(&engine_locks[i]);
+    }
+    reply[0] = htonl(numbers > INT32_MAX ? INT32_MAX : (int32_t)numbers);
+    reply[1] = htonl(max);
+}
+
+// Stan pojedynczego klienta w maszynie stanów serwera; rekord ze slaba wątku, bufor odpowiedzi
+// dołączany tylko na czas ich wysyłania, więc bezczynny klient zajmuje niecałe 100 bajtów
+struct client
+{
+    struct worker *worker;
+    int32_t *out;                    // OUT_WORDS słów ze slaba, tylko gdy czekają odpowiedzi
+    int fd;
+    uint32_t ip;
+    char in[sizeof(int32_t)];        // Częściowo odebrana liczba
+    uint8_t in_len;
+    int8_t numbers;                  // Liczby odebrane w tej sesji
+    int8_t pending_op;               // Zapytanie czekające na argument
+    uint8_t stalled;                 // Gniazdo pełne, odpowiedzi czekają
+    uint16_t out_len;                // W bajtach
+    uint16_t out_off;
+    struct wheel_timer timer;
+};
+
+// Limit czasu zależny od stanu klienta: bezczynność albo niedokończona liczba
+void arm_read_timeout(struct worker *w, struct client *c)
+{
+    wheel_timer_start(&w->wheel, &c->timer, c->in_len > 0 ? HEADER_TIMEOUT : IDLE_TIMEOUT);
+}
+
+void close_client(struct worker *w, struct client *c)
+{
+    wheel_timer_stop(&w->wheel, &c->timer);
+    if (reactor_remove(w->reactor, c->fd) < 0)
+        ERR("reactor_remove");
+    if (TEMP_FAILURE_RETRY(close(c->fd)) < 0)
+        ERR("close");
+    if (c->out != NULL)
+        slab_free(c->out, OUT_WORDS * sizeof(int32_t));
+    slab_free(c, sizeof(struct client));
+}
+
+// Podnosi globalne maksimum przez CAS, jeśli liczba jest większa; zwraca maksimum sprzed zmiany
+int32_t publish_max(int32_t number)
+{
+    int32_t current = atomic_load_explicit(&maxNumber, memory_order_relaxed);
+    while (number > current &&
+           !atomic_compare_exchange_weak_explicit(&maxNumber, &current, number, memory_order_relaxed, memory_order_relaxed))
+        ;
+    return current;
+}
+
+// Zwraca maksimum, które należy odesłać klientowi (uwzględnia już odebraną liczbę)
+int32_t handle_number(struct worker *w, struct client *c, int32_t receivedNumber)
+{
+    struct worker_stats *st = w->stats;
+    int32_t previous;
+    // Jedyny piszący, więc wystarczy load + store zamiast atomowego dodawania
+    atomic_store_explicit(&st->numbers, atomic_load_explicit(&st->numbers, memory_order_relaxed) + 1, memory_order_relaxed);
+    if (receivedNumber > st->max)
+    {
+        st->max = receivedNumber;
+        previous = publish_max(receivedNumber);
+    }
+    else
+    {
+        // Liczba nie większa od lokalnego maksimum nie może zmienić globalnego
+        previous = atomic_load_explicit(&maxNumber, memory_order_relaxed);
+    }
+    engine_add(w, receivedNumber, c->ip);
+    if (verbose)
+    {
+        printf("Received number: %d\n", receivedNumber);
+        if (receivedNumber == previous)
         {
-            printf("Invalid data received\n");
+            printf("HIT\n");
         }
     }
-    close(cfd);
+    return previous > receivedNumber ? previous : receivedNumber;
 }
 
-void doServer(int fd)
+// Wysyła zaległe odpowiedzi; zwraca -1 gdy klient zniknął
+int flush_client(struct worker *w, struct client *c)
 {
-    int cfd, fdmax;
-    fd_set base_rfds, rfds;
-    FD_ZERO(&base_rfds);
-    FD_SET(fd, &base_rfds);
-    fdmax = fd;
-    while (do_work)
+    size_t start = c->out_off;
+    while (c->out_off < c->out_len)
     {
-        rfds = base_rfds;
-        if (select(fdmax + 1, &rfds, NULL, NULL, NULL) < 0)
+        ssize_t n = write(c->fd, (char *)c->out + c->out_off, c->out_len - c->out_off);
+        if (n < 0)
         {
             if (EINTR == errno)
                 continue;
-            ERR("select");
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                // Gniazdo pełne, czekamy na gotowość do zapisu; limit liczymy od ostatniego postępu
+                if (reactor_modify(w->reactor, c->fd, REACTOR_READ | REACTOR_WRITE) < 0)
+                    ERR("reactor_modify");
+                if (!c->stalled || c->out_off > start)
+                    wheel_timer_start(&w->wheel, &c->timer, WRITE_TIMEOUT);
+                c->stalled = 1;
+                return 0;
+            }
+            if (EPIPE == errno || ECONNRESET == errno)
+                return -1;
+            ERR("write");
+        }
+        c->out_off += n;
+    }
+    if (c->out_off > 0)
+    {
+        trace_event(TRACE_WRITE, c->fd);
+        c->out_off = c->out_len = 0;
+        if (reactor_modify(w->reactor, c->fd, REACTOR_READ) < 0)
+            ERR("reactor_modify");
+        if (c->stalled)
+        {
+            c->stalled = 0;
+            arm_read_timeout(w, c);
         }
-        if (FD_ISSET(fd, &rfds))
+    }
+    if (c->out != NULL && c->out_len == 0)
+    {
+        slab_free(c->out, OUT_WORDS * sizeof(int32_t)); // Wszystko wysłane, bufor wraca do slaba
+        c->out = NULL;
+    }
+    return 0;
+}
+
+void reply_word(struct client *c, int32_t word)
+{
+    c->out[c->out_len / sizeof(int32_t)] = htonl(word);
+    c->out_len += sizeof(int32_t);
+}
+
+// Słowo od klienta to liczba albo zapytanie o statystyki (ujemny kod operacji)
+void handle_word(struct worker *w, struct client *c, int32_t word)
+{
+    int32_t *reply = c->out + c->out_len / sizeof(int32_t);
+    if (c->pending_op == OP_QUANTILE)
+    {
+        c->pending_op = 0;
+        reply_word(c, query_quantile(word));
+        return;
+    }
+    switch (word)
+    {
+    case OP_WINDOW_MAX:
+        reply_word(c, query_window_max());
+        break;
+    case OP_QUANTILE:
+        c->pending_op = OP_QUANTILE;
+        break;
+    case OP_TOP_K:
+        c->out_len += query_top_k(reply) * sizeof(int32_t);
+        break;
+    case OP_CLIENT_STATS:
+        query_client(c->ip, reply);
+        c->out_len += 2 * sizeof(int32_t);
+        break;
+    default:
+        reply_word(c, handle_number(w, c, word));
+        c->numbers++;
+    }
+}
+
+// Odczytuje wszystko, co przyszło od klienta, i od razu odpowiada na każde pełne słowo
+void handle_client(struct worker *w, struct client *c)
+{
+    int32_t words[READ_WORDS];
+    int received = 0;
+    while (c->numbers < MAX_NUMBERS && c->out_len + sizeof(words) / sizeof(int32_t) * MAX_REPLY_WORDS * sizeof(int32_t) <= OUT_WORDS * sizeof(int32_t))
+    {
+        memcpy(words, c->in, c->in_len);
+        ssize_t bytesRead = read(c->fd, (char *)words + c->in_len, sizeof(words) - c->in_len);
+        if (bytesRead < 0)
         {
-            cfd = add_new_client(fd);
-            if (cfd >= 0)
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                break;
+            if (ECONNRESET == errno)
             {
-                handle_client(cfd);
+                close_client(w, c);
+                return;
             }
+            ERR("read");
+        }
+        else if (bytesRead == 0)
+        {
+            close_client(w, c); // Zakończ połączenie, klient się rozłączył
+            return;
+        }
+        received = 1;
+        if (c->out == NULL && (c->out = slab_alloc(OUT_WORDS * sizeof(int32_t))) == NULL)
+            ERR("slab_alloc");
+        size_t len = c->in_len + bytesRead;
+        size_t whole = len / sizeof(int32_t);
+        for (size_t i = 0; i < whole && c->numbers < MAX_NUMBERS; i++)
+        {
+            trace_event(TRACE_FRAME, c->fd);
+            handle_word(w, c, ntohl(words[i]));
+            trace_event(TRACE_COMPUTE, c->fd);
         }
+        c->in_len = len - whole * sizeof(int32_t);
+        memcpy(c->in, (char *)words + whole * sizeof(int32_t), c->in_len);
+    }
+    if (received && !c->stalled)
+    {
+        arm_read_timeout(w, c);
+    }
+    if (flush_client(w, c) < 0 || (c->numbers == MAX_NUMBERS && c->out_len == 0))
+    {
+        close_client(w, c); // Klient kończy się po MAX_NUMBERS próbach
     }
 }
 
-int main()
+// Klient milczy, nie dokończył liczby albo nie odbiera odpowiedzi: zwalniamy połączenie
+void client_timeout(struct reactor *r, void *arg)
 {
-    int fd;
-    if (sethandler(sigint_handler, SIGINT) < 0)
+    struct client *c = arg;
+    close_client(c->worker, c);
+}
+
+void client_ready(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+    struct client *c = arg;
+    struct worker *w = c->worker;
+    if (events & REACTOR_WRITE)
+    {
+        if (flush_client(w, c) < 0 || (c->numbers == MAX_NUMBERS && c->out_len == 0))
+            close_client(w, c);
+        else
+            handle_client(w, c);
+    }
+    else
+    {
+        handle_client(w, c);
+    }
+}
+
+void add_client(struct worker *w, int cfd, uint32_t ip)
+{
+    struct client *c = slab_alloc(sizeof(struct client));
+    if (c == NULL)
+        ERR("slab_alloc");
+    memset(c, 0, sizeof(struct client));
+    c->worker = w;
+    c->fd = cfd;
+    c->ip = ip;
+    trace_event(TRACE_ACCEPT, cfd);
+    if (set_nonblock(cfd) < 0)
+        ERR("fcntl");
+    wheel_timer_init(&c->timer, client_timeout, c);
+    arm_read_timeout(w, c);
+    if (reactor_add(w->reactor, cfd, REACTOR_READ, client_ready, c) < 0)
+        ERR("reactor_add");
+}
+
+// Gniazdo nasłuchujące: przyjmujemy wszystkich oczekujących klientów
+void accept_clients(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+    struct worker *w = arg;
+    uint32_t ip;
+    int cfd;
+    while ((cfd = add_new_client(fd, &ip)) >= 0)
+        add_client(w, cfd, ip);
+}
+
+void stop_requested(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+    reactor_stop(r);
+}
+
+void sigint_handler(struct reactor *r, void *arg)
+{
+    reactor_stop(r);
+}
+
+void checkpoint_tick(struct reactor *r, void *arg)
+{
+    struct worker *w = arg;
+    checkpoint_save(MS_ASYNC);
+    reactor_timer_start(r, &w->checkpoint_timer, w->checkpoint_ms);
+}
+
+// Pętla zdarzeń wątku; backend wybiera zmienna POSIXNET_REACTOR (domyślnie epoll)
+void doServer(struct worker *w)
+{
+    if ((w->reactor = reactor_create(NULL)) == NULL)
+        ERR("reactor_create");
+    wheel_init(&w->wheel, w->reactor, TICK_MS);
+    if (reactor_add(w->reactor, w->fd, REACTOR_READ, accept_clients, w) < 0)
+        ERR("reactor_add");
+    if (w->stop_fd >= 0 && reactor_add(w->reactor, w->stop_fd, REACTOR_READ, stop_requested, w) < 0)
+        ERR("reactor_add");
+    if (w->stop_fd < 0 && reactor_signal(w->reactor, SIGINT, sigint_handler, w) < 0)
+        ERR("reactor_signal");
+    if (w->stop_fd < 0 && reactor_signal(w->reactor, SIGUSR1, trace_signal_dump, NULL) < 0)
+        ERR("reactor_signal");
+    if (w->checkpoint_ms > 0)
     {
-        ERR("Setting SIGINT handler failed");
+        reactor_timer_init(&w->checkpoint_timer, checkpoint_tick, w);
+        reactor_timer_start(w->reactor, &w->checkpoint_timer, w->checkpoint_ms);
     }
-    fd = make_socket(PF_INET, SOCK_STREAM);
+    if (reactor_run(w->reactor) < 0)
+        ERR("reactor_run");
+    wheel_destroy(&w->wheel);
+    reactor_destroy(w->reactor);
+}
+
+void *worker_thread(void *arg)
+{
+    doServer(arg);
+    return NULL;
+}
+
+int make_listen_socket(uint16_t port, int reuseport)
+{
+    int fd = make_socket(PF_INET, SOCK_STREAM), t = 1;
     struct sockaddr_in addr = {
         .sin_family = AF_INET,
-        .sin_port = htons(12345),
+        .sin_port = htons(port),
         .sin_addr.s_addr = INADDR_ANY,
     };
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)))
+    {
+        ERR("setsockopt");
+    }
+    // Każdy wątek ma własne gniazdo, jądro rozdziela między nie nowe połączenia
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &t, sizeof(t)))
+    {
+        ERR("setsockopt");
+    }
     if (bind(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0)
     {
         ERR("bind");
@@ -191,8 +854,131 @@ int main()
     {
         ERR("listen");
     }
-    doServer(fd);
-    close(fd);
-    return 0;
+    if (set_nonblock(fd) < 0)
+    {
+        ERR("fcntl");
+    }
+    return fd;
+}
+
+// Tryb wielowątkowy: SIGINT (zablokowany we wszystkich wątkach) odbiera główny wątek,
+// który w międzyczasie co CHECKPOINT_INTERVAL sekund zapisuje stan
+void doThreadedServer(struct worker *workers, sigset_t *mask)
+{
+    struct timespec interval = {CHECKPOINT_INTERVAL, 0};
+    uint64_t one = 1;
+    for (int i = 0; i < worker_count; i++)
+    {
+        workers[i].fd = make_listen_socket(12345, 1);
+        workers[i].checkpoint_ms = 0;
+        if ((workers[i].stop_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+            ERR("eventfd");
+        workers[i].stats = &stats[i];
+        workers[i].engine = &engines[i];
+        workers[i].engine_lock = &engine_locks[i];
+        workers[i].seed = i + 1;
+        if (pthread_create(&workers[i].tid, NULL, worker_thread, &workers[i]))
+            ERR("pthread_create");
+    }
+    int signo;
+    while ((signo = sigtimedwait(mask, NULL, &interval)) != SIGINT)
+    {
+        if (SIGUSR1 == signo)
+            trace_signal_dump(NULL, NULL);
+        else if (signo < 0 && EAGAIN == errno)
+            checkpoint_save(MS_ASYNC);
+        else if (signo < 0 && EINTR != errno)
+            ERR("sigtimedwait");
+    }
+    for (int i = 0; i < worker_count; i++)
+    {
+        if (write(workers[i].stop_fd, &one, sizeof(one)) != sizeof(one))
+            ERR("write");
+    }
+    for (int i = 0; i < worker_count; i++)
+    {
+        if (pthread_join(workers[i].tid, NULL))
+            ERR("pthread_join");
+        close(workers[i].stop_fd);
+        close(workers[i].fd);
+    }
 }
 
+void usage(char *name)
+{
+    fprintf(stderr, "USAGE: %s [-t threads] [-q] [-s statistics_file]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct worker workers[MAX_WORKERS];
+    char *stats_path = NULL;
+    sigset_t mask;
+    int c;
+    while ((c = getopt(argc, argv, "t:qs:")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            stats_path = optarg;
+            break;
+        case 't':
+            worker_count = atoi(optarg);
+            break;
+        case 'q':
+            verbose = 0;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (worker_count < 1 || worker_count > MAX_WORKERS)
+    {
+        usage(argv[0]);
+    }
+    if (sethandler(SIG_IGN, SIGPIPE) < 0)
+    {
+        ERR("Setting SIGPIPE handler failed");
+    }
+    raise_fd_limit();
+    if (trace_init() < 0)
+    {
+        ERR("trace_init");
+    }
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_mutex_init(&engine_locks[i], NULL);
+    }
+    if (stats_path != NULL && *stats_path)
+    {
+        checkpoint_open(stats_path);
+    }
+    // SIGINT i SIGUSR1 (zrzut śladu) nie mają procedur obsługi: odbieramy je synchronicznie (reaktor lub sigtimedwait)
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL))
+    {
+        ERR("pthread_sigmask");
+    }
+    if (worker_count > 1)
+    {
+        doThreadedServer(workers, &mask);
+    }
+    else
+    {
+        workers[0].fd = make_listen_socket(12345, 0);
+        workers[0].stop_fd = -1;
+        workers[0].checkpoint_ms = CHECKPOINT_INTERVAL * 1000;
+        workers[0].stats = &stats[0];
+        workers[0].engine = &engines[0];
+        workers[0].engine_lock = &engine_locks[0];
+        workers[0].seed = 1;
+        doServer(&workers[0]);
+        close(workers[0].fd);
+    }
+    checkpoint_save(MS_SYNC);
+    printf("Total numbers received: %" PRIu64 "\n", total_numbers());
+    return 0;
+}
@@ -0,0 +1,434 @@
+#include "posixnet.h"
+#include "posixnet_err.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/un.h>
+
+int sethandler(void (*f)(int), int sigNo)
+{
+	struct sigaction act;
+	memset(&act, 0, sizeof(struct sigaction));
+	act.sa_handler = f;
+	if (-1 == sigaction(sigNo, &act, NULL))
+		return -1;
+	return 0;
+}
+
+int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Thousands of clients need thousands of descriptors
+void raise_fd_limit(void)
+{
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+// Reads spin on the device queue for up to usec before sleeping, preferred over
+// interrupts; raising it above net.core.busy_read needs CAP_NET_ADMIN
+int set_busy_poll(int fd, int usec)
+{
+	int on = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+		return -1;
+	return setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+}
+
+// Binds the calling thread to one CPU; memory it touches first then comes from that CPU's node
+int pin_thread(int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int make_socket(int domain, int type)
+{
+	int sock;
+	sock = socket(domain, type, 0);
+	if (sock < 0)
+		ERR("socket");
+	return sock;
+}
+
+struct sockaddr_in make_address(char *address, char *port)
+{
+	int ret;
+	struct sockaddr_in addr;
+	struct addrinfo *result;
+	struct addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	if ((ret = getaddrinfo(address, port, &hints, &result))) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+		exit(EXIT_FAILURE);
+	}
+	addr = *(struct sockaddr_in *)(result->ai_addr);
+	freeaddrinfo(result);
+	return addr;
+}
+
+// A connect interrupted by a signal keeps going in the background, wait for its outcome
+static void finish_connect(int socketfd)
+{
+	fd_set wfds;
+	int status;
+	socklen_t size = sizeof(int);
+	if (errno != EINTR)
+		ERR("connect");
+	FD_ZERO(&wfds);
+	FD_SET(socketfd, &wfds);
+	if (TEMP_FAILURE_RETRY(select(socketfd + 1, NULL, &wfds, NULL, NULL)) < 0)
+		ERR("select");
+	if (getsockopt(socketfd, SOL_SOCKET, SO_ERROR, &status, &size) < 0)
+		ERR("getsockopt");
+	if (0 != status)
+		ERR("connect");
+}
+
+int connect_socket(char *name, char *port)
+{
+	struct sockaddr_in addr;
+	int socketfd;
+	socketfd = make_socket(PF_INET, SOCK_STREAM);
+	addr = make_address(name, port);
+	if (connect(socketfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0)
+		finish_connect(socketfd);
+	return socketfd;
+}
+
+static void make_local_address(char *name, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	strncpy(addr->sun_path, name, sizeof(addr->sun_path) - 1);
+}
+
+int connect_local_socket(char *name)
+{
+	struct sockaddr_un addr;
+	int socketfd;
+	socketfd = make_socket(PF_UNIX, SOCK_STREAM);
+	make_local_address(name, &addr);
+	if (connect(socketfd, (struct sockaddr *)&addr, SUN_LEN(&addr)) < 0)
+		finish_connect(socketfd);
+	return socketfd;
+}
+
+int bind_local_socket(char *name, int backlog)
+{
+	struct sockaddr_un addr;
+	int socketfd;
+	if (unlink(name) < 0 && errno != ENOENT)
+		ERR("unlink");
+	socketfd = make_socket(PF_UNIX, SOCK_STREAM);
+	make_local_address(name, &addr);
+	if (bind(socketfd, (struct sockaddr *)&addr, SUN_LEN(&addr)) < 0)
+		ERR("bind");
+	if (listen(socketfd, backlog) < 0)
+		ERR("listen");
+	return socketfd;
+}
+
+int bind_inet_socket(uint16_t port, int type, int backlog)
+{
+	struct sockaddr_in addr;
+	int socketfd, t = 1;
+	socketfd = make_socket(PF_INET, type);
+	memset(&addr, 0, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)))
+		ERR("setsockopt");
+	if (bind(socketfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		ERR("bind");
+	if (SOCK_STREAM == type)
+		if (listen(socketfd, backlog) < 0)
+			ERR("listen");
+	return socketfd;
+}
+
+// A datagram socket receiving what is sent to the group; several processes of one host
+// may join the same group and port
+int bind_multicast_socket(struct sockaddr_in group)
+{
+	struct ip_mreq mreq;
+	int socketfd, t = 1;
+	socketfd = make_socket(PF_INET, SOCK_DGRAM);
+	if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)))
+		ERR("setsockopt");
+	if (bind(socketfd, (struct sockaddr *)&group, sizeof(group)) < 0)
+		ERR("bind");
+	mreq.imr_multiaddr = group.sin_addr;
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY); // The interface of the route to the group
+	if (setsockopt(socketfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)))
+		ERR("IP_ADD_MEMBERSHIP");
+	return socketfd;
+}
+
+// A descriptor held in reserve for when the process runs out of them, see refuse_client
+static int spare_fd = -1;
+static pthread_once_t spare_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t spare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void open_spare(void)
+{
+	spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+// Out of descriptors: the spare one is freed for a moment to accept the oldest pending
+// connection and close it at once, so that the listener does not stay readable forever
+// and the overload is shed instead of killing the server. -1 when nothing was refused:
+// no spare, or the queue was empty (accept checks the descriptor table first).
+static int refuse_client(int sfd)
+{
+	int nfd, ret = -1;
+	pthread_mutex_lock(&spare_lock);
+	if (spare_fd >= 0) {
+		close(spare_fd);
+		if ((nfd = TEMP_FAILURE_RETRY(accept(sfd, NULL, NULL))) >= 0) {
+			close(nfd);
+			ret = 0;
+		}
+		open_spare();
+	}
+	pthread_mutex_unlock(&spare_lock);
+	return ret;
+}
+
+// Returns -1 when a non-blocking listen socket has nothing to accept; ip may be NULL
+int add_new_client(int sfd, uint32_t *ip)
+{
+	int nfd;
+	struct sockaddr_in addr;
+	socklen_t size = sizeof(addr);
+	pthread_once(&spare_once, open_spare);
+	while ((nfd = TEMP_FAILURE_RETRY(accept(sfd, ip ? (struct sockaddr *)&addr : NULL, ip ? &size : NULL))) < 0) {
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+			return -1;
+		if (ECONNABORTED == errno)
+			continue; // The client gave up while waiting in the queue
+		if (EMFILE != errno && ENFILE != errno)
+			ERR("accept");
+		perror("accept");
+		if (refuse_client(sfd) < 0)
+			return -1;
+	}
+	if (ip)
+		*ip = addr.sin_addr.s_addr;
+	return nfd;
+}
+
+// Descriptors over a UNIX socket (SCM_RIGHTS), with the one byte of data such a message needs
+int send_fds(int sock, const int *fds, int n)
+{
+	char byte = 0, control[CMSG_SPACE(NET_MAX_FDS * sizeof(int))];
+	struct iovec iov = { &byte, 1 };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control };
+	struct cmsghdr *cmsg;
+	if (n < 1 || n > NET_MAX_FDS)
+		return errno = EINVAL, -1;
+	memset(control, 0, sizeof(control));
+	msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+	return TEMP_FAILURE_RETRY(sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 ? -1 : 0;
+}
+
+// Up to n descriptors sent with send_fds, received close-on-exec; how many came, -1 on error or EOF
+int recv_fds(int sock, int *fds, int n)
+{
+	char byte, control[CMSG_SPACE(NET_MAX_FDS * sizeof(int))];
+	struct iovec iov = { &byte, 1 };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+	struct cmsghdr *cmsg;
+	ssize_t size;
+	int count = 0;
+	if ((size = TEMP_FAILURE_RETRY(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC))) <= 0)
+		return 0 == size ? (errno = ECONNRESET, -1) : -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+			int got = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (int i = 0; i < got; i++) {
+				int fd;
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				if (count < n)
+					fds[count++] = fd;
+				else if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+					ERR("close");
+			}
+		}
+	return count;
+}
+
+ssize_t bulk_read(int fd, void *buf, size_t count)
+{
+	ssize_t c;
+	size_t len = 0;
+	do {
+		c = TEMP_FAILURE_RETRY(read(fd, buf, count));
+		if (c < 0)
+			return c;
+		if (0 == c)
+			return len;
+		buf = (char *)buf + c;
+		len += c;
+		count -= c;
+	} while (count > 0);
+	return len;
+}
+
+ssize_t bulk_write(int fd, const void *buf, size_t count)
+{
+	ssize_t c;
+	size_t len = 0;
+	do {
+		c = TEMP_FAILURE_RETRY(write(fd, buf, count));
+		if (c < 0)
+			return c;
+		buf = (const char *)buf + c;
+		len += c;
+		count -= c;
+	} while (count > 0);
+	return len;
+}
+
+void reader_init(struct net_reader *r, int fd, char *buf, size_t size)
+{
+	r->fd = fd;
+	r->buf = buf;
+	r->size = size;
+	r->head = 0;
+	r->len = 0;
+}
+
+// One readv into all free space of the ring (two pieces when it wraps).
+// Returns the number of bytes read, 0 on EOF or a full ring, -1 on error (EAGAIN included).
+ssize_t reader_fill(struct net_reader *r)
+{
+	struct iovec iov[2];
+	size_t tail = (r->head + r->len) % r->size;
+	int cnt = 1;
+	ssize_t c;
+	if (r->len == r->size)
+		return 0;
+	if (0 == r->len)
+		tail = r->head = 0;
+	iov[0].iov_base = r->buf + tail;
+	if (tail >= r->head) {
+		iov[0].iov_len = r->size - tail;
+		if (r->head > 0) {
+			iov[1].iov_base = r->buf;
+			iov[1].iov_len = r->head;
+			cnt = 2;
+		}
+	} else
+		iov[0].iov_len = r->head - tail;
+	if ((c = TEMP_FAILURE_RETRY(readv(r->fd, iov, cnt))) > 0)
+		r->len += c;
+	return c;
+}
+
+// Copies out what is already buffered, never touches the descriptor
+size_t reader_take(struct net_reader *r, void *buf, size_t count)
+{
+	size_t first, taken = count < r->len ? count : r->len;
+	first = r->size - r->head < taken ? r->size - r->head : taken;
+	memcpy(buf, r->buf + r->head, first);
+	memcpy((char *)buf + first, r->buf, taken - first);
+	r->head = (r->head + taken) % r->size;
+	r->len -= taken;
+	return taken;
+}
+
+// Same contract as bulk_read: blocks until count bytes arrive or the stream ends
+ssize_t reader_read(struct net_reader *r, void *buf, size_t count)
+{
+	size_t len = 0;
+	ssize_t c;
+	for (;;) {
+		len += reader_take(r, (char *)buf + len, count - len);
+		if (len == count)
+			return len;
+		if ((c = reader_fill(r)) < 0)
+			return c;
+		if (0 == c)
+			return len;
+	}
+}
+
+void writer_init(struct net_writer *w, int fd)
+{
+	w->fd = fd;
+	w->iovcnt = 0;
+	w->pending = 0;
+}
+
+// Queues a piece, merging it with the previous one when they are adjacent in memory
+int writer_add(struct net_writer *w, const void *buf, size_t count)
+{
+	struct iovec *last = w->iovcnt ? &w->iov[w->iovcnt - 1] : NULL;
+	if (0 == count)
+		return 0;
+	if (last && (const char *)last->iov_base + last->iov_len == buf) {
+		last->iov_len += count;
+		w->pending += count;
+		return 0;
+	}
+	if (NET_WRITER_IOV == w->iovcnt && writer_flush(w) < 0)
+		return -1;
+	w->iov[w->iovcnt].iov_base = (void *)buf;
+	w->iov[w->iovcnt].iov_len = count;
+	w->iovcnt++;
+	w->pending += count;
+	return 0;
+}
+
+// Writes everything queued with as few writev calls as the descriptor allows. On a
+// non-blocking descriptor -1/EAGAIN leaves the unsent rest queued for the next call.
+ssize_t writer_flush(struct net_writer *w)
+{
+	size_t written = 0;
+	ssize_t c;
+	int first = 0;
+	while (w->pending > 0) {
+		if ((c = TEMP_FAILURE_RETRY(writev(w->fd, w->iov + first, w->iovcnt - first))) < 0) {
+			memmove(w->iov, w->iov + first, sizeof(struct iovec) * (w->iovcnt - first));
+			w->iovcnt -= first;
+			return -1;
+		}
+		written += c;
+		w->pending -= c;
+		while (c > 0) {
+			if ((size_t)c >= w->iov[first].iov_len) {
+				c -= w->iov[first].iov_len;
+				first++;
+			} else {
+				w->iov[first].iov_base = (char *)w->iov[first].iov_base + c;
+				w->iov[first].iov_len -= c;
+				c = 0;
+			}
+		}
+	}
+	w->iovcnt = 0;
+	return written;
+}
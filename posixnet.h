@@ -0,0 +1,71 @@
+// libposixnet: socket helpers shared by all programs in this repository and
+// buffered stream I/O - a ring reader that fills itself with one read per
+// wakeup and a writer that gathers pieces and sends them with one writev.
+
+#ifndef POSIXNET_H
+#define POSIXNET_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define NET_READER_SIZE 4096
+#define NET_WRITER_IOV 64
+#define NET_MAX_FDS 16 // descriptors in one send_fds message
+
+// Ring buffer over a stream descriptor; storage is supplied by the caller
+struct net_reader {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t head; // offset of the first unread byte
+	size_t len; // unread bytes
+};
+
+// Pending pieces of output; the memory behind each piece must stay valid until flushed
+struct net_writer {
+	int fd;
+	int iovcnt;
+	size_t pending;
+	struct iovec iov[NET_WRITER_IOV];
+};
+
+int sethandler(void (*f)(int), int sigNo);
+int set_nonblock(int fd);
+void raise_fd_limit(void);
+int set_busy_poll(int fd, int usec);
+int pin_thread(int cpu);
+
+int make_socket(int domain, int type);
+struct sockaddr_in make_address(char *address, char *port);
+int connect_socket(char *name, char *port);
+int connect_local_socket(char *name);
+int bind_local_socket(char *name, int backlog);
+int bind_inet_socket(uint16_t port, int type, int backlog);
+int bind_multicast_socket(struct sockaddr_in group);
+int add_new_client(int sfd, uint32_t *ip);
+int send_fds(int sock, const int *fds, int n);
+int recv_fds(int sock, int *fds, int n);
+
+ssize_t bulk_read(int fd, void *buf, size_t count);
+ssize_t bulk_write(int fd, const void *buf, size_t count);
+
+void reader_init(struct net_reader *r, int fd, char *buf, size_t size);
+ssize_t reader_fill(struct net_reader *r);
+size_t reader_take(struct net_reader *r, void *buf, size_t count);
+ssize_t reader_read(struct net_reader *r, void *buf, size_t count);
+
+void writer_init(struct net_writer *w, int fd);
+int writer_add(struct net_writer *w, const void *buf, size_t count);
+ssize_t writer_flush(struct net_writer *w);
+
+#endif
@@ -0,0 +1,12 @@
+// How the programs, benchmarks and library sources of this repository report fatal
+// errors. Kept out of posixnet.h so that including the library does not define ERR.
+
+#ifndef POSIXNET_ERR_H
+#define POSIXNET_ERR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ERR(source) (perror(source), fprintf(stderr, "%s:%d\n", __FILE__, __LINE__), exit(EXIT_FAILURE))
+
+#endif
@@ -0,0 +1,259 @@
+// Open-loop load generator for the calculator servers (prog23b_s over TCP). Requests
+// are started at a fixed rate whether or not earlier ones were answered, as real
+// clients would, each on its own connection like prog23_tcp. Latency is measured from
+// the moment a request was due, so time spent waiting for connect counts too; answers
+// and "busy" replies of the admission control are reported separately.
+// With -p it is closed-loop instead: one v2 request at a time over one connection,
+// timing the bare round trip, e.g. to compare prog23b_s with and without busy polling.
+
+#include "posixnet.h"
+#include "posixnet_err.h"
+#include "hist.h"
+#include "calc.h"
+
+#include <signal.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#define MAX_EVENTS 1024
+#define TICK_MS 1
+
+#define STATE_CONNECTING 0
+#define STATE_READING 1
+
+struct request {
+	int fd;
+	int state;
+	uint64_t due; // when the request should have started
+	uint64_t sent; // when the request was written, the connection established
+	int32_t data[5];
+	size_t done; // bytes of the answer read
+};
+
+struct load_stats {
+	uint64_t started;
+	uint64_t answered;
+	uint64_t busy;
+	uint64_t errors;
+	uint64_t skipped; // not started, too many requests outstanding
+	struct histogram connect_latency; // due until established, includes the accept queue
+	struct histogram answer_latency;
+	struct histogram busy_latency;
+};
+
+struct sockaddr_in server;
+struct load_stats stats;
+int epfd;
+int outstanding = 0;
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void finish_request(struct request *rq)
+{
+	if (TEMP_FAILURE_RETRY(close(rq->fd)) < 0)
+		ERR("close");
+	free(rq);
+	outstanding--;
+}
+
+void start_request(uint64_t due)
+{
+	struct request *rq;
+	struct epoll_event ev = { .events = EPOLLOUT };
+	if ((rq = calloc(1, sizeof(struct request))) == NULL)
+		ERR("calloc");
+	rq->due = due;
+	rq->data[0] = htonl(rand() % 1000);
+	rq->data[1] = htonl(rand() % 1000);
+	rq->data[3] = htonl('+');
+	rq->data[4] = htonl(CALC_V1);
+	if ((rq->fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+		if (EMFILE != errno && ENFILE != errno)
+			ERR("socket");
+		stats.skipped++; // Out of descriptors, the same as too many outstanding
+		free(rq);
+		return;
+	}
+	if (connect(rq->fd, (struct sockaddr *)&server, sizeof(server)) < 0 && EINPROGRESS != errno) {
+		stats.errors++;
+		if (TEMP_FAILURE_RETRY(close(rq->fd)) < 0)
+			ERR("close");
+		free(rq);
+		return;
+	}
+	ev.data.ptr = rq;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, rq->fd, &ev) < 0)
+		ERR("epoll_ctl");
+	stats.started++;
+	outstanding++;
+}
+
+void handle_event(struct request *rq, uint32_t events)
+{
+	ssize_t n;
+	if (STATE_CONNECTING == rq->state) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = rq };
+		// The request is 20 bytes, a fresh socket buffer always takes it whole
+		if (TEMP_FAILURE_RETRY(write(rq->fd, rq->data, sizeof(rq->data))) != sizeof(rq->data) ||
+		    epoll_ctl(epfd, EPOLL_CTL_MOD, rq->fd, &ev) < 0) {
+			stats.errors++;
+			finish_request(rq);
+			return;
+		}
+		rq->sent = now_ns();
+		hist_add(&stats.connect_latency, rq->sent - rq->due);
+		rq->state = STATE_READING;
+		return;
+	}
+	n = read(rq->fd, (char *)rq->data + rq->done, sizeof(rq->data) - rq->done);
+	if (n < 0 && (EAGAIN == errno || EINTR == errno))
+		return;
+	if (n <= 0) {
+		stats.errors++;
+		finish_request(rq);
+		return;
+	}
+	if ((rq->done += n) < sizeof(rq->data))
+		return;
+	if (CALC_BUSY == ntohl(rq->data[4])) {
+		stats.busy++;
+		hist_add(&stats.busy_latency, now_ns() - rq->due);
+	} else {
+		stats.answered++;
+		hist_add(&stats.answer_latency, now_ns() - rq->due);
+	}
+	finish_request(rq);
+}
+
+void print_latency(const char *name, struct histogram *h)
+{
+	printf("%s latency[us] p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", name,
+	       hist_percentile(h, 0.5) / 1000.0, hist_percentile(h, 0.9) / 1000.0, hist_percentile(h, 0.99) / 1000.0,
+	       hist_percentile(h, 0.999) / 1000.0, h->max / 1000.0);
+}
+
+void print_report(int rate, double seconds)
+{
+	printf("rate=%d/s duration=%.1fs\n", rate, seconds);
+	printf("started=%lu answered=%lu busy=%lu errors=%lu skipped=%lu\n", stats.started, stats.answered, stats.busy,
+	       stats.errors, stats.skipped);
+	printf("answers/s=%.0f busy/s=%.0f\n", stats.answered / seconds, stats.busy / seconds);
+	print_latency("connect", &stats.connect_latency);
+	print_latency("answer", &stats.answer_latency);
+	print_latency("busy", &stats.busy_latency);
+}
+
+void doLoad(int rate, int duration, int limit)
+{
+	struct epoll_event events[MAX_EVENTS];
+	uint64_t start = now_ns(), end = start + (uint64_t)duration * 1000000000ULL, due = start;
+	uint64_t period = 1000000000ULL / rate, now;
+	int i, n;
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		ERR("epoll_create1");
+	while ((now = now_ns()) < end) {
+		// Catch up with the schedule; a late generator starts the overdue requests at once
+		for (; due <= now; due += period) {
+			if (outstanding < limit)
+				start_request(due);
+			else
+				stats.skipped++;
+		}
+		if ((n = epoll_wait(epfd, events, MAX_EVENTS, TICK_MS)) < 0) {
+			if (EINTR == errno)
+				continue;
+			ERR("epoll_wait");
+		}
+		for (i = 0; i < n; i++)
+			handle_event(events[i].data.ptr, events[i].events);
+	}
+	print_report(rate, (now_ns() - start) / 1e9);
+	if (TEMP_FAILURE_RETRY(close(epfd)) < 0)
+		ERR("close");
+}
+
+// One request in flight: write it, wait for its answer, time the round trip, repeat
+void doPing(int duration)
+{
+	struct calc_frame f;
+	uint64_t start = now_ns(), end = start + (uint64_t)duration * 1000000000ULL, sent, id = 0;
+	int fd = make_socket(PF_INET, SOCK_STREAM), one = 1;
+	if (connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0)
+		ERR("connect");
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+		ERR("setsockopt");
+	while ((sent = now_ns()) < end) {
+		memset(&f, 0, sizeof(f));
+		f.data[0] = htonl(rand() % 1000);
+		f.data[1] = htonl(rand() % 1000);
+		f.data[3] = htonl('+');
+		f.data[4] = htonl(CALC_V2);
+		calc_set_id(&f, ++id);
+		if (bulk_write(fd, &f, CALC_FRAME_V2) < 0 || bulk_read(fd, &f, CALC_FRAME_V2) < (ssize_t)CALC_FRAME_V2)
+			ERR("ping"); // The server closed the connection or it failed
+		stats.started++;
+		if (CALC_BUSY == ntohl(f.data[4])) {
+			stats.busy++;
+			hist_add(&stats.busy_latency, now_ns() - sent);
+		} else {
+			stats.answered++;
+			hist_add(&stats.answer_latency, now_ns() - sent);
+		}
+	}
+	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+		ERR("close");
+	printf("round trips=%lu busy=%lu in %ds, %.0f/s\n", stats.answered, stats.busy, duration,
+	       (stats.answered + stats.busy) / ((now_ns() - start) / 1e9));
+	print_latency("round trip", &stats.answer_latency);
+}
+
+void usage(char *name)
+{
+	fprintf(stderr, "USAGE: %s domain port [-r requests_per_s] [-d seconds] [-m max_outstanding] [-p]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int rate = 10000, duration = 10, limit = 10000, ping = 0, c;
+	if (argc < 3)
+		usage(argv[0]);
+	optind = 3;
+	while ((c = getopt(argc, argv, "r:d:m:p")) != -1) {
+		switch (c) {
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'm':
+			limit = atoi(optarg);
+			break;
+		case 'p':
+			ping = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (rate < 1 || duration < 1 || limit < 1)
+		usage(argv[0]);
+	server = make_address(argv[1], argv[2]);
+	if (sethandler(SIG_IGN, SIGPIPE))
+		ERR("Seting SIGPIPE:");
+	raise_fd_limit();
+	srand(time(NULL));
+	if (ping)
+		doPing(duration);
+	else
+		doLoad(rate, duration, limit);
+	return EXIT_SUCCESS;
+}
@@ -1,167 +1,134 @@
-#define _GNU_SOURCE
-#include <errno.h>
-#include <netdb.h>
-#include <netinet/in.h>
+#include "posixnet.h"
+#include "posixnet_err.h"
+#include "calc_big.h"
+#include "calc_client.h"
+#include "calc_vm.h"
+#include "reactor.h"
+
 #include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <unistd.h>
-
-#define ERR(source) (perror(source), fprintf(stderr, "%s:%d\n", __FILE__, __LINE__), exit(EXIT_FAILURE))
 
-int sethandler(void (*f)(int), int sigNo)
-{
-	struct sigaction act;
-	memset(&act, 0, sizeof(struct sigaction));
-	act.sa_handler = f;
-	if (-1 == sigaction(sigNo, &act, NULL))
-		return -1;
-	return 0;
-}
+#define CONNECTIONS 2 // Connections shared by all requests of one run
 
-int make_socket(void)
+void print_answer(struct calc_client *cc, uint64_t id, int status, int32_t result, void *arg)
 {
-	int sock;
-	sock = socket(PF_INET, SOCK_STREAM, 0);
-	if (sock < 0)
-		ERR("socket");
-	return sock;
+	char **request = arg; // operand1 operand2 operation as given on the command line
+
+	if (CALC_OK == status)
+		printf("%d %c %d = %d\n", atoi(request[0]), request[2][0], atoi(request[1]), result); // Print the calculation result
+	else if (CALC_BUSY == status)
+		printf("%s %s %s: server busy, try again later\n", request[0], request[2], request[1]);
+	else if (CALC_FAILED == status)
+		printf("%s %s %s: operation impossible\n", request[0], request[2], request[1]);
+	else
+		printf("%s %s %s: connection lost\n", request[0], request[2], request[1]);
 }
 
-struct sockaddr_in make_address(char *address, char *port)
+void print_big(struct calc_client *cc, uint64_t id, int status, const uint32_t *limbs, int n, void *arg)
 {
-	int ret; // Return value of getaddrinfo
-	struct sockaddr_in addr; // Structure variable for socket address
-	struct addrinfo *result; // Pointer to the result of getaddrinfo
-	struct addrinfo hints = {}; // Structure variable for hints to influence getaddrinfo
-
-	hints.ai_family = AF_INET; // Set the address family to IPv4
-
-	// Call getaddrinfo to resolve the address and port
-	if ((ret = getaddrinfo(address, port, &hints, &result))) {
-		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret)); // Print error message if getaddrinfo fails
-		exit(EXIT_FAILURE); // Terminate the program if getaddrinfo fails
+	char **request = arg; // Decimal operand1 operand2 operation
+	char *text;
+
+	if (CALC_OK == status) {
+		text = calc_big_format(limbs, n);
+		printf("%s %c %s = %s\n", request[0], request[2][0], request[1], text);
+		free(text);
+	} else if (CALC_BUSY == status) {
+		printf("%s %s %s: server busy, try again later\n", request[0], request[2], request[1]);
+	} else if (CALC_FAILED == status) {
+		printf("%s %s %s: operation impossible\n", request[0], request[2], request[1]);
+	} else {
+		printf("%s %s %s: connection lost\n", request[0], request[2], request[1]);
 	}
-
-	// Copy the socket address from the result into the addr structure
-	addr = *(struct sockaddr_in *)(result->ai_addr);
-
-	freeaddrinfo(result); // Free the memory allocated by getaddrinfo
-
-	return addr; // Return the socket address
 }
 
-int connect_socket(char *name, char *port)
-{
-	struct sockaddr_in addr; // Structure variable for socket address
-	int socketfd; // Socket file descriptor
-
-	socketfd = make_socket(); // Create a socket using make_socket()
-
-	addr = make_address(name, port); // Create a socket address using make_address()
-
-	// Connect to the remote address
-	if (connect(socketfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
-		if (errno != EINTR)
-			ERR("connect"); // Error occurred during connection
-		else {
-			fd_set wfds; // File descriptor set for write events
-			int status; // Socket status
-			socklen_t size = sizeof(int); // Size of socket status
-			FD_ZERO(&wfds); // Clear the write file descriptor set
-			FD_SET(socketfd, &wfds); // Add socketfd to the write file descriptor set
-
-			// Wait for the socket to become writable using select
-			if (TEMP_FAILURE_RETRY(select(socketfd + 1, NULL, &wfds, NULL, NULL)) < 0)
-				ERR("select");
-
-			// Check the socket status using getsockopt
-			if (getsockopt(socketfd, SOL_SOCKET, SO_ERROR, &status, &size) < 0)
-				ERR("getsockopt");
-
-			if (0 != status)
-				ERR("connect"); // Error occurred during connection
-		}
-	}
-
-	return socketfd; // Return the socket file descriptor
-}
+// An expression with the values of its variables, sent as one program evaluation
+struct expression {
+	char *text;
+	int variables; // Operands per row
+	int rows;
+	int32_t operands[CALC_MAX_ROWS];
+};
 
-ssize_t bulk_read(int fd, char *buf, size_t count)
+void print_rows(struct calc_client *cc, uint64_t id, int status, int rows, const int32_t *results,
+		const uint32_t *failed, void *arg)
 {
-	int c; // Bytes read in each iteration
-	size_t len = 0; // Total bytes read
-
-	do {
-		c = TEMP_FAILURE_RETRY(read(fd, buf, count)); // Read data from the file descriptor
-
-		if (c < 0)
-			return c; // Error occurred during reading
+	struct expression *e = arg;
 
-		if (0 == c)
-			return len; // Reached end of file, return total bytes read
-
-		buf += c; // Move the buffer pointer
-		len += c; // Update the total bytes read
-		count -= c; // Update the remaining count of bytes to read
-
-	} while (count > 0);
-
-	return len; // Return total bytes read
+	if (CALC_BUSY == status || CALC_UNKNOWN == status || rows != e->rows) {
+		printf("%s: %s\n", e->text, CALC_BUSY == status ? "server busy, try again later" : "evaluation failed");
+		return;
+	}
+	for (int i = 0; i < rows; i++) {
+		for (int v = 0; v < e->variables; v++)
+			printf("%c=%d ", 'a' + v, e->operands[i * e->variables + v]);
+		if (calc_row_failed(failed, i))
+			printf("%s: division by zero\n", e->text);
+		else
+			printf("%s = %d\n", e->text, results[i]);
+	}
 }
 
-ssize_t bulk_write(int fd, char *buf, size_t count)
+// The program is compiled (or found in the server's cache); now evaluate it over all rows
+void compiled(struct calc_client *cc, uint64_t id, int status, int32_t handle, void *arg)
 {
-	int c; // Bytes written in each iteration
-	size_t len = 0; // Total bytes written
+	struct expression *e = arg;
 
-	do {
-		c = TEMP_FAILURE_RETRY(write(fd, buf, count)); // Write data to the file descriptor
-
-		if (c < 0)
-			return c; // Error occurred during writing
-
-		buf += c; // Move the buffer pointer
-		len += c; // Update the total bytes written
-		count -= c; // Update the remaining count of bytes to write
-
-	} while (count > 0);
-
-	return len; // Return total bytes written
-}
-
-void prepare_request(char **argv, int32_t data[5])
-{
-	data[0] = htonl(atoi(argv[3])); // Convert and store operand1 in network byte order
-	data[1] = htonl(atoi(argv[4])); // Convert and store operand2 in network byte order
-	data[2] = htonl(0); // Store a placeholder value (unused)
-	data[3] = htonl((int32_t)(argv[5][0])); // Convert and store the first character of operation in network byte order
-	data[4] = htonl(1); // Store a flag indicating request type (1 for calculation request)
+	if (CALC_OK != status) {
+		printf("%s: %s\n", e->text, CALC_BUSY == status ? "server busy, try again later" : "does not compile");
+		return;
+	}
+	if (calc_eval(cc, handle, e->variables, e->rows, e->operands, print_rows, e) == 0)
+		ERR("calc_eval");
 }
 
-void print_answer(int32_t data[5])
+void usage(char *name)
 {
-	if (ntohl(data[4])) // Check if the result flag is non-zero
-		printf("%d %c %d = %d\n", ntohl(data[0]), (char)ntohl(data[3]), ntohl(data[1]), ntohl(data[2])); // Print the calculation result
-	else
-		printf("Operation impossible\n"); // Print message indicating that the operation is impossible
+	fprintf(stderr, "USAGE: %s domain port operand1 operand2 operation [operand1 operand2 operation ...]\n"
+			"       %s domain port -e expression [operand ...]\n"
+			"       %s domain port -b operand1 operand2 operation\n",
+		name, name, name); // Print the usage information
 }
 
-void usage(char *name)
+// Called before every wait of the reactor; the run is over once every answer has come
+void check_done(struct reactor *r, void *arg)
 {
-	fprintf(stderr, "USAGE: %s domain port operand1 operand2 operation\n", name); // Print the usage information
+	if (0 == calc_pending(arg))
+		reactor_stop(r);
 }
 
 int main(int argc, char **argv)
 {
-	int fd; // File descriptor for the connected socket
-	int32_t data[5]; // Array to hold request/response data
-
-	if (argc != 6) {
+	struct reactor *r; // Event loop the client library runs on
+	struct calc_client *cc; // Connections to the server, requests matched to answers by ID
+	struct calc_program program;
+	struct expression e = { 0 };
+	static uint32_t a[CALC_MAX_LIMBS], b[CALC_MAX_LIMBS]; // Big-number operands
+	int na, nb, big = 0;
+
+	if (argc >= 5 && 0 == strcmp(argv[3], "-e")) {
+		// The variables a, b, ... of the expression take the operands row by row
+		e.text = argv[4];
+		if (calc_compile_expression(&program, e.text, strlen(e.text)) < 0) {
+			fprintf(stderr, "Cannot parse expression: %s\n", e.text);
+			return EXIT_FAILURE;
+		}
+		e.variables = program.variables;
+		e.rows = e.variables > 0 ? (argc - 5) / e.variables : 1;
+		if ((e.variables > 0 && (argc - 5) % e.variables != 0) || 0 == e.rows || e.rows * e.variables > (int)CALC_MAX_ROWS) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		for (int i = 0; i < e.rows * e.variables; i++)
+			e.operands[i] = atoi(argv[5 + i]);
+	} else if (7 == argc && 0 == strcmp(argv[3], "-b")) {
+		// Decimal numbers of any length, up to CALC_MAX_LIMBS 32-bit limbs
+		if (calc_big_parse(argv[4], a, CALC_MAX_LIMBS, &na) < 0 || calc_big_parse(argv[5], b, CALC_MAX_LIMBS, &nb) < 0) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		big = 1;
+	} else if (argc < 6 || (argc - 3) % 3 != 0) {
 		usage(argv[0]); // Display usage information
 		return EXIT_FAILURE; // Return failure if incorrect arguments provided
 	}
@@ -169,20 +136,25 @@ int main(int argc, char **argv)
 	if (sethandler(SIG_IGN, SIGPIPE))
 		ERR("Seting SIGPIPE:"); // Set SIGPIPE signal handler to ignore
 
-	fd = connect_socket(argv[1], argv[2]); // Connect to the specified domain and port
-
-	prepare_request(argv, data); // Prepare the request data
-
-	if (bulk_write(fd, (char *)data, sizeof(int32_t[5])) < 0)
-		ERR("write:"); // Write the request data to the socket
-
-	if (bulk_read(fd, (char *)data, sizeof(int32_t[5])) < (int)sizeof(int32_t[5]))
-		ERR("read:"); // Read the response data from the socket
-
-	print_answer(data); // Print the answer based on the response data
-
-	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
-		ERR("close"); // Close the socket
-
+	if ((r = reactor_create(NULL)) == NULL)
+		ERR("reactor_create");
+	if ((cc = calc_client_create(r, argv[1], argv[2], CONNECTIONS)) == NULL)
+		ERR("calc_client_create"); // Connect to the specified domain and port
+
+	// Send every request at once; answers are printed in the order they complete
+	if (e.text != NULL && calc_compile(cc, e.text, compiled, &e) == 0)
+		ERR("calc_compile");
+	if (big && calc_big(cc, a, na, argv[6][0], b, nb, print_big, &argv[4]) == 0)
+		ERR("calc_big");
+	for (int i = 3; NULL == e.text && !big && i < argc; i += 3)
+		if (calc_submit(cc, atoi(argv[i]), argv[i + 2][0], atoi(argv[i + 1]), print_answer, &argv[i]) == 0)
+			ERR("calc_submit");
+
+	reactor_prepare(r, check_done, cc);
+	if (reactor_run(r) < 0)
+		ERR("reactor_run");
+
+	calc_client_destroy(cc); // Close the connections
+	reactor_destroy(r);
 	return EXIT_SUCCESS; // Return success
-}
\ No newline at end of file
+}
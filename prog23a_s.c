@@ -1,113 +1,38 @@
-//Create the make file to this file
-
-#define _GNU_SOURCE
-#include <errno.h>
-#include <fcntl.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/un.h>
-#include <unistd.h>
-
-#define ERR(source) (perror(source), fprintf(stderr, "%s:%d\n", __FILE__, __LINE__), exit(EXIT_FAILURE));
-
-#define BACKLOG 3
-
-
-volatile sig_atomic_t do_work = 1;
-
-void sigint_handler(int sig)
-{
-	do_work = 0;
-}
-
-int sethandler(void (*f)(int), int sigNo)
-{
-	struct sigaction act;
-	memset(&act, 0, sizeof(struct sigaction));
-	act.sa_handler = f;
-	if (-1 == sigaction(sigNo, &act, NULL))
-		return -1;
-	return 0;
-}
-
-int make_socket(char *name, struct sockaddr_un *addr)
-{
-	int socketfd;
-	if ((socketfd = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-		ERR("socket");
-	memset(addr, 0, sizeof(struct sockaddr_un));
-	addr->sun_family = AF_UNIX;
-	strncpy(addr->sun_path, name, sizeof(addr->sun_path) - 1);
-	return socketfd;
-}
+#include "posixnet.h"
+#include "posixnet_err.h"
+#include "calc.h"
+#include "codel.h"
+#include "reactor.h"
+#include "trace.h"
+#include "wheel.h"
+
+#define BACKLOG 128 // -b
+#define TARGET_MS 5 // CoDel target sojourn, -t
+#define INTERVAL_MS 100 // CoDel interval, -i
+#define TICK_MS 100
+#define REQUEST_TIMEOUT 5000 // ms for the whole request, counted from accept
+#define WRITE_TIMEOUT 5000 // ms without progress while writing the answer
+
+struct client {
+	int fd;
+	int writing;
+	size_t done; // bytes of data read, then written
+	int32_t data[5];
+	uint64_t arrived; // codel_clock() at accept, unix sockets carry no receive timestamps
+	struct wheel_timer timer;
+};
 
-int bind_socket(char *name)
-{
-	struct sockaddr_un addr;
-	int socketfd;
-	if (unlink(name) < 0 && errno != ENOENT)
-		ERR("unlink");
-	socketfd = make_socket(name, &addr);
-	if (bind(socketfd, (struct sockaddr *)&addr, SUN_LEN(&addr)) < 0)
-		ERR("bind");
-	if (listen(socketfd, BACKLOG) < 0)
-		ERR("listen");
-	return socketfd;
-}
+struct timer_wheel wheel;
+struct codel admission;
 
-int add_new_client(int sfd)
+void sigint_handler(struct reactor *r, void *arg)
 {
-	int nfd;
-	if ((nfd = TEMP_FAILURE_RETRY(accept(sfd, NULL, NULL))) < 0) {
-		if (EAGAIN == errno || EWOULDBLOCK == errno)
-			return -1;
-		ERR("accept");
-	}
-	return nfd;
+	reactor_stop(r);
 }
 
 void usage(char *name)
 {
-	fprintf(stderr, "USAGE: %s socket port\n", name);
-}
-
-ssize_t bulk_read(int fd, char *buf, size_t count)
-{
-	int c;
-	size_t len = 0;
-	do {
-		c = TEMP_FAILURE_RETRY(read(fd, buf, count));
-		if (c < 0)
-			return c;
-		if (0 == c)
-			return len;
-		buf += c;
-		len += c;
-		count -= c;
-	} while (count > 0);
-	return len;
-}
-
-ssize_t bulk_write(int fd, char *buf, size_t count)
-{
-	int c;
-	size_t len = 0;
-	do {
-		c = TEMP_FAILURE_RETRY(write(fd, buf, count));
-		if (c < 0)
-			return c;
-		buf += c;
-		len += c;
-		count -= c;
-	} while (count > 0);
-	return len;
+	fprintf(stderr, "USAGE: %s [-b backlog] [-t target_ms] [-i interval_ms] socket port\n", name);
 }
 
 void calculate(int32_t data[5])
@@ -139,62 +64,150 @@ void calculate(int32_t data[5])
     data[2] = htonl(result);
 }
 
-void doServer(int fdL)
+void close_client(struct reactor *r, struct client *c)
 {
-	int cfd;
-	int32_t data[5];
+	wheel_timer_stop(&wheel, &c->timer);
+	if (reactor_remove(r, c->fd) < 0)
+		ERR("reactor_remove");
+	if (TEMP_FAILURE_RETRY(close(c->fd)) < 0)
+		ERR("close");
+	free(c);
+}
+
+void client_timeout(struct reactor *r, void *arg)
+{
+	close_client(r, arg);
+}
+
+void communicate(struct reactor *r, int cfd, uint32_t events, void *arg)
+{
+	struct client *c = arg;
 	ssize_t size;
-	fd_set base_rfds, rfds;
-	sigset_t mask, oldmask;
-	FD_ZERO(&base_rfds);
-	FD_SET(fdL, &base_rfds);
-	sigemptyset(&mask);
-	sigaddset(&mask, SIGINT);
-	sigprocmask(SIG_BLOCK, &mask, &oldmask);
-	while (do_work) {
-		rfds = base_rfds;
-		if (pselect(fdL + 1, &rfds, NULL, NULL, NULL, &oldmask) > 0) {
-			if ((cfd = add_new_client(fdL)) >= 0) {
-				;
-				if ((size = bulk_read(cfd, (char *)data, sizeof(int32_t[5]))) < 0)
-					ERR("read:");
-				if (size == (int)sizeof(int32_t[5])) {
-					calculate(data);
-					if (bulk_write(cfd, (char *)data, sizeof(int32_t[5])) < 0 && errno != EPIPE)
-						ERR("write:");
-				}
-				if (TEMP_FAILURE_RETRY(close(cfd)) < 0)
-					ERR("close");
+	uint64_t now;
+	int progress = 0;
+	if (!c->writing) {
+		while (c->done < sizeof(c->data)) {
+			size = codel_recv(cfd, (char *)c->data + c->done, sizeof(c->data) - c->done, &c->arrived);
+			if (size < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+				return;
+			if (size <= 0) {
+				close_client(r, c);
+				return;
 			}
-		} else {
-			if (EINTR == errno)
-				continue;
-			ERR("pselect");
+			c->done += size;
+		}
+		trace_event(TRACE_FRAME, cfd);
+		now = codel_clock();
+		if (codel_admit(&admission, now > c->arrived ? now - c->arrived : 0))
+			calculate(c->data);
+		else
+			c->data[4] = htonl(CALC_BUSY);
+		trace_event(TRACE_COMPUTE, cfd);
+		c->writing = 1;
+		c->done = 0;
+		wheel_timer_start(&wheel, &c->timer, WRITE_TIMEOUT);
+	}
+	while (c->done < sizeof(c->data)) {
+		size = TEMP_FAILURE_RETRY(write(cfd, (char *)c->data + c->done, sizeof(c->data) - c->done));
+		if (size < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+			if (reactor_modify(r, cfd, REACTOR_WRITE) < 0)
+				ERR("reactor_modify");
+			if (progress)
+				wheel_timer_start(&wheel, &c->timer, WRITE_TIMEOUT);
+			return;
 		}
+		if (size < 0) {
+			close_client(r, c);
+			return;
+		}
+		c->done += size;
+		progress = 1;
 	}
-	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	trace_event(TRACE_WRITE, cfd);
+	close_client(r, c);
+}
+
+void add_client(struct reactor *r, int cfd)
+{
+	struct client *c;
+	trace_event(TRACE_ACCEPT, cfd);
+	if (set_nonblock(cfd) < 0)
+		ERR("fcntl");
+	if ((c = calloc(1, sizeof(struct client))) == NULL)
+		ERR("calloc");
+	c->fd = cfd;
+	c->arrived = codel_clock();
+	wheel_timer_init(&c->timer, client_timeout, c);
+	wheel_timer_start(&wheel, &c->timer, REQUEST_TIMEOUT);
+	if (reactor_add(r, cfd, REACTOR_READ, communicate, c) < 0)
+		ERR("reactor_add");
+}
+
+// Drains the accept queue so that waiting clients are where admission control sees them
+void accept_client(struct reactor *r, int fdL, uint32_t events, void *arg)
+{
+	int cfd;
+	while ((cfd = add_new_client(fdL, NULL)) >= 0)
+		add_client(r, cfd);
+}
+
+void doServer(int fdL)
+{
+	struct reactor *r;
+	if ((r = reactor_create(NULL)) == NULL)
+		ERR("reactor_create");
+	wheel_init(&wheel, r, TICK_MS);
+	if (reactor_signal(r, SIGINT, sigint_handler, NULL) < 0)
+		ERR("Seting SIGINT:");
+	if (reactor_signal(r, SIGUSR1, trace_signal_dump, NULL) < 0)
+		ERR("Seting SIGUSR1:");
+	if (reactor_add(r, fdL, REACTOR_READ, accept_client, NULL) < 0)
+		ERR("reactor_add");
+	if (reactor_run(r) < 0)
+		ERR("reactor_run");
+	reactor_remove(r, fdL);
+	wheel_destroy(&wheel);
+	reactor_destroy(r);
 }
 
 int main(int argc, char **argv)
 {
-	int fdL;
-	int new_flags;
-	if (argc != 3) {
+	int fdL, backlog = BACKLOG, target_ms = TARGET_MS, interval_ms = INTERVAL_MS, c;
+	while ((c = getopt(argc, argv, "b:t:i:")) != -1) {
+		switch (c) {
+		case 'b':
+			backlog = atoi(optarg);
+			break;
+		case 't':
+			target_ms = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2 || backlog < 1 || target_ms < 1 || interval_ms < target_ms) {
 		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
+	argv += optind - 1;
+	codel_init(&admission, target_ms, interval_ms);
 	if (sethandler(SIG_IGN, SIGPIPE))
 		ERR("Seting SIGPIPE:");
-	if (sethandler(sigint_handler, SIGINT))
-		ERR("Seting SIGINT:");
-	fdL = bind_socket(argv[1]);
-	new_flags = fcntl(fdL, F_GETFL) | O_NONBLOCK;
-	fcntl(fdL, F_SETFL, new_flags);
+	if (trace_init() < 0)
+		ERR("trace_init");
+	fdL = bind_local_socket(argv[1], backlog);
+	if (set_nonblock(fdL) < 0)
+		ERR("fcntl");
 	doServer(fdL);
 	if (TEMP_FAILURE_RETRY(close(fdL)) < 0)
 		ERR("close");
 	if (unlink(argv[1]) < 0)
 		ERR("unlink");
+	fprintf(stderr, "Requests served: %lu, shed: %lu\n", admission.admitted, admission.shed);
 	fprintf(stderr, "Server has terminated.\n");
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
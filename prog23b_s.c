@@ -3,267 +3,735 @@
 //     Serwer akceptuje połączenia sieciowe TCP
 //     Klient sieciowy TCP
 
-#define _GNU_SOURCE
-#include <errno.h>
-#include <fcntl.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include "posixnet.h"
+#include "posixnet_err.h"
+#include "calc.h"
+#include "calc_big.h"
+#include "calc_vm.h"
+#include "codel.h"
+#include "reactor.h"
+#include "slab.h"
+#include "trace.h"
+#include "wheel.h"
+#include "workpool.h"
+
+#include <sched.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
 #include <sys/un.h>
-#include <unistd.h>
 
-#define ERR(source) (perror(source), fprintf(stderr, "%s:%d\n", __FILE__, __LINE__), exit(EXIT_FAILURE))
+#define BACKLOG 128 // Default listen backlog, -b changes it
+#define TARGET_MS 5 // Default CoDel target sojourn time, -t changes it
+#define INTERVAL_MS 100 // Default CoDel interval, -i changes it
+#define WORKERS 2 // Default threads for big-number operations, -w changes it
+#define NO_CPU -1 // The event loop runs wherever the scheduler puts it unless -c pins it
+#define TICK_MS 100 // Resolution of the connection timeouts
+#define REQUEST_TIMEOUT 5000 // ms to finish a request, counted from accept or its first byte
+#define IDLE_TIMEOUT 60000 // ms a v2 connection may wait between requests
+#define WRITE_TIMEOUT 5000 // ms without progress while answers are being written
+#define OUT_LIMIT 65536 // Unsent answers after which a v2 client is not read until they drain
+#define IN_SIZE SLAB_MAX_SIZE // Input buffer, grown for one larger request at a time
+#define BIG_INLINE 4096 // Limb products (a few us) up to which * / % run on the I/O thread
+#define JOB_LIMIT 16 // Operations of one client at the workers after which it is not read
+
+// One client connection; requests are read and answers written without blocking the server.
+// A v1 client sends one request and is closed after its answer, a v2 client sends any number.
+// The record is one cache line from the slab and is all an idle connection costs here; its
+// buffers are attached only while a request is partly read, computed or being answered.
+struct client {
+	int fd; // -1 once closed, while workers still compute for it
+	uint8_t version; // CALC_V1 or CALC_V2, 0 until the first request tells
+	uint8_t stalled; // Answers are waiting for the socket to take them
+	uint8_t events; // What the reactor watches
+	uint8_t jobs; // Big-number operations at the workers
+	uint32_t in_len; // Bytes of requests read but not handled yet
+	struct client_io *io; // NULL while idle
+	struct wheel_timer timer; // Request, idle or write-stall deadline
+};
+
+// Buffers of a busy connection, back to the slab when it goes idle
+struct client_io {
+	char *in; // Requests read but not handled yet, in_len of in_cap bytes
+	char *out; // Answers not written yet
+	uint32_t in_cap, out_len, out_done, out_cap;
+	uint64_t arrived; // codel_clock() of the request's arrival, its sojourn starts here
+};
+
+// A big-number operation handed to a worker thread, answered when it is done
+struct big_job {
+	struct workpool_job job;
+	struct client *c;
+	struct calc_frame f;
+	int na, nb;
+	uint32_t limbs[]; // Both operands, then room for the result
+};
+
+struct timer_wheel wheel; // Timeouts of all client connections
+struct codel admission; // Sheds requests that waited too long under overload
+struct calc_cache *programs; // Compiled expressions of all clients, by handle
+struct workpool *workers; // Threads for the big-number operations too long for the I/O thread
+cpu_set_t spare_cpus; // CPUs left to the workers when -c pins the event loop
+struct client **by_fd; // Open clients by descriptor
+int by_fd_len;
+int records; // Client records not freed yet, the ones closed with jobs pending too
+int listeners[2]; // The local and TCP listening sockets, in the order they are handed over
+int control = -1; // Listening restart socket of -r, or the connection to the process taken over
+int draining; // The listening sockets were handed over, exit once the last client is gone
+uint64_t started_ns; // codel_clock() when the process started, for the time a takeover took
+
+void communicate(struct reactor *r, int cfd, uint32_t events, void *arg);
+
+void sigint_handler(struct reactor *r, void *arg)
+{
+	reactor_stop(r); // Leave reactor_run after the current round
+}
 
-#define BACKLOG 3
-volatile sig_atomic_t do_work = 1;
+void usage(char *name)
+{
+	fprintf(stderr, "USAGE: %s [-b backlog] [-t target_ms] [-i interval_ms] [-w workers] [-c cpu] [-p spin_us] [-r restart_socket] socket port\n", name);
+}
 
-void sigint_handler(int sig)
+void calculate(int32_t data[5])
 {
-	do_work = 0;
+	int32_t op1, op2, result = 0, status = CALC_OK;
+	op1 = ntohl(data[0]);
+	op2 = ntohl(data[1]);
+	switch ((char)ntohl(data[3])) {
+	case '+':
+		result = op1 + op2;
+		break;
+	case '-':
+		result = op1 - op2;
+		break;
+	case '*':
+		result = op1 * op2;
+		break;
+	case '/':
+		if (!op2)
+			status = CALC_FAILED;
+		else
+			result = op1 / op2;
+		break;
+	default:
+		status = CALC_FAILED;
+	}
+	data[4] = htonl(status);
+	data[2] = htonl(result);
 }
-int sethandler(void (*f)(int), int sigNo)
+
+// Moves a slab buffer of cap bytes, len of them used, to one of new_cap bytes
+char *resize(char *buf, size_t len, size_t cap, size_t new_cap)
 {
-	struct sigaction act;
-	memset(&act, 0, sizeof(struct sigaction));
-	act.sa_handler = f;
-	if (-1 == sigaction(sigNo, &act, NULL))
-		return -1;
-	return 0;
+	char *p;
+
+	if ((p = slab_alloc(new_cap)) == NULL)
+		ERR("slab_alloc");
+	if (buf != NULL) {
+		memcpy(p, buf, len);
+		slab_free(buf, cap);
+	}
+	return p;
 }
-int make_socket(int domain, int type)
+
+// The buffers of the client, attached when it has something to do
+struct client_io *client_io(struct client *c)
 {
-	int sock;
-	sock = socket(domain, type, 0);
-	if (sock < 0)
-		ERR("socket");
-	return sock;
+	struct client_io *io = c->io;
+
+	if (io != NULL)
+		return io;
+	if ((io = c->io = slab_alloc(sizeof(struct client_io))) == NULL || (io->in = slab_alloc(IN_SIZE)) == NULL)
+		ERR("slab_alloc");
+	io->out = NULL;
+	io->in_cap = IN_SIZE;
+	io->out_len = io->out_done = io->out_cap = 0;
+	io->arrived = codel_clock(); // Until a receive timestamp says otherwise
+	return io;
 }
 
-int bind_local_socket(char *name)
+void release_io(struct client *c)
 {
-    struct sockaddr_un addr; // Structure variable for local UNIX domain socket address
-    int socketfd; // Socket file descriptor
-    
-    if (unlink(name) < 0 && errno != ENOENT) // Check if file already exists and delete it
-        ERR("unlink");
-
-    socketfd = make_socket(PF_UNIX, SOCK_STREAM); // Create a UNIX domain socket
-    memset(&addr, 0, sizeof(struct sockaddr_un)); // Initialize addr structure with zeros
-    addr.sun_family = AF_UNIX; // Set address family to UNIX domain
-    strncpy(addr.sun_path, name, sizeof(addr.sun_path) - 1); // Copy the socket path into addr structure
-    
-    if (bind(socketfd, (struct sockaddr *)&addr, SUN_LEN(&addr)) < 0) // Bind the socket to the address
-        ERR("bind");
-    
-    if (listen(socketfd, BACKLOG) < 0) // Put the socket in the listening state
-        ERR("listen");
-    
-    return socketfd; // Return the socket file descriptor
+	slab_free(c->io->in, c->io->in_cap);
+	if (c->io->out != NULL)
+		slab_free(c->io->out, c->io->out_cap);
+	slab_free(c->io, sizeof(struct client_io));
+	c->io = NULL;
 }
 
-int bind_tcp_socket(uint16_t port)
+void free_client(struct reactor *r, struct client *c)
 {
-    struct sockaddr_in addr; // Structure variable for TCP/IP socket address
-    int socketfd, t = 1; // Socket file descriptor and flag for setsockopt()
-
-    socketfd = make_socket(PF_INET, SOCK_STREAM); // Create a TCP/IP socket
-    memset(&addr, 0, sizeof(struct sockaddr_in)); // Initialize addr structure with zeros
-    addr.sin_family = AF_INET; // Set address family to IPv4
-    addr.sin_port = htons(port); // Set the port in network byte order
-    addr.sin_addr.s_addr = htonl(INADDR_ANY); // Set the IP address to any available interface
-    
-    if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t))) // Set socket option to reuse address
-        ERR("setsockopt");
-    
-    if (bind(socketfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) // Bind the socket to the address
-        ERR("bind");
-    
-    if (listen(socketfd, BACKLOG) < 0) // Put the socket in the listening state
-        ERR("listen");
-    
-    return socketfd; // Return the socket file descriptor
+	slab_free(c, sizeof(struct client));
+	if (0 == --records && draining)
+		reactor_stop(r); // The old process of a hot restart has served its last client
 }
 
+void close_client(struct reactor *r, struct client *c)
+{
+	wheel_timer_stop(&wheel, &c->timer);
+	if (reactor_remove(r, c->fd) < 0)
+		ERR("reactor_remove");
+	if (TEMP_FAILURE_RETRY(close(c->fd)) < 0)
+		ERR("close");
+	if (c->io != NULL)
+		release_io(c);
+	by_fd[c->fd] = NULL;
+	c->fd = -1;
+	if (0 == c->jobs)
+		free_client(r, c); // Otherwise the last job to finish frees it
+}
+
+// Slow or silent clients are dropped instead of holding a connection forever
+void client_timeout(struct reactor *r, void *arg)
+{
+	close_client(r, arg);
+}
 
-int add_new_client(int sfd)
+// Queues an answer frame and the payload that follows it
+void queue_answer(struct client *c, const struct calc_frame *f, size_t size, const void *payload, size_t len)
 {
-	int nfd;
-	if ((nfd = TEMP_FAILURE_RETRY(accept(sfd, NULL, NULL))) < 0) {
-		if (EAGAIN == errno || EWOULDBLOCK == errno)
-			return -1;
-		ERR("accept");
+	struct client_io *io = client_io(c);
+	size_t cap = io->out_cap;
+
+	if (io->out_done > 0) {
+		memmove(io->out, io->out + io->out_done, io->out_len - io->out_done);
+		io->out_len -= io->out_done;
+		io->out_done = 0;
 	}
-	return nfd;
+	while (io->out_len + size + len > cap)
+		cap = cap ? 2 * cap : 4 * CALC_FRAME_V2;
+	if (cap > io->out_cap) {
+		io->out = resize(io->out, io->out_len, io->out_cap, cap);
+		io->out_cap = cap;
+	}
+	memcpy(io->out + io->out_len, f, size);
+	memcpy(io->out + io->out_len + size, payload, len);
+	io->out_len += size + len;
 }
 
-void usage(char *name)
+// Compiles an expression, or finds it among the cached programs, and answers with its handle
+void compile(struct calc_frame *f, const char *text)
 {
-	fprintf(stderr, "USAGE: %s socket port\n", name);
+	const struct calc_program *p;
+	int32_t handle = calc_cache_compile(programs, text, ntohl(f->data[0]), &p);
+
+	f->data[1] = htonl(handle < 0 ? 0 : p->variables);
+	f->data[2] = htonl(handle);
+	f->data[4] = htonl(handle < 0 ? CALC_FAILED : CALC_OK);
 }
 
-ssize_t bulk_read(int fd, char *buf, size_t count)
+// Runs a cached program over the rows of operands in the payload; out gets the results and the
+// failed-row bitmap, the return value is their size
+size_t evaluate(struct calc_frame *f, const char *payload, int32_t out[CALC_MAX_ROWS + CALC_MASK_WORDS(CALC_MAX_ROWS)])
 {
-	int c;
-	size_t len = 0;
-	do {
-		c = TEMP_FAILURE_RETRY(read(fd, buf, count));
-		if (c < 0)
-			return c;
-		if (0 == c)
-			return len;
-		buf += c;
-		len += c;
-		count -= c;
-	} while (count > 0);
-	return len;
+	int32_t operands[CALC_MAX_PAYLOAD / sizeof(int32_t)];
+	const struct calc_program *p = calc_cache_get(programs, ntohl(f->data[0]));
+	int rows = ntohl(f->data[1]), n, failed;
+
+	if (NULL == p || p->variables != (int32_t)ntohl(f->data[2])) {
+		f->data[1] = htonl(0);
+		f->data[2] = htonl(0);
+		f->data[4] = htonl(NULL == p ? CALC_UNKNOWN : CALC_FAILED);
+		return 0;
+	}
+	n = rows * p->variables;
+	memcpy(operands, payload, n * sizeof(int32_t));
+	for (int i = 0; i < n; i++)
+		operands[i] = ntohl(operands[i]);
+	failed = calc_run(p, operands, rows, out, (uint32_t *)out + rows);
+	n = rows + CALC_MASK_WORDS(rows);
+	for (int i = 0; i < n; i++)
+		out[i] = htonl(out[i]);
+	f->data[2] = htonl(failed);
+	f->data[4] = htonl(failed > 0 ? CALC_FAILED : CALC_OK);
+	return n * sizeof(int32_t);
+}
+
+// Computes a CALC_BIG operation, on the I/O thread or a worker: the answer frame gets the
+// result's limb count and the job the limbs, in network order
+void big_work(void *arg)
+{
+	struct big_job *j = arg;
+	uint32_t *result = j->limbs + abs(j->na) + abs(j->nb);
+	int n = 0, status;
+
+	status = calc_big_calculate((char)ntohl(j->f.data[2]), j->limbs, j->na, j->limbs + abs(j->na), j->nb, result, &n);
+	for (int i = 0; i < abs(n); i++)
+		result[i] = htonl(result[i]);
+	j->f.data[2] = htonl(n);
+	j->f.data[4] = htonl(status);
+}
+
+void big_answer(struct client *c, struct big_job *j)
+{
+	trace_event(TRACE_COMPUTE, c->fd);
+	queue_answer(c, &j->f, CALC_FRAME_V2, j->limbs + abs(j->na) + abs(j->nb), abs((int32_t)ntohl(j->f.data[2])) * sizeof(uint32_t));
+}
+
+// Called by the reactor when a worker has finished a job
+void big_done(struct reactor *r, void *arg)
+{
+	struct big_job *j = arg;
+	struct client *c = j->c;
+
+	c->jobs--;
+	if (c->fd >= 0) {
+		big_answer(c, j);
+		communicate(r, c->fd, 0, c); // Send the answer, read again if the job limit held the client
+	} else if (0 == c->jobs) {
+		free_client(r, c); // The client went away while its last job was computed
+	}
+	free(j);
+}
+
+// Starts a CALC_BIG operation; sums and short products or quotients are answered at once,
+// the others when a worker has computed them
+void big(struct client *c, struct calc_frame *f, const char *payload)
+{
+	int na = ntohl(f->data[0]), nb = ntohl(f->data[1]), n = abs(na) + abs(nb);
+	char operation = (char)ntohl(f->data[2]);
+	struct big_job *j;
+
+	if ((j = malloc(sizeof(struct big_job) + (n + calc_big_limbs(operation, na, nb)) * sizeof(uint32_t))) == NULL)
+		ERR("malloc");
+	j->c = c;
+	j->f = *f;
+	j->na = na;
+	j->nb = nb;
+	memcpy(j->limbs, payload, n * sizeof(uint32_t));
+	for (int i = 0; i < n; i++)
+		j->limbs[i] = ntohl(j->limbs[i]);
+	if (('*' != operation && '/' != operation && '%' != operation) || (int64_t)abs(na) * abs(nb) <= BIG_INLINE) {
+		big_work(j);
+		big_answer(c, j);
+		free(j);
+		return;
+	}
+	c->jobs++;
+	workpool_job_init(&j->job, big_work, big_done, j);
+	workpool_submit(workers, &j->job);
 }
 
-ssize_t bulk_write(int fd, char *buf, size_t count)
+// Computes (or sheds) one request and queues its answer, a frame of the request's size
+void answer(struct client *c, struct calc_frame *f, size_t size, const char *payload)
 {
-	int c;
+	int32_t results[CALC_MAX_ROWS + CALC_MASK_WORDS(CALC_MAX_ROWS)];
 	size_t len = 0;
-	do {
-		c = TEMP_FAILURE_RETRY(write(fd, buf, count));
-		if (c < 0)
-			return c;
-		buf += c;
-		len += c;
-		count -= c;
-	} while (count > 0);
-	return len;
+	uint64_t now = codel_clock();
+
+	trace_event(TRACE_FRAME, c->fd);
+	if (!codel_admit(&admission, now > c->io->arrived ? now - c->io->arrived : 0)) {
+		f->data[1] = CALC_EVAL == ntohl(f->data[3]) ? htonl(0) : f->data[1]; // No results follow
+		f->data[2] = CALC_FRAME_V2 == size && CALC_BIG == ntohl(f->data[3]) ? htonl(0) : f->data[2];
+		f->data[4] = htonl(CALC_BUSY); // Overloaded: answer at once instead of queueing
+	} else if (CALC_FRAME_V2 == size && CALC_COMPILE == ntohl(f->data[3])) {
+		compile(f, payload);
+	} else if (CALC_FRAME_V2 == size && CALC_EVAL == ntohl(f->data[3])) {
+		len = evaluate(f, payload, results);
+	} else if (CALC_FRAME_V2 == size && CALC_BIG == ntohl(f->data[3])) {
+		big(c, f, payload); // Answers now or once a worker is done
+		return;
+	} else {
+		calculate(f->data); // Perform some calculation on the data
+	}
+	trace_event(TRACE_COMPUTE, c->fd);
+	queue_answer(c, f, size, results, len);
 }
 
-void calculate(int32_t data[5])
+// Answers every complete request in the input; returns how many or -1 on a protocol error
+int handle_requests(struct client *c)
 {
-	int32_t op1, op2, result, status = 1;
-	op1 = ntohl(data[0]);
-	op2 = ntohl(data[1]);
-	switch ((char)ntohl(data[3])) {
-	case '+':
-		result = op1 + op2;
-		break;
-	case '-':
-		result = op1 - op2;
-		break;
-	case '*':
-		result = op1 * op2;
-		break;
-	case '/':
-		if (!op2)
-			status = 0;
-		else
-			result = op1 / op2;
-		break;
-	default:
-		status = 0;
+	struct client_io *io = c->io;
+	struct calc_frame f;
+	size_t off = 0, size, need = 0;
+	ssize_t payload = 0;
+	int n = 0;
+
+	while (c->in_len - off >= CALC_FRAME_V1) {
+		memcpy(&f, io->in + off, CALC_FRAME_V1);
+		size = CALC_V2 == ntohl(f.data[4]) ? CALC_FRAME_V2 : CALC_FRAME_V1;
+		if (0 == c->version)
+			c->version = CALC_FRAME_V2 == size ? CALC_V2 : CALC_V1;
+		else if (CALC_V1 == c->version || CALC_FRAME_V1 == size)
+			return -1; // A v1 client sent more than one request, or a v2 client a v1 one
+		if (CALC_FRAME_V2 == size && (payload = calc_request_payload(&f)) < 0)
+			return -1; // Over the limits of the protocol
+		if (c->in_len - off < size + payload) {
+			need = size + payload;
+			break;
+		}
+		memcpy(&f, io->in + off, size);
+		answer(c, &f, size, io->in + off + size);
+		off += size + payload;
+		n++;
 	}
-	data[4] = htonl(status);
-	data[2] = htonl(result);
+	memmove(io->in, io->in + off, c->in_len - off);
+	c->in_len -= off;
+	// Room for the whole of a large request, and back to the usual size after it
+	if (need > io->in_cap || (io->in_cap > IN_SIZE && need <= IN_SIZE && c->in_len <= IN_SIZE)) {
+		off = need > IN_SIZE ? need : IN_SIZE;
+		io->in = resize(io->in, c->in_len, io->in_cap, off);
+		io->in_cap = off;
+	}
+	return n;
+}
+
+// Changes what the reactor watches for the client, unless it watches that already
+void watch(struct reactor *r, struct client *c, uint32_t events)
+{
+	if (events != c->events && reactor_modify(r, c->fd, events) < 0)
+		ERR("reactor_modify");
+	c->events = events;
 }
-void communicate(int cfd)
+
+// Called by the reactor when the client can be read from or written to; with no events it
+// only writes what was queued
+void communicate(struct reactor *r, int cfd, uint32_t events, void *arg)
 {
+	struct client *c = arg;
+	struct client_io *io = client_io(c);
 	ssize_t size; // Size of data read or written
-	int32_t data[5]; // Array to hold integer data
+	int progress = 0, started = 0, empty, n;
+
+	// Take whatever requests have arrived, as long as their answers can be queued
+	while ((events & REACTOR_READ) && CALC_V1 != c->version && io->out_len - io->out_done < OUT_LIMIT &&
+	       c->jobs < JOB_LIMIT) {
+		if (CALC_V2 == c->version)
+			io->arrived = codel_clock(); // Until a receive timestamp says otherwise
+		size = codel_recv(cfd, io->in + c->in_len, io->in_cap - c->in_len, &io->arrived);
+		if (size < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+			break; // The rest comes with a later wakeup
+		empty = 0 == c->in_len;
+		if (size <= 0 || (c->in_len += size, n = handle_requests(c)) < 0) {
+			close_client(r, c); // Client disconnected, the connection failed or the request was bad
+			return;
+		}
+		if (c->in_len > 0 && (empty || n > 0) && c->version != 0)
+			started = 1; // The first request is timed from accept, later ones from their first byte
+	}
 
-	// Read data from the client socket
-	if ((size = bulk_read(cfd, (char *)data, sizeof(int32_t[5]))) < 0)
-		ERR("read:");
+	// Write the answers back to the client socket
+	while (io->out_done < io->out_len) {
+		size = TEMP_FAILURE_RETRY(write(cfd, io->out + io->out_done, io->out_len - io->out_done));
+		if (size < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+			break;
+		if (size < 0) {
+			close_client(r, c); // EPIPE or reset: the client is gone
+			return;
+		}
+		io->out_done += size;
+		progress = 1;
+	}
 
-	// If full data was read successfully
-	if (size == (int)sizeof(int32_t[5])) {
-		calculate(data); // Perform some calculation on the data
+	if (io->out_done < io->out_len) {
+		// Keep reading a v2 client only while its unsent answers and jobs stay under the limits
+		n = CALC_V2 == c->version && io->out_len - io->out_done < OUT_LIMIT && c->jobs < JOB_LIMIT ? REACTOR_READ : 0;
+		watch(r, c, REACTOR_WRITE | n);
+		if (progress || !c->stalled)
+			wheel_timer_start(&wheel, &c->timer, WRITE_TIMEOUT); // Stalled only without progress
+		c->stalled = 1;
+		return;
+	}
+	io->out_done = io->out_len = 0;
+	if (progress)
+		trace_event(TRACE_WRITE, cfd);
+	if (CALC_V1 == c->version || (draining && 0 == c->in_len && 0 == c->jobs)) {
+		close_client(r, c); // The one request of a v1 client is answered, or a v2 one is idle while draining
+		return;
+	}
+	watch(r, c, c->jobs < JOB_LIMIT ? REACTOR_READ : 0);
+	if (c->stalled || started || (progress && 0 == c->in_len))
+		wheel_timer_start(&wheel, &c->timer, c->in_len > 0 ? REQUEST_TIMEOUT : IDLE_TIMEOUT);
+	c->stalled = 0;
+	if (0 == c->in_len && 0 == c->jobs)
+		release_io(c); // Idle until the next request
+}
 
-		// Write the processed data back to the client socket
-		if (bulk_write(cfd, (char *)data, sizeof(int32_t[5])) < 0 && errno != EPIPE)
-			ERR("write:");
+void add_client(struct reactor *r, int cfd)
+{
+	struct client *c;
+
+	trace_event(TRACE_ACCEPT, cfd);
+	if (set_nonblock(cfd) < 0)
+		ERR("fcntl");
+	if ((c = slab_alloc(sizeof(struct client))) == NULL)
+		ERR("slab_alloc");
+	memset(c, 0, sizeof(struct client));
+	c->fd = cfd;
+	c->events = REACTOR_READ;
+	if (cfd >= by_fd_len) {
+		int len = by_fd_len ? by_fd_len : 1024;
+		while (len <= cfd)
+			len *= 2;
+		if ((by_fd = realloc(by_fd, len * sizeof(struct client *))) == NULL)
+			ERR("realloc");
+		memset(by_fd + by_fd_len, 0, (len - by_fd_len) * sizeof(struct client *));
+		by_fd_len = len;
 	}
+	by_fd[cfd] = c;
+	records++;
+	wheel_timer_init(&c->timer, client_timeout, c);
+	wheel_timer_start(&wheel, &c->timer, REQUEST_TIMEOUT);
+	if (reactor_add(r, cfd, REACTOR_READ, communicate, c) < 0)
+		ERR("reactor_add"); // Handle communication with the client as data arrives
+}
+
+// Called by the reactor whenever one of the listening sockets has pending connections;
+// takes all of them so that waiting happens where admission control can see it
+void accept_client(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	int cfd;
 
-	// Close the client socket
-	if (TEMP_FAILURE_RETRY(close(cfd)) < 0)
+	while ((cfd = add_new_client(fd, NULL)) >= 0) // Accept until the queue is empty
+		add_client(r, cfd);
+}
+
+// Hot restart (-r): a new process connects to the restart socket of the running one, which
+// sends it the listening sockets and goes on accepting until the new one confirms it watches
+// them; then the old one stops accepting, closes its idle connections and exits once the rest
+// are answered. The listen queues stay open throughout, so no connect is refused or lost.
+
+void drain(struct reactor *r)
+{
+	struct client *c;
+
+	reactor_remove(r, listeners[0]);
+	reactor_remove(r, listeners[1]);
+	reactor_remove(r, control);
+	if (TEMP_FAILURE_RETRY(close(control)) < 0)
+		ERR("close"); // The restart socket's path belongs to the new process now
+	control = -1;
+	draining = 1;
+	for (int fd = 0; fd < by_fd_len; fd++)
+		if ((c = by_fd[fd]) != NULL && CALC_V2 == c->version && NULL == c->io && 0 == c->jobs)
+			close_client(r, c); // Between requests: the client reconnects to the new process
+	fprintf(stderr, "Listening sockets handed over, draining\n");
+	if (0 == records)
+		reactor_stop(r);
+}
+
+// Called by the reactor when the new process confirms, or fails before it did
+void handed_over(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	char ack;
+	ssize_t size = TEMP_FAILURE_RETRY(read(fd, &ack, 1));
+
+	reactor_remove(r, fd);
+	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
 		ERR("close");
+	if (size != 1)
+		fprintf(stderr, "Hot restart failed, still serving\n");
+	else if (!draining)
+		drain(r);
 }
 
-void doServer(int fdL, int fdT)
+// Called by the reactor when a new process connects to the restart socket
+void hand_over(struct reactor *r, int fd, uint32_t events, void *arg)
 {
-	int cfd, fdmax;
-	fd_set base_rfds, rfds;
-	sigset_t mask, oldmask;
-
-	FD_ZERO(&base_rfds); // Clear the base read file descriptor set
-	FD_SET(fdL, &base_rfds); // Add fdL to the base read file descriptor set
-	FD_SET(fdT, &base_rfds); // Add fdT to the base read file descriptor set
-	fdmax = (fdT > fdL ? fdT : fdL); // Calculate the maximum file descriptor value
-
-	sigemptyset(&mask); // Initialize an empty signal mask
-	sigaddset(&mask, SIGINT); // Add SIGINT to the signal mask
-	sigprocmask(SIG_BLOCK, &mask, &oldmask); // Block the signals in the mask
-
-	while (do_work) {
-		rfds = base_rfds; // Copy the base read file descriptor set to rfds
-
-		// Wait for activity on the file descriptors using pselect
-		if (pselect(fdmax + 1, &rfds, NULL, NULL, NULL, &oldmask) > 0) {
-			// Check if fdL has activity (new client connection)
-			if (FD_ISSET(fdL, &rfds))
-				cfd = add_new_client(fdL); // Accept the new client connection
-			else
-				cfd = add_new_client(fdT); // Accept the new client connection
-
-			// If a new client connection was established
-			if (cfd >= 0)
-				communicate(cfd); // Handle communication with the client
-		} else {
-			// Check for errors or interrupted system call
-			if (EINTR == errno)
-				continue; // Restart the loop on interrupted system call
-			ERR("pselect");
+	int cfd;
+
+	while ((cfd = add_new_client(fd, NULL)) >= 0) {
+		if (send_fds(cfd, listeners, 2) < 0) {
+			perror("send_fds");
+			if (TEMP_FAILURE_RETRY(close(cfd)) < 0)
+				ERR("close");
+			continue;
 		}
+		if (reactor_add(r, cfd, REACTOR_READ, handed_over, NULL) < 0)
+			ERR("reactor_add"); // Keep accepting until the confirmation
 	}
+}
+
+// The listening sockets of a server running with the same restart socket; -1 when there is none
+int take_over(char *path, int fds[2])
+{
+	struct sockaddr_un addr;
+	int fd = make_socket(PF_UNIX, SOCK_STREAM);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, SUN_LEN(&addr)) < 0) {
+		if (ENOENT != errno && ECONNREFUSED != errno)
+			ERR("connect");
+		if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+			ERR("close");
+		return -1; // A cold start
+	}
+	if (recv_fds(fd, fds, 2) != 2)
+		ERR("recv_fds");
+	control = fd; // Confirmed once the sockets are watched
+	return 0;
+}
+
+// Listens for the next restart, then lets the process taken over (if any) stop accepting
+void listen_restart(struct reactor *r, char *path)
+{
+	int fd = control;
+	char ack = 1;
+
+	control = bind_local_socket(path, 1); // Replaces the old process's path, its socket keeps working
+	if (set_nonblock(control) < 0)
+		ERR("fcntl");
+	if (reactor_add(r, control, REACTOR_READ, hand_over, NULL) < 0)
+		ERR("reactor_add");
+	if (fd < 0)
+		return;
+	if (bulk_write(fd, &ack, 1) < 0)
+		perror("write"); // The old process is gone, its sockets are ours anyway
+	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+		ERR("close");
+	fprintf(stderr, "Took over the listening sockets %.0f us after start\n", (codel_clock() - started_ns) / 1e3);
+}
+
+// Pins the I/O thread before the server allocates anything, so that its memory comes from
+// the NUMA node of the CPU (first touch); the workers get the other CPUs
+void pin_loop(int cpu)
+{
+	if (sched_getaffinity(0, sizeof(spare_cpus), &spare_cpus) < 0)
+		ERR("sched_getaffinity");
+	CPU_CLR(cpu, &spare_cpus);
+	if (pin_thread(cpu) < 0)
+		ERR("pin_thread");
+}
+
+void start_workers(struct reactor *r, int threads, int cpu)
+{
+	// Threads inherit the affinity of their creator: give them the spare CPUs, when there are any
+	if (cpu != NO_CPU && CPU_COUNT(&spare_cpus) > 0 && sched_setaffinity(0, sizeof(spare_cpus), &spare_cpus) < 0)
+		ERR("sched_setaffinity");
+	if ((workers = workpool_create(r, threads)) == NULL)
+		ERR("workpool_create"); // Created after the signals are blocked, which the threads inherit
+	if (cpu != NO_CPU && pin_thread(cpu) < 0)
+		ERR("pin_thread");
+}
 
-	sigprocmask(SIG_UNBLOCK, &mask, NULL); // Unblock the signals in the mask
+void doServer(int fdL, int fdT, int threads, int cpu, int spin_us, char *restart)
+{
+	struct reactor *r; // Event loop, backend chosen by POSIXNET_REACTOR
+
+	if ((r = reactor_create(NULL)) == NULL)
+		ERR("reactor_create");
+	wheel_init(&wheel, r, TICK_MS);
+	reactor_busy_poll(r, spin_us); // With -p the loop spins this long before it sleeps
+
+	if (reactor_signal(r, SIGINT, sigint_handler, NULL) < 0)
+		ERR("Seting SIGINT:"); // SIGINT is blocked and delivered through the reactor
+
+	if (reactor_signal(r, SIGUSR1, trace_signal_dump, NULL) < 0)
+		ERR("Seting SIGUSR1:"); // SIGUSR1 dumps the event trace (POSIXNET_TRACE) to JSON
+
+	start_workers(r, threads, cpu);
+
+	if (reactor_add(r, fdL, REACTOR_READ, accept_client, NULL) < 0 ||
+	    reactor_add(r, fdT, REACTOR_READ, accept_client, NULL) < 0)
+		ERR("reactor_add"); // Watch both listening sockets
+	if (restart != NULL)
+		listen_restart(r, restart);
+
+	if (reactor_run(r) < 0)
+		ERR("reactor_run"); // Serve clients until SIGINT
+
+	reactor_remove(r, fdL);
+	reactor_remove(r, fdT);
+	if (control >= 0) {
+		reactor_remove(r, control);
+		if (TEMP_FAILURE_RETRY(close(control)) < 0)
+			ERR("close");
+		if (unlink(restart) < 0)
+			ERR("unlink");
+	}
+	workpool_destroy(workers);
+	wheel_destroy(&wheel);
+	reactor_destroy(r);
 }
 
 int main(int argc, char **argv)
 {
 	int fdL, fdT; // File descriptors for local and TCP sockets
-	int new_flags; // Variable to hold new file flags
-
-	if (argc != 3) {
+	int backlog = BACKLOG, target_ms = TARGET_MS, interval_ms = INTERVAL_MS, threads = WORKERS, c;
+	int cpu = NO_CPU, spin_us = 0;
+	char *restart = NULL; // Restart socket, -r
+
+	started_ns = codel_clock();
+
+	while ((c = getopt(argc, argv, "b:t:i:w:c:p:r:")) != -1) {
+		switch (c) {
+		case 'b':
+			backlog = atoi(optarg);
+			break;
+		case 't':
+			target_ms = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'w':
+			threads = atoi(optarg);
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'p':
+			spin_us = atoi(optarg);
+			break;
+		case 'r':
+			restart = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2 || backlog < 1 || target_ms < 1 || interval_ms < target_ms || threads < 1 ||
+	    cpu < NO_CPU || cpu >= CPU_SETSIZE || spin_us < 0) {
 		usage(argv[0]); // Display usage information
 		return EXIT_FAILURE; // Return failure if incorrect arguments provided
 	}
+	argv += optind - 1; // Positional arguments as argv[1] and argv[2]
+	if (cpu != NO_CPU)
+		pin_loop(cpu); // Before the cache, trace rings and server state are allocated
+	codel_init(&admission, target_ms, interval_ms);
+	if ((programs = calc_cache_create()) == NULL)
+		ERR("calc_cache_create");
 
 	if (sethandler(SIG_IGN, SIGPIPE))
 		ERR("Seting SIGPIPE:"); // Set SIGPIPE signal handler to ignore
+	raise_fd_limit(); // One descriptor per client
+
+	if (trace_init() < 0)
+		ERR("trace_init"); // Map the trace rings when POSIXNET_TRACE is set
+
+	if (restart != NULL && take_over(restart, listeners) == 0) {
+		fdL = listeners[0]; // The sockets of the running server, with their queued connections
+		fdT = listeners[1];
+		if (listen(fdL, backlog) < 0 || listen(fdT, backlog) < 0)
+			ERR("listen"); // Only to apply -b of this process
+	} else {
+		fdL = listeners[0] = bind_local_socket(argv[1], backlog); // Bind a local UNIX domain socket
+		fdT = listeners[1] = bind_inet_socket(atoi(argv[2]), SOCK_STREAM, backlog); // Bind a TCP/IP socket
+	}
+	if (set_nonblock(fdL) < 0)
+		ERR("fcntl"); // Set non-blocking flag for fdL
 
-	if (sethandler(sigint_handler, SIGINT))
-		ERR("Seting SIGINT:"); // Set SIGINT signal handler to custom function sigint_handler
-
-	fdL = bind_local_socket(argv[1]); // Bind a local UNIX domain socket
-	new_flags = fcntl(fdL, F_GETFL) | O_NONBLOCK; // Get current file flags and set non-blocking flag
-	fcntl(fdL, F_SETFL, new_flags); // Set new file flags for fdL
-
-	fdT = bind_tcp_socket(atoi(argv[2])); // Bind a TCP/IP socket
-	new_flags = fcntl(fdT, F_GETFL) | O_NONBLOCK; // Get current file flags and set non-blocking flag
-	fcntl(fdT, F_SETFL, new_flags); // Set new file flags for fdT
+	if (codel_stamp(fdT) < 0)
+		ERR("setsockopt"); // Clients inherit receive timestamps for admission control
+	if (spin_us > 0 && set_busy_poll(fdT, spin_us) < 0)
+		perror("set_busy_poll"); // Without CAP_NET_ADMIN only the event loop spins, clients inherit the rest
+	if (set_nonblock(fdT) < 0)
+		ERR("fcntl"); // Set non-blocking flag for fdT
 
-	doServer(fdL, fdT); // Start the server to handle client connections
+	doServer(fdL, fdT, threads, cpu, spin_us, restart); // Start the server to handle client connections
 
 	if (TEMP_FAILURE_RETRY(close(fdL)) < 0)
 		ERR("close"); // Close the local socket
 
-	if (unlink(argv[1]) < 0)
-		ERR("unlink"); // Remove the local socket file
+	if (!draining && unlink(argv[1]) < 0)
+		ERR("unlink"); // Remove the local socket file, unless it went to a new process
 
 	if (TEMP_FAILURE_RETRY(close(fdT)) < 0)
 		ERR("close"); // Close the TCP socket
 
+	calc_cache_destroy(programs);
+	fprintf(stderr, "Requests served: %lu, shed: %lu\n", admission.admitted, admission.shed);
 	fprintf(stderr, "Server has terminated.\n"); // Print termination message
 	return EXIT_SUCCESS; // Return success
 }
\ No newline at end of file
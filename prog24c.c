@@ -1,26 +1,47 @@
-#define _GNU_SOURCE
-#include <errno.h>
+// -u name updates the named file kept by a server started with -d: the server sends the
+// signatures of its old copy and only the differences travel (see prog24s.c for the chunks)
+//
+// -m receivers sends the file once to the multicast group given as the address, to every
+// prog24s -m listening there: chunks go out unacknowledged, then polls collect the NAKs of
+// the receivers and only the chunks they miss are sent again, each once per round however
+// many receivers asked. It ends when that many receivers have the file, with 0 after rounds
+// in which nobody missed anything.
+
+#include "delta.h"
+#include "posixnet.h"
+#include "posixnet_err.h"
+
 #include <fcntl.h>
-#include <netdb.h>
-#include <netinet/in.h>
+#include <poll.h>
 #include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
-#include <sys/types.h>
-#include <unistd.h>
-
-#define ERR(source) (perror(source), fprintf(stderr, "%s:%d\n", __FILE__, __LINE__), exit(EXIT_FAILURE))
+#include <time.h>
 
 #define MAXBUF 576
+#define MODE_DELTA 1
+#define DELTA_READY 2
+#define OP_COPY 1
+#define OP_LITERAL 2
+#define MAXNAME 256
+#define DATA (MAXBUF - 2 * sizeof(int32_t))
+#define READAHEAD (64 * MAXBUF) // file bytes fetched by one read, chunks are cut from them
+#define MODE_MULTICAST 3
+#define GROUP_POLL (-1)
+#define GROUP_END (-2)
+#define GROUP_NAK (-3)
+#define GROUP_DONE (-4)
+#define POLL_MS 50 // answers to a poll are collected this long
+#define QUIET_ROUNDS 3 // rounds without a NAK that end a transfer to an unknown number of receivers
+#define MAX_IDLE_ROUNDS 40 // rounds without progress (see pollGroup) before giving up
+#define MAX_RECEIVERS 64
 volatile sig_atomic_t last_signal = 0;
 
 void usage(char *name)
 {
-	fprintf(stderr, "USAGE: %s domain port file \n", name);
+	fprintf(stderr, "USAGE: %s [-u name | -m receivers] domain port file \n", name);
 }
 
 
@@ -29,71 +50,6 @@ void sigalrm_handler(int sig)
 	last_signal = sig;
 }
 
-int sethandler(void (*f)(int), int sigNo)
-{
-	struct sigaction act;
-	memset(&act, 0, sizeof(struct sigaction));
-	act.sa_handler = f;
-	if (-1 == sigaction(sigNo, &act, NULL))
-		return -1;
-	return 0;
-}
-
-int make_socket(void)
-{
-	int sock;
-	sock = socket(PF_INET, SOCK_DGRAM, 0);
-	if (sock < 0)
-		ERR("socket");
-	return sock;
-}
-
-struct sockaddr_in make_address(char *address, char *port)
-{
-	int ret; // Return value of getaddrinfo
-	struct sockaddr_in addr; // Structure variable for socket address
-	struct addrinfo *result; // Pointer to the result of getaddrinfo
-	struct addrinfo hints = {}; // Structure variable for hints to influence getaddrinfo
-
-	hints.ai_family = AF_INET; // Set the address family to IPv4
-
-	// Call getaddrinfo to resolve the address and port
-	if ((ret = getaddrinfo(address, port, &hints, &result))) {
-		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret)); // Print error message if getaddrinfo fails
-		exit(EXIT_FAILURE); // Terminate the program if getaddrinfo fails
-	}
-
-	addr = *(struct sockaddr_in *)(result->ai_addr); // Copy the socket address from the result into the addr structure
-
-	freeaddrinfo(result); // Free the memory allocated by getaddrinfo
-
-	return addr; // Return the socket address
-}
-
-ssize_t bulk_read(int fd, char *buf, size_t count)
-{
-	int c; // Bytes read in each iteration
-	size_t len = 0; // Total bytes read
-
-	do {
-		c = TEMP_FAILURE_RETRY(read(fd, buf, count)); // Read data from the file descriptor
-
-		if (c < 0)
-			return c; // Error occurred during reading
-
-		if (0 == c)
-			return len; // End of file reached, return the total bytes read
-
-		buf += c; // Move the buffer pointer
-		len += c; // Update the total bytes read
-		count -= c; // Update the remaining count of bytes to read
-
-	} while (count > 0);
-
-	return len; // Return total bytes read
-}
-
-
 void sendAndConfirm(int fd, struct sockaddr_in addr, char *buf1, char *buf2, ssize_t size)
 {
 	struct itimerval ts; // Structure variable for setting the timer
@@ -116,18 +72,44 @@ void sendAndConfirm(int fd, struct sockaddr_in addr, char *buf1, char *buf2, ssi
 	}
 }
 
+// Sends the datagram until its chunk number comes back in buf2, 5 retries at most; 0 when it never did
+int sendChunk(int fd, struct sockaddr_in addr, char *buf, char *buf2, int32_t chunkNo)
+{
+	int counter = 0; // Counter for retry attempts
+
+	*((int32_t *)buf2) = htonl(-1); // No chunk has this number
+	do {
+		counter++;
+		sendAndConfirm(fd, addr, buf, buf2, MAXBUF); // Send the data and wait for confirmation
+	} while (*((int32_t *)buf2) != htonl(chunkNo) && counter <= 5); // Retry until the expected confirmation is received or the maximum retry attempts are reached
+
+	return *((int32_t *)buf2) == htonl(chunkNo);
+}
+
 void doClient(int fd, struct sockaddr_in addr, int file)
 {
 	char buf[MAXBUF]; // Buffer for storing data to be sent
 	char buf2[MAXBUF]; // Buffer for storing received confirmation
+	char rbuf[READAHEAD]; // Ring the file is read into
+	struct net_reader reader;
 	int offset = 2 * sizeof(int32_t); // Offset for storing chunk number and last flag
 	int32_t chunkNo = 0; // Chunk number
 	int32_t last = 0; // Last flag
 	ssize_t size; // Size of data read from file
-	int counter; // Counter for retry attempts
-
+	struct stat st; // Size of the file
+
+	// Chunk 0 announces the size, a server saving to disk allocates the file from it
+	if (fstat(file, &st) < 0)
+		ERR("fstat");
+	memset(buf, 0, MAXBUF);
+	*(((int32_t *)buf) + 2) = htonl((uint64_t)st.st_size >> 32);
+	*(((int32_t *)buf) + 3) = htonl((uint64_t)st.st_size & 0xffffffff);
+	if (!sendChunk(fd, addr, buf, buf2, 0))
+		return;
+
+	reader_init(&reader, file, rbuf, sizeof(rbuf));
 	do {
-		if ((size = bulk_read(file, buf + offset, MAXBUF - offset)) < 0)
+		if ((size = reader_read(&reader, buf + offset, MAXBUF - offset)) < 0)
 			ERR("read from file:"); // Read data from the file
 
 		*((int32_t *)buf) = htonl(++chunkNo); // Set the chunk number in network byte order
@@ -139,29 +121,378 @@ void doClient(int fd, struct sockaddr_in addr, int file)
 
 		*(((int32_t *)buf) + 1) = htonl(last); // Set the last flag in network byte order
 
-		memset(buf2, 0, MAXBUF); // Clear the confirmation buffer
-		counter = 0;
-
-		do {
-			counter++;
-			sendAndConfirm(fd, addr, buf, buf2, MAXBUF); // Send the data and wait for confirmation
-		} while (*((int32_t *)buf2) != htonl(chunkNo) && counter <= 5); // Retry until the expected confirmation is received or the maximum retry attempts are reached
-
-		if (*((int32_t *)buf2) != htonl(chunkNo) && counter > 5)
+		if (!sendChunk(fd, addr, buf, buf2, chunkNo))
 			break; // Break the loop if the confirmation is not received after maximum retry attempts
 
 	} while (size == MAXBUF - offset); // Continue until the entire file is read
 }
 
+// Delta chunks being filled: a run of copied blocks is held back until it ends
+struct delta_out {
+	int fd;
+	struct sockaddr_in addr;
+	char buf[MAXBUF], buf2[MAXBUF];
+	size_t used;
+	int32_t chunkNo, first, count; // count blocks from first wait to be copied
+	int failed;
+	int64_t literal; // statistics
+	int32_t reused, datagrams;
+};
+
+void sendDelta(struct delta_out *o, int32_t last)
+{
+	if (o->failed)
+		return;
+	memset(o->buf + o->used, 0, MAXBUF - o->used); // Zero ends the operations
+	*((int32_t *)o->buf) = htonl(++o->chunkNo);
+	*(((int32_t *)o->buf) + 1) = htonl(last);
+	o->failed = !sendChunk(o->fd, o->addr, o->buf, o->buf2, o->chunkNo);
+	o->used = 2 * sizeof(int32_t);
+	o->datagrams++;
+}
+
+// Makes room for len bytes of operation, sending the chunk when they do not fit
+void reserve(struct delta_out *o, size_t len)
+{
+	if (o->used + len > MAXBUF)
+		sendDelta(o, 0);
+}
+
+void putWords(struct delta_out *o, int32_t *words, int n)
+{
+	for (int i = 0; i < n; i++)
+		words[i] = htonl(words[i]);
+	memcpy(o->buf + o->used, words, n * sizeof(int32_t)); // Unaligned after a literal
+	o->used += n * sizeof(int32_t);
+}
+
+void flushCopy(struct delta_out *o)
+{
+	int32_t op[3] = { OP_COPY, o->first, o->count };
+	if (0 == o->count)
+		return;
+	reserve(o, sizeof(op));
+	putWords(o, op, 3);
+	o->count = 0;
+}
+
+void emitDelta(int32_t block, const uint8_t *data, size_t len, void *arg)
+{
+	struct delta_out *o = arg;
+	int32_t op[2] = { OP_LITERAL };
+
+	if (block >= 0) {
+		o->reused++;
+		if (o->count > 0 && block == o->first + o->count) {
+			o->count++;
+			return;
+		}
+		flushCopy(o);
+		o->first = block;
+		o->count = 1;
+		return;
+	}
+	flushCopy(o);
+	o->literal += len;
+	while (len > 0) {
+		reserve(o, sizeof(op) + 1);
+		op[0] = OP_LITERAL;
+		op[1] = MAXBUF - o->used - sizeof(op) < len ? MAXBUF - o->used - sizeof(op) : len;
+		putWords(o, op, 2);
+		op[1] = ntohl(op[1]);
+		memcpy(o->buf + o->used, data, op[1]);
+		o->used += op[1];
+		data += op[1];
+		len -= op[1];
+	}
+}
+
+// Fetches the signatures of the server's copy of name and sends what differs from file
+void doDelta(int fd, struct sockaddr_in addr, int file, const char *name)
+{
+	static struct delta_out o;
+	struct delta_index index;
+	struct delta_sig *sigs;
+	int32_t *reply = (int32_t *)o.buf2, *sig, blocks, page, count, i;
+	size_t block_size, last_len;
+	uint64_t hash;
+	struct stat st;
+	uint8_t *data = NULL;
+
+	if (fstat(file, &st) < 0)
+		ERR("fstat");
+	if (st.st_size > 0 && (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0)) == MAP_FAILED)
+		ERR("mmap");
+	hash = delta_strong(DELTA_STRONG_INIT, data, st.st_size);
+	o.fd = fd;
+	o.addr = addr;
+
+	// [0, 1, size, hash, name], the answer [0, 2, block size, blocks, last block length]
+	memset(o.buf, 0, MAXBUF);
+	*(((int32_t *)o.buf) + 1) = htonl(MODE_DELTA);
+	*(((int32_t *)o.buf) + 2) = htonl((uint64_t)st.st_size >> 32);
+	*(((int32_t *)o.buf) + 3) = htonl((uint64_t)st.st_size & 0xffffffff);
+	*(((int32_t *)o.buf) + 4) = htonl(hash >> 32);
+	*(((int32_t *)o.buf) + 5) = htonl(hash & 0xffffffff);
+	strncpy(o.buf + 6 * sizeof(int32_t), name, MAXNAME - 1);
+	if (!sendChunk(fd, addr, o.buf, o.buf2, 0))
+		return;
+	if (ntohl(reply[1]) != DELTA_READY) {
+		fprintf(stderr, "The server does not keep files (start it with -d)\n");
+		return;
+	}
+	blocks = ntohl(reply[3]);
+	block_size = ntohl(reply[2]);
+	last_len = ntohl(reply[4]);
+	if ((sigs = malloc((blocks + 1) * sizeof(struct delta_sig))) == NULL)
+		ERR("malloc");
+
+	// [-(p + 1)] asks for page p, the answer is [-(p + 1), count, weak, strong, ...]
+	for (page = 0, i = 0; i < blocks; page++) {
+		memset(o.buf, 0, MAXBUF);
+		*((int32_t *)o.buf) = htonl(-(page + 1));
+		if (!sendChunk(fd, addr, o.buf, o.buf2, -(page + 1)))
+			goto out;
+		sig = reply + 2;
+		for (count = ntohl(reply[1]); count > 0 && i < blocks; count--, i++, sig += 3) {
+			sigs[i].weak = ntohl(sig[0]);
+			sigs[i].strong = (uint64_t)ntohl(sig[1]) << 32 | ntohl(sig[2]);
+		}
+	}
+	if (delta_index_init(&index, sigs, blocks, block_size, last_len) < 0)
+		ERR("delta_index_init");
+
+	o.used = 2 * sizeof(int32_t);
+	delta_scan(&index, data, st.st_size, emitDelta, &o);
+	flushCopy(&o);
+	sendDelta(&o, 1);
+	if (!o.failed)
+		printf("%s: %d of %d blocks reused, %lld literal bytes, %d datagrams and %d of signatures\n", name,
+		       o.reused, blocks, (long long)o.literal, o.datagrams, page);
+	delta_index_free(&index);
+out:
+	free(sigs);
+	if (data && munmap(data, st.st_size) < 0)
+		ERR("munmap");
+}
+
+// The state of a multicast transfer
+struct group_out {
+	int fd;
+	struct sockaddr_in group;
+	const uint8_t *data;
+	int64_t size;
+	int32_t chunks, transfer, round;
+	int32_t *sent; // round after whose poll each chunk went out last
+	uint64_t *need; // chunks asked for in this round
+	struct sockaddr_in done[MAX_RECEIVERS];
+	int receivers, done_len;
+	struct sockaddr_in nakers[MAX_RECEIVERS];
+	int32_t front[MAX_RECEIVERS]; // the furthest each receiver's first missing chunk has been
+	int32_t lowest[MAX_RECEIVERS], nak_round[MAX_RECEIVERS]; // its first missing chunk in a round
+	int nakers_len;
+	int64_t missing, least_missing; // chunks NAKed in this round, fewest in any round so far
+	int32_t resent, naks, suppressed; // statistics
+};
+
+void sendGroup(struct group_out *g, int32_t *words, size_t len)
+{
+	if (TEMP_FAILURE_RETRY(sendto(g->fd, words, len, 0, &g->group, sizeof(g->group))) < 0)
+		ERR("sendto");
+}
+
+void sendGroupChunk(struct group_out *g, int32_t chunk)
+{
+	int32_t words[MAXBUF / sizeof(int32_t)];
+	int64_t offset = (int64_t)(chunk - 1) * DATA;
+
+	memset(words, 0, sizeof(words));
+	if (0 == chunk) {
+		words[1] = htonl(MODE_MULTICAST);
+		words[2] = htonl((uint64_t)g->size >> 32);
+		words[3] = htonl((uint64_t)g->size & 0xffffffff);
+		words[4] = htonl(g->transfer);
+	} else {
+		words[0] = htonl(chunk);
+		words[1] = htonl(chunk == g->chunks);
+		memcpy(words + 2, g->data + offset, g->size - offset < (int64_t)DATA ? g->size - offset : DATA);
+	}
+	sendGroup(g, words, MAXBUF);
+	g->sent[chunk] = g->round;
+}
+
+// A NAK answering poll round: chunks sent again since that poll are not sent twice, nor are
+// chunks another receiver asked for already. The NAKs of one receiver come in order, the
+// first of a round starts at its first missing chunk.
+void takeNak(struct group_out *g, int32_t *words, ssize_t len, struct sockaddr_in *from)
+{
+	int32_t round = ntohl(words[1]), first = ntohl(words[2]), count = ntohl(words[3]), chunk;
+	int i;
+
+	g->naks++;
+	if (count < 0 || len < (ssize_t)((4 + (count + 31) / 32) * sizeof(int32_t)))
+		return;
+	for (i = 0; i < g->nakers_len && memcmp(from, &g->nakers[i], sizeof(*from)); i++)
+		;
+	if (i == g->nakers_len && i < MAX_RECEIVERS) {
+		g->nakers[g->nakers_len++] = *from;
+		g->front[i] = -1;
+	}
+	if (i < g->nakers_len && (g->nak_round[i] != g->round || first < g->lowest[i])) {
+		g->nak_round[i] = g->round;
+		g->lowest[i] = first;
+	}
+	for (int32_t bit = 0; bit < count; bit++) {
+		if (!(ntohl(words[4 + bit / 32]) & 1u << bit % 32))
+			continue;
+		if ((chunk = first + bit) < 0 || chunk > g->chunks)
+			return;
+		g->missing++;
+		if (g->sent[chunk] >= round || g->need[chunk / 64] & 1ULL << chunk % 64)
+			g->suppressed++;
+		else
+			g->need[chunk / 64] |= 1ULL << chunk % 64;
+	}
+}
+
+int takeDone(struct group_out *g, struct sockaddr_in *from)
+{
+	for (int i = 0; i < g->done_len; i++)
+		if (0 == memcmp(from, &g->done[i], sizeof(*from)))
+			return 0;
+	if (g->done_len < MAX_RECEIVERS)
+		g->done[g->done_len++] = *from;
+	return 1;
+}
+
+// Polls the group and collects the answers for POLL_MS; returns whether any receiver missed a chunk.
+// Progress is a receiver newly done, one whose first missing chunk is further than ever before,
+// or fewer chunks missing than in any round before; a receiver that NAKs the same chunks forever (e.g. its fallocate failed) is none.
+int pollGroup(struct group_out *g, int *progress)
+{
+	int32_t words[MAXBUF / sizeof(int32_t)];
+	struct pollfd pfd = { .fd = g->fd, .events = POLLIN };
+	struct sockaddr_in from;
+	socklen_t size;
+	ssize_t len;
+	int missing = 0, ret;
+
+	words[0] = htonl(GROUP_POLL);
+	words[1] = htonl(++g->round);
+	words[2] = htonl(g->transfer);
+	sendGroup(g, words, 3 * sizeof(int32_t));
+	g->missing = 0;
+	while ((ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, POLL_MS))) > 0) {
+		size = sizeof(from);
+		if ((len = TEMP_FAILURE_RETRY(recvfrom(g->fd, words, sizeof(words), 0, &from, &size))) < 0)
+			ERR("recvfrom");
+		if (len < (ssize_t)(2 * sizeof(int32_t)))
+			continue;
+		if (GROUP_NAK == ntohl(words[0]) && len >= (ssize_t)(4 * sizeof(int32_t))) {
+			takeNak(g, words, len, &from);
+			missing = 1;
+		} else if (GROUP_DONE == ntohl(words[0]))
+			*progress |= takeDone(g, &from);
+	}
+	if (ret < 0)
+		ERR("poll");
+	if (missing && g->missing < g->least_missing) {
+		g->least_missing = g->missing;
+		*progress = 1;
+	}
+	for (int i = 0; i < g->nakers_len; i++)
+		if (g->nak_round[i] == g->round && g->lowest[i] > g->front[i]) {
+			g->front[i] = g->lowest[i];
+			*progress = 1;
+		}
+	return missing;
+}
+
+// Sends the file to the group once, then only what receivers report missing
+int doMulticast(int fd, struct sockaddr_in group, int file, int receivers)
+{
+	static struct group_out g;
+	int32_t words[2], chunk;
+	int quiet = 0, idle = 0, progress, ttl = 1;
+	struct stat st;
+
+	if (fstat(file, &st) < 0)
+		ERR("fstat");
+	if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)))
+		ERR("setsockopt"); // The local network only
+	g.fd = fd;
+	g.group = group;
+	g.size = st.st_size;
+	g.chunks = g.size / DATA + 1; // The last chunk is short, empty when the size is a multiple of DATA
+	g.transfer = getpid() ^ time(NULL);
+	g.receivers = receivers;
+	g.least_missing = INT64_MAX;
+	if (g.size > 0 && (g.data = mmap(NULL, g.size, PROT_READ, MAP_PRIVATE, file, 0)) == MAP_FAILED)
+		ERR("mmap");
+	if ((g.sent = calloc(g.chunks + 1, sizeof(int32_t))) == NULL ||
+	    (g.need = calloc(g.chunks / 64 + 1, sizeof(uint64_t))) == NULL)
+		ERR("calloc");
+
+	for (chunk = 0; chunk <= g.chunks; chunk++)
+		sendGroupChunk(&g, chunk);
+	for (;;) {
+		progress = 0;
+		if (pollGroup(&g, &progress)) {
+			quiet = 0;
+			for (chunk = 0; chunk <= g.chunks; chunk++)
+				if (g.need[chunk / 64] & 1ULL << chunk % 64) {
+					sendGroupChunk(&g, chunk);
+					g.resent++;
+				}
+			memset(g.need, 0, (g.chunks / 64 + 1) * sizeof(uint64_t));
+		} else
+			quiet++;
+		idle = progress ? 0 : idle + 1;
+		if ((receivers > 0 && g.done_len >= receivers) || (0 == receivers && quiet >= QUIET_ROUNDS) ||
+		    idle >= MAX_IDLE_ROUNDS)
+			break;
+	}
+
+	words[0] = htonl(GROUP_END);
+	words[1] = htonl(g.transfer);
+	for (int i = 0; i < 3; i++)
+		sendGroup(&g, words, sizeof(words)); // Receivers forget the transfer, one of three is enough
+	printf("%d chunks sent, %d again, %d NAKs, %d requests suppressed, %d receivers done in %d rounds\n",
+	       g.chunks + 1, g.resent, g.naks, g.suppressed, g.done_len, g.round);
+	if (receivers > 0 && g.done_len < receivers)
+		fprintf(stderr, "Only %d of %d receivers have the file\n", g.done_len, receivers);
+	if (g.data && munmap((void *)g.data, g.size) < 0)
+		ERR("munmap");
+	free(g.sent);
+	free(g.need);
+	return receivers > 0 ? g.done_len >= receivers : 1;
+}
+
 int main(int argc, char **argv)
 {
-	int fd, file; // File descriptors
+	int fd, file, c; // File descriptors, option
 	struct sockaddr_in addr; // Structure variable for socket address
-
-	if (argc != 4) {
+	char *name = NULL; // -u
+	int receivers = -1, ok = 1; // -m
+
+	while ((c = getopt(argc, argv, "u:m:")) != -1) {
+		switch (c) {
+		case 'u':
+			name = optarg;
+			break;
+		case 'm':
+			receivers = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 3 || (name && (strlen(name) >= MAXNAME || strchr(name, '/'))) || (name && receivers >= 0)) {
 		usage(argv[0]); // Display usage information
 		return EXIT_FAILURE; // Return failure if incorrect arguments provided
 	}
+	argv += optind - 1; // Positional arguments as argv[1] to argv[3]
 
 	if (sethandler(SIG_IGN, SIGPIPE))
 		ERR("Seting SIGPIPE:"); // Set SIGPIPE signal handler to ignore
@@ -172,11 +503,16 @@ int main(int argc, char **argv)
 	if ((file = TEMP_FAILURE_RETRY(open(argv[3], O_RDONLY))) < 0)
 		ERR("open:"); // Open the file for reading
 
-	fd = make_socket(); // Create a socket
+	fd = make_socket(PF_INET, SOCK_DGRAM); // Create a socket
 
 	addr = make_address(argv[1], argv[2]); // Create a socket address
 
-	doClient(fd, addr, file); // Perform client operations
+	if (receivers >= 0)
+		ok = doMulticast(fd, addr, file, receivers); // Send once to every receiver in the group
+	else if (name)
+		doDelta(fd, addr, file, name); // Send only what the server's copy lacks
+	else
+		doClient(fd, addr, file); // Perform client operations
 
 	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
 		ERR("close"); // Close the socket
@@ -184,5 +520,5 @@ int main(int argc, char **argv)
 	if (TEMP_FAILURE_RETRY(close(file)) < 0)
 		ERR("close"); // Close the file
 
-	return EXIT_SUCCESS; // Return success
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE; // Return success
 }
\ No newline at end of file
@@ -19,146 +19,667 @@
 // Program serwer jako parametr przyjmuje numer portu na którym będzie pracował, 
 // program klient przyjmuje jako parametry adres i port serwera oraz nazwę pliku.
 
-#define _GNU_SOURCE
-#include <errno.h>
+// With -d directory every transfer is saved to a file of its own instead of being printed.
+// The client announces the size first in chunk 0 ([0, 0, size >> 32, size & 0xffffffff]),
+// the file is allocated up front and each chunk is written in place at its offset, in
+// whatever order it comes, by io_uring from the buffer it was received into (diskio.c).
+// The file is synced once its last chunk is on the way to the disk.
+//
+// A client updating a named file by delta announces [0, 1, size >> 32, size & 0xffffffff,
+// hash >> 32, hash & 0xffffffff, name in int32 words]; the answer [0, 2, block size, blocks,
+// last block length] describes the copy the server keeps, chunk -(p + 1) asks for page p of
+// its block signatures ([-(p + 1), count, weak, strong >> 32, strong & 0xffffffff, ...]).
+// Chunks from 1 on then carry [1, first block, count] copies and [2, length] literals
+// followed by their bytes. They rebuild the file in order next to the old copy, which it
+// replaces once the strong hash of the whole file matches. The old copy is read and the new
+// one written through the ring a block at a time, so a delta chunk (and chunk 0, which reads
+// the signatures) is acknowledged once its work is done, the last one after the rename.
+//
+// With -m group:port the server also joins a multicast group, on which a sender (prog24c -m)
+// sends every chunk once, unacknowledged, after [0, 3, size >> 32, size & 0xffffffff,
+// transfer]. Its polls [-1, round, transfer] are answered with NAKs [-3, round, first chunk,
+// count, bitmap of missing chunks in int32 words] or, once the file is saved, [-4, round];
+// the file is forgotten at [-2, transfer], when the sender is done.
+
+#include "delta.h"
+#include "diskio.h"
+#include "posixnet.h"
+#include "posixnet_err.h"
+#include "reactor.h"
+#include "trace.h"
+
+#include <arpa/inet.h>
 #include <fcntl.h>
-#include <netdb.h>
-#include <netinet/in.h>
 #include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/un.h>
-#include <unistd.h>
-
-#define ERR(source) (perror(source), fprintf(stderr, "%s:%d\n", __FILE__, __LINE__), exit(EXIT_FAILURE))
+#include <sys/stat.h>
 
 #define BACKLOG 3
 #define MAXBUF 576
 #define MAXADDR 5
+#define DATA (MAXBUF - 2 * sizeof(int32_t)) // bytes of the file in one chunk
+#define DISK_BUFFERS 256 // datagrams being written at once, reading stops when all are
+#define MODE_DELTA 1 // second word of chunk 0
+#define DELTA_READY 2 // second word of the answer to it
+#define OP_COPY 1
+#define OP_LITERAL 2
+#define SIGS_PER_PAGE ((MAXBUF - 2 * sizeof(int32_t)) / (3 * sizeof(int32_t)))
+#define MAXNAME 256
+#define MODE_MULTICAST 3
+#define GROUP_POLL (-1)
+#define GROUP_END (-2)
+#define GROUP_NAK (-3)
+#define GROUP_DONE (-4)
+#define NAK_WORDS (MAXBUF / sizeof(int32_t) - 4)
+#define NAK_DATAGRAMS 8 // answering one poll, the next poll brings the rest
+#define GROUP_RCVBUF (4 << 20) // a burst of the sender waits here while the disk catches up
+#define ACK_LATER 2 // save_chunk: accepted, the acknowledgement goes out when the work is done
 
 struct connections {
 	int free;
 	int32_t chunkNo;
 	struct sockaddr_in addr;
+	// -d only, file is -1 until the size is announced
+	int file, slot; // the descriptor and its fixed file slot in the ring
+	int64_t size;
+	int32_t chunks, received, writing; // announced, received so far and still being written
+	uint64_t *have; // bitmap of the received chunks, duplicates are only acknowledged
+	char path[MAXNAME + 64];
+	// delta updates only, basis is the old copy or -1; their files are in the slots of copier
+	int delta, basis, basis_slot;
+	struct delta_sig *sigs;
+	int32_t blocks, sigs_len; // signatures read so far and room for them
+	size_t block_size, last_len;
+	int64_t offset; // rebuilt so far
+	uint64_t hash, expected; // of the whole file
+	char target[MAXNAME + 64];
+	int busy; // a chunk is being applied, or the signatures read for chunk 0
+	int32_t pending, pending_last; // the chunk acknowledged when the work is done
+	char ops[MAXBUF]; // its copies and literals
+	size_t pos; // the next of them
+	int64_t copy_from, copy_left; // bytes of the old copy still to go for the current copy
+	char *piece; // buffer of copier for the read or write in flight
+	int piece_index;
+	// multicast only, the slot stays taken after the file is saved until the sender ends
+	int group, complete;
+	int ended; // the sender gave up while chunks were being written, released by the last one
+	int32_t transfer;
 };
 
-int sethandler(void (*f)(int), int sigNo)
+const char *directory; // -d
+struct diskio *disk;
+struct diskio *copier; // -d, reads and writes of delta updates, a block per buffer
+struct reactor *reactor;
+int sock; // the UDP socket, not read while every disk buffer is in flight
+int group_sock = -1; // -m
+int stalled;
+int saved; // transfers started, numbers the files
+
+void usage(char *name)
 {
-	struct sigaction act;
-	memset(&act, 0, sizeof(struct sigaction));
-	act.sa_handler = f;
-	if (-1 == sigaction(sigNo, &act, NULL))
-		return -1;
-	return 0;
+	fprintf(stderr, "USAGE: %s [-d directory [-m group:port]] port\n", name);
 }
 
-int make_socket(int domain, int type)
+int findIndex(struct sockaddr_in addr, struct connections con[MAXADDR])
 {
-	int sock;
-	sock = socket(domain, type, 0);
-	if (sock < 0)
-		ERR("socket");
-	return sock;
+	int i, empty = -1, pos = -1;
+
+	for (i = 0; i < MAXADDR; i++) {
+		if (con[i].free)
+			empty = i;
+		else if (0 == memcmp(&addr, &(con[i].addr), sizeof(struct sockaddr_in))) {
+			pos = i;
+			break;
+		}
+	}
+
+	if (-1 == pos && empty != -1) {
+		con[empty].free = 0;
+		con[empty].chunkNo = 0;
+		con[empty].addr = addr;
+		pos = empty;
+	}
+
+	return pos; // Return the index of the connection
 }
 
-void usage(char *name)
+void release_file(struct connections *c)
 {
-	fprintf(stderr, "USAGE: %s port\n", name);
+	if (TEMP_FAILURE_RETRY(close(c->file)) < 0)
+		ERR("close");
+	free(c->have);
+	c->have = NULL;
+	c->file = -1;
+	if (c->basis >= 0 && TEMP_FAILURE_RETRY(close(c->basis)) < 0)
+		ERR("close");
+	c->basis = -1;
+	free(c->sigs);
+	c->sigs = NULL;
+	c->delta = c->busy = 0;
+	c->free = 1;
 }
 
-int bind_inet_socket(uint16_t port, int type)
+// The answer to chunk 0 of a delta update describes the blocks of the old copy
+int delta_answer(struct connections *c, int32_t *header)
 {
-	struct sockaddr_in addr; // Structure variable for socket address
-	int socketfd, t = 1; // Socket file descriptor and temporary variable
+	header[1] = htonl(DELTA_READY);
+	header[2] = htonl(c->block_size);
+	header[3] = htonl(c->blocks);
+	header[4] = htonl(c->last_len);
+	return 1;
+}
 
-	socketfd = make_socket(PF_INET, type); // Create a socket using make_socket()
+// The fixed file slots of the transfer; none may have an operation in flight
+void close_slots(struct connections *c)
+{
+	diskio_close(c->delta ? copier : disk, c->slot);
+	if (c->basis_slot >= 0)
+		diskio_close(copier, c->basis_slot);
+	c->basis_slot = -1;
+}
 
-	memset(&addr, 0, sizeof(struct sockaddr_in)); // Clear the socket address structure
-	addr.sin_family = AF_INET; // Set the address family to IPv4
-	addr.sin_port = htons(port); // Set the port in network byte order
-	addr.sin_addr.s_addr = htonl(INADDR_ANY); // Set the IP address to any available
+// The acknowledgement of a delta chunk whose work is done; for chunk 0 the answer describing the old copy
+void delta_ack(struct connections *c)
+{
+	int32_t answer[5];
+	size_t len = 2 * sizeof(int32_t);
+
+	answer[0] = htonl(c->pending);
+	answer[1] = htonl(c->pending_last);
+	if (0 == c->pending) {
+		delta_answer(c, answer);
+		len = sizeof(answer);
+	}
+	c->busy = 0;
+	if (TEMP_FAILURE_RETRY(sendto(sock, answer, len, 0, &c->addr, sizeof(c->addr))) < 0)
+		ERR("sendto");
+}
 
-	if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)))
-		ERR("setsockopt"); // Set socket options (SO_REUSEADDR) to reuse the address
+void synced(struct diskio *d, int res, void *arg)
+{
+	struct connections *c = arg;
+	if (res < 0) {
+		errno = -res;
+		ERR("fsync");
+	}
+	close_slots(c);
+	if (c->delta) {
+		if (rename(c->path, c->target) < 0)
+			ERR("rename");
+		printf("Updated %s, %lld bytes\n", c->target, (long long)c->size);
+		c->chunkNo++;
+		delta_ack(c); // Only now, a push that follows finds the new copy
+	} else
+		printf("Saved %s, %lld bytes\n", c->path, (long long)c->size);
+	release_file(c);
+	if (c->group && c->ended)
+		c->group = c->ended = 0; // The end came already, nobody polls any more
+	else if (c->group) {
+		c->free = 0; // Reported by the answers to polls until the sender ends
+		c->complete = 1;
+	}
+}
 
-	if (bind(socketfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-		ERR("bind"); // Bind the socket to the specified address and port
+void finish_file(struct connections *c)
+{
+	if (c->received == c->chunks && 0 == c->writing)
+		diskio_fsync(disk, c->slot, synced, c);
+}
 
-	if (SOCK_STREAM == type)
-		if (listen(socketfd, BACKLOG) < 0)
-			ERR("listen"); // Listen for incoming connections on a TCP socket
+// The sender of a multicast transfer gave up: the file stays as far as it came
+void end_transfer(struct connections *c)
+{
+	fprintf(stderr, "Transfer to %s ended incomplete\n", c->path);
+	diskio_close(disk, c->slot);
+	release_file(c);
+	c->group = c->complete = c->ended = 0;
+}
 
-	return socketfd; // Return the socket file descriptor
+void written(struct diskio *d, int res, void *arg)
+{
+	struct connections *c = arg;
+	if (res < 0) {
+		errno = -res;
+		ERR("write");
+	}
+	c->writing--;
+	if (stalled) {
+		if (reactor_modify(reactor, sock, REACTOR_READ) < 0 ||
+		    (group_sock >= 0 && reactor_modify(reactor, group_sock, REACTOR_READ) < 0))
+			ERR("reactor_modify");
+		stalled = 0; // A buffer is free again
+	}
+	if (c->ended && 0 == c->writing && c->received < c->chunks)
+		end_transfer(c);
+	else
+		finish_file(c);
 }
 
-ssize_t bulk_write(int fd, char *buf, size_t count)
+// Opens the old copy of the named file, if there is one, and computes its block signatures
+int open_basis(struct connections *c, int32_t *header)
 {
-	int c; // Bytes written in each iteration
-	size_t len = 0; // Total bytes written
+	char *name = (char *)(header + 6);
+	struct stat st;
+
+	if (memchr(name, 0, MAXNAME) == NULL || 0 == name[0] || '.' == name[0] || strchr(name, '/') != NULL)
+		return 0; // Only plain names inside the directory
+	c->delta = 1;
+	c->expected = (uint64_t)ntohl(header[4]) << 32 | ntohl(header[5]);
+	c->hash = DELTA_STRONG_INIT;
+	c->offset = 0;
+	c->blocks = 0;
+	c->last_len = 0;
+	snprintf(c->target, sizeof(c->target), "%s/%s", directory, name);
+	if ((c->basis = TEMP_FAILURE_RETRY(open(c->target, O_RDONLY | O_CLOEXEC))) < 0) {
+		if (ENOENT != errno)
+			ERR("open");
+		c->block_size = delta_block_size(0);
+		return 1; // Everything comes as literals
+	}
+	if (fstat(c->basis, &st) < 0)
+		ERR("fstat");
+	c->block_size = delta_block_size(st.st_size);
+	c->sigs_len = st.st_size / c->block_size + 1;
+	if ((c->sigs = malloc(c->sigs_len * sizeof(struct delta_sig))) == NULL)
+		ERR("malloc");
+	return 1; // The signatures are read once the new file is there, see scan_basis
+}
 
-	do {
-		c = TEMP_FAILURE_RETRY(write(fd, buf, count)); // Write data to the file descriptor
+// One page of the signatures of the old copy, into the answer
+int delta_signatures(struct connections *c, int32_t page, char *buf)
+{
+	int32_t *answer = (int32_t *)buf, first, count;
+
+	// The page comes from the client: check it before multiplying, first must stay inside sigs
+	if (!c->delta || page < 0 || page > c->blocks / (int32_t)SIGS_PER_PAGE)
+		return 0;
+	first = page * (int32_t)SIGS_PER_PAGE;
+	count = c->blocks - first < (int32_t)SIGS_PER_PAGE ? c->blocks - first : (int32_t)SIGS_PER_PAGE;
+	answer[1] = htonl(count);
+	for (int32_t i = 0; i < count; i++) {
+		answer[2 + 3 * i] = htonl(c->sigs[first + i].weak);
+		answer[3 + 3 * i] = htonl(c->sigs[first + i].strong >> 32);
+		answer[4 + 3 * i] = htonl(c->sigs[first + i].strong & 0xffffffff);
+	}
+	return 1;
+}
 
-		if (c < 0)
-			return c; // Error occurred during writing
+void delta_fail(struct connections *c)
+{
+	fprintf(stderr, "Update of %s failed\n", c->target);
+	close_slots(c);
+	if (unlink(c->path) < 0)
+		ERR("unlink");
+	release_file(c); // Not acknowledged, the client gives up after its retries
+}
 
-		buf += c; // Move the buffer pointer
-		len += c; // Update the total bytes written
-		count -= c; // Update the remaining count of bytes to write
+void delta_next(struct connections *c);
 
-	} while (count > 0);
+void put_done(struct diskio *d, int res, void *arg)
+{
+	struct connections *c = arg;
+	if (res < 0) {
+		errno = -res;
+		ERR("write");
+	}
+	delta_next(c);
+}
 
-	return len; // Return total bytes written
+// Writes len bytes of the new copy from the piece buffer, which the write gives back
+int delta_put(struct connections *c, size_t len)
+{
+	if (c->offset + (int64_t)len > c->size) {
+		diskio_release(copier, c->piece_index);
+		return 0;
+	}
+	c->hash = delta_strong(c->hash, c->piece, len);
+	diskio_write(copier, c->slot, c->piece_index, c->piece, len, c->offset, put_done, c);
+	c->offset += len;
+	return 1;
 }
 
-int findIndex(struct sockaddr_in addr, struct connections con[MAXADDR])
+void copied(struct diskio *d, int res, void *arg)
 {
-	int i, empty = -1, pos = -1;
+	struct connections *c = arg;
+	if (res <= 0) {
+		diskio_release(d, c->piece_index); // The old copy shrank under us, or cannot be read
+		delta_fail(c);
+		return;
+	}
+	c->copy_from += res;
+	c->copy_left -= res;
+	if (!delta_put(c, res))
+		delta_fail(c);
+}
 
-	for (i = 0; i < MAXADDR; i++) {
-		if (con[i].free)
-			empty = i;
-		else if (0 == memcmp(&addr, &(con[i].addr), sizeof(struct sockaddr_in))) {
-			pos = i;
+// Takes the next copy or literal of the chunk and starts its read or write; when there are
+// none left the chunk is done. Called again as each read or write completes, so a connection
+// has one operation in flight and a long copy goes a block at a time between other work.
+void delta_next(struct connections *c)
+{
+	int32_t word[3];
+	size_t len;
+
+	// A buffer per connection and one operation each, so there is always one
+	if (c->copy_left > 0) {
+		c->piece = diskio_buffer(copier, &c->piece_index);
+		len = c->copy_left < DELTA_MAX_BLOCK ? c->copy_left : DELTA_MAX_BLOCK;
+		diskio_read(copier, c->basis_slot, c->piece_index, c->piece, len, c->copy_from, copied, c);
+		return;
+	}
+	while (c->pos + sizeof(int32_t) <= MAXBUF) {
+		memcpy(word, c->ops + c->pos, sizeof(int32_t)); // Literals leave the words unaligned
+		switch (ntohl(word[0])) {
+		case 0:
+			c->pos = MAXBUF; // The rest is padding
 			break;
+		case OP_COPY:
+			if (c->pos + sizeof(word) > MAXBUF)
+				goto fail;
+			memcpy(word, c->ops + c->pos, sizeof(word));
+			c->pos += sizeof(word);
+			word[1] = ntohl(word[1]);
+			word[2] = ntohl(word[2]);
+			if (word[1] < 0 || word[2] <= 0 || word[1] > c->blocks - word[2])
+				goto fail;
+			c->copy_from = (int64_t)word[1] * c->block_size;
+			c->copy_left = (int64_t)(word[2] - 1) * c->block_size +
+				       (word[1] + word[2] == c->blocks ? c->last_len : c->block_size);
+			delta_next(c);
+			return;
+		case OP_LITERAL:
+			if (c->pos + 2 * sizeof(int32_t) > MAXBUF)
+				goto fail;
+			memcpy(word, c->ops + c->pos, 2 * sizeof(int32_t));
+			c->pos += 2 * sizeof(int32_t);
+			len = (uint32_t)ntohl(word[1]);
+			if (len > MAXBUF - c->pos)
+				goto fail;
+			c->pos += len;
+			if (0 == len)
+				break;
+			c->piece = diskio_buffer(copier, &c->piece_index);
+			memcpy(c->piece, c->ops + c->pos - len, len);
+			if (!delta_put(c, len))
+				goto fail;
+			return;
+		default:
+			goto fail;
 		}
 	}
+	if (!c->pending_last) {
+		c->chunkNo++;
+		delta_ack(c);
+	} else if (c->offset == c->size && c->hash == c->expected)
+		diskio_fsync(copier, c->slot, synced, c); // Acknowledged after the rename
+	else
+		goto fail;
+	return;
+fail:
+	delta_fail(c);
+}
 
-	if (-1 == pos && empty != -1) {
-		con[empty].free = 0;
-		con[empty].chunkNo = 0;
-		con[empty].addr = addr;
-		pos = empty;
+// Signatures of the old copy, a block per read; chunk 0 is acknowledged when all are there
+void scanned(struct diskio *d, int res, void *arg)
+{
+	struct connections *c = arg;
+	if (res < 0) {
+		diskio_release(d, c->piece_index);
+		errno = -res;
+		perror("read");
+		delta_fail(c);
+		return;
 	}
+	if (res > 0) {
+		c->sigs[c->blocks].weak = delta_weak((uint8_t *)c->piece, res);
+		c->sigs[c->blocks].strong = delta_strong(DELTA_STRONG_INIT, c->piece, res);
+		c->blocks++;
+		c->last_len = res;
+	}
+	if ((size_t)res == c->block_size && c->blocks < c->sigs_len) {
+		diskio_read(d, c->basis_slot, c->piece_index, c->piece, c->block_size, (off_t)c->blocks * c->block_size,
+			    scanned, c);
+		return;
+	}
+	diskio_release(d, c->piece_index); // The end of the old copy
+	delta_ack(c);
+}
 
-	return pos; // Return the index of the connection
+// Chunk 0 of a delta update once the new file is open. Returns what save_chunk does.
+int delta_start(struct connections *c, int32_t *header)
+{
+	if (c->basis < 0)
+		return delta_answer(c, header); // Nothing to read
+	if ((c->basis_slot = diskio_open(copier, c->basis)) < 0)
+		ERR("diskio_open");
+	c->busy = 1;
+	c->pending = c->pending_last = 0;
+	c->piece = diskio_buffer(copier, &c->piece_index);
+	diskio_read(copier, c->basis_slot, c->piece_index, c->piece, c->block_size, 0, scanned, c);
+	return ACK_LATER;
 }
 
-void doServer(int fd)
+// Delta chunks rebuild the file in order, each acknowledged when it has been applied
+int delta_chunk(struct connections *c, int32_t chunkNo, int32_t last, char *buf)
+{
+	if (chunkNo < 0)
+		return !c->busy && delta_signatures(c, -(chunkNo + 1), buf); // No overflow for INT32_MIN
+	if (chunkNo <= c->chunkNo)
+		return 1; // Applied already, the acknowledgement was lost
+	if (c->busy || chunkNo > c->chunkNo + 1)
+		return 0; // A resend of the chunk being applied is answered when it is
+	memcpy(c->ops, buf, MAXBUF);
+	c->pos = 2 * sizeof(int32_t);
+	c->copy_left = 0;
+	c->busy = 1;
+	c->pending = chunkNo;
+	c->pending_last = last;
+	delta_next(c);
+	return ACK_LATER;
+}
+
+// Chunk 0: creates the file and allocates its announced size. Returns 0 when it cannot be stored.
+int open_file(struct connections *c, char *buf)
 {
+	int32_t *header = (int32_t *)buf;
+	char address[INET_ADDRSTRLEN];
+
+	if (c->file >= 0) // The acknowledgement was lost, the file is there already
+		return c->delta ? !c->busy && delta_answer(c, header) : 1;
+	c->size = (int64_t)ntohl(header[2]) << 32 | ntohl(header[3]);
+	if (c->size < 0 || c->size / DATA >= INT32_MAX)
+		return 0;
+	if (MODE_DELTA == ntohl(header[1])) {
+		if (!open_basis(c, header))
+			return 0;
+		snprintf(c->path, sizeof(c->path), "%s/.%s.%d", directory, (char *)(header + 6), ++saved);
+	} else {
+		inet_ntop(AF_INET, &c->addr.sin_addr, address, sizeof(address));
+		snprintf(c->path, sizeof(c->path), "%s/%s-%d-%d", directory, address, ntohs(c->addr.sin_port), ++saved);
+	}
+	if ((c->file = TEMP_FAILURE_RETRY(open(c->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))) < 0)
+		ERR("open");
+	// Blocks are allocated now rather than chunk by chunk, a transfer that cannot fit is refused
+	if (c->size > 0 && fallocate(c->file, 0, 0, c->size) < 0 && EOPNOTSUPP != errno) {
+		perror("fallocate");
+		if (unlink(c->path) < 0)
+			ERR("unlink");
+		release_file(c);
+		return 0;
+	}
+	c->chunks = c->size / DATA + 1; // The last chunk is short, empty when the size is a multiple of DATA
+	c->received = c->writing = 0;
+	c->ended = 0;
+	if ((c->have = calloc((c->chunks + 63) / 64, sizeof(uint64_t))) == NULL)
+		ERR("calloc");
+	if ((c->slot = diskio_open(c->delta ? copier : disk, c->file)) < 0)
+		ERR("diskio_open");
+	return c->delta ? delta_start(c, header) : 1;
+}
+
+// Starts writing the chunk received into buffer index at its offset. Returns 0 when it is not
+// acknowledged, ACK_LATER when it will be, and sets *taken when the buffer went to the write.
+int save_chunk(struct connections *c, int32_t chunkNo, int32_t last, char *buf, int index, int *taken)
+{
+	int64_t offset = (int64_t)(chunkNo - 1) * DATA;
+	size_t len;
+
+	if (0 == chunkNo)
+		return open_file(c, buf);
+	if (c->file < 0) {
+		c->free = 1; // No size announced, nothing to save it to
+		return 0;
+	}
+	if (c->delta)
+		return delta_chunk(c, chunkNo, last, buf);
+	if (chunkNo < 0 || chunkNo > c->chunks)
+		return 0;
+	if (c->have[(chunkNo - 1) / 64] & 1ULL << (chunkNo - 1) % 64)
+		return 1;
+	c->have[(chunkNo - 1) / 64] |= 1ULL << (chunkNo - 1) % 64;
+	c->received++;
+	len = c->size - offset < (int64_t)DATA ? c->size - offset : DATA;
+	if (len > 0) {
+		diskio_write(disk, c->slot, index, buf + 2 * sizeof(int32_t), len, offset, written, c);
+		c->writing++;
+		*taken = 1;
+	}
+	finish_file(c);
+	return 1;
+}
+
+// Which chunks of the transfer are missing, from the first on, in up to NAK_DATAGRAMS bitmaps
+void answer_poll(struct connections *c, int32_t round, int32_t transfer, struct sockaddr_in *sender)
+{
+	int32_t answer[MAXBUF / sizeof(int32_t)], chunk = 1, bit;
+	int n = 0;
+
+	answer[1] = htonl(round);
+	if (c->complete && c->transfer != transfer)
+		c->complete = 0; // A new transfer whose announcement was lost
+	if (c->complete) {
+		answer[0] = htonl(GROUP_DONE);
+		if (TEMP_FAILURE_RETRY(sendto(sock, answer, 2 * sizeof(int32_t), 0, sender, sizeof(*sender))) < 0)
+			ERR("sendto");
+		return;
+	}
+	answer[0] = htonl(GROUP_NAK);
+	if (c->file < 0) {
+		memset(answer + 2, 0, 3 * sizeof(int32_t));
+		answer[3] = htonl(1);
+		answer[4] = htonl(1); // Chunk 0, the announcement
+		if (TEMP_FAILURE_RETRY(sendto(sock, answer, 5 * sizeof(int32_t), 0, sender, sizeof(*sender))) < 0)
+			ERR("sendto");
+		return;
+	}
+	while (n < NAK_DATAGRAMS) {
+		while (chunk <= c->chunks && c->have[(chunk - 1) / 64] & 1ULL << (chunk - 1) % 64)
+			chunk++;
+		if (chunk > c->chunks)
+			return; // Nothing (more) missing, the last writes are on their way
+		memset(answer + 4, 0, NAK_WORDS * sizeof(int32_t));
+		answer[2] = htonl(chunk);
+		for (bit = 0; bit < (int32_t)(32 * NAK_WORDS) && chunk + bit <= c->chunks; bit++)
+			if (!(c->have[(chunk + bit - 1) / 64] & 1ULL << (chunk + bit - 1) % 64))
+				answer[4 + bit / 32] |= 1u << bit % 32;
+		answer[3] = htonl(bit);
+		for (int w = 0; w < (bit + 31) / 32; w++)
+			answer[4 + w] = htonl(answer[4 + w]);
+		if (TEMP_FAILURE_RETRY(sendto(sock, answer, (4 + (bit + 31) / 32) * sizeof(int32_t), 0, sender,
+					      sizeof(*sender))) < 0)
+			ERR("sendto");
+		chunk += bit;
+		n++;
+	}
+}
+
+// A datagram of the multicast group: nothing is acknowledged, gaps are reported when polled
+void from_group(struct connections *c, int32_t chunkNo, int32_t last, char *buf, int index, int *taken,
+		struct sockaddr_in *sender)
+{
+	int32_t *words = (int32_t *)buf;
+
+	c->group = 1;
+	switch (chunkNo) {
+	case GROUP_POLL:
+		answer_poll(c, ntohl(words[1]), ntohl(words[2]), sender);
+		return;
+	case GROUP_END:
+		// Writes in flight or the fsync of a complete file hold the slot: written() or synced() releases it
+		if (c->file >= 0 && ntohl(words[1]) == c->transfer) {
+			if (c->writing > 0 || c->received == c->chunks)
+				c->ended = 1;
+			else
+				end_transfer(c);
+		}
+		if (c->file < 0) {
+			c->group = c->complete = 0;
+			c->free = 1;
+		}
+		return;
+	case 0:
+		if (ntohl(words[1]) != MODE_MULTICAST || (c->complete && ntohl(words[4]) == c->transfer))
+			return; // Saved already, the announcement was resent for another receiver
+		c->complete = 0;
+		c->transfer = ntohl(words[4]);
+		break;
+	default:
+		if (c->file < 0 || chunkNo < 0)
+			return; // The size is not known yet, the next poll asks for the announcement
+	}
+	save_chunk(c, chunkNo, last, buf, index, taken);
+}
+
+void sigint_handler(struct reactor *r, void *arg)
+{
+	reactor_stop(r);
+}
+
+// Called by the reactor when datagrams are waiting; drains the socket without blocking
+void handle_datagrams(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	struct connections *con = arg; // Array of connections
 	struct sockaddr_in addr; // Structure variable for client socket address
-	struct connections con[MAXADDR]; // Array of connections
-	char buf[MAXBUF]; // Buffer for receiving data
-	socklen_t size = sizeof(addr); // Size of client socket address
-	int i; // Loop variable
+	char local[MAXBUF], *buf = local; // Buffer for receiving data, a disk buffer with -d
+	socklen_t size; // Size of client socket address
+	int i; // Index of the connection
+	int index, taken; // Disk buffer received into and whether a write took it
 	int32_t chunkNo, last; // Variables for chunk number and last flag
 
-	for (i = 0; i < MAXADDR; i++)
-		con[i].free = 1; // Initialize connection array
-
 	for (;;) {
-		if (TEMP_FAILURE_RETRY(recvfrom(fd, buf, MAXBUF, 0, &addr, &size) < 0))
+		if (disk && (buf = diskio_buffer(disk, &index)) == NULL) {
+			// Every buffer is being written: leave the datagrams in the socket until one is back
+			if (reactor_modify(r, fd, 0) < 0)
+				ERR("reactor_modify");
+			stalled = 1;
+			return;
+		}
+		taken = 0;
+		size = sizeof(addr);
+		if (TEMP_FAILURE_RETRY(recvfrom(fd, buf, MAXBUF, MSG_DONTWAIT, &addr, &size)) < 0) {
+			if (disk)
+				diskio_release(disk, index);
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				return; // Nothing more to read until the next wakeup
 			ERR("read:"); // Read data from the socket
+		}
 
 		if ((i = findIndex(addr, con)) >= 0) {
+			trace_event(TRACE_FRAME, i); // Events carry the connection slot, UDP has no descriptor per sender
 			chunkNo = ntohl(*((int32_t *)buf)); // Extract chunk number from the received buffer
 			last = ntohl(*(((int32_t *)buf) + 1)); // Extract last flag from the received buffer
 
-			if (chunkNo > con[i].chunkNo + 1)
+			if (fd == group_sock) {
+				from_group(&con[i], chunkNo, last, buf, index, &taken, &addr);
+				if (!taken)
+					diskio_release(disk, index);
+				continue; // Nothing is acknowledged to the group
+			} else if (disk) {
+				if (save_chunk(&con[i], chunkNo, last, buf, index, &taken) != 1) {
+					diskio_release(disk, index);
+					continue; // Not acknowledged (the client gives up after its retries) or not yet
+				}
+			} else if (chunkNo > con[i].chunkNo + 1)
 				continue; // Skip processing if the chunk number is not in sequence
 
 			else if (chunkNo == con[i].chunkNo + 1) {
@@ -170,6 +691,7 @@ void doServer(int fd)
 				}
 				con[i].chunkNo++; // Increment the chunk number for the connection
 			}
+			trace_event(TRACE_COMPUTE, i);
 
 			if (TEMP_FAILURE_RETRY(sendto(fd, buf, MAXBUF, 0, &addr, size)) < 0) {
 				if (EPIPE == errno)
@@ -177,28 +699,103 @@ void doServer(int fd)
 				else
 					ERR("send:"); // Error occurred during sending
 			}
+			trace_event(TRACE_WRITE, i); // Acknowledgement sent
 		}
+		if (disk && !taken)
+			diskio_release(disk, index);
+	}
+}
+
+void doServer(int fd)
+{
+	struct connections con[MAXADDR]; // Array of connections
+	struct reactor *r; // Event loop, backend chosen by POSIXNET_REACTOR
+	int i; // Loop variable
+
+	for (i = 0; i < MAXADDR; i++) {
+		con[i].free = 1; // Initialize connection array
+		con[i].file = con[i].basis = con[i].basis_slot = -1;
+		con[i].have = NULL;
+		con[i].sigs = NULL;
+		con[i].delta = con[i].busy = 0;
+		con[i].group = con[i].complete = 0;
+	}
+
+	if ((r = reactor = reactor_create(NULL)) == NULL)
+		ERR("reactor_create");
+	sock = fd;
+	if (directory && (disk = diskio_create(r, DISK_BUFFERS, MAXBUF, MAXADDR)) == NULL)
+		ERR("diskio_create"); // Registered receive buffers and a fixed file slot per transfer
+	if (directory && (copier = diskio_create(r, MAXADDR, DELTA_MAX_BLOCK, 2 * MAXADDR)) == NULL)
+		ERR("diskio_create"); // A block buffer per transfer and slots for its old and new copy
+	if (reactor_signal(r, SIGINT, sigint_handler, NULL) < 0)
+		ERR("Seting SIGINT:"); // SIGINT ends the server loop
+	if (reactor_signal(r, SIGUSR1, trace_signal_dump, NULL) < 0)
+		ERR("Seting SIGUSR1:"); // SIGUSR1 dumps the event trace (POSIXNET_TRACE) to JSON
+	if (reactor_add(r, fd, REACTOR_READ, handle_datagrams, con) < 0)
+		ERR("reactor_add");
+	if (group_sock >= 0 && reactor_add(r, group_sock, REACTOR_READ, handle_datagrams, con) < 0)
+		ERR("reactor_add");
+	if (reactor_run(r) < 0)
+		ERR("reactor_run");
+	reactor_remove(r, fd);
+	if (group_sock >= 0)
+		reactor_remove(r, group_sock);
+	if (disk) {
+		diskio_destroy(copier);
+		diskio_destroy(disk); // Waits for the writes in flight
+		for (i = 0; i < MAXADDR; i++)
+			if (con[i].file >= 0)
+				release_file(&con[i]); // Unfinished transfers stay as partial files
 	}
+	reactor_destroy(r);
 }
 
 int main(int argc, char **argv)
 {
-	int fd; // File descriptor for the socket
+	int fd, c, size = GROUP_RCVBUF; // File descriptor for the socket, option
+	char *group = NULL, *port; // -m group:port
 
-	if (argc != 2) {
+	while ((c = getopt(argc, argv, "d:m:")) != -1) {
+		switch (c) {
+		case 'd':
+			directory = optarg;
+			break;
+		case 'm':
+			group = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 1 || (group && (!directory || (port = strchr(group, ':')) == NULL))) {
 		usage(argv[0]); // Display usage information
 		return EXIT_FAILURE; // Return failure if incorrect arguments provided
 	}
+	argv += optind - 1; // The port as argv[1]
 
 	if (sethandler(SIG_IGN, SIGPIPE))
 		ERR("Seting SIGPIPE:"); // Set SIGPIPE signal handler to ignore
 
-	fd = bind_inet_socket(atoi(argv[1]), SOCK_DGRAM); // Bind the socket to the specified port
+	if (trace_init() < 0)
+		ERR("trace_init"); // Map the trace rings when POSIXNET_TRACE is set
+
+	fd = bind_inet_socket(atoi(argv[1]), SOCK_DGRAM, BACKLOG); // Bind the socket to the specified port
+
+	if (group) {
+		*port++ = '\0';
+		group_sock = bind_multicast_socket(make_address(group, port));
+		if (setsockopt(group_sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)))
+			ERR("setsockopt");
+	}
 
 	doServer(fd); // Start the server
 
 	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
 		ERR("close"); // Close the socket
+	if (group_sock >= 0 && TEMP_FAILURE_RETRY(close(group_sock)) < 0)
+		ERR("close");
 
 	fprintf(stderr, "Server has terminated.\n"); // Print termination message
 
@@ -0,0 +1,739 @@
+#include "reactor.h"
+#include "uring.h"
+#include "posixnet_err.h"
+
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/signalfd.h>
+#include <time.h>
+
+#define URING_ENTRIES 1024
+#define URING_IGNORE UINT64_MAX // user_data of poll removals, their completions carry nothing
+
+struct reactor_handler {
+	reactor_fd_cb cb;
+	void *arg;
+	uint32_t events;
+	uint32_t gen; // bumped on every registration, guards against reused descriptor numbers
+	uint32_t arm; // io_uring: bumped whenever the outstanding poll is replaced
+	int active;
+	int armed;
+	int pos; // poll: index in the pollfd array
+};
+
+struct reactor_event {
+	int fd;
+	uint32_t events;
+	uint32_t gen;
+};
+
+struct reactor_task {
+	reactor_cb cb;
+	void *arg;
+};
+
+struct reactor_backend {
+	const char *name;
+	int (*init)(struct reactor *r);
+	void (*destroy)(struct reactor *r);
+	int (*add)(struct reactor *r, int fd, uint32_t events);
+	int (*modify)(struct reactor *r, int fd, uint32_t events);
+	int (*remove)(struct reactor *r, int fd);
+	int (*wait)(struct reactor *r, int timeout_ms);
+};
+
+struct reactor {
+	const struct reactor_backend *backend;
+	void *state;
+	struct reactor_handler *handlers;
+	int handlers_len;
+	int fd_count;
+	struct reactor_event *ready;
+	int ready_len, ready_cap;
+	struct reactor_timer **timers;
+	int timers_len, timers_cap;
+	struct reactor_task *tasks, *running;
+	int tasks_len, tasks_cap, running_cap;
+	struct reactor_task prepare;
+	int stop;
+	uint64_t spin_ns; // busy-poll budget before a wait may sleep, 0 to sleep at once
+	int signal_fd;
+	sigset_t signals;
+	struct reactor_task signal_handlers[_NSIG];
+};
+
+static void *grow(void *array, int *cap, int need, size_t size)
+{
+	int n = *cap ? *cap : 16;
+	if (need <= *cap)
+		return array;
+	while (n < need)
+		n *= 2;
+	if ((array = realloc(array, n * size)) == NULL)
+		ERR("realloc");
+	*cap = n;
+	return array;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t now_ms(void)
+{
+	return now_ns() / 1000000;
+}
+
+static void push_ready(struct reactor *r, int fd, uint32_t events)
+{
+	r->ready = grow(r->ready, &r->ready_cap, r->ready_len + 1, sizeof(struct reactor_event));
+	r->ready[r->ready_len].fd = fd;
+	r->ready[r->ready_len].events = events;
+	r->ready[r->ready_len].gen = r->handlers[fd].gen;
+	r->ready_len++;
+}
+
+// select: the fd_sets are rebuilt from the handler table on every wait
+
+static int select_init(struct reactor *r)
+{
+	return 0;
+}
+
+static void select_destroy(struct reactor *r)
+{
+}
+
+static int select_add(struct reactor *r, int fd, uint32_t events)
+{
+	if (fd >= FD_SETSIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+static int select_modify(struct reactor *r, int fd, uint32_t events)
+{
+	return 0;
+}
+
+static int select_remove(struct reactor *r, int fd)
+{
+	return 0;
+}
+
+static int select_wait(struct reactor *r, int timeout_ms)
+{
+	fd_set rfds, wfds;
+	struct timeval tv = { timeout_ms / 1000, timeout_ms % 1000 * 1000 };
+	int max_fd = -1, n;
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	for (int fd = 0; fd < r->handlers_len; fd++) {
+		if (!r->handlers[fd].active)
+			continue;
+		if (r->handlers[fd].events & REACTOR_READ)
+			FD_SET(fd, &rfds);
+		if (r->handlers[fd].events & REACTOR_WRITE)
+			FD_SET(fd, &wfds);
+		max_fd = fd;
+	}
+	if ((n = select(max_fd + 1, &rfds, &wfds, NULL, timeout_ms < 0 ? NULL : &tv)) <= 0)
+		return n < 0 && EINTR != errno ? -1 : 0;
+	for (int fd = 0; fd <= max_fd; fd++) {
+		uint32_t events = (FD_ISSET(fd, &rfds) ? REACTOR_READ : 0) | (FD_ISSET(fd, &wfds) ? REACTOR_WRITE : 0);
+		if (events)
+			push_ready(r, fd, events);
+	}
+	return 0;
+}
+
+// poll: a dense pollfd array, removal moves the last entry into the hole
+
+struct poll_state {
+	struct pollfd *fds;
+	int len, cap;
+};
+
+static short poll_mask(uint32_t events)
+{
+	return (events & REACTOR_READ ? POLLIN : 0) | (events & REACTOR_WRITE ? POLLOUT : 0);
+}
+
+static uint32_t poll_events(short revents)
+{
+	uint32_t events = 0;
+	if (revents & (POLLERR | POLLHUP | POLLNVAL))
+		events |= REACTOR_READ | REACTOR_ERROR;
+	if (revents & POLLIN)
+		events |= REACTOR_READ;
+	if (revents & POLLOUT)
+		events |= REACTOR_WRITE;
+	return events;
+}
+
+static int poll_init(struct reactor *r)
+{
+	if ((r->state = calloc(1, sizeof(struct poll_state))) == NULL)
+		ERR("calloc");
+	return 0;
+}
+
+static void poll_destroy(struct reactor *r)
+{
+	struct poll_state *s = r->state;
+	free(s->fds);
+	free(s);
+}
+
+static int poll_add(struct reactor *r, int fd, uint32_t events)
+{
+	struct poll_state *s = r->state;
+	s->fds = grow(s->fds, &s->cap, s->len + 1, sizeof(struct pollfd));
+	s->fds[s->len].fd = fd;
+	s->fds[s->len].events = poll_mask(events);
+	r->handlers[fd].pos = s->len++;
+	return 0;
+}
+
+static int poll_modify(struct reactor *r, int fd, uint32_t events)
+{
+	struct poll_state *s = r->state;
+	s->fds[r->handlers[fd].pos].events = poll_mask(events);
+	return 0;
+}
+
+static int poll_remove(struct reactor *r, int fd)
+{
+	struct poll_state *s = r->state;
+	int pos = r->handlers[fd].pos;
+	s->fds[pos] = s->fds[--s->len];
+	r->handlers[s->fds[pos].fd].pos = pos;
+	return 0;
+}
+
+static int poll_wait(struct reactor *r, int timeout_ms)
+{
+	struct poll_state *s = r->state;
+	int n;
+	if ((n = poll(s->fds, s->len, timeout_ms)) <= 0)
+		return n < 0 && EINTR != errno ? -1 : 0;
+	for (int i = 0; i < s->len && n > 0; i++) {
+		if (s->fds[i].revents) {
+			push_ready(r, s->fds[i].fd, poll_events(s->fds[i].revents));
+			n--;
+		}
+	}
+	return 0;
+}
+
+// epoll: level-triggered, the kernel keeps the interest set
+
+struct epoll_state {
+	int epfd;
+	struct epoll_event *events;
+	int cap;
+};
+
+static uint32_t epoll_mask(uint32_t events)
+{
+	return (events & REACTOR_READ ? EPOLLIN : 0) | (events & REACTOR_WRITE ? EPOLLOUT : 0);
+}
+
+static int epoll_init(struct reactor *r)
+{
+	struct epoll_state *s;
+	if ((s = r->state = calloc(1, sizeof(struct epoll_state))) == NULL)
+		ERR("calloc");
+	if ((s->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return -1;
+	return 0;
+}
+
+static void epoll_destroy(struct reactor *r)
+{
+	struct epoll_state *s = r->state;
+	close(s->epfd);
+	free(s->events);
+	free(s);
+}
+
+static int epoll_ctl_fd(struct reactor *r, int op, int fd, uint32_t events)
+{
+	struct epoll_state *s = r->state;
+	struct epoll_event ev = { .events = epoll_mask(events), .data.fd = fd };
+	return epoll_ctl(s->epfd, op, fd, &ev);
+}
+
+static int epoll_add(struct reactor *r, int fd, uint32_t events)
+{
+	return epoll_ctl_fd(r, EPOLL_CTL_ADD, fd, events);
+}
+
+static int epoll_modify(struct reactor *r, int fd, uint32_t events)
+{
+	return epoll_ctl_fd(r, EPOLL_CTL_MOD, fd, events);
+}
+
+static int epoll_remove(struct reactor *r, int fd)
+{
+	return epoll_ctl_fd(r, EPOLL_CTL_DEL, fd, 0);
+}
+
+static int epoll_wait_ready(struct reactor *r, int timeout_ms)
+{
+	struct epoll_state *s = r->state;
+	int n;
+	s->events = grow(s->events, &s->cap, r->fd_count > 64 ? r->fd_count : 64, sizeof(struct epoll_event));
+	if ((n = epoll_wait(s->epfd, s->events, s->cap, timeout_ms)) < 0)
+		return EINTR != errno ? -1 : 0;
+	for (int i = 0; i < n; i++) {
+		uint32_t e = s->events[i].events, events = 0;
+		if (e & (EPOLLERR | EPOLLHUP))
+			events |= REACTOR_READ | REACTOR_ERROR;
+		if (e & EPOLLIN)
+			events |= REACTOR_READ;
+		if (e & EPOLLOUT)
+			events |= REACTOR_WRITE;
+		push_ready(r, s->events[i].data.fd, events);
+	}
+	return 0;
+}
+
+// io_uring: one-shot IORING_OP_POLL_ADD per descriptor, re-armed after its callback
+// ran, so the semantics stay level-triggered. Re-arms and changes are batched into the
+// io_uring_enter that waits for the next completions. No liburing, raw syscalls only.
+
+struct uring_state {
+	struct uring ring;
+	int *rearm;
+	int rearm_len, rearm_cap;
+};
+
+static uint64_t uring_tag(struct reactor_handler *h, int fd)
+{
+	return (uint64_t)h->arm << 32 | (uint32_t)fd;
+}
+
+static void uring_arm(struct reactor *r, int fd)
+{
+	struct reactor_handler *h = &r->handlers[fd];
+	struct io_uring_sqe *sqe;
+	if (h->armed || 0 == h->events)
+		return;
+	sqe = uring_sqe(&((struct uring_state *)r->state)->ring);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = poll_mask(h->events);
+	sqe->user_data = uring_tag(h, fd);
+	h->armed = 1;
+}
+
+static void uring_disarm(struct reactor *r, int fd)
+{
+	struct reactor_handler *h = &r->handlers[fd];
+	struct io_uring_sqe *sqe;
+	if (h->armed) {
+		sqe = uring_sqe(&((struct uring_state *)r->state)->ring);
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->addr = uring_tag(h, fd);
+		sqe->user_data = URING_IGNORE;
+		h->armed = 0;
+	}
+	h->arm++;
+}
+
+static int uring_init(struct reactor *r)
+{
+	struct io_uring_params p;
+	struct uring_state *s;
+	if ((s = r->state = calloc(1, sizeof(struct uring_state))) == NULL)
+		ERR("calloc");
+	memset(&p, 0, sizeof(p));
+	if (uring_setup(&s->ring, URING_ENTRIES, &p) < 0)
+		return -1;
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	return 0;
+}
+
+static void uring_destroy(struct reactor *r)
+{
+	struct uring_state *s = r->state;
+	uring_teardown(&s->ring);
+	free(s->rearm);
+	free(s);
+}
+
+static int uring_add(struct reactor *r, int fd, uint32_t events)
+{
+	r->handlers[fd].arm++;
+	uring_arm(r, fd);
+	return 0;
+}
+
+static int uring_modify(struct reactor *r, int fd, uint32_t events)
+{
+	uring_disarm(r, fd);
+	uring_arm(r, fd);
+	return 0;
+}
+
+static int uring_remove(struct reactor *r, int fd)
+{
+	uring_disarm(r, fd);
+	return 0;
+}
+
+static int uring_wait(struct reactor *r, int timeout_ms)
+{
+	struct uring_state *s = r->state;
+	struct __kernel_timespec ts = { timeout_ms / 1000, timeout_ms % 1000 * 1000000LL };
+	struct io_uring_getevents_arg arg = { .ts = timeout_ms < 0 ? 0 : (uint64_t)(uintptr_t)&ts };
+	unsigned head, tail;
+	// Descriptors dispatched in the previous round get their poll back only now
+	for (int i = 0; i < s->rearm_len; i++)
+		if (r->handlers[s->rearm[i]].active)
+			uring_arm(r, s->rearm[i]);
+	s->rearm_len = 0;
+	if (uring_enter(&s->ring, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0 &&
+	    EINTR != errno && ETIME != errno)
+		return -1;
+	head = *s->ring.cq_head;
+	tail = __atomic_load_n(s->ring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &s->ring.cqes[head & *s->ring.cq_mask];
+		int fd = (int)(uint32_t)cqe->user_data;
+		struct reactor_handler *h;
+		uint32_t events;
+		if (URING_IGNORE == cqe->user_data || fd >= r->handlers_len)
+			continue;
+		h = &r->handlers[fd];
+		if (!h->active || !h->armed || uring_tag(h, fd) != cqe->user_data)
+			continue;
+		h->armed = 0;
+		events = cqe->res < 0 ? REACTOR_READ | REACTOR_ERROR : poll_events(cqe->res);
+		push_ready(r, fd, events);
+		s->rearm = grow(s->rearm, &s->rearm_cap, s->rearm_len + 1, sizeof(int));
+		s->rearm[s->rearm_len++] = fd;
+	}
+	__atomic_store_n(s->ring.cq_head, head, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static const struct reactor_backend backends[] = {
+	{ "select", select_init, select_destroy, select_add, select_modify, select_remove, select_wait },
+	{ "poll", poll_init, poll_destroy, poll_add, poll_modify, poll_remove, poll_wait },
+	{ "epoll", epoll_init, epoll_destroy, epoll_add, epoll_modify, epoll_remove, epoll_wait_ready },
+	{ "io_uring", uring_init, uring_destroy, uring_add, uring_modify, uring_remove, uring_wait },
+};
+
+struct reactor *reactor_create(const char *backend)
+{
+	struct reactor *r;
+	if (NULL == backend && NULL == (backend = getenv("POSIXNET_REACTOR")))
+		backend = "epoll";
+	if ((r = calloc(1, sizeof(struct reactor))) == NULL)
+		ERR("calloc");
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+		if (0 == strcmp(backends[i].name, backend))
+			r->backend = &backends[i];
+	r->signal_fd = -1;
+	sigemptyset(&r->signals);
+	if (NULL == r->backend) {
+		free(r);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (r->backend->init(r) < 0) {
+		int saved = errno;
+		if (r->state)
+			r->backend->destroy(r);
+		free(r);
+		errno = saved;
+		return NULL;
+	}
+	return r;
+}
+
+void reactor_destroy(struct reactor *r)
+{
+	if (r->signal_fd >= 0)
+		close(r->signal_fd);
+	r->backend->destroy(r);
+	free(r->handlers);
+	free(r->ready);
+	free(r->timers);
+	free(r->tasks);
+	free(r->running);
+	free(r);
+}
+
+const char *reactor_backend(struct reactor *r)
+{
+	return r->backend->name;
+}
+
+// Descriptors must be removed before they are closed
+int reactor_add(struct reactor *r, int fd, uint32_t events, reactor_fd_cb cb, void *arg)
+{
+	struct reactor_handler *h;
+	if (fd < 0 || (fd < r->handlers_len && r->handlers[fd].active)) {
+		errno = fd < 0 ? EBADF : EEXIST;
+		return -1;
+	}
+	if (fd >= r->handlers_len) {
+		int old = r->handlers_len;
+		r->handlers = grow(r->handlers, &r->handlers_len, fd + 1, sizeof(struct reactor_handler));
+		memset(r->handlers + old, 0, (r->handlers_len - old) * sizeof(struct reactor_handler));
+	}
+	h = &r->handlers[fd];
+	h->cb = cb;
+	h->arg = arg;
+	h->events = events;
+	h->gen++;
+	h->active = 1;
+	h->armed = 0;
+	if (r->backend->add(r, fd, events) < 0) {
+		h->active = 0;
+		return -1;
+	}
+	r->fd_count++;
+	return 0;
+}
+
+int reactor_modify(struct reactor *r, int fd, uint32_t events)
+{
+	if (fd < 0 || fd >= r->handlers_len || !r->handlers[fd].active) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (r->handlers[fd].events == events)
+		return 0;
+	r->handlers[fd].events = events;
+	return r->backend->modify(r, fd, events);
+}
+
+int reactor_remove(struct reactor *r, int fd)
+{
+	if (fd < 0 || fd >= r->handlers_len || !r->handlers[fd].active) {
+		errno = ENOENT;
+		return -1;
+	}
+	r->backend->remove(r, fd);
+	r->handlers[fd].active = 0;
+	r->fd_count--;
+	return 0;
+}
+
+// Timers live in a binary min-heap ordered by deadline
+
+static void heap_place(struct reactor *r, struct reactor_timer *t, int i)
+{
+	r->timers[i] = t;
+	t->index = i;
+}
+
+static void heap_up(struct reactor *r, int i)
+{
+	struct reactor_timer *t = r->timers[i];
+	while (i > 0 && r->timers[(i - 1) / 2]->deadline > t->deadline) {
+		heap_place(r, r->timers[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+	heap_place(r, t, i);
+}
+
+static void heap_down(struct reactor *r, int i)
+{
+	struct reactor_timer *t = r->timers[i];
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= r->timers_len)
+			break;
+		if (child + 1 < r->timers_len && r->timers[child + 1]->deadline < r->timers[child]->deadline)
+			child++;
+		if (r->timers[child]->deadline >= t->deadline)
+			break;
+		heap_place(r, r->timers[child], i);
+		i = child;
+	}
+	heap_place(r, t, i);
+}
+
+void reactor_timer_init(struct reactor_timer *t, reactor_cb cb, void *arg)
+{
+	t->index = -1;
+	t->cb = cb;
+	t->arg = arg;
+}
+
+void reactor_timer_start(struct reactor *r, struct reactor_timer *t, int ms)
+{
+	reactor_timer_stop(r, t);
+	t->deadline = now_ms() + ms;
+	r->timers = grow(r->timers, &r->timers_cap, r->timers_len + 1, sizeof(struct reactor_timer *));
+	heap_place(r, t, r->timers_len++);
+	heap_up(r, t->index);
+}
+
+void reactor_timer_stop(struct reactor *r, struct reactor_timer *t)
+{
+	int i = t->index;
+	if (i < 0)
+		return;
+	t->index = -1;
+	if (i == --r->timers_len)
+		return;
+	t = r->timers[r->timers_len];
+	heap_place(r, t, i);
+	heap_up(r, i);
+	heap_down(r, t->index);
+}
+
+static void expire_timers(struct reactor *r)
+{
+	uint64_t now = now_ms();
+	while (r->timers_len > 0 && r->timers[0]->deadline <= now) {
+		struct reactor_timer *t = r->timers[0];
+		reactor_timer_stop(r, t);
+		t->cb(r, t->arg);
+	}
+}
+
+static void signal_ready(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	struct signalfd_siginfo info;
+	while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+		struct reactor_task *h = &r->signal_handlers[info.ssi_signo];
+		if (h->cb)
+			h->cb(r, h->arg);
+	}
+}
+
+// The signal is blocked in the calling thread and delivered through a signalfd
+int reactor_signal(struct reactor *r, int signo, reactor_cb cb, void *arg)
+{
+	sigset_t one;
+	int fd;
+	sigemptyset(&one);
+	sigaddset(&one, signo);
+	if (pthread_sigmask(SIG_BLOCK, &one, NULL))
+		return -1;
+	sigaddset(&r->signals, signo);
+	if ((fd = signalfd(r->signal_fd, &r->signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		return -1;
+	if (r->signal_fd < 0) {
+		r->signal_fd = fd;
+		if (reactor_add(r, fd, REACTOR_READ, signal_ready, NULL) < 0)
+			return -1;
+	}
+	r->signal_handlers[signo].cb = cb;
+	r->signal_handlers[signo].arg = arg;
+	return 0;
+}
+
+// Runs once, after the callbacks of the current round
+void reactor_defer(struct reactor *r, reactor_cb cb, void *arg)
+{
+	r->tasks = grow(r->tasks, &r->tasks_cap, r->tasks_len + 1, sizeof(struct reactor_task));
+	r->tasks[r->tasks_len].cb = cb;
+	r->tasks[r->tasks_len].arg = arg;
+	r->tasks_len++;
+}
+
+// Runs before every wait, e.g. to flush output gathered during the round
+void reactor_prepare(struct reactor *r, reactor_cb cb, void *arg)
+{
+	r->prepare.cb = cb;
+	r->prepare.arg = arg;
+}
+
+static void run_tasks(struct reactor *r)
+{
+	while (r->tasks_len > 0) {
+		struct reactor_task *tasks = r->tasks;
+		int len = r->tasks_len, cap = r->tasks_cap;
+		// Tasks deferred by these tasks go to the other array
+		r->tasks = r->running;
+		r->tasks_cap = r->running_cap;
+		r->tasks_len = 0;
+		for (int i = 0; i < len; i++)
+			tasks[i].cb(r, tasks[i].arg);
+		r->running = tasks;
+		r->running_cap = cap;
+	}
+}
+
+// One wait and dispatch round. Returns the number of descriptor callbacks run or -1.
+int reactor_run_once(struct reactor *r, int timeout_ms)
+{
+	int dispatched = 0;
+	if (r->prepare.cb) {
+		r->prepare.cb(r, r->prepare.arg);
+		if (r->stop)
+			return 0; // stopped by the prepare callback, do not wait for more
+	}
+	if (r->tasks_len > 0)
+		timeout_ms = 0;
+	if (r->timers_len > 0) {
+		uint64_t now = now_ms(), deadline = r->timers[0]->deadline;
+		int left = deadline > now ? (int)(deadline - now) : 0;
+		if (timeout_ms < 0 || left < timeout_ms)
+			timeout_ms = left;
+	}
+	r->ready_len = 0;
+	if (r->spin_ns > 0 && timeout_ms != 0) {
+		// Poll without sleeping until something is ready or the budget (or timeout) runs out
+		uint64_t start = now_ns(), spun, end = start + r->spin_ns;
+		if (timeout_ms > 0 && start + timeout_ms * 1000000ULL < end)
+			end = start + timeout_ms * 1000000ULL;
+		do {
+			if (r->backend->wait(r, 0) < 0)
+				return -1;
+		} while (0 == r->ready_len && now_ns() < end);
+		spun = (now_ns() - start) / 1000000;
+		if (timeout_ms > 0)
+			timeout_ms = spun < (uint64_t)timeout_ms ? timeout_ms - (int)spun : 0;
+	}
+	if (0 == r->ready_len && r->backend->wait(r, timeout_ms) < 0)
+		return -1;
+	for (int i = 0; i < r->ready_len; i++) {
+		struct reactor_event *ev = &r->ready[i];
+		struct reactor_handler *h = &r->handlers[ev->fd];
+		if (!h->active || h->gen != ev->gen)
+			continue;
+		h->cb(r, ev->fd, ev->events, h->arg);
+		dispatched++;
+	}
+	expire_timers(r);
+	run_tasks(r);
+	return dispatched;
+}
+
+int reactor_run(struct reactor *r)
+{
+	r->stop = 0;
+	while (!r->stop)
+		if (reactor_run_once(r, -1) < 0)
+			return -1;
+	return 0;
+}
+
+void reactor_stop(struct reactor *r)
+{
+	r->stop = 1;
+}
+
+void reactor_busy_poll(struct reactor *r, int usec)
+{
+	r->spin_ns = usec > 0 ? usec * 1000ULL : 0;
+}
@@ -0,0 +1,52 @@
+// Event loop of libposixnet: descriptor readiness, timers, signals and deferred
+// tasks on top of an interchangeable backend (select, poll, epoll or io_uring).
+// The backend is picked when the reactor is created; NULL means the value of the
+// POSIXNET_REACTOR environment variable and, when that is unset, epoll.
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "posixnet.h"
+
+#include <signal.h>
+
+#define REACTOR_READ 1
+#define REACTOR_WRITE 2
+#define REACTOR_ERROR 4 // reported together with REACTOR_READ so that the next read sees the error or EOF
+
+struct reactor;
+
+typedef void (*reactor_fd_cb)(struct reactor *r, int fd, uint32_t events, void *arg);
+typedef void (*reactor_cb)(struct reactor *r, void *arg);
+
+// One-shot timer; the storage belongs to the caller and may be restarted from its own callback
+struct reactor_timer {
+	uint64_t deadline; // CLOCK_MONOTONIC in ms
+	int index; // position in the heap, -1 when not armed
+	reactor_cb cb;
+	void *arg;
+};
+
+struct reactor *reactor_create(const char *backend);
+void reactor_destroy(struct reactor *r);
+const char *reactor_backend(struct reactor *r);
+
+int reactor_add(struct reactor *r, int fd, uint32_t events, reactor_fd_cb cb, void *arg);
+int reactor_modify(struct reactor *r, int fd, uint32_t events);
+int reactor_remove(struct reactor *r, int fd);
+
+void reactor_timer_init(struct reactor_timer *t, reactor_cb cb, void *arg);
+void reactor_timer_start(struct reactor *r, struct reactor_timer *t, int ms);
+void reactor_timer_stop(struct reactor *r, struct reactor_timer *t);
+
+int reactor_signal(struct reactor *r, int signo, reactor_cb cb, void *arg);
+void reactor_defer(struct reactor *r, reactor_cb cb, void *arg);
+void reactor_prepare(struct reactor *r, reactor_cb cb, void *arg);
+
+int reactor_run_once(struct reactor *r, int timeout_ms);
+int reactor_run(struct reactor *r);
+void reactor_stop(struct reactor *r);
+// Waits first poll without sleeping for up to usec (0 turns it off): a core burnt for no wakeup latency
+void reactor_busy_poll(struct reactor *r, int usec);
+
+#endif
@@ -0,0 +1,121 @@
+// Benchmark of the reactor backends: registers n pipes, makes a few of them readable
+// each round and measures the cost of one wait-and-dispatch round as the number of
+// registered descriptors grows.
+
+#include "reactor.h"
+#include "posixnet_err.h"
+
+#include <string.h>
+#include <time.h>
+
+#define MAX_FDS 16384
+
+struct bench_pipe {
+	int rfd;
+	int wfd;
+};
+
+struct bench_pipe pipes[MAX_FDS];
+uint64_t dispatched;
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void on_readable(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	char c;
+	if (TEMP_FAILURE_RETRY(read(fd, &c, 1)) < 0)
+		ERR("read");
+	dispatched++;
+}
+
+void run(const char *backend, int fds, int active, int rounds)
+{
+	struct reactor *r;
+	uint64_t start, elapsed;
+	int next = 0;
+	if ((r = reactor_create(backend)) == NULL) {
+		fprintf(stderr, "%s: %s\n", backend, strerror(errno));
+		return;
+	}
+	for (int i = 0; i < fds; i++) {
+		if (reactor_add(r, pipes[i].rfd, REACTOR_READ, on_readable, NULL) < 0) {
+			printf("%-9s %7d %7d %12s\n", backend, fds, active, "unsupported");
+			for (int j = 0; j < i; j++)
+				reactor_remove(r, pipes[j].rfd);
+			reactor_destroy(r);
+			return;
+		}
+	}
+	dispatched = 0;
+	start = now_ns();
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < active; i++) {
+			if (TEMP_FAILURE_RETRY(write(pipes[next].wfd, "x", 1)) < 0)
+				ERR("write");
+			next = (next + 1) % fds;
+		}
+		// Drain until every written byte went through a callback
+		for (uint64_t target = dispatched + active; dispatched < target;)
+			if (reactor_run_once(r, -1) < 0)
+				ERR("reactor_run_once");
+	}
+	elapsed = now_ns() - start;
+	printf("%-9s %7d %7d %12.0f %12.0f\n", backend, fds, active, (double)elapsed / rounds,
+	       (double)elapsed / dispatched);
+	for (int i = 0; i < fds; i++)
+		reactor_remove(r, pipes[i].rfd);
+	reactor_destroy(r);
+}
+
+void usage(char *name)
+{
+	fprintf(stderr, "USAGE: %s [-b backend] [-n max_fds] [-a active_per_round] [-r rounds]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *all[] = { "select", "poll", "epoll", "io_uring" };
+	const char *only = NULL;
+	int max_fds = 4096, active = 1, rounds = 20000, c;
+	while ((c = getopt(argc, argv, "b:n:a:r:")) != -1) {
+		switch (c) {
+		case 'b':
+			only = optarg;
+			break;
+		case 'n':
+			max_fds = atoi(optarg);
+			break;
+		case 'a':
+			active = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_fds < 1 || max_fds > MAX_FDS || active < 1 || active > max_fds || rounds < 1)
+		usage(argv[0]);
+	raise_fd_limit();
+	for (int i = 0; i < max_fds; i++) {
+		int p[2];
+		if (pipe(p) < 0)
+			ERR("pipe");
+		pipes[i].rfd = p[0];
+		pipes[i].wfd = p[1];
+	}
+	printf("%-9s %7s %7s %12s %12s\n", "backend", "fds", "active", "ns/round", "ns/event");
+	for (int fds = 16; fds <= max_fds; fds *= 4) {
+		for (size_t b = 0; b < sizeof(all) / sizeof(all[0]); b++)
+			if (NULL == only || 0 == strcmp(only, all[b]))
+				run(all[b], fds, active < fds ? active : fds, rounds);
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,25 +1,168 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <fcntl.h>
+
+#include "reactor.h"
+#include "slab.h"
+#include "trace.h"
+#include "wheel.h"
 
 
 #define MAX_PACKET_SIZE 128
+#define MAX_HOSTS 8
+#define BROADCAST_ADDRESS 9
+#define PUBLISH_ADDRESS 10
+#define UNREGISTERED_ADDRESS 63  // Odbiorca odpowiedzi routera dla hosta, który nie ma jeszcze adresu
+
+// Ramka hosta: [odbiorca | priorytet << 6, nadawca, długość danych, dane]
+#define FRAME_HEADER 3
+#define ADDRESS_MASK 0x3F
+#define PRIO_SHIFT 6
+#define HOST_BUF_SIZE 1024
+
+// Klasy ruchu; 0 to domyślna klasa starych klientów
+#define PRIO_NORMAL 0
+#define PRIO_CONTROL 1
+#define PRIO_BULK 2
+#define NUM_CLASSES 3
+#define NORMAL_WEIGHT 4          // Tyle ramek NORMAL na jedną ramkę BULK przy nasyceniu
+#define DRR_QUANTUM 256          // Bajty przyznawane nadawcy w jednej rundzie DRR, >= MAX_PACKET_SIZE
+#define SENDER_QUEUE_LIMIT 64    // Po przekroczeniu przestajemy czytać od nadawcy
+#define OUT_BATCH 1024
+#define HOST_SNDBUF 16384        // Mały bufor jądra, by kolejkowanie (i priorytety) działo się w routerze
+
+// Limity czasu hostów w ms (koło czasowe o rozdzielczości TICK_MS)
+#define TICK_MS 100
+#define IDLE_TIMEOUT 120000      // Zarejestrowany host bez subskrypcji nic nie wysyła ani nie odbiera
+#define HEADER_TIMEOUT 5000      // Brak rejestracji albo niedokończona ramka
+#define WRITE_TIMEOUT 10000      // Host nie odbiera, a czekają dla niego ramki
+
+// Polecenia w wiadomości do routera: [0, adres nadawcy, długość, polecenie, długość tematu, temat]
+#define CMD_REGISTER 0
+#define CMD_SUBSCRIBE 1
+#define CMD_UNSUBSCRIBE 2
+
+#define MAX_TOPICS 256  // Potęga dwójki, rozmiar tablicy haszującej
+#define MAX_TOPIC_LEN 32
+#define ANNOUNCE_SIZE (1 + (MAX_TOPICS - 1) * (1 + MAX_TOPIC_LEN))  // Maska adresów i wszystkie tematy
+
+#define MAX_PEERS 8
+#define MAX_ORIGINS 64  // Najwyżej 64: tyle bitów ma maska Topic.remote
+#define PEER_BUF_SIZE 65536
+#define PEER_MAX_TTL 8
+#define DEDUP_WINDOW 64
+#define RECONNECT_INTERVAL 1
+
+// Typy ramek przesyłanych między routerami
+#define PEER_HELLO 1
+#define PEER_ANNOUNCE 2
+#define PEER_FRAME 3
+
+// Nadawcy w kolejkach: sloty hostów, potem peery, na końcu sam router (odpowiedzi)
+#define MAX_SENDERS (MAX_HOSTS + MAX_PEERS + 1)
+#define ROUTER_SENDER (MAX_SENDERS - 1)
+
+// Wpis kolejki hosta; treść ramki jest wspólna dla wszystkich odbiorców (rozgłoszenie to jedna alokacja)
+typedef struct Frame {
+    struct Frame* next;
+    int sender;                  // -1 gdy nadawca odszedł: ramka nie liczy się już do sender_queued
+    struct slab_buf* payload;
+} Frame;
+
+// Kolejka jednego nadawcy w jednej klasie, obsługiwana algorytmem deficit round robin
+typedef struct {
+    Frame* head;
+    Frame* tail;
+    int deficit;
+} Flow;
+
+// Kolejka wyjściowa hosta: osobne przepływy dla każdej pary (klasa, nadawca)
+typedef struct {
+    Flow flows[NUM_CLASSES][MAX_SENDERS];
+    int count[NUM_CLASSES];
+    int cursor[NUM_CLASSES];
+    int granted[NUM_CLASSES];    // Czy przepływ pod kursorem dostał już kwant w tej rundzie
+    int normal_credit;
+    char* out;                   // OUT_BATCH bajtów ze slaba, tylko gdy są ramki do wysłania
+    size_t out_off;
+    size_t out_len;
+} OutQueue;
 
 typedef struct {
     int address;
     int socket;
+    char* in;                    // HOST_BUF_SIZE bajtów ze slaba, tylko gdy czeka niepełna ramka
+    size_t in_len;
+    OutQueue queue;
+    int stalled;                 // Gniazdo pełne, limit czasu liczy brak postępu zapisu
+    int subscriptions;           // Liczba tematów subskrybowanych przez hosta
+    struct wheel_timer timer;
 } Host;
 
+// Nagłówek ramki na łączu router-router, wszystkie pola w kolejności sieciowej
+typedef struct {
+    uint8_t type;
+    uint8_t ttl;
+    uint16_t length;  // Długość danych za nagłówkiem
+    uint32_t origin;  // Id routera, który wysłał ramkę jako pierwszy
+    uint32_t seq;     // Numer sekwencyjny nadany przez router źródłowy
+} __attribute__((packed)) PeerHeader;
+
+typedef struct {
+    int socket;
+    int outgoing;              // 1 jeśli to my łączymy się z peerem (i ponawiamy połączenie)
+    struct sockaddr_in addr;
+    uint32_t id;               // Id routera po drugiej stronie, 0 do czasu otrzymania HELLO
+    char in[PEER_BUF_SIZE];
+    size_t in_len;
+    char out[PEER_BUF_SIZE];   // Ramki czekające na wysłanie jednym write()
+    size_t out_len;
+    int connecting;            // Nieblokujący connect() w toku, czekamy na gotowość do zapisu
+} Peer;
+
+// Stan znanego routera źródłowego: okno deduplikacji i ostatnie ogłoszenie adresów
+typedef struct {
+    uint32_t id;
+    uint32_t max_seq;
+    uint64_t seen;             // Bit i oznacza, że widzieliśmy numer max_seq - i
+    uint32_t announce_seq;
+    uint8_t addresses;         // Bit a - 1 oznacza, że host o adresie a jest podłączony do tego routera
+    int via;                   // Peer, przez którego dotarło ogłoszenie (-1 gdy brak trasy)
+} Origin;
+
+// Wpis indeksu tematów: kto subskrybuje temat tu i za innymi routerami; wpis bez nikogo jest usuwany
+typedef struct {
+    char name[MAX_TOPIC_LEN + 1];
+    uint8_t subscribers;         // Maska slotów lokalnych hostów
+    uint64_t remote;             // Bit i oznacza, że origins[i] ma subskrybentów tematu
+} Topic;
+
 Host hosts[8];  // Tablica przechowująca informacje o hostach
+Topic topics[MAX_TOPICS];
+int topic_count = 0;
+int sender_queued[MAX_SENDERS];  // Ramki nadawcy czekające jeszcze w kolejkach
+Peer peers[MAX_PEERS];
+int peer_count = 0;
+Origin origins[MAX_ORIGINS];
+int origin_count = 0;
+uint32_t router_id;
+uint32_t local_seq = 0;
+struct reactor* reactor;  // Pętla zdarzeń; backend wybiera zmienna POSIXNET_REACTOR
+struct reactor_timer reconnect_timer;
+struct timer_wheel wheel;  // Limity czasu hostów
 
 int create_socket(const char* address, int port) {
-    int sockfd;
+    int sockfd, t = 1;
     struct sockaddr_in server_addr;
 
     if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -35,6 +178,11 @@ int create_socket(const char* address, int port) {
         exit(EXIT_FAILURE);
     }
 
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)) < 0) {
+        perror("setsockopt");
+        exit(EXIT_FAILURE);
+    }
+
     if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("bind");
         exit(EXIT_FAILURE);
@@ -45,123 +193,1046 @@ int create_socket(const char* address, int port) {
         exit(EXIT_FAILURE);
     }
 
+    // add_new_client nie może zablokować pętli zdarzeń na pustej kolejce połączeń
+    if (set_nonblock(sockfd) < 0) {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+
     return sockfd;
 }
 
-void handle_host_message(int host_socket) {
-    char buffer[MAX_PACKET_SIZE];
-    ssize_t bytes_read = read(host_socket, buffer, sizeof(buffer));
+// Slot hosta zarejestrowanego pod danym adresem albo -1
+int find_host(int address) {
+    for (int i = 0; i < MAX_HOSTS; i++) {
+        if (hosts[i].socket != -1 && hosts[i].address == address) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint8_t local_addresses(void) {
+    uint8_t mask = 0;
+    for (int i = 0; i < MAX_HOSTS; i++) {
+        if (hosts[i].socket != -1 && hosts[i].address != 0) {
+            mask |= 1 << (hosts[i].address - 1);
+        }
+    }
+    return mask;
+}
+
+uint32_t topic_hash(const char* name, int length) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Wyszukuje temat w tablicy z adresowaniem otwartym; przy create dodaje brakujący wpis
+Topic* find_topic(const char* name, int length, int create) {
+    uint32_t i = topic_hash(name, length) & (MAX_TOPICS - 1);
+    for (int probe = 0; probe < MAX_TOPICS; probe++, i = (i + 1) & (MAX_TOPICS - 1)) {
+        if (topics[i].name[0] == '\0') {
+            if (!create || topic_count == MAX_TOPICS - 1) {
+                return NULL;
+            }
+            memcpy(topics[i].name, name, length);
+            topics[i].name[length] = '\0';
+            topic_count++;
+            return &topics[i];
+        }
+        if ((int)strlen(topics[i].name) == length && memcmp(topics[i].name, name, length) == 0) {
+            return &topics[i];
+        }
+    }
+    return NULL;
+}
+
+// Usuwa wpis i przesuwa w jego miejsce dalsze wpisy łańcucha, więc wyszukiwanie nie potrzebuje nagrobków
+void remove_topic(uint32_t i) {
+    uint32_t j = i;
+    topic_count--;
+    for (;;) {
+        memset(&topics[i], 0, sizeof(Topic));
+        for (;;) {
+            j = (j + 1) & (MAX_TOPICS - 1);
+            if (topics[j].name[0] == '\0') {
+                return;
+            }
+            uint32_t home = topic_hash(topics[j].name, strlen(topics[j].name)) & (MAX_TOPICS - 1);
+            // Wpis z j może zająć dziurę i, jeśli i leży między jego miejscem docelowym a j
+            if (((j - home) & (MAX_TOPICS - 1)) >= ((j - i) & (MAX_TOPICS - 1))) {
+                break;
+            }
+        }
+        topics[i] = topics[j];
+        i = j;
+    }
+}
+
+// Zwalnia wpisy tematów, których nikt już nie subskrybuje
+void purge_topics(void) {
+    for (uint32_t i = 0; i < MAX_TOPICS; i++) {
+        // Po usunięciu na miejsce i może trafić kolejny wpis, więc sprawdzamy je ponownie
+        while (topics[i].name[0] != '\0' && topics[i].subscribers == 0 && topics[i].remote == 0) {
+            remove_topic(i);
+        }
+    }
+}
+
+// Zwraca 1, jeśli któryś temat stracił ostatniego lokalnego subskrybenta
+int unsubscribe_all(int slot) {
+    int changed = 0;
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        if (topics[i].subscribers == 1 << slot) {
+            changed = 1;
+        }
+        topics[i].subscribers &= ~(1 << slot);
+    }
+    hosts[slot].subscriptions = 0;
+    purge_topics();
+    return changed;
+}
+
+// Tematy z subskrybentami lokalnymi (origin == -1) albo routera origins[origin]: [długość, nazwa] po kolei
+int topic_list(int origin, char* out) {
+    int length = 0;
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        if (origin == -1 ? topics[i].subscribers != 0 : (topics[i].remote & (1ULL << origin)) != 0) {
+            int name_len = strlen(topics[i].name);
+            out[length] = name_len;
+            memcpy(out + length + 1, topics[i].name, name_len);
+            length += 1 + name_len;
+        }
+    }
+    return length;
+}
+
+// Ogłoszenie routera zastępuje wszystkie jego wcześniejsze tematy
+void set_remote_topics(int origin, const char* list, int length) {
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        topics[i].remote &= ~(1ULL << origin);
+    }
+    for (int off = 0; off < length; ) {
+        int name_len = (uint8_t)list[off];
+        Topic* topic;
+        if (name_len == 0 || name_len > MAX_TOPIC_LEN || off + 1 + name_len > length) {
+            break;
+        }
+        // Przy pełnej tablicy temat przepada; jego publikacje nie dotrą do tamtego routera
+        if ((topic = find_topic(list + off + 1, name_len, 1)) != NULL) {
+            topic->remote |= 1ULL << origin;
+        }
+        off += 1 + name_len;
+    }
+    purge_topics();
+}
+
+Origin* find_origin(uint32_t id) {
+    for (int i = 0; i < origin_count; i++) {
+        if (origins[i].id == id) {
+            return &origins[i];
+        }
+    }
+    if (origin_count == MAX_ORIGINS) {
+        return NULL;
+    }
+    Origin* o = &origins[origin_count++];
+    memset(o, 0, sizeof(*o));
+    o->id = id;
+    o->via = -1;
+    return o;
+}
+
+// Zwraca 1 jeśli ramka (origin, seq) była już widziana, w przeciwnym razie zapamiętuje ją
+int seen_before(Origin* o, uint32_t seq) {
+    if (seq > o->max_seq) {
+        uint32_t shift = seq - o->max_seq;
+        o->seen = shift >= DEDUP_WINDOW ? 0 : o->seen << shift;
+        o->seen |= 1;
+        o->max_seq = seq;
+        return 0;
+    }
+    uint32_t diff = o->max_seq - seq;
+    if (diff >= DEDUP_WINDOW || (o->seen & (1ULL << diff))) {
+        return 1;
+    }
+    o->seen |= 1ULL << diff;
+    return 0;
+}
+
+// Peer, przez którego osiągalny jest zdalny host o danym adresie, albo -1
+int remote_route(int address) {
+    for (int i = 0; i < origin_count; i++) {
+        if (origins[i].via != -1 && (origins[i].addresses & (1 << (address - 1)))) {
+            return origins[i].via;
+        }
+    }
+    return -1;
+}
+
+// Slot nadawcy się zwalnia: jego ramki nadal czekają na doręczenie, ale nowy host
+// lub peer w tym slocie zaczyna z zerowym licznikiem
+void forget_sender(int sender) {
+    for (int i = 0; i < MAX_HOSTS; i++) {
+        for (int prio = 0; prio < NUM_CLASSES; prio++) {
+            for (Frame* frame = hosts[i].queue.flows[prio][sender].head; frame != NULL; frame = frame->next) {
+                frame->sender = -1;
+            }
+        }
+    }
+    sender_queued[sender] = 0;
+}
+
+void close_peer(int p) {
+    reactor_remove(reactor, peers[p].socket);
+    close(peers[p].socket);
+    peers[p].socket = -1;
+    peers[p].connecting = 0;
+    peers[p].id = 0;
+    peers[p].in_len = 0;
+    peers[p].out_len = 0;
+    forget_sender(MAX_HOSTS + p);
+    // Trasy i tematy prowadzące przez zamknięte łącze przestają być ważne
+    for (int i = 0; i < origin_count; i++) {
+        if (origins[i].via == p) {
+            origins[i].via = -1;
+            origins[i].addresses = 0;
+            set_remote_topics(i, NULL, 0);
+        }
+    }
+}
+
+// Wysyła tyle, ile przyjmie gniazdo; reszta czeka w buforze na gotowość do zapisu
+void flush_peer(int p) {
+    size_t off = 0;
+    if (peers[p].socket == -1 || peers[p].connecting || peers[p].out_len == 0) {
+        return;
+    }
+    while (off < peers[p].out_len) {
+        ssize_t c = write(peers[p].socket, peers[p].out + off, peers[p].out_len - off);
+        if (c < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            perror("write to peer");
+            close_peer(p);
+            return;
+        }
+        off += c;
+    }
+    memmove(peers[p].out, peers[p].out + off, peers[p].out_len - off);
+    peers[p].out_len -= off;
+}
+
+// Dopisuje ramkę do bufora peera; bufor jest wysyłany zbiorczo na końcu obrotu pętli
+void peer_send(int p, uint8_t type, uint8_t ttl, uint32_t origin, uint32_t seq, const char* data, uint16_t length) {
+    PeerHeader header;
+    if (peers[p].socket == -1 || peers[p].connecting) {
+        return;
+    }
+    if (peers[p].out_len + sizeof(header) + length > PEER_BUF_SIZE) {
+        flush_peer(p);
+        if (peers[p].socket == -1) {
+            return;
+        }
+        if (peers[p].out_len + sizeof(header) + length > PEER_BUF_SIZE) {
+            // Peer nic nie odbiera: zrywamy łącze, po ponownym zestawieniu ogłoszenia odtworzą trasy
+            fprintf(stderr, "Peer link stalled, closing it\n");
+            close_peer(p);
+            return;
+        }
+    }
+    header.type = type;
+    header.ttl = ttl;
+    header.length = htons(length);
+    header.origin = htonl(origin);
+    header.seq = htonl(seq);
+    memcpy(peers[p].out + peers[p].out_len, &header, sizeof(header));
+    if (length > 0) {
+        memcpy(peers[p].out + peers[p].out_len + sizeof(header), data, length);
+    }
+    peers[p].out_len += sizeof(header) + length;
+}
+
+// Rozsyła ramkę do wszystkich peerów poza tym, od którego przyszła
+void peer_flood(int except, uint8_t type, uint8_t ttl, uint32_t origin, uint32_t seq, const char* data, uint16_t length) {
+    for (int i = 0; i < peer_count; i++) {
+        if (i != except && peers[i].id != 0) {
+            peer_send(i, type, ttl, origin, seq, data, length);
+        }
+    }
+}
+
+// PUBLISH idzie tylko do peerów, za którymi są routery z subskrybentami tematu
+void peer_publish(int except, uint8_t ttl, uint32_t origin, uint32_t seq, const char* data, uint16_t length) {
+    int topic_len = length > FRAME_HEADER ? (uint8_t)data[FRAME_HEADER] : 0;
+    unsigned targets = 0;
+    Topic* topic;
+    if (topic_len == 0 || topic_len > MAX_TOPIC_LEN || length < FRAME_HEADER + 1 + topic_len ||
+        (topic = find_topic(data + FRAME_HEADER + 1, topic_len, 0)) == NULL) {
+        return;
+    }
+    for (int i = 0; i < origin_count; i++) {
+        if ((topic->remote & (1ULL << i)) && origins[i].via != -1 && origins[i].via != except) {
+            targets |= 1u << origins[i].via;
+        }
+    }
+    for (int i = 0; i < peer_count; i++) {
+        if ((targets & (1u << i)) && peers[i].id != 0) {
+            peer_send(i, PEER_FRAME, ttl, origin, seq, data, length);
+        }
+    }
+}
+
+// Ogłoszenie: [maska adresów, długość tematu, temat, ...] z tematami, które mają tu subskrybentów
+void announce_local(void) {
+    char announce[ANNOUNCE_SIZE];
+    announce[0] = local_addresses();
+    int length = 1 + topic_list(-1, announce + 1);
+    peer_flood(-1, PEER_ANNOUNCE, PEER_MAX_TTL, router_id, ++local_seq, announce, length);
+}
+
+// Po zestawieniu łącza wysyłamy HELLO, nasze adresy i tematy oraz znane ogłoszenia innych routerów
+void peer_established(int p) {
+    char announce[ANNOUNCE_SIZE];
+    int length;
+    peer_send(p, PEER_HELLO, 1, router_id, 0, NULL, 0);
+    announce[0] = local_addresses();
+    length = 1 + topic_list(-1, announce + 1);
+    peer_send(p, PEER_ANNOUNCE, PEER_MAX_TTL, router_id, ++local_seq, announce, length);
+    for (int i = 0; i < origin_count; i++) {
+        if (origins[i].via != -1 && origins[i].via != p) {
+            announce[0] = origins[i].addresses;
+            length = 1 + topic_list(i, announce + 1);
+            peer_send(p, PEER_ANNOUNCE, PEER_MAX_TTL, origins[i].id, origins[i].announce_seq, announce, length);
+        }
+    }
+}
+
+int frame_class(const char* frame) {
+    int prio = (uint8_t)frame[0] >> PRIO_SHIFT;
+    return prio >= NUM_CLASSES ? PRIO_BULK : prio;
+}
+
+void* router_alloc(size_t size) {
+    void* p = slab_alloc(size);
+    if (p == NULL) {
+        perror("slab_alloc");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+struct slab_buf* make_payload(const char* buffer, int length) {
+    struct slab_buf* payload = slab_buf_new(MAX_PACKET_SIZE);
+    if (payload == NULL) {
+        perror("slab_buf_new");
+        exit(EXIT_FAILURE);
+    }
+    payload->length = length;
+    memcpy(payload->data, buffer, length);
+    return payload;
+}
+
+void release_frame(Frame* frame) {
+    if (frame->sender != -1) {
+        sender_queued[frame->sender]--;
+    }
+    slab_buf_unref(frame->payload);
+    slab_free(frame, sizeof(Frame));
+}
+
+void enqueue_frame(int slot, int prio, int sender, struct slab_buf* payload) {
+    Frame* frame = router_alloc(sizeof(Frame));
+    frame->next = NULL;
+    frame->sender = sender;
+    frame->payload = slab_buf_ref(payload);
+
+    Flow* flow = &hosts[slot].queue.flows[prio][sender];
+    if (flow->tail != NULL) {
+        flow->tail->next = frame;
+    } else {
+        flow->head = frame;
+    }
+    flow->tail = frame;
+    hosts[slot].queue.count[prio]++;
+    sender_queued[sender]++;
+}
+
+// Kolejna ramka klasy wg DRR: każdy nadawca dostaje kwant bajtów na rundę
+Frame* drr_next(OutQueue* q, int prio) {
+    for (;;) {
+        Flow* flow = &q->flows[prio][q->cursor[prio]];
+        if (flow->head != NULL) {
+            if (!q->granted[prio]) {
+                flow->deficit += DRR_QUANTUM;
+                q->granted[prio] = 1;
+            }
+            if (flow->deficit >= (int)flow->head->payload->length) {
+                Frame* frame = flow->head;
+                flow->deficit -= frame->payload->length;
+                if ((flow->head = frame->next) == NULL) {
+                    flow->tail = NULL;
+                    flow->deficit = 0;
+                }
+                q->count[prio]--;
+                return frame;
+            }
+        }
+        q->cursor[prio] = (q->cursor[prio] + 1) % MAX_SENDERS;
+        q->granted[prio] = 0;
+    }
+}
+
+// Klasa sterująca ma pierwszeństwo, NORMAL i BULK dzielą łącze w proporcji NORMAL_WEIGHT:1
+Frame* dequeue_frame(OutQueue* q) {
+    if (q->count[PRIO_CONTROL] > 0) {
+        return drr_next(q, PRIO_CONTROL);
+    }
+    if (q->count[PRIO_NORMAL] > 0 && (q->normal_credit > 0 || q->count[PRIO_BULK] == 0)) {
+        if (q->normal_credit > 0) {
+            q->normal_credit--;
+        }
+        return drr_next(q, PRIO_NORMAL);
+    }
+    if (q->count[PRIO_BULK] > 0) {
+        q->normal_credit = NORMAL_WEIGHT;
+        return drr_next(q, PRIO_BULK);
+    }
+    return NULL;
+}
+
+int queue_pending(OutQueue* q) {
+    return q->out_len > q->out_off || q->count[PRIO_CONTROL] + q->count[PRIO_NORMAL] + q->count[PRIO_BULK] > 0;
+}
+
+// Limit czasu czytania: rejestracja i dokończenie ramki są krótkie, bezczynność długa.
+// Host z subskrypcjami tylko odbiera, więc nie ma limitu bezczynności.
+void arm_read_timeout(int slot) {
+    Host* host = &hosts[slot];
+    if (host->address == 0 || host->in_len > 0) {
+        wheel_timer_start(&wheel, &host->timer, HEADER_TIMEOUT);
+    } else if (host->subscriptions > 0) {
+        wheel_timer_stop(&wheel, &host->timer);
+    } else {
+        wheel_timer_start(&wheel, &host->timer, IDLE_TIMEOUT);
+    }
+}
+
+// Zapisuje do hosta tyle, ile przyjmie gniazdo; zwraca -1 przy błędzie zapisu
+int flush_host(int slot) {
+    OutQueue* q = &hosts[slot].queue;
+    int progress = 0;
+    for (;;) {
+        if (q->out_off == q->out_len) {
+            Frame* frame;
+            q->out_off = q->out_len = 0;
+            while (q->out_len + MAX_PACKET_SIZE <= OUT_BATCH && (frame = dequeue_frame(q)) != NULL) {
+                if (q->out == NULL) {
+                    q->out = router_alloc(OUT_BATCH);
+                }
+                memcpy(q->out + q->out_len, frame->payload->data, frame->payload->length);
+                q->out_len += frame->payload->length;
+                release_frame(frame);
+            }
+            if (q->out_len == 0) {
+                // Bezczynny host nie trzyma bufora wyjściowego
+                slab_free(q->out, OUT_BATCH);
+                q->out = NULL;
+                if (hosts[slot].stalled || progress) {
+                    // Host, który odbiera ramki, nie jest bezczynny
+                    hosts[slot].stalled = 0;
+                    arm_read_timeout(slot);
+                }
+                return 0;
+            }
+        }
+        ssize_t c = write(hosts[slot].socket, q->out + q->out_off, q->out_len - q->out_off);
+        if (c < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!hosts[slot].stalled || progress) {
+                    wheel_timer_start(&wheel, &hosts[slot].timer, WRITE_TIMEOUT);
+                }
+                hosts[slot].stalled = 1;
+                return 0;
+            }
+            return -1;
+        }
+        q->out_off += c;
+        progress = 1;
+        trace_event(TRACE_WRITE, hosts[slot].socket);
+    }
+}
+
+void clear_queue(OutQueue* q) {
+    for (int prio = 0; prio < NUM_CLASSES; prio++) {
+        for (int i = 0; i < MAX_SENDERS; i++) {
+            Frame* frame = q->flows[prio][i].head;
+            while (frame != NULL) {
+                Frame* next = frame->next;
+                release_frame(frame);
+                frame = next;
+            }
+        }
+    }
+    slab_free(q->out, OUT_BATCH);
+    memset(q, 0, sizeof(OutQueue));
+}
+
+// Odpowiedź routera dla hosta: [adres hosta, 0, długość, dane] w klasie sterującej;
+// host bez adresu (nieudana rejestracja) dostaje ją pod UNREGISTERED_ADDRESS
+void reply(int slot, const void* data, int length) {
+    char frame[MAX_PACKET_SIZE];
+    int address = hosts[slot].address != 0 ? hosts[slot].address : UNREGISTERED_ADDRESS;
+    frame[0] = address | PRIO_CONTROL << PRIO_SHIFT;
+    frame[1] = 0;
+    frame[2] = length;
+    memcpy(frame + FRAME_HEADER, data, length);
+    struct slab_buf* payload = make_payload(frame, FRAME_HEADER + length);
+    enqueue_frame(slot, PRIO_CONTROL, ROUTER_SENDER, payload);
+    slab_buf_unref(payload);
+}
+
+void reply_error(int slot, char* error_message) {
+    reply(slot, error_message, strlen(error_message) + 1);
+}
+
+void deliver_local(int sender, const char* buffer, ssize_t length) {
+    int recipient_address = buffer[0] & ADDRESS_MASK;
+    int prio = frame_class(buffer);
+    int slot;
+    struct slab_buf* payload = make_payload(buffer, length);
+    if (recipient_address == BROADCAST_ADDRESS) {
+        for (int i = 0; i < MAX_HOSTS; i++) {
+            if (hosts[i].socket != -1) {
+                enqueue_frame(i, prio, sender, payload);
+            }
+        }
+    } else if (recipient_address == PUBLISH_ADDRESS) {
+        // [10, nadawca, długość, długość tematu, temat, dane] trafia tylko do subskrybentów
+        Topic* topic;
+        int topic_len = (uint8_t)buffer[FRAME_HEADER];
+        if (length >= FRAME_HEADER + 1 + topic_len && topic_len > 0 && topic_len <= MAX_TOPIC_LEN &&
+            (topic = find_topic(buffer + FRAME_HEADER + 1, topic_len, 0)) != NULL) {
+            for (int i = 0; i < MAX_HOSTS; i++) {
+                if ((topic->subscribers & (1 << i)) && hosts[i].socket != -1) {
+                    enqueue_frame(i, prio, sender, payload);
+                }
+            }
+        }
+    } else if ((slot = find_host(recipient_address)) != -1) {
+        enqueue_frame(slot, prio, sender, payload);
+    }
+    slab_buf_unref(payload);
+}
+
+void handle_peer_frame(int p, PeerHeader* header, const char* data) {
+    uint32_t origin_id = ntohl(header->origin);
+    uint32_t seq = ntohl(header->seq);
+    uint16_t length = ntohs(header->length);
+    Origin* o;
+    int resent;
+
+    if (header->type == PEER_HELLO) {
+        if (origin_id == router_id) {
+            // Połączyliśmy się sami ze sobą
+            close_peer(p);
+            return;
+        }
+        if (peers[p].id == 0) {
+            peers[p].id = origin_id;
+            if (!peers[p].outgoing) {
+                peer_established(p);
+            }
+        }
+        return;
+    }
+    if (peers[p].id == 0 || origin_id == router_id || (o = find_origin(origin_id)) == NULL) {
+        return;
+    }
+    // Po zerwaniu łącza sąsiad ponawia znane ogłoszenia z ich starym numerem; przyjmujemy je, jeśli straciliśmy trasę
+    resent = header->type == PEER_ANNOUNCE && o->via == -1 && seq == o->announce_seq;
+    if (seen_before(o, seq) && !resent) {
+        return;
+    }
+
+    if (header->type == PEER_ANNOUNCE && length >= 1) {
+        if (seq > o->announce_seq || o->via == -1) {
+            o->announce_seq = seq;
+            o->addresses = data[0];
+            o->via = p;
+            set_remote_topics(o - origins, data + 1, length - 1);
+        }
+        if (header->ttl > 1) {
+            peer_flood(p, PEER_ANNOUNCE, header->ttl - 1, origin_id, seq, data, length);
+        }
+    } else if (header->type == PEER_FRAME && length >= FRAME_HEADER && length <= MAX_PACKET_SIZE) {
+        int recipient_address = data[0] & ADDRESS_MASK;
+        if (recipient_address == BROADCAST_ADDRESS) {
+            deliver_local(MAX_HOSTS + p, data, length);
+            if (header->ttl > 1) {
+                peer_flood(p, PEER_FRAME, header->ttl - 1, origin_id, seq, data, length);
+            }
+        } else if (recipient_address == PUBLISH_ADDRESS) {
+            deliver_local(MAX_HOSTS + p, data, length);
+            if (header->ttl > 1) {
+                peer_publish(p, header->ttl - 1, origin_id, seq, data, length);
+            }
+        } else if (recipient_address >= 1 && recipient_address <= MAX_HOSTS) {
+            if (find_host(recipient_address) != -1) {
+                deliver_local(MAX_HOSTS + p, data, length);
+            } else {
+                int via = remote_route(recipient_address);
+                if (via != -1 && via != p && header->ttl > 1) {
+                    peer_send(via, PEER_FRAME, header->ttl - 1, origin_id, seq, data, length);
+                }
+            }
+        }
+    }
+}
+
+void handle_peer_data(int p) {
+    ssize_t bytes_read = read(peers[p].socket, peers[p].in + peers[p].in_len, PEER_BUF_SIZE - peers[p].in_len);
+    if (bytes_read < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
     if (bytes_read <= 0) {
-        // Błąd odczytu lub zamknięcie połączenia
-        close(host_socket);
+        close_peer(p);
+        return;
+    }
+    peers[p].in_len += bytes_read;
+
+    size_t offset = 0;
+    while (peers[p].socket != -1 && peers[p].in_len - offset >= sizeof(PeerHeader)) {
+        PeerHeader header;
+        memcpy(&header, peers[p].in + offset, sizeof(header));
+        size_t frame_len = sizeof(header) + ntohs(header.length);
+        if (frame_len > PEER_BUF_SIZE) {
+            close_peer(p);
+            return;
+        }
+        if (peers[p].in_len - offset < frame_len) {
+            break;
+        }
+        handle_peer_frame(p, &header, peers[p].in + offset + sizeof(header));
+        offset += frame_len;
+    }
+    if (peers[p].socket != -1) {
+        memmove(peers[p].in, peers[p].in + offset, peers[p].in_len - offset);
+        peers[p].in_len -= offset;
+    }
+}
+
+// Łącze wychodzące zestawione: wynik nieblokującego connect() odczytujemy z SO_ERROR
+void peer_connected(int p) {
+    int status;
+    socklen_t size = sizeof(status);
+    if (getsockopt(peers[p].socket, SOL_SOCKET, SO_ERROR, &status, &size) < 0 || status != 0) {
+        // Peer jeszcze nie działa, spróbujemy ponownie później
+        close_peer(p);
         return;
     }
+    peers[p].connecting = 0;
+    peer_established(p);
+}
+
+void peer_ready(struct reactor* r, int fd, uint32_t events, void* arg) {
+    int p = (Peer*)arg - peers;
+    if (peers[p].connecting) {
+        peer_connected(p);
+        return;
+    }
+    if (events & REACTOR_READ) {
+        handle_peer_data(p);
+    }
+    // Gotowość do zapisu: resztę bufora wyśle prepare_round
+}
+
+void watch_peer(int p, uint32_t events) {
+    if (set_nonblock(peers[p].socket) < 0 || reactor_add(reactor, peers[p].socket, events, peer_ready, &peers[p]) < 0) {
+        perror("reactor_add");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Nieblokujący connect(): pętla zdarzeń nie czeka na peera, który gubi pakiety
+void connect_peer(int p) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    peers[p].socket = sockfd;
+    watch_peer(p, REACTOR_WRITE);
+    peers[p].connecting = 1;
+    if (connect(sockfd, (struct sockaddr*)&peers[p].addr, sizeof(peers[p].addr)) == 0) {
+        peer_connected(p);
+    } else if (errno != EINPROGRESS) {
+        close_peer(p);
+    }
+}
 
-    int recipient_address = buffer[0];
+int add_peer(int socket, int outgoing, struct sockaddr_in* addr) {
+    int p = -1;
+    for (int i = 0; i < peer_count; i++) {
+        if (peers[i].socket == -1 && !peers[i].outgoing) {
+            p = i;
+            break;
+        }
+    }
+    if (p == -1) {
+        if (peer_count == MAX_PEERS) {
+            return -1;
+        }
+        p = peer_count++;
+    }
+    memset(&peers[p], 0, sizeof(Peer));
+    peers[p].socket = socket;
+    peers[p].outgoing = outgoing;
+    if (addr != NULL) {
+        peers[p].addr = *addr;
+    }
+    return p;
+}
+
+int parse_peer(const char* spec, struct sockaddr_in* addr) {
+    char host[64];
+    const char* colon = strrchr(spec, ':');
+    if (colon == NULL || colon - spec >= (int)sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &addr->sin_addr) <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void handle_host_frame(int slot, char* buffer, int length) {
+    int recipient_address = buffer[0] & ADDRESS_MASK;
     int sender_address = buffer[1];
+    int command = length > FRAME_HEADER ? buffer[FRAME_HEADER] : CMD_REGISTER;
 
-    if (recipient_address == 0) {
+    if (hosts[slot].address == 0 && (recipient_address != 0 || command == CMD_SUBSCRIBE || command == CMD_UNSUBSCRIBE)) {
+        // Przed rejestracją host nie może niczego wysyłać ani subskrybować
+        reply_error(slot, "Not registered");
+    } else if (recipient_address == 0 && (command == CMD_SUBSCRIBE || command == CMD_UNSUBSCRIBE)) {
+        // Subskrypcja tematu: [0, adres nadawcy, długość, polecenie, długość tematu, temat]
+        int topic_len = length > FRAME_HEADER + 1 ? (uint8_t)buffer[FRAME_HEADER + 1] : 0;
+        char* name = buffer + FRAME_HEADER + 2;
+        Topic* topic;
+        if (topic_len == 0 || topic_len > MAX_TOPIC_LEN || length < FRAME_HEADER + 2 + topic_len) {
+            reply_error(slot, "Invalid topic");
+        } else if ((topic = find_topic(name, topic_len, command == CMD_SUBSCRIBE)) == NULL && command == CMD_SUBSCRIBE) {
+            reply_error(slot, "Too many topics");
+        } else {
+            // Inne routery dowiadują się o temacie, gdy pojawia się lub znika jego ostatni subskrybent
+            int had_subscribers = topic != NULL && topic->subscribers != 0;
+            if (topic != NULL) {
+                if ((topic->subscribers & (1 << slot)) != (command == CMD_SUBSCRIBE) << slot) {
+                    hosts[slot].subscriptions += command == CMD_SUBSCRIBE ? 1 : -1;
+                }
+                if (command == CMD_SUBSCRIBE) {
+                    topic->subscribers |= 1 << slot;
+                } else {
+                    topic->subscribers &= ~(1 << slot);
+                }
+                if (had_subscribers != (topic->subscribers != 0)) {
+                    if (topic->subscribers == 0 && topic->remote == 0) {
+                        remove_topic(topic - topics);
+                    }
+                    announce_local();
+                }
+            }
+            reply(slot, &sender_address, sizeof(int));
+        }
+    } else if (recipient_address == 0) {
         // Wiadomość dla routera
         if (sender_address >= 1 && sender_address <= 8) {
-            // Poprawny adres hosta
-            hosts[sender_address - 1].address = sender_address;
-            write(host_socket, &sender_address, sizeof(int));
+            int owner = find_host(sender_address);
+            if ((owner != -1 && owner != slot) || remote_route(sender_address) != -1) {
+                // Adres zajęty przez innego hosta, lokalnie albo za innym routerem
+                reply_error(slot, "Address in use");
+                return;
+            }
+            // Poprawny adres hosta; ponowna rejestracja pod tym samym adresem podtrzymuje połączenie
+            if (hosts[slot].address != sender_address) {
+                hosts[slot].address = sender_address;
+                announce_local();
+            }
+            reply(slot, &sender_address, sizeof(int));
         } else {
             // Niepoprawny adres hosta
-            char* error_message = "Wrong address";
-            write(host_socket, error_message, strlen(error_message) + 1);
-        }
-    } else if (recipient_address == 9) {
-        // Wiadomość do wszystkich hostów
-        for (int i = 0; i < 8; i++) {
-            if (hosts[i].socket != -1) {
-                write(hosts[i].socket, buffer, bytes_read);
-            }
+            reply_error(slot, "Wrong address");
         }
+    } else if (recipient_address == BROADCAST_ADDRESS) {
+        // Wiadomość do wszystkich hostów, również tych za innymi routerami
+        deliver_local(slot, buffer, length);
+        peer_flood(-1, PEER_FRAME, PEER_MAX_TTL, router_id, ++local_seq, buffer, length);
+    } else if (recipient_address == PUBLISH_ADDRESS) {
+        // Wiadomość do subskrybentów tematu tutaj i za routerami, które go ogłosiły
+        deliver_local(slot, buffer, length);
+        peer_publish(-1, PEER_MAX_TTL, router_id, ++local_seq, buffer, length);
     } else {
         // Wiadomość do konkretnego hosta
         if (recipient_address >= 1 && recipient_address <= 8) {
-            if (hosts[recipient_address - 1].socket != -1) {
-                write(hosts[recipient_address - 1].socket, buffer, bytes_read);
+            int via;
+            if (find_host(recipient_address) != -1) {
+                deliver_local(slot, buffer, length);
+            } else if ((via = remote_route(recipient_address)) != -1) {
+                // Host podłączony do innego routera
+                peer_send(via, PEER_FRAME, PEER_MAX_TTL, router_id, ++local_seq, buffer, length);
             } else {
                 // Nieznany host
-                char* error_message = "Unknown host";
-                write(host_socket, error_message, strlen(error_message) + 1);
+                reply_error(slot, "Unknown host");
             }
         } else {
             // Niepoprawny adres odbiorcy
-            char* error_message = "Invalid recipient address";
-            write(host_socket, error_message, strlen(error_message) + 1);
+            reply_error(slot, "Invalid recipient address");
         }
     }
 }
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-    fprintf(stderr, "Usage: %s <address> <port>\n", argv[0]);
-    exit(EXIT_FAILURE);
+
+// Bufor wejściowy zostaje przy hoście tylko wtedy, gdy czeka w nim początek ramki
+void release_input(Host* host) {
+    if (host->in_len == 0) {
+        slab_free(host->in, HOST_BUF_SIZE);
+        host->in = NULL;
     }
-const char* address = argv[1];
-int port = atoi(argv[2]);
+}
 
-int router_socket = create_socket(address, port);
+// Zwraca -1 gdy host zamknął połączenie lub przysłał błędną ramkę
+int handle_host_message(int slot) {
+    Host* host = &hosts[slot];
+    if (host->in == NULL) {
+        host->in = router_alloc(HOST_BUF_SIZE);
+    }
+    ssize_t bytes_read = read(host->socket, host->in + host->in_len, HOST_BUF_SIZE - host->in_len);
+    if (bytes_read <= 0) {
+        // Błąd odczytu lub zamknięcie połączenia
+        if (bytes_read < 0 && (errno == EINTR || errno == EAGAIN)) {
+            release_input(host);
+            return 0;
+        }
+        return -1;
+    }
+    host->in_len += bytes_read;
 
-for (int i = 0; i < 8; i++) {
-    hosts[i].address = i + 1;
-    hosts[i].socket = -1;
+    size_t offset = 0;
+    while (host->in_len - offset >= FRAME_HEADER) {
+        int length = FRAME_HEADER + (uint8_t)host->in[offset + 2];
+        if (length > MAX_PACKET_SIZE) {
+            return -1;
+        }
+        if (host->in_len - offset < (size_t)length) {
+            break;
+        }
+        trace_event(TRACE_FRAME, host->socket);
+        handle_host_frame(slot, host->in + offset, length);
+        trace_event(TRACE_COMPUTE, host->socket);
+        offset += length;
+    }
+    memmove(host->in, host->in + offset, host->in_len - offset);
+    host->in_len -= offset;
+    release_input(host);
+    if (!host->stalled) {
+        arm_read_timeout(slot);
+    }
+    return 0;
 }
 
-while (1) {
-    fd_set rfds;
-    int max_fd = router_socket;
+void close_host(int slot) {
+    wheel_timer_stop(&wheel, &hosts[slot].timer);
+    hosts[slot].stalled = 0;
+    reactor_remove(reactor, hosts[slot].socket);
+    close(hosts[slot].socket);
+    hosts[slot].socket = -1;
+    hosts[slot].in_len = 0;
+    release_input(&hosts[slot]);
+    clear_queue(&hosts[slot].queue);
+    forget_sender(slot);
+    int changed = unsubscribe_all(slot);
+    if (hosts[slot].address != 0) {
+        hosts[slot].address = 0;
+        changed = 1;
+    }
+    if (changed) {
+        announce_local();
+    }
+}
 
-    FD_ZERO(&rfds);
-    FD_SET(router_socket, &rfds);
+// Host milczy, nie dokończył ramki albo nie odbiera: zwalniamy jego slot
+void host_timeout(struct reactor* r, void* arg) {
+    close_host((Host*)arg - hosts);
+}
 
-    for (int i = 0; i < 8; i++) {
-        if (hosts[i].socket != -1) {
-            FD_SET(hosts[i].socket, &rfds);
-            if (hosts[i].socket > max_fd) {
-                max_fd = hosts[i].socket;
-            }
-        }
+void host_ready(struct reactor* r, int fd, uint32_t events, void* arg) {
+    int slot = (Host*)arg - hosts;
+    // Gotowość do zapisu obsługuje prepare_round, tu zostaje tylko czytanie
+    if ((events & REACTOR_READ) && handle_host_message(slot) < 0) {
+        close_host(slot);
     }
+}
 
-    if (select(max_fd + 1, &rfds, NULL, NULL, NULL) < 0) {
-        perror("select");
-        exit(EXIT_FAILURE);
+void accept_host(struct reactor* r, int fd, uint32_t events, void* arg) {
+    int host_socket = add_new_client(fd, NULL);
+    if (host_socket < 0) {
+        return;
     }
 
-    if (FD_ISSET(router_socket, &rfds)) {
-        int host_socket = accept(router_socket, NULL, NULL);
-        if (host_socket < 0) {
-            perror("accept");
+    // Znajdowanie wolnego slotu w tablicy hosts
+    int free_slot = -1;
+    for (int i = 0; i < 8; i++) {
+        if (hosts[i].socket == -1) {
+            free_slot = i;
+            break;
+        }
+    }
+
+    if (free_slot == -1) {
+        // Brak wolnego slotu dla nowego hosta
+        close(host_socket);
+    } else {
+        // Adres zostanie przypisany dopiero po rejestracji (wiadomość do routera)
+        int sndbuf = HOST_SNDBUF;
+        set_nonblock(host_socket);
+        setsockopt(host_socket, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        hosts[free_slot].address = 0;
+        hosts[free_slot].socket = host_socket;
+        trace_event(TRACE_ACCEPT, host_socket);
+        wheel_timer_init(&hosts[free_slot].timer, host_timeout, &hosts[free_slot]);
+        arm_read_timeout(free_slot);
+        if (reactor_add(r, host_socket, REACTOR_READ, host_ready, &hosts[free_slot]) < 0) {
+            perror("reactor_add");
             exit(EXIT_FAILURE);
         }
+    }
+}
 
-        // Znajdowanie wolnego slotu w tablicy hosts
-        int free_slot = -1;
-        for (int i = 0; i < 8; i++) {
-            if (hosts[i].socket == -1) {
-                free_slot = i;
-                break;
-            }
+void accept_peer(struct reactor* r, int fd, uint32_t events, void* arg) {
+    int socket = add_new_client(fd, NULL);
+    int p;
+    if (socket < 0) {
+        return;
+    }
+    if ((p = add_peer(socket, 0, NULL)) < 0) {
+        // Brak miejsca na kolejnego peera
+        close(socket);
+        return;
+    }
+    watch_peer(p, REACTOR_READ);
+}
+
+void reconnect_peers(struct reactor* r, void* arg) {
+    for (int i = 0; i < peer_count; i++) {
+        if (peers[i].outgoing && peers[i].socket == -1) {
+            connect_peer(i);
         }
+    }
+    reactor_timer_start(r, &reconnect_timer, RECONNECT_INTERVAL * 1000);
+}
 
-        if (free_slot == -1) {
-            // Brak wolnego slotu dla nowego hosta
-            close(host_socket);
-        } else {
-            hosts[free_slot].socket = host_socket;
+// Przed każdym czekaniem na zdarzenia: opróżniamy kolejki i ustawiamy, na co czekamy
+void prepare_round(struct reactor* r, void* arg) {
+    // Kolejki wyjściowe opróżniamy po przetworzeniu wszystkich wejść, tak by klasy i DRR miały z czego wybierać
+    for (int i = 0; i < 8; i++) {
+        if (hosts[i].socket != -1 && queue_pending(&hosts[i].queue) && flush_host(i) < 0) {
+            close_host(i);
         }
     }
 
+    // Wszystko, co zebrało się dla peerów w tej rundzie, idzie jednym write(), bez czekania na wolnego peera
+    for (int i = 0; i < peer_count; i++) {
+        flush_peer(i);
+    }
+
     for (int i = 0; i < 8; i++) {
-        if (hosts[i].socket != -1 && FD_ISSET(hosts[i].socket, &rfds)) {
-            handle_host_message(hosts[i].socket);
+        if (hosts[i].socket != -1) {
+            // Nadawca z pełnymi kolejkami musi poczekać, aż odbiorcy je opróżnią
+            uint32_t events = sender_queued[i] < SENDER_QUEUE_LIMIT ? REACTOR_READ : 0;
+            if (queue_pending(&hosts[i].queue)) {
+                events |= REACTOR_WRITE;
+            }
+            reactor_modify(r, hosts[i].socket, events);
         }
     }
+    for (int i = 0; i < peer_count; i++) {
+        if (peers[i].socket != -1 && !peers[i].connecting) {
+            uint32_t events = sender_queued[MAX_HOSTS + i] < SENDER_QUEUE_LIMIT ? REACTOR_READ : 0;
+            if (peers[i].out_len > 0) {
+                events |= REACTOR_WRITE;  // Peer nie przyjął wszystkiego, resztę wyślemy, gdy będzie gotów
+            }
+            reactor_modify(r, peers[i].socket, events);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+    fprintf(stderr, "Usage: %s <address> <port> [<peer_port> [<peer_address>:<peer_port> ...]]\n", argv[0]);
+    exit(EXIT_FAILURE);
+    }
+const char* address = argv[1];
+int port = atoi(argv[2]);
+
+int router_socket = create_socket(address, port);
+int peer_socket = argc > 3 ? create_socket(address, atoi(argv[3])) : -1;
+
+signal(SIGPIPE, SIG_IGN);
+srand(time(NULL) ^ getpid());
+while ((router_id = ((uint32_t)rand() << 16) ^ rand()) == 0)
+    ;
+
+for (int i = 0; i < 8; i++) {
+    hosts[i].address = 0;
+    hosts[i].socket = -1;
+}
+
+for (int i = 4; i < argc; i++) {
+    struct sockaddr_in peer_addr;
+    if (parse_peer(argv[i], &peer_addr) < 0 || add_peer(-1, 1, &peer_addr) < 0) {
+        fprintf(stderr, "Invalid peer: %s\n", argv[i]);
+        exit(EXIT_FAILURE);
+    }
+}
+if (trace_init() < 0) {
+    perror("trace_init");
+    exit(EXIT_FAILURE);
+}
+if ((reactor = reactor_create(NULL)) == NULL) {
+    perror("reactor_create");
+    exit(EXIT_FAILURE);
+}
+// SIGUSR1 zapisuje ślad zdarzeń (POSIXNET_TRACE) do pliku JSON
+if (reactor_signal(reactor, SIGUSR1, trace_signal_dump, NULL) < 0) {
+    perror("reactor_signal");
+    exit(EXIT_FAILURE);
+}
+if (reactor_add(reactor, router_socket, REACTOR_READ, accept_host, NULL) < 0 ||
+    (peer_socket != -1 && reactor_add(reactor, peer_socket, REACTOR_READ, accept_peer, NULL) < 0)) {
+    perror("reactor_add");
+    exit(EXIT_FAILURE);
+}
+wheel_init(&wheel, reactor, TICK_MS);
+reactor_prepare(reactor, prepare_round, NULL);
+reactor_timer_init(&reconnect_timer, reconnect_peers, NULL);
+reconnect_peers(reactor, NULL);
+
+if (reactor_run(reactor) < 0) {
+    perror("reactor_run");
+    exit(EXIT_FAILURE);
 }
 
 close(router_socket);
 return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,290 @@
+// Benchmark for router.c: simulated hosts inside one process register with the
+// router, exchange a configurable mix of unicast and broadcast frames and measure
+// throughput and end-to-end latency of every delivered frame.
+
+#include "posixnet.h"
+#include "posixnet_err.h"
+#include "hist.h"
+
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PACKET_SIZE 128
+#define FRAME_HEADER 3
+#define PRIO_SHIFT 6
+#define BROADCAST_ADDRESS 9
+#define ADDRESS_MASK 0x3F // the address field of a frame; the router may accept fewer hosts
+#define BUF_SIZE 65536
+
+#define PATTERN_UNICAST 0
+#define PATTERN_BROADCAST 1
+
+struct pattern_stats {
+	uint64_t messages;
+	uint64_t bytes;
+	struct histogram latency;
+};
+
+struct bench_host {
+	int fd;
+	int address;
+	int outstanding; // frames sent but not yet delivered (closed loop window)
+	char in[BUF_SIZE];
+	size_t in_len;
+	char out[BUF_SIZE];
+	size_t out_off;
+	size_t out_len;
+};
+
+struct bench_config {
+	int hosts;
+	int duration;
+	int size;
+	int broadcast_percent;
+	int window;
+	int priority;
+};
+
+struct bench_host *hosts; // host i has address i + 1
+int host_count;
+struct pattern_stats stats[2];
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Blocking registration: [0, address, 0] answered by a control frame with the address
+void register_host(struct bench_host *h)
+{
+	char frame[MAX_PACKET_SIZE] = { 0, h->address, 0 };
+	char rbuf[NET_READER_SIZE];
+	struct net_reader reader;
+	int32_t answer;
+	if (bulk_write(h->fd, frame, FRAME_HEADER) < 0)
+		ERR("write");
+	// The header and the answer behind it usually arrive together and cost one read
+	reader_init(&reader, h->fd, rbuf, sizeof(rbuf));
+	if (reader_read(&reader, frame, FRAME_HEADER) < FRAME_HEADER) {
+		fprintf(stderr, "Host %d rejected: the router closed the connection\n", h->address);
+		exit(EXIT_FAILURE);
+	}
+	if (reader_read(&reader, frame + FRAME_HEADER, (uint8_t)frame[2]) < (uint8_t)frame[2])
+		ERR("read");
+	memcpy(&answer, frame + FRAME_HEADER, sizeof(answer));
+	if ((uint8_t)frame[2] != sizeof(answer) || answer != h->address) {
+		fprintf(stderr, "Host %d rejected: %.*s\n", h->address, (uint8_t)frame[2], frame + FRAME_HEADER);
+		exit(EXIT_FAILURE);
+	}
+	// Frames that came right behind the answer belong to the event loop
+	h->in_len = reader_take(&reader, h->in, sizeof(h->in));
+	if (set_nonblock(h->fd) < 0)
+		ERR("fcntl");
+}
+
+// Payload starts with the send timestamp, the rest is padding up to the configured size
+void queue_frame(struct bench_host *h, struct bench_config *cfg)
+{
+	char *frame = h->out + h->out_len;
+	int recipient;
+	uint64_t ts;
+	if (rand() % 100 < cfg->broadcast_percent)
+		recipient = BROADCAST_ADDRESS;
+	else if (cfg->hosts == 1)
+		recipient = h->address;
+	else {
+		recipient = 1 + rand() % (cfg->hosts - 1);
+		if (recipient >= h->address)
+			recipient++;
+	}
+	frame[0] = recipient | cfg->priority << PRIO_SHIFT;
+	frame[1] = h->address;
+	frame[2] = cfg->size;
+	memset(frame + FRAME_HEADER, 0, cfg->size);
+	ts = now_ns();
+	memcpy(frame + FRAME_HEADER, &ts, sizeof(ts));
+	h->out_len += FRAME_HEADER + cfg->size;
+	h->outstanding++;
+}
+
+void fill_and_send(struct bench_host *h, struct bench_config *cfg, int sending)
+{
+	while (sending && h->outstanding < cfg->window && h->out_len + MAX_PACKET_SIZE <= BUF_SIZE)
+		queue_frame(h, cfg);
+	while (h->out_off < h->out_len) {
+		ssize_t c = write(h->fd, h->out + h->out_off, h->out_len - h->out_off);
+		if (c < 0) {
+			if (EINTR == errno)
+				continue;
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				break;
+			ERR("write");
+		}
+		h->out_off += c;
+	}
+	if (h->out_off == h->out_len)
+		h->out_off = h->out_len = 0;
+}
+
+// A unicast frame completes when its recipient gets it, a broadcast when the sender sees its own copy
+void deliver(struct bench_host *h, char *frame, int length, int counting)
+{
+	int recipient = frame[0] & 0x3F, sender = frame[1];
+	int pattern = BROADCAST_ADDRESS == recipient ? PATTERN_BROADCAST : PATTERN_UNICAST;
+	uint64_t ts;
+	if (0 == sender || length < FRAME_HEADER + (int)sizeof(ts))
+		return;
+	memcpy(&ts, frame + FRAME_HEADER, sizeof(ts));
+	if (counting) {
+		stats[pattern].messages++;
+		stats[pattern].bytes += length;
+		hist_add(&stats[pattern].latency, now_ns() - ts);
+	}
+	if (sender >= 1 && sender <= host_count && (PATTERN_UNICAST == pattern || sender == h->address))
+		hosts[sender - 1].outstanding--;
+}
+
+int receive(struct bench_host *h, int counting)
+{
+	ssize_t c = read(h->fd, h->in + h->in_len, BUF_SIZE - h->in_len);
+	size_t offset = 0;
+	if (c < 0) {
+		if (EINTR == errno || EAGAIN == errno)
+			return 0;
+		ERR("read");
+	}
+	if (0 == c)
+		return -1;
+	h->in_len += c;
+	while (h->in_len - offset >= FRAME_HEADER) {
+		int length = FRAME_HEADER + (uint8_t)h->in[offset + 2];
+		if (h->in_len - offset < (size_t)length)
+			break;
+		deliver(h, h->in + offset, length, counting);
+		offset += length;
+	}
+	memmove(h->in, h->in + offset, h->in_len - offset);
+	h->in_len -= offset;
+	return 0;
+}
+
+void print_stats(char *name, struct pattern_stats *s, double seconds)
+{
+	if (0 == s->messages)
+		return;
+	printf("%-10s %12.0f %14.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, s->messages / seconds,
+	       s->bytes / seconds, hist_percentile(&s->latency, 0.5) / 1000.0,
+	       hist_percentile(&s->latency, 0.9) / 1000.0, hist_percentile(&s->latency, 0.99) / 1000.0,
+	       hist_percentile(&s->latency, 0.999) / 1000.0, s->latency.max / 1000.0);
+}
+
+void doBench(struct bench_config *cfg)
+{
+	struct pollfd *fds = calloc(cfg->hosts, sizeof(struct pollfd));
+	uint64_t start = now_ns(), end = start + (uint64_t)cfg->duration * 1000000000ULL, drain_end = end + 1000000000ULL;
+	uint64_t now;
+	int i, pending;
+	if (NULL == fds)
+		ERR("calloc");
+
+	while ((now = now_ns()) < drain_end) {
+		int sending = now < end;
+		pending = 0;
+		for (i = 0; i < cfg->hosts; i++) {
+			fill_and_send(&hosts[i], cfg, sending);
+			fds[i].fd = hosts[i].fd;
+			fds[i].events = POLLIN | (hosts[i].out_len > hosts[i].out_off ? POLLOUT : 0);
+			pending += hosts[i].outstanding;
+		}
+		if (!sending && 0 == pending)
+			break;
+		if (TEMP_FAILURE_RETRY(poll(fds, cfg->hosts, 100)) < 0)
+			ERR("poll");
+		for (i = 0; i < cfg->hosts; i++) {
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				if (receive(&hosts[i], sending) < 0) {
+					fprintf(stderr, "Router closed connection of host %d\n", hosts[i].address);
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+	}
+
+	free(fds);
+	printf("hosts=%d size=%d broadcast=%d%% window=%d priority=%d duration=%ds\n", cfg->hosts, cfg->size,
+	       cfg->broadcast_percent, cfg->window, cfg->priority, cfg->duration);
+	printf("%-10s %12s %14s %10s %10s %10s %10s %10s\n", "pattern", "msgs/s", "bytes/s", "p50[us]", "p90[us]",
+	       "p99[us]", "p99.9[us]", "max[us]");
+	print_stats("unicast", &stats[PATTERN_UNICAST], cfg->duration);
+	print_stats("broadcast", &stats[PATTERN_BROADCAST], cfg->duration);
+}
+
+void usage(char *name)
+{
+	fprintf(stderr, "USAGE: %s address port [-n hosts] [-d seconds] [-s payload_size] [-b broadcast_percent] "
+			"[-w window] [-p priority]\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_config cfg = { .hosts = 4, .duration = 5, .size = 32, .broadcast_percent = 0, .window = 16 };
+	int c, i;
+	if (argc < 3)
+		usage(argv[0]);
+	optind = 3;
+	while ((c = getopt(argc, argv, "n:d:s:b:w:p:")) != -1) {
+		switch (c) {
+		case 'n':
+			cfg.hosts = atoi(optarg);
+			break;
+		case 'd':
+			cfg.duration = atoi(optarg);
+			break;
+		case 's':
+			cfg.size = atoi(optarg);
+			break;
+		case 'b':
+			cfg.broadcast_percent = atoi(optarg);
+			break;
+		case 'w':
+			cfg.window = atoi(optarg);
+			break;
+		case 'p':
+			cfg.priority = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (cfg.hosts < 1 || cfg.hosts > ADDRESS_MASK || cfg.duration < 1 || cfg.window < 1 ||
+	    cfg.size < (int)sizeof(uint64_t) || cfg.size > MAX_PACKET_SIZE - FRAME_HEADER || cfg.priority < 0 ||
+	    cfg.priority > 3)
+		usage(argv[0]);
+	if (sethandler(SIG_IGN, SIGPIPE))
+		ERR("Seting SIGPIPE:");
+	raise_fd_limit();
+	srand(time(NULL));
+	if ((hosts = calloc(cfg.hosts, sizeof(struct bench_host))) == NULL)
+		ERR("calloc");
+	host_count = cfg.hosts;
+	for (i = 0; i < cfg.hosts; i++) {
+		hosts[i].address = i + 1;
+		hosts[i].fd = connect_socket(argv[1], argv[2]);
+		if (setsockopt(hosts[i].fd, IPPROTO_TCP, TCP_NODELAY, &(int){ 1 }, sizeof(int)))
+			ERR("setsockopt");
+		register_host(&hosts[i]);
+	}
+	doBench(&cfg);
+	for (i = 0; i < cfg.hosts; i++)
+		if (TEMP_FAILURE_RETRY(close(hosts[i].fd)) < 0)
+			ERR("close");
+	free(hosts);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+#include "slab.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define SLAB_CLASSES 16
+#define SLAB_BATCH 32 // objects moved between a thread cache and the depot at once
+#define SLAB_CACHE_LIMIT (2 * SLAB_BATCH)
+
+// Roughly 1.5x apart so that internal waste stays under a third of an object
+static const uint32_t class_size[SLAB_CLASSES] = { 16, 32, 48, 64, 96, 128, 192, 256,
+						   384, 512, 768, 1024, 1536, 2048, 3072, 4096 };
+
+struct slab_object {
+	struct slab_object *next;
+};
+
+struct slab_cache {
+	struct slab_object *free[SLAB_CLASSES];
+	uint32_t count[SLAB_CLASSES];
+	int registered; // the thread exit destructor knows about this cache
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t refills;
+};
+
+struct slab_depot {
+	pthread_mutex_t lock;
+	struct slab_object *free;
+	size_t count;
+};
+
+static __thread struct slab_cache cache;
+static struct slab_depot depots[SLAB_CLASSES];
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *arena_next = NULL, *arena_end = NULL;
+static _Atomic size_t mapped = 0, huge_chunks = 0;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+
+static int size_class(size_t size)
+{
+	int c = 0;
+	while (class_size[c] < size)
+		c++;
+	return c;
+}
+
+// Gives SLAB_BATCH objects of a class (or all of them) back to the depot
+static void release_batch(struct slab_cache *sc, int c, uint32_t n)
+{
+	struct slab_object *first = sc->free[c], *last = first;
+	for (uint32_t i = 1; i < n; i++)
+		last = last->next;
+	sc->free[c] = last->next;
+	sc->count[c] -= n;
+	pthread_mutex_lock(&depots[c].lock);
+	last->next = depots[c].free;
+	depots[c].free = first;
+	depots[c].count += n;
+	pthread_mutex_unlock(&depots[c].lock);
+}
+
+// Objects cached by an exiting thread would otherwise be lost
+static void flush_cache(void *arg)
+{
+	struct slab_cache *sc = arg;
+	for (int c = 0; c < SLAB_CLASSES; c++)
+		if (sc->count[c] > 0)
+			release_batch(sc, c, sc->count[c]);
+}
+
+static void slab_init(void)
+{
+	for (int c = 0; c < SLAB_CLASSES; c++)
+		pthread_mutex_init(&depots[c].lock, NULL);
+	pthread_key_create(&slab_key, flush_cache);
+}
+
+// One chunk: explicit huge pages if reserved, otherwise a 2 MB aligned region offered to THP
+static char *map_chunk(void)
+{
+	char *raw, *aligned;
+	size_t head;
+	raw = mmap(NULL, SLAB_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (raw != MAP_FAILED) {
+		huge_chunks++;
+		return raw;
+	}
+	if ((raw = mmap(NULL, 2 * SLAB_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		return NULL;
+	aligned = (char *)(((uintptr_t)raw + SLAB_CHUNK - 1) & ~(uintptr_t)(SLAB_CHUNK - 1));
+	head = aligned - raw;
+	if (head > 0)
+		munmap(raw, head);
+	munmap(aligned + SLAB_CHUNK, SLAB_CHUNK - head);
+	madvise(aligned, SLAB_CHUNK, MADV_HUGEPAGE);
+	return aligned;
+}
+
+// Refills an empty cache from the depot or, when that is empty too, from the current chunk
+static int refill(struct slab_cache *sc, int c)
+{
+	struct slab_object *list = NULL;
+	uint32_t n = 0;
+	sc->refills++;
+	pthread_mutex_lock(&depots[c].lock);
+	while (n < SLAB_BATCH && depots[c].free != NULL) {
+		struct slab_object *o = depots[c].free;
+		depots[c].free = o->next;
+		o->next = list;
+		list = o;
+		n++;
+	}
+	depots[c].count -= n;
+	pthread_mutex_unlock(&depots[c].lock);
+	if (0 == n) {
+		pthread_mutex_lock(&arena_lock);
+		for (; n < SLAB_BATCH; n++) {
+			struct slab_object *o;
+			if (arena_end - arena_next < (ptrdiff_t)class_size[c]) {
+				// The tail of the old chunk is too small for this class and stays unused
+				if ((arena_next = map_chunk()) == NULL) {
+					arena_end = NULL;
+					break;
+				}
+				arena_end = arena_next + SLAB_CHUNK;
+				mapped += SLAB_CHUNK;
+			}
+			o = (struct slab_object *)arena_next;
+			arena_next += class_size[c];
+			o->next = list;
+			list = o;
+		}
+		pthread_mutex_unlock(&arena_lock);
+	}
+	if (0 == n)
+		return errno = ENOMEM, -1;
+	sc->free[c] = list;
+	sc->count[c] = n;
+	return 0;
+}
+
+// The first allocation or free of a thread registers its cache for flush_cache: a thread
+// that only frees objects allocated elsewhere never refills, yet its cache fills up
+static void register_cache(struct slab_cache *sc)
+{
+	pthread_once(&slab_once, slab_init);
+	pthread_setspecific(slab_key, sc);
+	sc->registered = 1;
+}
+
+void *slab_alloc(size_t size)
+{
+	struct slab_object *o;
+	int c;
+	if (size > SLAB_MAX_SIZE)
+		return malloc(size);
+	if (!cache.registered)
+		register_cache(&cache);
+	c = size_class(size);
+	if (NULL == cache.free[c] && refill(&cache, c) < 0)
+		return NULL;
+	o = cache.free[c];
+	cache.free[c] = o->next;
+	cache.count[c]--;
+	cache.allocs++;
+	return o;
+}
+
+// size must be the one the object was allocated with
+void slab_free(void *p, size_t size)
+{
+	struct slab_object *o = p;
+	int c;
+	if (NULL == p)
+		return;
+	if (size > SLAB_MAX_SIZE) {
+		free(p);
+		return;
+	}
+	if (!cache.registered)
+		register_cache(&cache);
+	c = size_class(size);
+	o->next = cache.free[c];
+	cache.free[c] = o;
+	cache.frees++;
+	if (++cache.count[c] > SLAB_CACHE_LIMIT)
+		release_batch(&cache, c, SLAB_BATCH);
+}
+
+struct slab_buf *slab_buf_new(size_t capacity)
+{
+	struct slab_buf *b = slab_alloc(sizeof(struct slab_buf) + capacity);
+	if (NULL == b)
+		return NULL;
+	atomic_init(&b->refs, 1);
+	b->capacity = capacity;
+	b->length = 0;
+	return b;
+}
+
+struct slab_buf *slab_buf_ref(struct slab_buf *b)
+{
+	atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+	return b;
+}
+
+void slab_buf_unref(struct slab_buf *b)
+{
+	if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1)
+		slab_free(b, sizeof(struct slab_buf) + b->capacity);
+}
+
+void slab_stats(struct slab_stats *s)
+{
+	s->allocs = cache.allocs;
+	s->frees = cache.frees;
+	s->refills = cache.refills;
+	s->mapped = mapped;
+	s->huge_chunks = huge_chunks;
+}
@@ -0,0 +1,43 @@
+// Size-classed slab allocator of libposixnet for frames, message buffers and
+// connection buffers. Objects are carved from 2 MB chunks (huge pages when the
+// system has them) and recycled through a per-thread cache, so the hot path
+// neither locks nor calls malloc; a shared depot moves objects between threads.
+// Memory is reused but never returned to the system, which keeps the RSS of a
+// long-running server at its peak working set instead of letting it drift.
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "posixnet.h"
+
+#include <stdatomic.h>
+
+#define SLAB_CHUNK (2 << 20)
+#define SLAB_MAX_SIZE 4096 // larger requests go to malloc
+
+// Buffer shared by several owners, e.g. one broadcast frame queued for many hosts
+struct slab_buf {
+	_Atomic uint32_t refs;
+	uint32_t capacity;
+	uint32_t length; // bytes used in data, set by the owner
+	char data[];
+};
+
+struct slab_stats {
+	uint64_t allocs; // of the calling thread
+	uint64_t frees;
+	uint64_t refills; // cache misses served by the depot or a chunk
+	size_t mapped; // bytes of chunks mapped by the process
+	size_t huge_chunks; // chunks backed by explicit huge pages
+};
+
+void *slab_alloc(size_t size);
+void slab_free(void *p, size_t size);
+
+struct slab_buf *slab_buf_new(size_t capacity);
+struct slab_buf *slab_buf_ref(struct slab_buf *b);
+void slab_buf_unref(struct slab_buf *b);
+
+void slab_stats(struct slab_stats *s);
+
+#endif
@@ -0,0 +1,152 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define TRACE_CALIBRATE_NS 10000000ULL
+
+struct trace_file *trace_map = NULL;
+__thread struct trace_ring *trace_local = NULL;
+static char trace_path[PATH_MAX];
+
+static const char *point_names[TRACE_POINTS] = { "accept", "frame", "compute", "write" };
+// Name of the span that ends at a point when the previous event of the ring has the same id
+static const char *span_names[TRACE_POINTS] = { NULL, "read", "compute", "write" };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// TSC frequency measured against CLOCK_MONOTONIC; the dump turns ticks into microseconds with it
+static double calibrate(void)
+{
+	uint64_t ns = now_ns(), tsc = trace_ticks(), elapsed;
+	while ((elapsed = now_ns() - ns) < TRACE_CALIBRATE_NS)
+		;
+	return (double)(trace_ticks() - tsc) * 1000.0 / elapsed;
+}
+
+// Maps the file named by POSIXNET_TRACE; without it tracing stays disabled
+int trace_init(void)
+{
+	const char *path = getenv("POSIXNET_TRACE");
+	struct trace_file *t;
+	int fd;
+	if (NULL == path || '\0' == *path || trace_map != NULL)
+		return 0;
+	if (strlen(path) >= sizeof(trace_path) - sizeof(".json"))
+		return errno = ENAMETOOLONG, -1;
+	if ((fd = TEMP_FAILURE_RETRY(open(path, O_RDWR | O_CREAT | O_TRUNC, 0644))) < 0)
+		return -1;
+	if (ftruncate(fd, sizeof(struct trace_file)) < 0) {
+		close(fd);
+		return -1;
+	}
+	t = mmap(NULL, sizeof(struct trace_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == t)
+		return -1;
+	t->version = TRACE_VERSION;
+	t->pid = getpid();
+	t->ticks_per_us = calibrate();
+	t->tsc_start = trace_ticks();
+	memcpy(t->magic, TRACE_MAGIC, sizeof(t->magic));
+	strcpy(trace_path, path);
+	trace_map = t;
+	return 0;
+}
+
+// Claims the next ring for the calling thread, NULL when all of them are taken
+struct trace_ring *trace_attach(void)
+{
+	uint32_t index = atomic_load(&trace_map->rings);
+	do {
+		if (index >= TRACE_MAX_THREADS)
+			return NULL;
+	} while (!atomic_compare_exchange_weak(&trace_map->rings, &index, index + 1));
+	trace_local = &trace_map->ring[index];
+	trace_local->tid = syscall(SYS_gettid);
+	return trace_local;
+}
+
+static double to_us(const struct trace_file *t, uint64_t tsc)
+{
+	return tsc < t->tsc_start ? 0.0 : (double)(tsc - t->tsc_start) / t->ticks_per_us;
+}
+
+// Writes the rings as Chrome trace event JSON (chrome://tracing, ui.perfetto.dev): an instant
+// event per point and a span between consecutive points of the same request
+int trace_export(const struct trace_file *t, FILE *out)
+{
+	struct trace_event *copy;
+	const char *sep = "";
+	uint32_t rings = atomic_load((_Atomic uint32_t *)&t->rings);
+	if (memcmp(t->magic, TRACE_MAGIC, sizeof(t->magic)) != 0 || t->version != TRACE_VERSION)
+		return errno = EINVAL, -1;
+	if ((copy = malloc(sizeof(t->ring[0].events))) == NULL)
+		return -1;
+	fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+	for (uint32_t r = 0; r < rings && r < TRACE_MAX_THREADS; r++) {
+		const struct trace_ring *ring = &t->ring[r];
+		uint64_t head, first, last;
+		head = atomic_load_explicit((_Atomic uint64_t *)&ring->head, memory_order_acquire);
+		memcpy(copy, ring->events, sizeof(ring->events));
+		// Slots the writer reused while they were copied are dropped
+		last = atomic_load_explicit((_Atomic uint64_t *)&ring->head, memory_order_acquire);
+		first = last > TRACE_RING_SIZE ? last - TRACE_RING_SIZE + 1 : 0;
+		for (uint64_t i = first, prev = UINT64_MAX; i < head; prev = i++) {
+			const struct trace_event *e = &copy[i & (TRACE_RING_SIZE - 1)];
+			const struct trace_event *p = prev != UINT64_MAX ? &copy[prev & (TRACE_RING_SIZE - 1)] : NULL;
+			if (e->point >= TRACE_POINTS)
+				continue;
+			fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d, "
+				"\"args\": {\"id\": %u}}",
+				sep, point_names[e->point], to_us(t, e->tsc), t->pid, ring->tid, e->id);
+			sep = ",";
+			if (p != NULL && p->id == e->id && span_names[e->point] != NULL && e->tsc >= p->tsc)
+				fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, "
+					"\"tid\": %d, \"args\": {\"id\": %u}}",
+					span_names[e->point], to_us(t, p->tsc), (double)(e->tsc - p->tsc) / t->ticks_per_us,
+					t->pid, ring->tid, e->id);
+		}
+	}
+	fprintf(out, "\n]}\n");
+	free(copy);
+	return ferror(out) ? -1 : 0;
+}
+
+// Writes the trace of this process to path, NULL means the POSIXNET_TRACE file name plus ".json"
+int trace_dump(const char *path)
+{
+	char name[PATH_MAX];
+	FILE *out;
+	int ret;
+	if (NULL == trace_map)
+		return errno = ENODEV, -1;
+	if (NULL == path) {
+		if (snprintf(name, sizeof(name), "%s.json", trace_path) >= (int)sizeof(name))
+			return errno = ENAMETOOLONG, -1;
+		path = name;
+	}
+	if ((out = fopen(path, "w")) == NULL)
+		return -1;
+	ret = trace_export(trace_map, out);
+	if (fclose(out) == EOF)
+		ret = -1;
+	return ret;
+}
+
+// Reactor callback for a dump signal (SIGUSR1 in the servers)
+void trace_signal_dump(struct reactor *r, void *arg)
+{
+	if (trace_dump(NULL) < 0)
+		perror("trace_dump");
+	else
+		fprintf(stderr, "Trace written to %s.json\n", trace_path);
+}
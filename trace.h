@@ -0,0 +1,98 @@
+// Per-thread event tracing of libposixnet. Every thread writes timestamped events
+// (TSC ticks) into its own ring inside a shared memory-mapped file, so recording needs
+// no locks and the rings can be read by tracedump while the server runs or after it
+// died. Tracing is off unless POSIXNET_TRACE names the file, and while it is off
+// trace_event() costs a single well-predicted branch.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "posixnet.h"
+
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_MAGIC "PNTRACE1"
+#define TRACE_VERSION 1
+#define TRACE_MAX_THREADS 64
+#define TRACE_RING_SIZE 16384 // events per thread, power of two
+
+// Points of a request's life recorded by the servers
+enum trace_point {
+	TRACE_ACCEPT, // connection accepted
+	TRACE_FRAME, // a whole request read
+	TRACE_COMPUTE, // reply computed
+	TRACE_WRITE, // reply written to the socket
+	TRACE_POINTS
+};
+
+struct trace_event {
+	uint64_t tsc;
+	uint32_t id; // descriptor or request the event belongs to
+	uint16_t point;
+	uint16_t reserved;
+};
+
+struct trace_ring {
+	_Atomic uint64_t head; // events written so far, the newest is at (head - 1) % TRACE_RING_SIZE
+	int32_t tid;
+	uint32_t reserved;
+	struct trace_event events[TRACE_RING_SIZE];
+};
+
+struct trace_file {
+	char magic[8];
+	uint32_t version;
+	int32_t pid;
+	double ticks_per_us;
+	uint64_t tsc_start;
+	_Atomic uint32_t rings; // claimed rings
+	uint32_t reserved;
+	struct trace_ring ring[TRACE_MAX_THREADS];
+};
+
+extern struct trace_file *trace_map;
+extern __thread struct trace_ring *trace_local;
+
+static inline uint64_t trace_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+struct trace_ring *trace_attach(void);
+
+static inline void trace_event(enum trace_point point, uint32_t id)
+{
+	struct trace_ring *ring;
+	struct trace_event *e;
+	uint64_t head;
+	if (__builtin_expect(trace_map == NULL, 1))
+		return;
+	if ((ring = trace_local) == NULL && (ring = trace_attach()) == NULL)
+		return;
+	// Only this thread writes the ring; the release store publishes the event to readers
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+	e->tsc = trace_ticks();
+	e->id = id;
+	e->point = point;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int trace_init(void);
+int trace_export(const struct trace_file *t, FILE *out);
+int trace_dump(const char *path);
+
+struct reactor;
+void trace_signal_dump(struct reactor *r, void *arg);
+
+#endif
@@ -0,0 +1,45 @@
+// Converts the trace file of a running (or dead) server, named by its POSIXNET_TRACE,
+// into Chrome trace event JSON for chrome://tracing or ui.perfetto.dev.
+
+#include "trace.h"
+#include "posixnet_err.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void usage(char *name)
+{
+	fprintf(stderr, "USAGE: %s trace_file [output.json]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_file *t;
+	struct stat st;
+	FILE *out = stdout;
+	int fd;
+	if (argc != 2 && argc != 3)
+		usage(argv[0]);
+	if ((fd = TEMP_FAILURE_RETRY(open(argv[1], O_RDONLY))) < 0)
+		ERR("open");
+	if (fstat(fd, &st) < 0)
+		ERR("fstat");
+	if (st.st_size < (off_t)sizeof(struct trace_file)) {
+		fprintf(stderr, "%s: not a trace file\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	if ((t = mmap(NULL, sizeof(struct trace_file), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		ERR("mmap");
+	if (TEMP_FAILURE_RETRY(close(fd)) < 0)
+		ERR("close");
+	if (3 == argc && (out = fopen(argv[2], "w")) == NULL)
+		ERR("fopen");
+	if (trace_export(t, out) < 0)
+		ERR("trace_export");
+	if (out != stdout && fclose(out) == EOF)
+		ERR("fclose");
+	munmap(t, sizeof(struct trace_file));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+#include "uring.h"
+#include "posixnet_err.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int uring_setup(struct uring *u, unsigned entries, struct io_uring_params *p)
+{
+	void *ring;
+	memset(u, 0, sizeof(*u));
+	if ((u->ring_fd = syscall(__NR_io_uring_setup, entries, p)) < 0)
+		return -1;
+	u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+	u->sq_entries = p->sq_entries;
+	ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd,
+		    IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring)
+		return -1;
+	u->sq_ring = u->cq_ring = ring;
+	if (!(p->features & IORING_FEAT_SINGLE_MMAP)) {
+		u->cq_ring = NULL;
+		ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd,
+			    IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ring)
+			return -1;
+		u->cq_ring = ring;
+	}
+	ring = mmap(NULL, p->sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+	if (MAP_FAILED == ring)
+		return -1;
+	u->sqes = ring;
+	u->sq_head = (unsigned *)((char *)u->sq_ring + p->sq_off.head);
+	u->sq_tail = (unsigned *)((char *)u->sq_ring + p->sq_off.tail);
+	u->sq_mask = (unsigned *)((char *)u->sq_ring + p->sq_off.ring_mask);
+	u->sq_array = (unsigned *)((char *)u->sq_ring + p->sq_off.array);
+	u->cq_head = (unsigned *)((char *)u->cq_ring + p->cq_off.head);
+	u->cq_tail = (unsigned *)((char *)u->cq_ring + p->cq_off.tail);
+	u->cq_mask = (unsigned *)((char *)u->cq_ring + p->cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p->cq_off.cqes);
+	return 0;
+}
+
+// Also undoes a setup that failed half way
+void uring_teardown(struct uring *u)
+{
+	if (u->sqes)
+		munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+	if (u->cq_ring && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->ring_fd > 0)
+		close(u->ring_fd);
+	u->ring_fd = -1;
+}
+
+int uring_enter(struct uring *u, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	int n = syscall(__NR_io_uring_enter, u->ring_fd, u->to_submit, min_complete, flags, arg, argsz);
+	if (n >= 0)
+		u->to_submit -= n;
+	return n;
+}
+
+struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+	unsigned tail = *u->sq_tail, index;
+	struct io_uring_sqe *sqe;
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+		if (uring_enter(u, 0, 0, NULL, 0) < 0)
+			ERR("io_uring_enter");
+	}
+	index = tail & *u->sq_mask;
+	sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[index] = index;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->to_submit++;
+	return sqe;
+}
+
+int uring_register(struct uring *u, unsigned opcode, const void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, u->ring_fd, opcode, arg, nr_args);
+}
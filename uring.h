@@ -0,0 +1,31 @@
+// Raw io_uring rings of libposixnet, shared by the io_uring backend of the reactor and
+// by diskio.c: setup and mapping of the rings, submission queue entries and
+// io_uring_enter, without liburing.
+
+#ifndef URING_H
+#define URING_H
+
+#include "posixnet.h"
+
+#include <linux/io_uring.h>
+
+struct uring {
+	int ring_fd;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned to_submit; // entries queued and not yet handed to the kernel
+};
+
+// Zero-filled p may carry setup flags; it returns the features of the kernel
+int uring_setup(struct uring *u, unsigned entries, struct io_uring_params *p);
+void uring_teardown(struct uring *u);
+int uring_enter(struct uring *u, unsigned min_complete, unsigned flags, void *arg, size_t argsz);
+// A cleared entry queued for the next io_uring_enter; submits the queue first when it is full
+struct io_uring_sqe *uring_sqe(struct uring *u);
+int uring_register(struct uring *u, unsigned opcode, const void *arg, unsigned nr_args);
+
+#endif
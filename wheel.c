@@ -0,0 +1,137 @@
+#include "wheel.h"
+
+#include <string.h>
+#include <time.h>
+
+static uint64_t current_tick(struct timer_wheel *w)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000) / w->tick_ms;
+}
+
+static void link_timer(struct wheel_timer **head, struct wheel_timer *t)
+{
+	if ((t->next = *head) != NULL)
+		t->next->pprev = &t->next;
+	*head = t;
+	t->pprev = head;
+}
+
+static void unlink_timer(struct wheel_timer *t)
+{
+	if ((*t->pprev = t->next) != NULL)
+		t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+// Level 0 holds the next WHEEL_SLOTS ticks, each higher level WHEEL_SLOTS times more
+static void place(struct timer_wheel *w, struct wheel_timer *t)
+{
+	uint64_t delta = t->expires - w->now;
+	int level = 0;
+	while (level < WHEEL_LEVELS - 1 && delta >= 1ULL << (WHEEL_BITS * (level + 1)))
+		level++;
+	if (delta >= 1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+		t->expires = w->now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	link_timer(&w->slots[level][(t->expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)], t);
+}
+
+// Moves the timers of the higher-level slot that just came due one level down
+static void cascade(struct timer_wheel *w, int level)
+{
+	struct wheel_timer **slot = &w->slots[level][(w->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+	struct wheel_timer *t;
+	while ((t = *slot) != NULL) {
+		unlink_timer(t);
+		place(w, t);
+	}
+	if (level + 1 < WHEEL_LEVELS && 0 == ((w->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)))
+		cascade(w, level + 1);
+}
+
+static void advance(struct timer_wheel *w, uint64_t target)
+{
+	while (w->now < target && w->armed > 0) {
+		struct wheel_timer *batch, *t;
+		w->now++;
+		if (0 == (w->now & (WHEEL_SLOTS - 1)))
+			cascade(w, 1);
+		// Detach the whole slot first: callbacks may start or stop any timer, this one included
+		batch = w->slots[0][w->now & (WHEEL_SLOTS - 1)];
+		w->slots[0][w->now & (WHEEL_SLOTS - 1)] = NULL;
+		if (batch != NULL)
+			batch->pprev = &batch;
+		while ((t = batch) != NULL) {
+			unlink_timer(t);
+			w->armed--;
+			w->expired++;
+			t->cb(w->reactor, t->arg);
+		}
+	}
+	if (w->now < target)
+		w->now = target; // nothing armed, skip the idle ticks at once
+}
+
+static void on_tick(struct reactor *r, void *arg)
+{
+	struct timer_wheel *w = arg;
+	advance(w, current_tick(w));
+	if (w->armed > 0)
+		reactor_timer_start(r, &w->tick, w->tick_ms);
+}
+
+void wheel_init(struct timer_wheel *w, struct reactor *r, int tick_ms)
+{
+	memset(w, 0, sizeof(*w));
+	w->reactor = r;
+	w->tick_ms = tick_ms;
+	w->now = current_tick(w);
+	reactor_timer_init(&w->tick, on_tick, w);
+}
+
+// Disarms all timers without calling them
+void wheel_destroy(struct timer_wheel *w)
+{
+	for (int level = 0; level < WHEEL_LEVELS; level++)
+		for (int i = 0; i < WHEEL_SLOTS; i++)
+			while (w->slots[level][i] != NULL)
+				unlink_timer(w->slots[level][i]);
+	w->armed = 0;
+	reactor_timer_stop(w->reactor, &w->tick);
+}
+
+void wheel_timer_init(struct wheel_timer *t, reactor_cb cb, void *arg)
+{
+	t->next = NULL;
+	t->pprev = NULL;
+	t->cb = cb;
+	t->arg = arg;
+}
+
+// Fires after ms rounded up to whole ticks (at least one)
+void wheel_timer_start(struct timer_wheel *w, struct wheel_timer *t, int ms)
+{
+	uint64_t ticks = ms > 0 ? ((uint64_t)ms + w->tick_ms - 1) / w->tick_ms : 1;
+	if (wheel_timer_armed(t))
+		unlink_timer(t);
+	else if (0 == w->armed++) {
+		// The wheel slept; its clock may be far behind, and with nothing armed it can jump
+		w->now = current_tick(w);
+		reactor_timer_start(w->reactor, &w->tick, w->tick_ms);
+	}
+	// From the current time, not w->now: the tick may be running late, and the timer would
+	// fire early by as much. place() still files it relative to w->now, which it is ahead of.
+	t->expires = current_tick(w) + ticks;
+	place(w, t);
+}
+
+void wheel_timer_stop(struct timer_wheel *w, struct wheel_timer *t)
+{
+	if (!wheel_timer_armed(t))
+		return;
+	unlink_timer(t);
+	if (0 == --w->armed)
+		reactor_timer_stop(w->reactor, &w->tick);
+}
@@ -0,0 +1,46 @@
+// Hierarchical timing wheel of libposixnet for per-connection timeouts (idle,
+// header read, write stall). Starting and stopping a timer is O(1) - it only links
+// or unlinks the timer in a slot list - so a server can re-arm a connection's
+// timeout on every read. The wheel drives itself from one reactor timer that ticks
+// only while timers are armed; all timers due in a tick expire in one batch.
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include "reactor.h"
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 // WHEEL_SLOTS^4 ticks, at 100 ms per tick about 19 days
+
+struct wheel_timer {
+	struct wheel_timer *next;
+	struct wheel_timer **pprev; // NULL when not armed
+	uint64_t expires; // in ticks
+	reactor_cb cb;
+	void *arg;
+};
+
+struct timer_wheel {
+	struct reactor *reactor;
+	struct reactor_timer tick;
+	int tick_ms;
+	uint64_t now; // last processed tick
+	size_t armed;
+	uint64_t expired; // timers fired so far
+	struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+void wheel_init(struct timer_wheel *w, struct reactor *r, int tick_ms);
+void wheel_destroy(struct timer_wheel *w);
+
+void wheel_timer_init(struct wheel_timer *t, reactor_cb cb, void *arg);
+void wheel_timer_start(struct timer_wheel *w, struct wheel_timer *t, int ms);
+void wheel_timer_stop(struct timer_wheel *w, struct wheel_timer *t);
+
+static inline int wheel_timer_armed(const struct wheel_timer *t)
+{
+	return t->pprev != NULL;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#include "workpool.h"
+#include "posixnet_err.h"
+
+#include <sys/eventfd.h>
+
+struct workpool {
+	struct reactor *reactor;
+	int fd; // eventfd, readable while finished jobs wait for the reactor
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	struct workpool_job *queue, **queue_tail; // waiting for a thread
+	struct workpool_job *finished, **finished_tail; // waiting for the reactor
+	int stopping;
+	size_t pending; // submitted and not done, touched by the reactor thread only
+	int threads;
+	pthread_t tid[];
+};
+
+static void *worker(void *arg)
+{
+	struct workpool *p = arg;
+	struct workpool_job *job;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!p->stopping && NULL == p->queue)
+			pthread_cond_wait(&p->ready, &p->lock);
+		if (p->stopping)
+			break;
+		job = p->queue;
+		if ((p->queue = job->next) == NULL)
+			p->queue_tail = &p->queue;
+		pthread_mutex_unlock(&p->lock);
+
+		job->work(job->arg);
+
+		pthread_mutex_lock(&p->lock);
+		job->next = NULL;
+		*p->finished_tail = job;
+		p->finished_tail = &job->next;
+		// Only the first finished job wakes the reactor, the others ride along
+		if (p->finished == job && TEMP_FAILURE_RETRY(write(p->fd, &one, sizeof(one))) < 0)
+			ERR("write");
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+// Called by the reactor when jobs have finished; runs their done callbacks
+static void reap(struct reactor *r, int fd, uint32_t events, void *arg)
+{
+	struct workpool *p = arg;
+	struct workpool_job *job, *next;
+	uint64_t count;
+
+	if (TEMP_FAILURE_RETRY(read(fd, &count, sizeof(count))) < 0 && errno != EAGAIN)
+		ERR("read");
+	pthread_mutex_lock(&p->lock);
+	job = p->finished;
+	p->finished = NULL;
+	p->finished_tail = &p->finished;
+	pthread_mutex_unlock(&p->lock);
+	for (; job != NULL; job = next) {
+		next = job->next;
+		p->pending--;
+		job->done(r, job->arg);
+	}
+}
+
+struct workpool *workpool_create(struct reactor *r, int threads)
+{
+	struct workpool *p;
+
+	if (threads < 1)
+		return errno = EINVAL, NULL;
+	if ((p = calloc(1, sizeof(struct workpool) + threads * sizeof(pthread_t))) == NULL)
+		return NULL;
+	p->reactor = r;
+	p->queue_tail = &p->queue;
+	p->finished_tail = &p->finished;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->ready, NULL);
+	if ((p->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || reactor_add(r, p->fd, REACTOR_READ, reap, p) < 0) {
+		if (p->fd >= 0)
+			close(p->fd);
+		free(p);
+		return NULL;
+	}
+	for (p->threads = 0; p->threads < threads; p->threads++)
+		if ((errno = pthread_create(&p->tid[p->threads], NULL, worker, p)) != 0) {
+			workpool_destroy(p);
+			return NULL;
+		}
+	return p;
+}
+
+void workpool_destroy(struct workpool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->stopping = 1;
+	pthread_cond_broadcast(&p->ready);
+	pthread_mutex_unlock(&p->lock);
+	for (int i = 0; i < p->threads; i++)
+		if ((errno = pthread_join(p->tid[i], NULL)) != 0)
+			ERR("pthread_join");
+	reactor_remove(p->reactor, p->fd);
+	if (TEMP_FAILURE_RETRY(close(p->fd)) < 0)
+		ERR("close");
+	pthread_cond_destroy(&p->ready);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+void workpool_job_init(struct workpool_job *job, void (*work)(void *arg), reactor_cb done, void *arg)
+{
+	job->next = NULL;
+	job->work = work;
+	job->done = done;
+	job->arg = arg;
+}
+
+void workpool_submit(struct workpool *p, struct workpool_job *job)
+{
+	job->next = NULL;
+	pthread_mutex_lock(&p->lock);
+	*p->queue_tail = job;
+	p->queue_tail = &job->next;
+	pthread_cond_signal(&p->ready);
+	pthread_mutex_unlock(&p->lock);
+	p->pending++;
+}
+
+size_t workpool_pending(const struct workpool *p)
+{
+	return p->pending;
+}
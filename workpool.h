@@ -0,0 +1,35 @@
+// Worker threads of libposixnet for work too long for a reactor callback. A job runs
+// on one of the threads and its done callback afterwards on the reactor's thread, in
+// the order jobs finish. Finished jobs come back through an eventfd the reactor
+// watches, one wakeup for however many finished since the last one.
+//
+// The threads inherit the signal mask of the thread creating the pool, so create it
+// after reactor_signal() has blocked the signals the reactor delivers.
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include "posixnet.h"
+#include "reactor.h"
+
+#include <pthread.h>
+
+// The storage belongs to the caller and must stay until done is called
+struct workpool_job {
+	struct workpool_job *next;
+	void (*work)(void *arg); // on a worker thread
+	reactor_cb done; // on the reactor thread, may free the job
+	void *arg;
+};
+
+struct workpool;
+
+struct workpool *workpool_create(struct reactor *r, int threads);
+// Jobs not done yet are dropped without calling back; the ones running are waited for
+void workpool_destroy(struct workpool *p);
+
+void workpool_job_init(struct workpool_job *job, void (*work)(void *arg), reactor_cb done, void *arg);
+void workpool_submit(struct workpool *p, struct workpool_job *job);
+size_t workpool_pending(const struct workpool *p);
+
+#endif